@@ -0,0 +1,1954 @@
+// Micro-benchmarks for EventStore hot paths.
+//
+//   core_bench                 run every case
+//   core_bench --case append   run one case
+//   core_bench --n 20000       operations per case
+//
+// The household case is the regression benchmark: a seeded mixed workload
+// whose results are written as JSON.
+//
+//   core_bench --case household --n 50000 --seed 42 --json out.json
+#include "core/DeltaBundle.h"
+#include "core/EventStore.h"
+#include "core/HouseholdRouter.h"
+#include "core/Metrics.h"
+#include "core/PayloadCodec.h"
+#include <sqlite3.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using together::DeltaEvent;
+using together::DeltaEventView;
+using together::EventStore;
+using together::ReadBudget;
+using together::ReadCursor;
+using together::ReplayOptions;
+using together::ReplayReport;
+using together::SeqRange;
+using together::TaskRow;
+using together::TaskRowView;
+using together::TaskUpsert;
+
+// Global allocation counter for the allocation benchmarks. Every form of
+// operator new/delete is replaced, so no pointer crosses between the
+// library's allocator and this one. They are kept out of line: inlined
+// into a caller, GCC pairs the free() with a new-expression and warns.
+static std::atomic<unsigned long long> g_allocs{0};
+
+#define BENCH_NOINLINE __attribute__((noinline))
+
+static BENCH_NOINLINE void *countedAlloc(std::size_t sz, std::size_t align) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (sz == 0)
+    sz = 1;
+  if (align <= alignof(std::max_align_t))
+    return std::malloc(sz);
+  // aligned_alloc wants a size that is a multiple of the alignment.
+  return std::aligned_alloc(align, (sz + align - 1) / align * align);
+}
+
+static BENCH_NOINLINE void countedFree(void *p) noexcept { std::free(p); }
+
+static void *countedNew(std::size_t sz, std::size_t align) {
+  if (void *p = countedAlloc(sz, align))
+    return p;
+  throw std::bad_alloc();
+}
+
+constexpr std::size_t kDefaultAlign = alignof(std::max_align_t);
+
+BENCH_NOINLINE void *operator new(std::size_t sz) {
+  return countedNew(sz, kDefaultAlign);
+}
+BENCH_NOINLINE void *operator new[](std::size_t sz) {
+  return countedNew(sz, kDefaultAlign);
+}
+BENCH_NOINLINE void *operator new(std::size_t sz, std::align_val_t al) {
+  return countedNew(sz, (std::size_t)al);
+}
+BENCH_NOINLINE void *operator new[](std::size_t sz, std::align_val_t al) {
+  return countedNew(sz, (std::size_t)al);
+}
+BENCH_NOINLINE void *operator new(std::size_t sz,
+                                  const std::nothrow_t &) noexcept {
+  return countedAlloc(sz, kDefaultAlign);
+}
+BENCH_NOINLINE void *operator new[](std::size_t sz,
+                                    const std::nothrow_t &) noexcept {
+  return countedAlloc(sz, kDefaultAlign);
+}
+BENCH_NOINLINE void *operator new(std::size_t sz, std::align_val_t al,
+                                  const std::nothrow_t &) noexcept {
+  return countedAlloc(sz, (std::size_t)al);
+}
+BENCH_NOINLINE void *operator new[](std::size_t sz, std::align_val_t al,
+                                    const std::nothrow_t &) noexcept {
+  return countedAlloc(sz, (std::size_t)al);
+}
+
+BENCH_NOINLINE void operator delete(void *p) noexcept { countedFree(p); }
+BENCH_NOINLINE void operator delete[](void *p) noexcept { countedFree(p); }
+BENCH_NOINLINE void operator delete(void *p, std::size_t) noexcept {
+  countedFree(p);
+}
+BENCH_NOINLINE void operator delete[](void *p, std::size_t) noexcept {
+  countedFree(p);
+}
+BENCH_NOINLINE void operator delete(void *p, std::align_val_t) noexcept {
+  countedFree(p);
+}
+BENCH_NOINLINE void operator delete[](void *p, std::align_val_t) noexcept {
+  countedFree(p);
+}
+BENCH_NOINLINE void operator delete(void *p, std::size_t,
+                                    std::align_val_t) noexcept {
+  countedFree(p);
+}
+BENCH_NOINLINE void operator delete[](void *p, std::size_t,
+                                      std::align_val_t) noexcept {
+  countedFree(p);
+}
+BENCH_NOINLINE void operator delete(void *p, const std::nothrow_t &) noexcept {
+  countedFree(p);
+}
+BENCH_NOINLINE void operator delete[](void *p,
+                                      const std::nothrow_t &) noexcept {
+  countedFree(p);
+}
+BENCH_NOINLINE void operator delete(void *p, std::align_val_t,
+                                    const std::nothrow_t &) noexcept {
+  countedFree(p);
+}
+BENCH_NOINLINE void operator delete[](void *p, std::align_val_t,
+                                      const std::nothrow_t &) noexcept {
+  countedFree(p);
+}
+
+#undef BENCH_NOINLINE
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchCase {
+  const char *name;
+  std::function<int(long long n)> run;
+};
+
+// Flags only the household case reads.
+struct HouseholdFlags {
+  unsigned long long seed = 42;
+  std::string json_path; // empty: JSON goes to stdout
+} g_household;
+
+std::string freshDb(const std::string &name) {
+  std::filesystem::create_directories("tmp");
+  std::string path = "tmp/bench_" + name + ".db";
+  for (const char *suffix : {"", "-wal", "-shm"})
+    std::filesystem::remove(path + suffix);
+  return path;
+}
+
+void report(const char *name, long long n, Clock::duration elapsed) {
+  double secs = std::chrono::duration<double>(elapsed).count();
+  std::printf("%-24s n=%-8lld %10.0f ops/sec  (%.3f s)\n", name, n,
+              secs > 0 ? n / secs : 0.0, secs);
+}
+
+int benchAppend(long long n) {
+  EventStore store;
+  if (!store.open(freshDb("append")).empty())
+    return 1;
+
+  DeltaEvent ev;
+  ev.entity_type = "task";
+  ev.op = "upsert";
+  ev.payload = R"({"title":"Do dishes","points":3})";
+
+  auto t0 = Clock::now();
+  for (long long i = 0; i < n; ++i) {
+    ev.entity_id = "t" + std::to_string(i % 512);
+    ev.ts = i;
+    if (store.append(ev) < 1)
+      return 1;
+  }
+  report("append", n, Clock::now() - t0);
+  return 0;
+}
+
+// Baseline: the pre-cache code path, preparing and finalizing per call.
+int benchAppendUncached(long long n) {
+  std::string path = freshDb("append_uncached");
+  {
+    EventStore schema; // creates tables
+    if (!schema.open(path).empty())
+      return 1;
+  }
+  sqlite3 *db = nullptr;
+  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+    return 1;
+
+  const std::string payload = R"({"title":"Do dishes","points":3})";
+  const char *sql =
+      "INSERT INTO event_log(type_code, entity_id, op_code, payload_blob, ts) "
+      "VALUES((SELECT code FROM event_dict WHERE name = ?1), ?2, "
+      "       (SELECT code FROM event_dict WHERE name = ?3), ?4, ?5)";
+
+  auto t0 = Clock::now();
+  for (long long i = 0; i < n; ++i) {
+    std::string id = "t" + std::to_string(i % 512);
+    sqlite3_stmt *st = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &st, nullptr) != SQLITE_OK)
+      return 1;
+    sqlite3_bind_text(st, 1, "task", -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st, 2, id.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st, 3, "upsert", -1, SQLITE_TRANSIENT);
+    sqlite3_bind_blob(st, 4, payload.data(), (int)payload.size(),
+                      SQLITE_TRANSIENT);
+    sqlite3_bind_int64(st, 5, i);
+    int rc = sqlite3_step(st);
+    sqlite3_finalize(st);
+    if (rc != SQLITE_DONE)
+      return 1;
+  }
+  report("append (uncached)", n, Clock::now() - t0);
+  sqlite3_close(db);
+  return 0;
+}
+
+int benchUpsertTask(long long n) {
+  EventStore store;
+  if (!store.open(freshDb("upsert")).empty())
+    return 1;
+
+  const std::string payload = R"({"title":"Sweep floor","points":2})";
+  auto t0 = Clock::now();
+  for (long long i = 0; i < n; ++i) {
+    if (store.upsertTask("t" + std::to_string(i % 512), "Sweep floor", "kid1",
+                         0, 2, "open", "family", i, payload) < 1)
+      return 1;
+  }
+  report("upsertTask", n, Clock::now() - t0);
+  return 0;
+}
+
+// Baseline: upsertTask as it was before the cache (exec BEGIN/COMMIT,
+// prepare + finalize both statements on every call).
+int benchUpsertTaskUncached(long long n) {
+  std::string path = freshDb("upsert_uncached");
+  {
+    EventStore schema;
+    if (!schema.open(path).empty())
+      return 1;
+  }
+  sqlite3 *db = nullptr;
+  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+    return 1;
+
+  const std::string payload = R"({"title":"Sweep floor","points":2})";
+  const char *sql_task = "INSERT INTO task(id, title, assignees_csv, due_at, "
+                         "points, status, visibility_tag, updated_at) "
+                         "VALUES(?,?,?,?,?,?,?,?) "
+                         "ON CONFLICT(id) DO UPDATE SET "
+                         "  title=excluded.title, "
+                         "  assignees_csv=excluded.assignees_csv, "
+                         "  due_at=excluded.due_at, "
+                         "  points=excluded.points, "
+                         "  status=excluded.status, "
+                         "  visibility_tag=excluded.visibility_tag, "
+                         "  updated_at=excluded.updated_at";
+  const char *sql_ev =
+      "INSERT INTO event_log(type_code, entity_id, op_code, payload_blob, ts) "
+      "VALUES((SELECT code FROM event_dict WHERE name = ?1), ?2, "
+      "       (SELECT code FROM event_dict WHERE name = ?3), ?4, ?5)";
+
+  auto t0 = Clock::now();
+  for (long long i = 0; i < n; ++i) {
+    std::string id = "t" + std::to_string(i % 512);
+    sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr);
+
+    sqlite3_stmt *st = nullptr;
+    sqlite3_prepare_v2(db, sql_task, -1, &st, nullptr);
+    sqlite3_bind_text(st, 1, id.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st, 2, "Sweep floor", -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st, 3, "kid1", -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(st, 4, 0);
+    sqlite3_bind_int(st, 5, 2);
+    sqlite3_bind_text(st, 6, "open", -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st, 7, "family", -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(st, 8, i);
+    int rc = sqlite3_step(st);
+    sqlite3_finalize(st);
+
+    sqlite3_prepare_v2(db, sql_ev, -1, &st, nullptr);
+    sqlite3_bind_text(st, 1, "task", -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st, 2, id.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st, 3, "upsert", -1, SQLITE_TRANSIENT);
+    sqlite3_bind_blob(st, 4, payload.data(), (int)payload.size(),
+                      SQLITE_TRANSIENT);
+    sqlite3_bind_int64(st, 5, i);
+    int rc2 = sqlite3_step(st);
+    sqlite3_finalize(st);
+
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    if (rc != SQLITE_DONE || rc2 != SQLITE_DONE)
+      return 1;
+  }
+  report("upsertTask (uncached)", n, Clock::now() - t0);
+  sqlite3_close(db);
+  return 0;
+}
+
+// Events/sec as a function of batch size: one commit (fsync) per batch.
+int benchAppendBatch(long long n) {
+  for (std::size_t batch_size : {1, 10, 100, 1000}) {
+    EventStore store;
+    if (!store.open(freshDb("append_batch")).empty())
+      return 1;
+
+    std::vector<DeltaEvent> batch(batch_size);
+    for (std::size_t i = 0; i < batch_size; ++i) {
+      batch[i].entity_type = "task";
+      batch[i].entity_id = "t" + std::to_string(i % 512);
+      batch[i].op = "upsert";
+      batch[i].payload = R"({"title":"Do dishes","points":3})";
+      batch[i].ts = (long long)i;
+    }
+
+    long long written = 0;
+    SeqRange range;
+    auto t0 = Clock::now();
+    while (written < n) {
+      if (store.appendBatch(batch, range) < 1)
+        return 1;
+      written += (long long)batch_size;
+    }
+    std::string name = "appendBatch x" + std::to_string(batch_size);
+    report(name.c_str(), written, Clock::now() - t0);
+  }
+  return 0;
+}
+
+int benchUpsertTasks(long long n) {
+  for (std::size_t batch_size : {1, 10, 100, 1000}) {
+    EventStore store;
+    if (!store.open(freshDb("upsert_tasks")).empty())
+      return 1;
+
+    std::vector<TaskUpsert> batch(batch_size);
+    for (std::size_t i = 0; i < batch_size; ++i) {
+      batch[i].row.id = "t" + std::to_string(i % 512);
+      batch[i].row.title = "Sweep floor";
+      batch[i].row.assignees_csv = "kid1";
+      batch[i].row.points = 2;
+      batch[i].row.status = "open";
+      batch[i].row.visibility_tag = "family";
+      batch[i].row.updated_at = (long long)i;
+      batch[i].payload_json = R"({"title":"Sweep floor","points":2})";
+    }
+
+    long long written = 0;
+    SeqRange range;
+    auto t0 = Clock::now();
+    while (written < n) {
+      if (store.upsertTasks(batch, range) < 1)
+        return 1;
+      written += (long long)batch_size;
+    }
+    std::string name = "upsertTasks x" + std::to_string(batch_size);
+    report(name.c_str(), written, Clock::now() - t0);
+  }
+  return 0;
+}
+
+long maxRssKb() {
+  struct rusage ru {};
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+// Seed `n` events of ~200 payload bytes into a fresh database.
+bool seedEvents(EventStore &store, const std::string &name, long long n) {
+  if (!store.open(freshDb(name)).empty())
+    return false;
+  std::vector<DeltaEvent> batch(1000);
+  for (std::size_t i = 0; i < batch.size(); ++i) {
+    batch[i].entity_type = "task";
+    batch[i].entity_id = "t" + std::to_string(i);
+    batch[i].op = "upsert";
+    batch[i].payload = std::string(200, 'p');
+  }
+  SeqRange range;
+  for (long long written = 0; written < n; written += 1000)
+    if (store.appendBatch(batch, range) < 1)
+      return false;
+  return true;
+}
+
+// Peak RSS is process-wide and never shrinks, so the streaming case runs
+// first; run each with --case for isolated numbers.
+int benchSinceStream(long long n) {
+  EventStore store;
+  if (!seedEvents(store, "since", n * 10))
+    return 1;
+
+  long rss0 = maxRssKb();
+  ReadBudget budget;
+  budget.max_rows = 1000;
+  long long cursor_seq = 0, rows = 0;
+  std::string err;
+  auto t0 = Clock::now();
+  for (;;) {
+    ReadCursor cursor;
+    if (!store.scanSince(cursor_seq, budget,
+                         [&](const DeltaEvent &) {
+                           ++rows;
+                           return true;
+                         },
+                         cursor, err))
+      return 1;
+    cursor_seq = cursor.next_seq;
+    if (cursor.done)
+      break;
+  }
+  report("scanSince (1000/page)", rows, Clock::now() - t0);
+  std::printf("%-24s peak RSS growth %ld KB\n", "", maxRssKb() - rss0);
+  return 0;
+}
+
+int benchSinceVector(long long n) {
+  EventStore store;
+  if (!seedEvents(store, "since", n * 10))
+    return 1;
+
+  long rss0 = maxRssKb();
+  std::string err;
+  auto t0 = Clock::now();
+  auto events = store.since(0, err);
+  if (!err.empty())
+    return 1;
+  report("since (vector)", (long long)events.size(), Clock::now() - t0);
+  std::printf("%-24s peak RSS growth %ld KB\n", "", maxRssKb() - rss0);
+  return 0;
+}
+
+// Allocations per listing pass over n tasks: owning vs view API.
+int benchListAllocs(long long n) {
+  EventStore store;
+  if (!store.open(freshDb("list_allocs")).empty())
+    return 1;
+  std::vector<TaskUpsert> batch((std::size_t)n);
+  for (long long i = 0; i < n; ++i) {
+    TaskRow &r = batch[(std::size_t)i].row;
+    r.id = "task-" + std::to_string(i);
+    r.title = "A reasonably long chore title #" + std::to_string(i);
+    r.assignees_csv = "parent1,kid1,kid2";
+    r.status = "open";
+    r.visibility_tag = "family";
+    r.updated_at = i;
+  }
+  SeqRange range;
+  if (store.upsertTasks(batch, range) < 1)
+    return 1;
+
+  std::string err;
+  err.reserve(64);
+  const int limit = (int)n;
+
+  unsigned long long a0 = g_allocs.load();
+  auto t0 = Clock::now();
+  std::size_t owned_rows = store.listTasks("", limit, 0, err).size();
+  auto owned_time = Clock::now() - t0;
+  unsigned long long owned_allocs = g_allocs.load() - a0;
+
+  std::size_t view_rows = 0, title_bytes = 0;
+  a0 = g_allocs.load();
+  t0 = Clock::now();
+  store.forEachTask("", limit, 0,
+                    [&](const TaskRowView &v) {
+                      ++view_rows;
+                      title_bytes += v.title.size();
+                      return true;
+                    },
+                    err);
+  auto view_time = Clock::now() - t0;
+  unsigned long long view_allocs = g_allocs.load() - a0;
+
+  report("listTasks (owning)", (long long)owned_rows, owned_time);
+  std::printf("%-24s %llu allocations\n", "", owned_allocs);
+  report("forEachTask (view)", (long long)view_rows, view_time);
+  std::printf("%-24s %llu allocations\n", "", view_allocs);
+  return owned_rows == view_rows ? 0 : 1;
+}
+
+// Cost of page 1 vs a deep page: OFFSET grows with depth, keyset does not.
+int benchListPages(long long n) {
+  EventStore store;
+  if (!store.open(freshDb("list_pages")).empty())
+    return 1;
+  std::vector<TaskUpsert> batch((std::size_t)n);
+  for (long long i = 0; i < n; ++i) {
+    TaskRow &r = batch[(std::size_t)i].row;
+    r.id = "task-" + std::to_string(i);
+    r.title = "Chore " + std::to_string(i);
+    r.status = (i % 4 == 0) ? "done" : "open";
+    r.visibility_tag = "family";
+    r.updated_at = i;
+  }
+  SeqRange range;
+  if (store.upsertTasks(batch, range) < 1)
+    return 1;
+
+  const int limit = 50, reps = 200;
+  const int deep_page = (int)(n * 3 / 4 / limit) - 2; // within "open" rows
+  std::string err, token, next;
+
+  // Walk to the deep page once to get its keyset token.
+  std::string deep_token;
+  for (int p = 0; p < deep_page; ++p) {
+    store.listTasksPage("open", limit, token, next, err);
+    token = next;
+  }
+  deep_token = token;
+
+  auto time_it = [&](const char *name, const std::function<void()> &fn) {
+    auto t0 = Clock::now();
+    for (int i = 0; i < reps; ++i)
+      fn();
+    report(name, reps, Clock::now() - t0);
+  };
+  time_it("OFFSET page 1", [&] { store.listTasks("open", limit, 0, err); });
+  time_it("OFFSET deep page", [&] {
+    store.listTasks("open", limit, deep_page * limit, err);
+  });
+  time_it("keyset page 1",
+          [&] { store.listTasksPage("open", limit, "", next, err); });
+  time_it("keyset deep page",
+          [&] { store.listTasksPage("open", limit, deep_token, next, err); });
+  return err.empty() ? 0 : 1;
+}
+
+// Repeated getTaskId over a small hot set, with and without the cache.
+int benchGetTask(long long n) {
+  EventStore store;
+  if (!store.open(freshDb("get_task")).empty())
+    return 1;
+  for (int i = 0; i < 1000; ++i)
+    if (store.upsertTask("t" + std::to_string(i), "Chore", "kid1", 0, 1,
+                         "open", "family", i, R"({})") < 1)
+      return 1;
+
+  std::vector<std::string> hot;
+  for (int i = 0; i < 32; ++i)
+    hot.push_back("t" + std::to_string(i * 31));
+
+  TaskRow row;
+  std::string err;
+  for (std::size_t budget : {std::size_t(0), std::size_t(256 * 1024)}) {
+    store.setTaskCacheBudget(budget);
+    auto t0 = Clock::now();
+    for (long long i = 0; i < n; ++i)
+      if (!store.getTaskId(hot[(std::size_t)i % hot.size()], row, err))
+        return 1;
+    report(budget ? "getTaskId (cached)" : "getTaskId (sqlite)", n,
+           Clock::now() - t0);
+  }
+  auto st = store.taskCacheStats();
+  std::printf("%-24s hits=%llu misses=%llu evictions=%llu bytes=%zu\n", "",
+              st.hits, st.misses, st.evictions, st.bytes);
+  return 0;
+}
+
+// Size and speed of the binary codec against the JSON payloads used in
+// the tests. "json parse" is the cost a reader pays per replayed event.
+int benchPayloadCodec(long long n) {
+  namespace payload = together::payload;
+  const std::vector<std::pair<const char *, std::string>> samples = {
+      {"task", R"({"title":"Do dishes","points":3})"},
+      {"task", R"({"title":"Sweep floor","assignees":"kid1","points":2})"},
+      {"task", R"({"title":"Homework","assignees":"kid3","points":4})"},
+      {"task", R"({"reason":"user_deleted"})"},
+  };
+
+  std::size_t json_bytes = 0, bin_bytes = 0;
+  std::vector<std::string> bins;
+  for (const auto &s : samples) {
+    std::string bin;
+    payload::jsonToBinary(s.first, s.second, bin);
+    json_bytes += s.second.size();
+    bin_bytes += bin.size();
+    std::printf("%-24s json=%3zu B  binary=%3zu B  %s\n", "", s.second.size(),
+                bin.size(), s.second.c_str());
+    bins.push_back(std::move(bin));
+  }
+  std::printf("%-24s total json=%zu B binary=%zu B (%.0f%%)\n", "",
+              json_bytes, bin_bytes, 100.0 * bin_bytes / json_bytes);
+
+  together::PayloadFields fields;
+  std::string out;
+  std::size_t k = 0;
+  auto t0 = Clock::now();
+  for (long long i = 0; i < n; ++i, k = (k + 1) % samples.size())
+    payload::parseJson(samples[k].second, fields);
+  report("json parse", n, Clock::now() - t0);
+
+  t0 = Clock::now();
+  for (long long i = 0; i < n; ++i, k = (k + 1) % samples.size())
+    payload::jsonToBinary(samples[k].first, samples[k].second, out);
+  report("json -> binary encode", n, Clock::now() - t0);
+
+  t0 = Clock::now();
+  for (long long i = 0; i < n; ++i, k = (k + 1) % samples.size())
+    payload::decodeBinary(bins[k], fields);
+  report("binary decode", n, Clock::now() - t0);
+  return 0;
+}
+
+// Bundle size and encode/decode time for household-like event runs.
+int benchDeltaBundle(long long) {
+  std::printf("%-24s zlib: %s\n", "",
+              together::bundle::compressionAvailable() ? "yes" : "no");
+  for (long long n : {1000LL, 10000LL, 100000LL}) {
+    std::vector<DeltaEvent> events((std::size_t)n);
+    std::size_t raw = 0;
+    for (long long i = 0; i < n; ++i) {
+      DeltaEvent &e = events[(std::size_t)i];
+      e.seq = 1000 + i;
+      e.ts = 1700000000000LL + i * 1500;
+      e.entity_type = (i % 10 == 0) ? "budget_tx" : "task";
+      e.entity_id = "t" + std::to_string(i % 300);
+      e.op = (i % 7 == 0) ? "delete" : "upsert";
+      e.payload = R"({"title":"Chore )" + std::to_string(i % 300) +
+                  R"(","assignees":"kid)" + std::to_string(i % 3) +
+                  R"(","points":)" + std::to_string(i % 5) + "}";
+      raw += 16 + e.entity_type.size() + e.entity_id.size() + e.op.size() +
+             e.payload.size();
+    }
+
+    std::string bundle;
+    auto t0 = Clock::now();
+    together::bundle::encode(events, bundle);
+    double enc_ms =
+        std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+
+    std::vector<DeltaEvent> decoded;
+    std::string err;
+    t0 = Clock::now();
+    if (!together::bundle::decode(bundle, decoded, err))
+      return 1;
+    double dec_ms =
+        std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+
+    std::printf("bundle n=%-8lld raw=%9zu B  bundle=%8zu B (%4.1f%%)  "
+                "encode=%7.2f ms  decode=%7.2f ms\n",
+                n, raw, bundle.size(), 100.0 * bundle.size() / raw, enc_ms,
+                dec_ms);
+  }
+  return 0;
+}
+
+// Replay throughput: n events over 5000 tasks, verified then rebuilt.
+int benchReplay(long long n) {
+  EventStore store;
+  if (!store.open(freshDb("replay")).empty())
+    return 1;
+
+  std::vector<TaskUpsert> batch(1000);
+  SeqRange range;
+  for (long long written = 0; written < n; written += (long long)batch.size()) {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      long long k = written + (long long)i;
+      TaskRow &r = batch[i].row;
+      r.id = "t" + std::to_string(k % 5000);
+      r.title = "Chore " + std::to_string(k % 300);
+      r.assignees_csv = "kid" + std::to_string(k % 3);
+      r.points = (int)(k % 5);
+      r.status = "open";
+      r.visibility_tag = "family";
+      r.updated_at = k;
+      batch[i].payload_json = R"({"title":")" + r.title +
+                              R"(","assignees":")" + r.assignees_csv +
+                              R"(","points":)" + std::to_string(r.points) +
+                              R"(,"status":"open","visibility_tag":"family"})";
+    }
+    if (store.upsertTasks(batch, range) < 1)
+      return 1;
+  }
+
+  ReplayOptions opts;
+  ReplayReport rep;
+  std::string err;
+  for (bool verify : {true, false}) {
+    opts.verify_only = verify;
+    if (!store.replay(opts, rep, err) || rep.mismatches != 0) {
+      std::cerr << "replay: " << err << std::endl;
+      return 1;
+    }
+    std::printf("%-24s n=%-8lld %10.0f events/sec  (%.3f s, %lld rows)\n",
+                verify ? "replay verify" : "replay rebuild", rep.events,
+                rep.events_per_sec, rep.seconds, rep.rows);
+  }
+  return 0;
+}
+
+// Aggregate read throughput (getTaskId + a 20-row listTasks page) against
+// reader thread count, with and without a reader pool, while one writer
+// commits 100-row batches in the background.
+// Event log footprint and full-log since() scan: bytes per event on disk
+// (table plus indexes, after a WAL checkpoint) and rows/sec.
+int benchEventLog(long long n) {
+  const std::string path = freshDb("event_log");
+  EventStore store;
+  if (!store.open(path).empty())
+    return 1;
+
+  const char *const kTypes[] = {"task", "task", "budget_tx", "event"};
+  const char *const kOps[] = {"upsert", "upsert", "upsert", "delete"};
+  std::vector<DeltaEvent> batch(1000);
+  SeqRange range;
+  for (long long written = 0; written < n; written += (long long)batch.size()) {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      long long k = written + (long long)i;
+      DeltaEvent &e = batch[i];
+      e.entity_type = kTypes[k % 4];
+      e.entity_id = "t" + std::to_string(k % 5000);
+      e.op = kOps[(k / 4) % 4];
+      e.payload = R"({"points":)" + std::to_string(k % 5) + "}";
+      e.ts = k;
+    }
+    if (store.appendBatch(batch, range) < 1)
+      return 1;
+  }
+
+  sqlite3 *db = nullptr;
+  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+    return 1;
+  sqlite3_exec(db, "PRAGMA wal_checkpoint(TRUNCATE)", nullptr, nullptr,
+               nullptr);
+  sqlite3_close(db);
+  const double bytes = (double)std::filesystem::file_size(path);
+  std::printf("%-24s n=%-8lld %10.1f bytes/event (%.1f MB)\n", "event_log size",
+              n, bytes / (double)n, bytes / (1024.0 * 1024.0));
+
+  std::string err;
+  ReadCursor cursor;
+  long long rows = 0;
+  auto t0 = Clock::now();
+  if (!store.scanSinceView(
+          0, ReadBudget{},
+          [&rows](const DeltaEventView &) {
+            ++rows;
+            return true;
+          },
+          cursor, err) ||
+      rows != n)
+    return 1;
+  report("since (view, full log)", rows, Clock::now() - t0);
+
+  t0 = Clock::now();
+  auto all = store.since(0, err);
+  if ((long long)all.size() != n)
+    return 1;
+  report("since (vector, full log)", n, Clock::now() - t0);
+  return 0;
+}
+
+// Role-scoped reads against fetching everything and filtering in the
+// client. One task in five is visible to a Child.
+int benchVisibility(long long n) {
+  EventStore store;
+  if (!store.open(freshDb("visibility")).empty())
+    return 1;
+  const char *const kTagMix[] = {"family", "kids", "adults_only",
+                                 "adults_only", "owner_only"};
+  std::vector<TaskUpsert> batch(1000);
+  SeqRange range;
+  for (long long written = 0; written < n; written += (long long)batch.size()) {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      long long k = written + (long long)i;
+      TaskRow &r = batch[i].row;
+      r.id = "t" + std::to_string(k);
+      r.title = "Chore";
+      r.assignees_csv = "kid" + std::to_string(k % 3);
+      r.status = k % 2 ? "open" : "done";
+      r.visibility_tag = kTagMix[k % 5];
+      r.updated_at = k;
+      batch[i].payload_json = R"({"title":"Chore"})";
+    }
+    if (store.upsertTasks(batch, range) < 1)
+      return 1;
+  }
+
+  using together::Role;
+  namespace visibility = together::visibility;
+  std::string err;
+  const int kPages = 2000;
+  long long rows = 0;
+  auto t0 = Clock::now();
+  for (int i = 0; i < kPages; ++i)
+    rows += (long long)store.listTasks(Role::Child, "kid1", "", 50, 0, err).size();
+  report("child page (scoped)", kPages, Clock::now() - t0);
+
+  // Client-side: walk the unscoped listing until 50 visible rows.
+  long long scanned = 0;
+  t0 = Clock::now();
+  for (int i = 0; i < kPages; ++i) {
+    int kept = 0;
+    store.forEachTask("", 1 << 30, 0,
+                      [&](const TaskRowView &v) {
+                        ++scanned;
+                        if (visibility::canSeeTask(Role::Child,
+                                                   v.visibility_tag, false))
+                          ++kept;
+                        return kept < 50;
+                      },
+                      err);
+  }
+  report("child page (client)", kPages, Clock::now() - t0);
+  std::printf("%-24s %lld vs %lld rows read per page\n", "", rows / kPages,
+              scanned / kPages);
+
+  t0 = Clock::now();
+  auto mine = store.since(Role::Child, 0, err);
+  report("child since (scoped)", (long long)mine.size(), Clock::now() - t0);
+  // Client-side, every event has to be fetched before it can be filtered.
+  t0 = Clock::now();
+  auto all = store.since(0, err);
+  report("child since (client)", (long long)all.size(), Clock::now() - t0);
+  std::printf("%-24s %zu of %zu events visible\n", "", mine.size(),
+              all.size());
+  return mine.empty() ? 1 : 0;
+}
+
+// "My tasks" for one of 8 members through task_assignee, against the
+// assignees_csv scan it replaces: walk every task and split its CSV.
+int benchAssignees(long long n) {
+  EventStore store;
+  if (!store.open(freshDb("assignees_" + std::to_string(n))).empty())
+    return 1;
+  std::vector<TaskUpsert> batch(1000);
+  SeqRange range;
+  for (long long written = 0; written < n; written += (long long)batch.size()) {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      long long k = written + (long long)i;
+      TaskRow &r = batch[i].row;
+      r.id = "t" + std::to_string(k);
+      r.title = "Chore";
+      r.assignees_csv = "m" + std::to_string(k % 8);
+      if (k % 3 == 0)
+        r.assignees_csv += ",m" + std::to_string((k + 3) % 8);
+      r.status = k % 2 ? "open" : "done";
+      r.visibility_tag = "family";
+      r.updated_at = k;
+      batch[i].payload_json = R"({"title":"Chore"})";
+    }
+    if (store.upsertTasks(batch, range) < 1)
+      return 1;
+  }
+
+  // What callers did before task_assignee: split every task's CSV.
+  auto listed = [](std::string_view csv, std::string_view member) {
+    while (!csv.empty()) {
+      const std::size_t comma = csv.find(',');
+      if (csv.substr(0, comma) == member)
+        return true;
+      if (comma == std::string_view::npos)
+        break;
+      csv.remove_prefix(comma + 1);
+    }
+    return false;
+  };
+  const std::string label = std::to_string(n / 1000) + "k";
+  std::string err, next;
+
+  const int kPages = 2000;
+  long long rows = 0;
+  auto t0 = Clock::now();
+  for (int i = 0; i < kPages; ++i)
+    rows += (long long)store.listTasksForMember("m1", "", 50, "", next, err)
+                .size();
+  report(("first page (index) " + label).c_str(), kPages, Clock::now() - t0);
+  long long scanned = 0;
+  t0 = Clock::now();
+  for (int i = 0; i < kPages; ++i) {
+    int kept = 0;
+    store.forEachTask("", 1 << 30, 0,
+                      [&](const TaskRowView &v) {
+                        ++scanned;
+                        if (listed(v.assignees_csv, "m1"))
+                          ++kept;
+                        return kept < 50;
+                      },
+                      err);
+  }
+  report(("first page (csv) " + label).c_str(), kPages, Clock::now() - t0);
+  std::printf("%-24s %lld vs %lld rows read per page\n", "", rows / kPages,
+              scanned / kPages);
+
+  // Every task of the member, for the whole "my tasks" list.
+  const int kLists = n >= 100000 ? 20 : 200;
+  long long mine = 0;
+  t0 = Clock::now();
+  for (int i = 0; i < kLists; ++i) {
+    std::string token;
+    do {
+      store.forEachTaskForMember("m1", "open", 500, token,
+                                 [&](const TaskRowView &) {
+                                   ++mine;
+                                   return true;
+                                 },
+                                 next, err);
+      token = next;
+    } while (!token.empty());
+  }
+  report(("all open (index) " + label).c_str(), kLists, Clock::now() - t0);
+  long long found = 0;
+  t0 = Clock::now();
+  for (int i = 0; i < kLists; ++i)
+    store.forEachTask("open", 1 << 30, 0,
+                      [&](const TaskRowView &v) {
+                        found += listed(v.assignees_csv, "m1");
+                        return true;
+                      },
+                      err);
+  report(("all open (csv) " + label).c_str(), kLists, Clock::now() - t0);
+  std::printf("%-24s %lld of %lld tasks\n", "", found / kLists, n);
+  return err.empty() && found > 0 && found == mine ? 0 : 1;
+}
+
+// Due scheduler: load cost, per-write cost and nextDue, against finding
+// the next reminders with a listTasks scan.
+int benchDueScheduler(long long n) {
+  EventStore store;
+  if (!store.open(freshDb("due_scheduler")).empty())
+    return 1;
+  std::vector<TaskUpsert> batch(1000);
+  SeqRange range;
+  for (long long written = 0; written < n; written += (long long)batch.size()) {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      long long k = written + (long long)i;
+      TaskRow &r = batch[i].row;
+      r.id = "t" + std::to_string(k);
+      r.title = "Chore";
+      r.due_at = k % 5 == 0 ? 0 : 1000000 + (k * 7919) % n;
+      r.status = k % 2 ? "open" : "done";
+      r.visibility_tag = "family";
+      r.updated_at = k;
+      batch[i].payload_json = R"({"title":"Chore"})";
+    }
+    if (store.upsertTasks(batch, range) < 1)
+      return 1;
+  }
+
+  auto t0 = Clock::now();
+  if (!store.enableDueScheduler().empty())
+    return 1;
+  const auto load = Clock::now() - t0;
+  const long long open = (long long)store.nextDue(0, (std::size_t)n).size();
+  report("load (open tasks)", open, load);
+
+  // Raw heap updates at this size: reschedule random tasks.
+  together::DueScheduler heap;
+  std::vector<together::DueTask> seed;
+  for (long long k = 0; k < open; ++k)
+    seed.push_back({"t" + std::to_string(k), 1000000 + k});
+  heap.load(seed);
+  std::mt19937 rng(7);
+  std::vector<std::string> ids;
+  for (int i = 0; i < 100000; ++i)
+    ids.push_back("t" + std::to_string(rng() % (unsigned)open));
+  t0 = Clock::now();
+  for (int i = 0; i < 100000; ++i)
+    heap.update(ids[(std::size_t)i], 1000000 + (long long)(rng() % 1000000),
+                "open");
+  report("scheduler update", 100000, Clock::now() - t0);
+
+  const int kPeeks = 2000;
+  std::size_t got = 0;
+  t0 = Clock::now();
+  for (int i = 0; i < kPeeks; ++i)
+    got += store.nextDue(1000000, 10).size();
+  report("nextDue(10)", kPeeks, Clock::now() - t0);
+
+  // Without the scheduler: scan the open tasks and keep the 10 earliest.
+  std::string err;
+  const int kScans = 20;
+  std::size_t kept = 0;
+  t0 = Clock::now();
+  for (int i = 0; i < kScans; ++i) {
+    std::vector<long long> best;
+    store.forEachTask("open", 1 << 30, 0,
+                      [&](const TaskRowView &v) {
+                        if (v.due_at <= 1000000)
+                          return true;
+                        best.push_back(v.due_at);
+                        if (best.size() > 10) {
+                          std::nth_element(best.begin(), best.begin() + 10,
+                                           best.end());
+                          best.resize(10);
+                        }
+                        return true;
+                      },
+                      err);
+    kept += best.size();
+  }
+  report("listTasks scan (10)", kScans, Clock::now() - t0);
+  return got == (std::size_t)kPeeks * 10 && kept == (std::size_t)kScans * 10
+             ? 0
+             : 1;
+}
+
+int benchRecurrence(long long n) {
+  using together::Frequency;
+  using together::Occurrence;
+  using together::Recurrence;
+  using together::RecurrenceRule;
+  constexpr long long kDay = 86400000;
+  const long long t0ms = 1704067200000LL; // 2024-01-01
+
+  // A household's worth of series, each with a few moved or cancelled
+  // occurrences.
+  std::vector<Recurrence> series;
+  std::string err;
+  for (int k = 0; k < 20; ++k) {
+    RecurrenceRule rule;
+    rule.freq = (Frequency)(k % 3);
+    rule.interval = 1 + k % 2;
+    rule.dtstart = t0ms + (k % 7) * kDay + (8 + k % 10) * 3600000LL;
+    rule.weekdays = k % 3 == 1 ? 0x15u : 0u;
+    Recurrence r;
+    if (!Recurrence::compile(rule, r, err))
+      return 1;
+    Occurrence o;
+    int i = 0;
+    for (auto it = r.occurrences(t0ms, t0ms + 120 * kDay); it.next(o); ++i)
+      if (i % 5 == 2)
+        r.setOverride({o.original, o.start + (i % 2 ? 3600000LL : 0), i % 2 == 0},
+                      err);
+    series.push_back(std::move(r));
+  }
+
+  // Expand a year from two years in, as a calendar view would.
+  const long long from = t0ms + 730 * kDay, to = from + 365 * kDay;
+  long long total = 0;
+  const unsigned long long a0 = g_allocs.load();
+  auto start = Clock::now();
+  for (long long rep = 0; rep < n; ++rep)
+    for (const Recurrence &r : series) {
+      Occurrence o;
+      for (auto it = r.occurrences(from, to); it.next(o);)
+        ++total;
+    }
+  const auto dur = Clock::now() - start;
+  const unsigned long long allocs = g_allocs.load() - a0;
+  report("expand year x20", n, dur);
+  report("occurrences", total, dur);
+  std::printf("%-24s %llu allocations while iterating\n", "", allocs);
+  return allocs == 0 && total > 0 ? 0 : 1;
+}
+
+// Budget rollups: what the incremental budget_month upkeep adds to an
+// append, and a month's envelopes from budgetSummary against folding the
+// whole log client-side, which is what a summary cost without them.
+int benchBudget(long long n) {
+  const char *const kCategories[] = {"groceries", "rent", "fun",
+                                     "transport", "kids", "utilities"};
+  const long long t0ms = 1704067200000LL; // 2024-01-01
+  constexpr long long kDay = 86400000;
+  auto txEvents = [&](long long from, std::size_t count, const char *type) {
+    std::vector<DeltaEvent> out(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      const long long k = from + (long long)i;
+      DeltaEvent &ev = out[i];
+      ev.entity_type = type;
+      ev.entity_id = "tx" + std::to_string(k % (n / 2 + 1));
+      ev.op = "upsert";
+      ev.payload = R"({"category":")" + std::string(kCategories[k % 6]) +
+                   R"(","amount_cents":-)" + std::to_string(500 + k % 9000) +
+                   "}";
+      ev.ts = t0ms + (k * 730 / n) * kDay + k % 1000; // two years
+    }
+    return out;
+  };
+
+  double per_event[2] = {0, 0};
+  EventStore store;
+  for (int pass = 0; pass < 2; ++pass) {
+    const char *type = pass ? "budget_tx" : "note";
+    EventStore plain;
+    EventStore &target = pass ? store : plain;
+    if (!target.open(freshDb(std::string("budget_") + type)).empty())
+      return 1;
+    SeqRange range;
+    auto start = Clock::now();
+    for (long long written = 0; written < n; written += 500) {
+      auto batch = txEvents(written, (std::size_t)std::min(500LL, n - written),
+                            type);
+      if (target.appendBatch(batch, range) < 1)
+        return 1;
+    }
+    const auto dur = Clock::now() - start;
+    report(pass ? "append budget_tx" : "append note", n, dur);
+    per_event[pass] = std::chrono::duration<double, std::micro>(dur).count() / n;
+  }
+  std::printf("%-24s %+.2f us per event for the rollups\n", "",
+              per_event[1] - per_event[0]);
+  for (int k = 0; k < 6; ++k)
+    if (store.setBudgetLimit(kCategories[k], 202401, 50000 + k * 10000, true,
+                             t0ms) < 1)
+      return 1;
+
+  std::string err;
+  std::vector<together::BudgetEnvelope> envelopes;
+  auto start = Clock::now();
+  if (!store.budgetSummary(202512, envelopes, err))
+    return 1;
+  report("summary (first read)", 1, Clock::now() - start);
+  const int kReps = 1000;
+  long long net = 0;
+  start = Clock::now();
+  for (int rep = 0; rep < kReps; ++rep) {
+    if (!store.budgetSummary(202401 + (rep % 12), envelopes, err))
+      return 1;
+    for (const auto &e : envelopes)
+      net += e.net_cents;
+  }
+  report("summary (rollups)", kReps, Clock::now() - start);
+
+  // Client-side: fold every budget_tx event, then total February 2024.
+  // A transaction stays in the month of its first event.
+  const int kScans = 5;
+  long long scanned_net = 0;
+  start = Clock::now();
+  for (int rep = 0; rep < kScans; ++rep) {
+    std::unordered_map<std::string, std::pair<long long, long long>> rows;
+    together::PayloadFields fields;
+    for (const DeltaEvent &ev : store.since(0, err)) {
+      if (ev.entity_type != "budget_tx" || !together::payload::decode(ev.payload, fields))
+        continue;
+      auto &row = rows.try_emplace(ev.entity_id, ev.ts, 0).first->second;
+      for (const together::PayloadField &f : fields)
+        if (f.name == "amount_cents")
+          row.second = f.i;
+    }
+    for (const auto &[id, row] : rows)
+      if (row.first >= t0ms + 31 * kDay && row.first < t0ms + 60 * kDay)
+        scanned_net += row.second;
+  }
+  report("summary (log scan)", kScans, Clock::now() - start);
+  return net != 0 && scanned_net != 0 ? 0 : 1;
+}
+
+int benchReadThreads(long long n) {
+  const std::string path = freshDb("read_threads");
+  EventStore store;
+  if (!store.open(path).empty())
+    return 1;
+
+  std::vector<TaskUpsert> batch(100);
+  SeqRange range;
+  for (int k = 0; k < 10000; k += (int)batch.size()) {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      TaskRow &r = batch[i].row;
+      r.id = "t" + std::to_string(k + (int)i);
+      r.title = "Chore";
+      r.status = "open";
+      r.visibility_tag = "family";
+      r.updated_at = k + (long long)i;
+      batch[i].payload_json = R"({"title":"Chore"})";
+    }
+    if (store.upsertTasks(batch, range) < 1)
+      return 1;
+  }
+
+  for (std::size_t pool : {(std::size_t)0, (std::size_t)8}) {
+    if (!store.setReaderPool(pool).empty())
+      return 1;
+    for (int threads : {1, 2, 4, 8}) {
+      std::atomic<bool> done{false};
+      std::thread writer([&] {
+        SeqRange r;
+        while (!done)
+          store.upsertTasks(batch, r);
+      });
+
+      const long long per_thread = n / threads;
+      auto t0 = Clock::now();
+      std::vector<std::thread> readers;
+      for (int t = 0; t < threads; ++t)
+        readers.emplace_back([&, t] {
+          std::string err;
+          TaskRow row;
+          for (long long i = 0; i < per_thread; ++i) {
+            store.getTaskId("t" + std::to_string((i * 31 + t) % 10000), row,
+                            err);
+            store.forEachTask("", 20, (int)(i % 500),
+                              [](const TaskRowView &) { return true; }, err);
+          }
+        });
+      for (auto &r : readers)
+        r.join();
+      auto elapsed = Clock::now() - t0;
+      done = true;
+      writer.join();
+
+      std::string name = std::string(pool ? "pool" : "no pool") + " x" +
+                         std::to_string(threads) + " readers";
+      report(name.c_str(), per_thread * threads, elapsed);
+    }
+  }
+  return 0;
+}
+
+// Per-write latency path vs the async queue: the same task upserts from
+// one and from four producer threads, synchronous and group-committed.
+int benchUpsertAsync(long long n) {
+  auto makeTask = [](long long i) {
+    TaskUpsert t;
+    t.row.id = "t" + std::to_string(i % 512);
+    t.row.title = "Sweep floor";
+    t.row.status = "open";
+    t.row.visibility_tag = "family";
+    t.row.updated_at = i;
+    t.payload_json = R"({"title":"Sweep floor","points":2})";
+    return t;
+  };
+
+  for (int producers : {1, 4}) {
+    for (bool async : {false, true}) {
+      EventStore store;
+      if (!store.open(freshDb("upsert_async")).empty())
+        return 1;
+      const long long per_thread = n / producers;
+      std::atomic<int> errors{0};
+      auto t0 = Clock::now();
+      std::vector<std::thread> threads;
+      for (int p = 0; p < producers; ++p)
+        threads.emplace_back([&, p] {
+          std::vector<std::future<long long>> pending;
+          for (long long i = 0; i < per_thread; ++i) {
+            TaskUpsert t = makeTask(p * per_thread + i);
+            if (async) {
+              pending.push_back(store.upsertTaskAsync(std::move(t)));
+            } else if (store.upsertTask(t.row.id, t.row.title, "", 0, 2,
+                                        t.row.status, t.row.visibility_tag,
+                                        t.row.updated_at, t.payload_json) < 1) {
+              ++errors;
+            }
+          }
+          for (auto &f : pending)
+            if (f.get() < 1)
+              ++errors;
+        });
+      for (auto &t : threads)
+        t.join();
+      if (errors)
+        return 1;
+      std::string name = std::string(async ? "upsertTaskAsync" : "upsertTask") +
+                         " x" + std::to_string(producers);
+      report(name.c_str(), per_thread * producers, Clock::now() - t0);
+    }
+  }
+  return 0;
+}
+
+// Latency samples of one operation kind, in microseconds.
+struct OpStats {
+  const char *name;
+  std::vector<double> us;
+};
+
+double percentile(std::vector<double> &sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  std::size_t idx = (std::size_t)(p * (double)(sorted.size() - 1) + 0.5);
+  return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+// Commit-to-tailer latency of a ChangeRing consumer blocked in wait(),
+// against one polling since() every millisecond. A callback subscribed
+// first stamps each event's commit time.
+int benchChangeFeed(long long n) {
+  using together::ChangeNotice;
+  using together::ChangeRing;
+  EventStore store;
+  if (!store.open(freshDb("change_feed")).empty())
+    return 1;
+  const long long kWrites = std::max(200LL, n / 20);
+  std::unique_ptr<std::atomic<long long>[]> committed_ns(
+      new std::atomic<long long>[2 * kWrites + 1]);
+  auto nowNs = [] {
+    return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now().time_since_epoch())
+        .count();
+  };
+  store.subscribe({"note"}, [&](const ChangeNotice &c) {
+    committed_ns[c.last_seq].store(nowNs());
+  });
+  auto ring = std::make_shared<ChangeRing>(64);
+  const auto sub = store.subscribe({"note"}, ring);
+
+  // An event every 1.7 ms: the tailer is idle between them, and the
+  // writes drift against the poll interval instead of locking to it.
+  auto writeAll = [&] {
+    for (long long i = 0; i < kWrites; ++i) {
+      DeltaEvent ev;
+      ev.entity_type = "note";
+      ev.entity_id = "n" + std::to_string(i);
+      ev.op = "upsert";
+      ev.payload = R"({"text":"pick up milk"})";
+      ev.ts = i;
+      store.append(ev);
+      std::this_thread::sleep_for(std::chrono::microseconds(1700));
+    }
+  };
+
+  std::vector<double> pushed, polled;
+  std::thread tailer([&] {
+    ChangeNotice notice;
+    while ((long long)pushed.size() < kWrites) {
+      if (!ring->wait(std::chrono::milliseconds(100)))
+        break;
+      while (ring->pop(notice))
+        pushed.push_back((nowNs() - committed_ns[notice.last_seq].load()) /
+                         1e3);
+    }
+  });
+  writeAll();
+  tailer.join();
+  store.unsubscribe(sub);
+
+  std::atomic<bool> done{false};
+  long long polls = 0;
+  Clock::duration poll_time{};
+  std::thread poller([&] {
+    std::string err;
+    long long last = kWrites;
+    while (!done) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      const auto t0 = Clock::now();
+      auto fresh = store.since(last, err);
+      poll_time += Clock::now() - t0;
+      ++polls;
+      for (const DeltaEvent &e : fresh)
+        polled.push_back((nowNs() - committed_ns[e.seq].load()) / 1e3);
+      if (!fresh.empty())
+        last = fresh.back().seq;
+    }
+  });
+  writeAll();
+  done = true;
+  poller.join();
+
+  std::sort(pushed.begin(), pushed.end());
+  std::sort(polled.begin(), polled.end());
+  std::printf("%-24s n=%-8zu p50 %8.1f us  p99 %8.1f us\n", "wake (ring)",
+              pushed.size(), percentile(pushed, 0.50),
+              percentile(pushed, 0.99));
+  std::printf("%-24s n=%-8zu p50 %8.1f us  p99 %8.1f us\n", "wake (poll 1ms)",
+              polled.size(), percentile(polled, 0.50),
+              percentile(polled, 0.99));
+  std::printf("%-24s %lld since() polls for %lld events, %.1f us each\n", "",
+              polls, kWrites,
+              polls ? std::chrono::duration<double, std::micro>(poll_time)
+                              .count() /
+                          (double)polls
+                    : 0.0);
+  return (long long)pushed.size() == kWrites && ring->dropped() == 0 ? 0 : 1;
+}
+
+// A peer's backlog of n events (80% task upserts over 5000 tasks, half of
+// them already present locally, 20% notes) merged with one ingestRemote
+// batch, against the per-event path a client would take without it:
+// getTaskId, compare updated_at, then upsertTask or append, each in its
+// own transaction. The batch is then delivered again, all duplicates.
+int benchIngest(long long n) {
+  using together::IngestReport;
+  using together::RemoteEvent;
+  constexpr long long kTasks = 5000;
+  std::vector<RemoteEvent> batch((std::size_t)n);
+  std::mt19937_64 rng(7);
+  for (long long i = 0; i < n; ++i) {
+    RemoteEvent &r = batch[(std::size_t)i];
+    r.origin = i % 2 ? "phone" : "tablet";
+    r.remote_id = r.origin + ":" + std::to_string(i);
+    r.event.op = "upsert";
+    r.event.ts = 1000 + (long long)(rng() % (unsigned long long)(2 * n));
+    if (rng() % 5) {
+      r.event.entity_type = "task";
+      r.event.entity_id = "t" + std::to_string(rng() % kTasks);
+      r.event.payload = R"({"title":"Chore )" + std::to_string(i % 300) +
+                        R"(","points":)" + std::to_string(i % 5) + "}";
+    } else {
+      r.event.entity_type = "note";
+      r.event.entity_id = "n" + std::to_string(i);
+      r.event.payload = R"({"text":"pick up milk"})";
+    }
+  }
+  // Half the tasks exist, written locally at ts n + 1000: about half the
+  // remote events for them lose.
+  auto seed = [&](EventStore &store) {
+    std::vector<TaskUpsert> rows(kTasks / 2);
+    for (long long k = 0; k < kTasks / 2; ++k) {
+      TaskRow &r = rows[(std::size_t)k].row;
+      r.id = "t" + std::to_string(k * 2);
+      r.title = "Local";
+      r.status = "open";
+      r.visibility_tag = "family";
+      r.updated_at = n + 1000;
+      rows[(std::size_t)k].payload_json = R"({"title":"Local"})";
+    }
+    SeqRange range;
+    return store.upsertTasks(rows, range) > 0;
+  };
+
+  {
+    EventStore store;
+    if (!store.open(freshDb("ingest_each")).empty() || !seed(store))
+      return 1;
+    TaskRow row;
+    std::string err;
+    const auto start = Clock::now();
+    for (const RemoteEvent &r : batch) {
+      const DeltaEvent &ev = r.event;
+      if (ev.entity_type != "task") {
+        if (store.append(ev) < 1)
+          return 1;
+        continue;
+      }
+      const bool existed = store.getTaskId(ev.entity_id, row, err);
+      if (existed && ev.ts <= row.updated_at)
+        continue;
+      if (store.upsertTask(ev.entity_id, "Chore", "", 0, 0, "open", "family",
+                           ev.ts, ev.payload) < 1)
+        return 1;
+    }
+    report("ingest per event", n, Clock::now() - start);
+  }
+
+  EventStore store;
+  if (!store.open(freshDb("ingest")).empty() || !seed(store))
+    return 1;
+  IngestReport rep;
+  for (const char *name : {"ingestRemote", "ingestRemote (again)"}) {
+    const auto start = Clock::now();
+    if (store.ingestRemote(batch, rep) < 0)
+      return 1;
+    report(name, n, Clock::now() - start);
+    std::printf("%-24s %lld applied, %lld superseded, %lld duplicates\n", "",
+                rep.applied, rep.superseded, rep.duplicates);
+  }
+  return rep.duplicates == n ? 0 : 1;
+}
+
+// entityHistory of one task (about 20 events) and a range of about 200
+// events, on a log of n and of 10n events: both seek an index, so their
+// cost should not grow with the log. A since() scan filtered to the same
+// task shows what they replace.
+int benchHistory(long long n) {
+  for (long long size : {n, 10 * n}) {
+    EventStore store;
+    if (!store.open(freshDb("history")).empty())
+      return 1;
+    std::vector<DeltaEvent> batch(1000);
+    SeqRange range;
+    for (long long written = 0; written < size;
+         written += (long long)batch.size()) {
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+        const long long k = written + (long long)i;
+        batch[i].entity_type = "task";
+        batch[i].entity_id = "t" + std::to_string(k % (size / 20));
+        batch[i].op = "upsert";
+        batch[i].payload = R"({"title":"Chore","points":2})";
+        batch[i].ts = k; // one event per ms
+      }
+      if (store.appendBatch(batch, range) < 1)
+        return 1;
+    }
+
+    std::mt19937_64 rng(11);
+    std::string err;
+    long long rows = 0;
+    auto count = [&rows](const DeltaEvent &) {
+      ++rows;
+      return true;
+    };
+    ReadCursor cursor;
+    const long long kQueries = 500;
+    auto start = Clock::now();
+    for (long long q = 0; q < kQueries; ++q) {
+      const std::string id = "t" + std::to_string(rng() % (size / 20));
+      if (!store.entityHistory("task", id, 0, ReadBudget{}, count, cursor, err))
+        return 1;
+    }
+    const auto history = Clock::now() - start;
+    const long long history_rows = rows;
+    rows = 0;
+    start = Clock::now();
+    for (long long q = 0; q < kQueries; ++q) {
+      const long long from = (long long)(rng() % (unsigned long long)size);
+      if (!store.range(from, from + 200, ReadCursor{}, ReadBudget{}, count,
+                       cursor, err))
+        return 1;
+    }
+    const auto ranged = Clock::now() - start;
+    const long long range_rows = rows;
+    long long scanned = 0;
+    start = Clock::now();
+    for (const DeltaEvent &e : store.since(0, err))
+      scanned += e.entity_id == "t0";
+    const auto scan = Clock::now() - start;
+
+    const auto us = [](Clock::duration d, long long per) {
+      return std::chrono::duration<double, std::micro>(d).count() /
+             (double)per;
+    };
+    std::printf("%-24s log=%-8lld %8.1f us/query  (%lld rows each)\n",
+                "entityHistory", size, us(history, kQueries),
+                history_rows / kQueries);
+    std::printf("%-24s log=%-8lld %8.1f us/query  (%lld rows each)\n",
+                "range", size, us(ranged, kQueries), range_rows / kQueries);
+    std::printf("%-24s log=%-8lld %8.1f us/query  (%lld rows)\n",
+                "since() + filter", size, us(scan, 1), scanned);
+  }
+  return 0;
+}
+
+// Write throughput against active households: h writer threads, each
+// committing one event at a time, either all into one store or each into
+// its own household shard through a HouseholdRouter.
+int benchRouter(long long n) {
+  using together::HouseholdRouter;
+  using together::RouterOptions;
+  const long long per_writer = std::max(500LL, n / 8);
+  for (int households : {1, 2, 4, 8}) {
+    double rates[2] = {0, 0};
+    for (int sharded = 0; sharded < 2; ++sharded) {
+      const std::string dir = "tmp/bench_router";
+      std::filesystem::remove_all(dir);
+      RouterOptions options;
+      options.directory = dir;
+      options.idle_timeout = std::chrono::milliseconds(0);
+      HouseholdRouter router(options);
+      std::vector<std::thread> writers;
+      std::atomic<bool> failed{false};
+      const auto start = Clock::now();
+      for (int h = 0; h < households; ++h) {
+        writers.emplace_back([&, h] {
+          std::string err;
+          auto lease = router.acquire(
+              sharded ? "h" + std::to_string(h) : std::string("shared"), err);
+          DeltaEvent ev;
+          ev.entity_type = "task";
+          ev.entity_id = "t" + std::to_string(h);
+          ev.op = "upsert";
+          ev.payload = R"({"title":"Do dishes","points":3})";
+          for (long long i = 0; lease && i < per_writer; ++i) {
+            ev.ts = i;
+            if (lease->append(ev) < 1)
+              failed = true;
+          }
+          if (!lease)
+            failed = true;
+        });
+      }
+      for (std::thread &t : writers)
+        t.join();
+      if (failed)
+        return 1;
+      const double secs =
+          std::chrono::duration<double>(Clock::now() - start).count();
+      rates[sharded] = (double)(per_writer * households) / secs;
+    }
+    std::printf("%-24s h=%-8d %10.0f events/sec  (one store %.0f, x%.2f)\n",
+                "router writes", households, rates[1], rates[0],
+                rates[1] / rates[0]);
+  }
+  return 0;
+}
+
+// Cold start: open + first query (a task lookup and the last page of the
+// log) on a database of 20n events, about 100 MB at the default n, per
+// tuning profile. "schema script" reopens with user_version one behind, so
+// every open reruns the DDL, as opens did before the version check.
+int benchOpenProfiles(long long n) {
+  using together::OpenOptions;
+  const std::string path = freshDb("open_profiles");
+  {
+    EventStore store;
+    if (!store.open(path).empty())
+      return 1;
+    const std::string filler(180, 'x');
+    std::vector<TaskUpsert> tasks(1000);
+    SeqRange range;
+    for (long long written = 0; written < 20 * n;
+         written += (long long)tasks.size()) {
+      for (std::size_t i = 0; i < tasks.size(); ++i) {
+        const long long k = written + (long long)i;
+        TaskRow &row = tasks[i].row;
+        row.id = "t" + std::to_string(k % 20000);
+        row.title = "Chore " + std::to_string(k);
+        row.points = 2;
+        row.status = "open";
+        row.visibility_tag = "family";
+        row.updated_at = k;
+        tasks[i].payload_json = R"({"title":"Chore","note":")" + filler + "\"}";
+      }
+      if (store.upsertTasks(tasks, range) < 1)
+        return 1;
+    }
+  }
+  std::error_code ec;
+  const double mb = (double)std::filesystem::file_size(path, ec) / 1e6;
+  auto setVersion = [&path](int version) {
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    const std::string sql = "PRAGMA user_version = " + std::to_string(version);
+    sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+  };
+  int version = 0;
+  {
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_stmt *st = nullptr;
+    sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &st, nullptr);
+    if (sqlite3_step(st) == SQLITE_ROW)
+      version = sqlite3_column_int(st, 0);
+    sqlite3_finalize(st);
+    sqlite3_close(db);
+  }
+
+  struct Profile {
+    const char *name;
+    OpenOptions options;
+    bool schema_script;
+  };
+  const Profile profiles[] = {
+      {"schema script", OpenOptions(), true},
+      {"default", OpenOptions(), false},
+      {"phone", OpenOptions::phone(), false},
+      {"desktop", OpenOptions::desktop(), false},
+      {"server", OpenOptions::server(), false},
+  };
+  const int kOpens = 30;
+  for (const Profile &p : profiles) {
+    std::vector<double> us;
+    for (int i = 0; i < kOpens; ++i) {
+      if (p.schema_script)
+        setVersion(version - 1);
+      const auto start = Clock::now();
+      {
+        EventStore store;
+        if (!store.open(path, p.options).empty())
+          return 1;
+        TaskRow row;
+        std::string err;
+        if (!store.getTaskId("t" + std::to_string(i * 631 % 20000), row, err))
+          return 1;
+        long long rows = 0;
+        ReadCursor cursor;
+        if (!store.scanSince(20 * n - 100, ReadBudget{},
+                             [&rows](const DeltaEvent &) {
+                               ++rows;
+                               return true;
+                             },
+                             cursor, err) ||
+            rows != 100)
+          return 1;
+      }
+      us.push_back(
+          std::chrono::duration<double, std::micro>(Clock::now() - start)
+              .count());
+    }
+    std::sort(us.begin(), us.end());
+    std::printf("%-24s db=%.0fMB %8.0f us p50 %8.0f us p95 (open + first "
+                "query)\n",
+                p.name, mb, percentile(us, 0.50), percentile(us, 0.95));
+  }
+  setVersion(version);
+  return 0;
+}
+
+// Synthetic household: four members editing a shared task list while a
+// peer syncs. Every choice comes from one mt19937_64 stream (its output is
+// fixed by the standard) and timestamps are derived from the op index, so
+// a seed replays the same operations and ends in the same state.
+//
+// Mix per op: 35% upsertTask, 10% append (notes, budget entries),
+// 5% deleteTask, 25% listTasks page, 25% since from the peer's cursor.
+int benchHousehold(long long n) {
+  EventStore store;
+  if (!store.open(freshDb("household")).empty())
+    return 1;
+
+  std::mt19937_64 rng(g_household.seed);
+  auto pick = [&rng](unsigned long long bound) { return rng() % bound; };
+  const char *const kMembers[] = {"mom", "dad", "kid1", "kid2"};
+  const char *const kStatuses[] = {"open", "done", "snoozed"};
+  const long long tasks = std::max(100LL, n / 10);
+  const long long base_ts = 1700000000000LL;
+
+  // Preload so reads have something to find; not timed.
+  for (long long i = 0; i < tasks; ++i)
+    store.upsertTask("t" + std::to_string(i), "Chore " + std::to_string(i),
+                     kMembers[i % 4], base_ts + i * 3600000, (int)(i % 5),
+                     "open", "family", base_ts + i, R"({"seed":true})");
+
+  OpStats upsert{"upsertTask", {}}, append{"append", {}},
+      del{"deleteTask", {}}, list{"listTasks", {}}, since{"since", {}};
+  for (OpStats *op : {&upsert, &append, &del, &list, &since})
+    op->us.reserve((std::size_t)n / 2);
+
+  long long peer_seq = 0;
+  long long rows_read = 0;
+  std::string err;
+  auto t_start = Clock::now();
+  for (long long i = 0; i < n; ++i) {
+    const long long ts = base_ts + 1000000 + i * 1000;
+    const unsigned long long roll = pick(100);
+    const std::string id = "t" + std::to_string(pick((unsigned long long)tasks));
+
+    OpStats *op;
+    auto t0 = Clock::now();
+    if (roll < 35) {
+      op = &upsert;
+      const char *who = kMembers[pick(4)];
+      const char *status = kStatuses[pick(3)];
+      int points = (int)pick(5);
+      std::string payload = R"({"title":"Chore","assignees":")" +
+                            std::string(who) + R"(","points":)" +
+                            std::to_string(points) + R"(,"status":")" +
+                            status + "\"}";
+      t0 = Clock::now();
+      if (store.upsertTask(id, "Chore", who, ts + 86400000, points, status,
+                           "family", ts, payload) < 1)
+        return 1;
+    } else if (roll < 45) {
+      op = &append;
+      DeltaEvent ev;
+      const bool budget = pick(2) == 0;
+      ev.entity_type = budget ? "budget_tx" : "note";
+      ev.entity_id = (budget ? "b" : "n") + std::to_string(pick(1000));
+      ev.op = "upsert";
+      ev.payload = budget ? R"({"amount_cents":-1250,"category":"groceries"})"
+                          : R"({"text":"pick up milk"})";
+      ev.ts = ts;
+      t0 = Clock::now();
+      if (store.append(ev) < 1)
+        return 1;
+    } else if (roll < 50) {
+      op = &del;
+      t0 = Clock::now();
+      if (store.deleteTask(id, ts, R"({"reason":"user_deleted"})") < 1)
+        return 1;
+    } else if (roll < 75) {
+      op = &list;
+      const unsigned long long filter = pick(4);
+      const std::string status = filter < 3 ? kStatuses[filter] : "";
+      const int offset = (int)pick(5) * 20;
+      t0 = Clock::now();
+      store.forEachTask(status, 20, offset,
+                        [&rows_read](const TaskRowView &) {
+                          ++rows_read;
+                          return true;
+                        },
+                        err);
+    } else {
+      op = &since;
+      ReadBudget budget;
+      budget.max_rows = 200;
+      ReadCursor cursor;
+      t0 = Clock::now();
+      if (!store.scanSinceView(peer_seq, budget,
+                               [&rows_read](const DeltaEventView &) {
+                                 ++rows_read;
+                                 return true;
+                               },
+                               cursor, err))
+        return 1;
+      peer_seq = cursor.next_seq;
+    }
+    op->us.push_back(
+        std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+  }
+  const double total_secs =
+      std::chrono::duration<double>(Clock::now() - t_start).count();
+
+  std::vector<DeltaEvent> tail = store.since(peer_seq, err);
+  const long long final_seq = tail.empty() ? peer_seq : tail.back().seq;
+
+  std::string json = "{\"case\":\"household\",\"seed\":" +
+                     std::to_string(g_household.seed) +
+                     ",\"ops\":" + std::to_string(n) +
+                     ",\"tasks\":" + std::to_string(tasks) +
+                     ",\"final_seq\":" + std::to_string(final_seq) +
+                     ",\"rows_read\":" + std::to_string(rows_read);
+  char buf[256];
+  std::snprintf(buf, sizeof(buf), ",\"seconds\":%.3f,\"ops_per_sec\":%.0f",
+                total_secs, total_secs > 0 ? n / total_secs : 0.0);
+  json += buf;
+  json += ",\"operations\":{";
+  bool first = true;
+  for (OpStats *op : {&upsert, &append, &del, &list, &since}) {
+    std::vector<double> &v = op->us;
+    double sum = 0;
+    for (double x : v)
+      sum += x;
+    std::sort(v.begin(), v.end());
+    std::snprintf(buf, sizeof(buf),
+                  "%s\"%s\":{\"count\":%zu,\"ops_per_sec\":%.0f,"
+                  "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f}",
+                  first ? "" : ",", op->name, v.size(),
+                  sum > 0 ? v.size() / (sum / 1e6) : 0.0, percentile(v, 0.50),
+                  percentile(v, 0.99), percentile(v, 0.999));
+    json += buf;
+    first = false;
+    std::printf("%-24s n=%-8zu p50 %8.1f us  p99 %8.1f us  p999 %8.1f us\n",
+                op->name, v.size(), percentile(v, 0.50), percentile(v, 0.99),
+                percentile(v, 0.999));
+  }
+  json += "}}\n";
+
+  if (g_household.json_path.empty()) {
+    std::fputs(json.c_str(), stdout);
+  } else {
+    FILE *f = std::fopen(g_household.json_path.c_str(), "w");
+    if (!f)
+      return 1;
+    std::fputs(json.c_str(), f);
+    std::fclose(f);
+  }
+  return 0;
+}
+
+// Cost of the per-operation instrumentation (two clock reads and one
+// histogram record), and the stats() snapshot after a short mixed run.
+// Compare against a -DTOGETHER_METRICS=OFF build for the end-to-end cost.
+int benchMetrics(long long n) {
+  together::LatencyHistogram h;
+  auto t0 = Clock::now();
+  for (long long i = 0; i < n * 50; ++i) {
+    auto start = Clock::now();
+    h.record((std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 Clock::now() - start)
+                 .count());
+  }
+  report("timer + record", n * 50, Clock::now() - t0);
+
+  EventStore store;
+  if (!store.open(freshDb("metrics")).empty())
+    return 1;
+  together::StoreStats st = store.stats();
+  std::printf("%-24s %s\n", "metrics", st.enabled ? "enabled" : "compiled out");
+  if (!st.enabled)
+    return 0;
+
+  std::string err;
+  TaskRow row;
+  for (long long i = 0; i < n; ++i) {
+    store.upsertTask("t" + std::to_string(i % 500), "Sweep floor", "kid1", 0,
+                     2, "open", "family", i,
+                     R"({"title":"Sweep floor","points":2})");
+    store.getTaskId("t" + std::to_string((i * 7) % 500), row, err);
+    if (i % 10 == 0)
+      store.listTasks("", 20, 0, err);
+  }
+  st = store.stats();
+  for (const together::OpLatencyStats &op : st.ops)
+    if (op.count)
+      std::printf("%-24s n=%-8llu p50 %8.1f us  p99 %8.1f us  p999 %8.1f us\n",
+                  op.op, (unsigned long long)op.count, op.p50_us, op.p99_us,
+                  op.p999_us);
+  std::printf("%-24s payload=%llu B  task_rows=%llu  rollbacks=%llu\n", "",
+              (unsigned long long)st.payload_bytes_written,
+              (unsigned long long)st.task_rows_scanned,
+              (unsigned long long)st.rollbacks);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string which;
+  long long n = 20000;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    if (flag == "--case")
+      which = argv[i + 1];
+    else if (flag == "--n")
+      n = std::stoll(argv[i + 1]);
+    else if (flag == "--seed")
+      g_household.seed = std::stoull(argv[i + 1]);
+    else if (flag == "--json")
+      g_household.json_path = argv[i + 1];
+  }
+
+  const std::vector<BenchCase> cases = {
+      {"append_uncached", benchAppendUncached},
+      {"append", benchAppend},
+      {"upsert_uncached", benchUpsertTaskUncached},
+      {"upsert", benchUpsertTask},
+      {"append_batch", benchAppendBatch},
+      {"upsert_tasks", benchUpsertTasks},
+      {"since_stream", benchSinceStream},
+      {"since_vector", benchSinceVector},
+      {"list_allocs", [](long long) { return benchListAllocs(10000); }},
+      {"list_pages", [](long long) { return benchListPages(100000); }},
+      {"get_task", benchGetTask},
+      {"payload_codec", [](long long n) { return benchPayloadCodec(n * 50); }},
+      {"delta_bundle", benchDeltaBundle},
+      {"replay", [](long long n) { return benchReplay(n * 50); }},
+      {"event_log", [](long long n) { return benchEventLog(n * 50); }},
+      {"visibility", [](long long n) { return benchVisibility(n * 5); }},
+      {"assignees",
+       [](long long) { return benchAssignees(10000) | benchAssignees(100000); }},
+      {"due_scheduler",
+       [](long long) { return benchDueScheduler(100000); }},
+      {"recurrence",
+       [](long long n) { return benchRecurrence(n / 10 + 1); }},
+      {"budget", [](long long n) { return benchBudget(n * 10); }},
+      {"change_feed", benchChangeFeed},
+      {"ingest", [](long long n) { return benchIngest(n * 5 / 2); }},
+      {"history", [](long long n) { return benchHistory(n * 5); }},
+      {"router", benchRouter},
+      {"open_profiles", benchOpenProfiles},
+      {"read_threads", benchReadThreads},
+      {"upsert_async", benchUpsertAsync},
+      {"household", benchHousehold},
+      {"metrics", benchMetrics},
+  };
+
+  int rc = 0;
+  bool matched = false;
+  for (const auto &c : cases) {
+    if (!which.empty() && which != c.name)
+      continue;
+    matched = true;
+    if (c.run(n) != 0) {
+      std::cerr << "BENCH FAIL: " << c.name << std::endl;
+      rc = 1;
+    }
+  }
+  if (!matched) {
+    std::cerr << "unknown case " << which << std::endl;
+    return 1;
+  }
+  return rc;
+}
@@ -0,0 +1,68 @@
+#pragma once
+// Change notifications for event_log tailers (EventStore::subscribe).
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace together {
+
+// The events one commit added that a subscriber asked for: `events` of
+// the seqs in [first_seq, last_seq]. A commit's seqs are contiguous, but
+// when it mixes entity types the range can also hold events the
+// subscriber filtered out.
+struct ChangeNotice {
+  long long first_seq = 0;
+  long long last_seq = 0;
+  std::size_t events = 0;
+};
+
+using ChangeCallback = std::function<void(const ChangeNotice &)>;
+
+// Bounded single-producer / single-consumer ring of notices. The store's
+// writer pushes without taking a lock; one consumer thread pops. When the
+// ring is full the notice is dropped and the ring marked overflowed: the
+// consumer then catches up with since(last seq it handled) and carries on
+// with the notices that follow.
+class ChangeRing {
+public:
+  explicit ChangeRing(std::size_t capacity = 1024); // rounded up to 2^k
+
+  ChangeRing(const ChangeRing &) = delete;
+  ChangeRing &operator=(const ChangeRing &) = delete;
+
+  // Producer. False, and the ring overflowed, if it is full.
+  bool push(const ChangeNotice &notice);
+
+  // Consumer. False if the ring is empty.
+  bool pop(ChangeNotice &out);
+  // Consumer. Blocks until a notice is queued or the ring overflows, for
+  // at most `timeout`; true if either happened. Never blocks the producer.
+  bool wait(std::chrono::microseconds timeout);
+  // Consumer. Whether notices were dropped since the last call.
+  bool takeOverflow();
+
+  std::size_t capacity() const { return slots_.size(); }
+  unsigned long long dropped() const { return dropped_.load(); }
+
+private:
+  std::vector<ChangeNotice> slots_;
+  std::size_t mask_ = 0;
+  alignas(64) std::atomic<std::size_t> head_{0}; // next pop, consumer-owned
+  alignas(64) std::atomic<std::size_t> tail_{0}; // next push, producer-owned
+  std::atomic<bool> overflow_{false};
+  std::atomic<unsigned long long> dropped_{0};
+
+  // The producer only touches the mutex when the consumer is asleep.
+  std::atomic<bool> sleeping_{false};
+  std::mutex wake_mu_;
+  std::condition_variable wake_cv_;
+
+  bool ready() const;
+  void wake();
+};
+
+} // namespace together
@@ -0,0 +1,38 @@
+#pragma once
+#include "core/EventStore.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace together {
+
+// Self-describing, compressed container for a run of event_log rows, used
+// for delta sync.
+//
+// Layout:
+//   "2GDB" <version=1> <compression: 0 stored, 1 deflate> varint(raw size)
+//   body (compressed as a whole)
+// Body, column by column so similar values sit together:
+//   varint count
+//   string table: varint n, then n x (varint len, bytes) — every distinct
+//     entity_type / op / entity_id appears once
+//   seq:  varint first, then varint deltas
+//   ts:   zigzag varint first, then zigzag deltas
+//   entity_type, op, entity_id: varint string-table indexes
+//   payload: varint len + bytes each
+namespace bundle {
+
+// Encode `events` (ascending seq). Compresses when the library was built
+// with zlib, otherwise stores the body uncompressed.
+void encode(const std::vector<DeltaEvent> &events, std::string &out);
+
+// Decode a bundle produced by encode(). Returns false and sets out_error on
+// malformed input or an unsupported compression method.
+bool decode(std::string_view bundle, std::vector<DeltaEvent> &out,
+            std::string &out_error);
+
+// True if this build can write/read deflate-compressed bundles.
+bool compressionAvailable();
+
+} // namespace bundle
+} // namespace together
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace together {
+
+// A task reminder: the task id and its due_at (epoch millis).
+struct DueTask {
+  std::string id;
+  long long due_at = 0;
+};
+
+// Reminder times of open tasks, as an indexed binary min-heap on
+// (due_at, id). A task is tracked while it has a due_at and is neither
+// done nor deleted (see tracks()). Each tracked task is pending until
+// drainDue passes its due_at and fired afterwards; a fired task is only
+// re-armed when its due_at changes. Loading is O(n), every update
+// O(log n). Not thread-safe; EventStore serializes access.
+class DueScheduler {
+public:
+  // Whether a task row with this due_at / status has a reminder. Must
+  // agree with the idx_task_due predicate EventStore loads from.
+  static bool tracks(long long due_at, std::string_view status);
+
+  // Replace the contents with `tasks`, all pending. O(n).
+  void load(std::vector<DueTask> tasks);
+  void clear();
+
+  // Apply a committed write of the task row.
+  void update(std::string_view id, long long due_at, std::string_view status);
+  void remove(std::string_view id);
+
+  // Up to `n` pending reminders due after `now`, earliest first. Leaves
+  // the scheduler unchanged.
+  std::vector<DueTask> nextDue(long long now, std::size_t n) const;
+  // Every pending reminder due at or before `now`, earliest first, marked
+  // fired.
+  std::vector<DueTask> drainDue(long long now);
+
+  std::size_t pending() const { return heap_.size(); }
+  std::size_t tracked() const { return slots_.size(); }
+
+private:
+  static constexpr std::size_t kFired = static_cast<std::size_t>(-1);
+
+  struct Slot {
+    long long due_at = 0;
+    std::size_t heap = kFired; // index in heap_, or kFired
+  };
+  using SlotMap = std::unordered_map<std::string, Slot>;
+
+  SlotMap slots_;
+  std::vector<SlotMap::value_type *> heap_;
+
+  bool less(std::size_t a, std::size_t b) const;
+  void place(std::size_t i, SlotMap::value_type *entry);
+  void siftUp(std::size_t i);
+  void siftDown(std::size_t i);
+  void push(SlotMap::value_type *entry);
+  void erase(std::size_t i);
+};
+
+} // namespace together
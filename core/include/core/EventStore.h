@@ -1,11 +1,35 @@
 #pragma once
+#include "core/ChangeFeed.h"
+#include "core/DueScheduler.h"
+#include "core/Metrics.h"
+#include "core/PayloadCodec.h"
+#include "core/Recurrence.h"
+#include "core/StatementCache.h"
+#include "core/Visibility.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
 #include <vector>
 
 struct sqlite3; // forward-declare
+struct sqlite3_stmt;
 
 namespace together {
 
+class EventCodes;
+class ReaderPool;
+class TaskCache;
+struct StoreMetrics;
+
 // Move TaskRow to namespace scope so it can be referenced without EventStore::
 struct TaskRow {
   std::string id;
@@ -24,10 +48,171 @@ struct DeltaEvent {
   std::string entity_type; // "task", "event", "budget_tx", ...
   std::string entity_id;   // caller id (e.g., "t1")
   std::string op;          // "upsert" | "delete"
-  std::string payload;     // JSON now (protobuf later)
+  std::string payload;     // JSON (stored binary with PayloadFormat::Binary)
   long long ts = 0;        // epoch millis
 };
 
+// Non-owning views of a task / event row. The string_views point into
+// SQLite's column memory and are valid only for the duration of the
+// visitor call that receives them; use toOwned() to keep a copy.
+struct TaskRowView {
+  std::string_view id;
+  std::string_view title;
+  std::string_view assignees_csv;
+  long long due_at = 0;
+  int points = 0;
+  std::string_view status;
+  std::string_view visibility_tag;
+  long long updated_at = 0;
+
+  TaskRow toOwned() const;
+  void copyTo(TaskRow &out) const; // reuses out's string capacity
+};
+
+struct DeltaEventView {
+  long long seq = 0;
+  std::string_view entity_type;
+  std::string_view entity_id;
+  std::string_view op;
+  std::string_view payload;
+  long long ts = 0;
+
+  DeltaEvent toOwned() const;
+  void copyTo(DeltaEvent &out) const; // reuses out's string capacity
+};
+
+// Inclusive range of event_log seqs written by one batch call.
+// Both ends are 0 when nothing was written.
+struct SeqRange {
+  long long first = 0;
+  long long last = 0;
+};
+
+// An event written on another device (EventStore::ingestRemote).
+struct RemoteEvent {
+  DeltaEvent event;      // seq is ignored
+  std::string origin;    // id of the device that wrote it
+  std::string remote_id; // unique across devices, e.g. "<origin>:<seq>"
+};
+
+// Outcome of EventStore::ingestRemote.
+struct IngestReport {
+  long long received = 0;
+  long long duplicates = 0; // remote_id ingested before, or twice here
+  long long superseded = 0; // task events older than the task row (LWW)
+  long long applied = 0;    // appended to the log
+  SeqRange range;           // seqs of the applied events
+};
+
+// One entry for EventStore::upsertTasks; row.updated_at is also the
+// timestamp of the appended event.
+struct TaskUpsert {
+  TaskRow row;
+  std::string payload_json;
+};
+
+// Limits for one page of a streaming read; 0 means unlimited. Bytes count
+// the string and payload bytes of each delivered row.
+struct ReadBudget {
+  std::size_t max_rows = 0;
+  std::size_t max_bytes = 0;
+};
+
+// Where a streaming read stopped. Pass next_seq back as since_seq to
+// resume with the following page.
+struct ReadCursor {
+  long long next_seq = 0; // seq of the last delivered row (or the input)
+  long long next_ts = 0;  // its ts; range() resumes after (next_ts, next_seq)
+  std::size_t rows = 0;   // rows delivered in this page
+  std::size_t bytes = 0;  // bytes delivered in this page
+  bool done = false;      // no rows remain after next_seq
+};
+
+// Receives each row of a streaming read; return false to stop early. The
+// event is reused between calls, so copy anything that must outlive it.
+// A visitor may read from the store again, the same read included: the
+// nested read runs on a statement of its own.
+using EventVisitor = std::function<bool(const DeltaEvent &)>;
+using EventViewVisitor = std::function<bool(const DeltaEventView &)>;
+using TaskViewVisitor = std::function<bool(const TaskRowView &)>;
+
+// Counters for sizing the task cache per device class.
+struct TaskCacheStats {
+  unsigned long long hits = 0;
+  unsigned long long misses = 0;
+  unsigned long long evictions = 0;
+  std::size_t entries = 0;
+  std::size_t bytes = 0;        // estimated bytes held
+  std::size_t budget_bytes = 0; // configured limit
+};
+
+// One category's envelope for a month (EventStore::budgetSummary).
+struct BudgetEnvelope {
+  std::string category;
+  long long limit_cents = 0;     // limit in force that month; 0 if none
+  bool rollover = false;         // what remains carries into the next month
+  long long carry_in_cents = 0;  // carried over from the month before
+  long long net_cents = 0;       // sum of the month's amount_cents
+  long long tx_count = 0;
+  long long remaining_cents = 0; // limit + carry_in + net
+};
+
+// Progress of an incremental compaction pass (see EventStore::compactStep).
+struct CompactionProgress {
+  long long checkpoint_seq = 0;    // snapshot point being compacted to
+  long long compacted_through = 0; // events with seq <= this are compacted
+  long long rows_deleted = 0;      // rows dropped by this step
+  bool done = false;               // compacted_through reached checkpoint
+};
+
+// Group-commit window of the asynchronous write queue.
+struct WriteQueueOptions {
+  std::size_t max_batch = 256;     // writes per transaction
+  long long max_delay_micros = 2000; // how long a write waits for company
+};
+
+// Connection tuning for EventStore::open. The defaults are SQLite's; the
+// profiles are starting points for a device class.
+struct OpenOptions {
+  int page_size = 4096;      // bytes; takes effect when the file is created
+  int cache_kib = 2000;      // page cache, per connection
+  long long mmap_bytes = 0;  // reads through a memory map; 0 disables
+  // synchronous=NORMAL: in WAL mode a commit no longer waits for fsync.
+  // A power loss can lose the last commits but never corrupts the file.
+  bool sync_normal = false;
+  int wal_autocheckpoint = 1000; // WAL pages between checkpoints
+
+  // Low memory: a small heap cache, reads served from the OS page cache
+  // through a modest map (those pages can be reclaimed), a short WAL.
+  static OpenOptions phone();
+  static OpenOptions desktop();
+  // Large cache and map, larger pages for new files, fewer checkpoints.
+  static OpenOptions server();
+};
+
+// Options for EventStore::replay.
+struct ReplayOptions {
+  std::size_t batch_events = 20000; // events applied per transaction
+  bool verify_only = false; // diff against the live tables, change nothing
+  std::size_t max_reported_diffs = 20;
+};
+
+// Outcome of a replay. Diff ids are "<entity_type>:<id>".
+struct ReplayReport {
+  long long events = 0;    // events streamed
+  long long applied = 0;   // events applied to an entity table
+  long long skipped = 0;   // unknown entity type/op or undecodable payload
+  long long rows = 0;      // rows in the rebuilt task table
+  long long budget_rows = 0; // rows in the rebuilt budget_tx / budget_limit
+  long long mismatches = 0; // verify mode: rows that differ from live
+  std::vector<std::string> diff_ids;
+  double seconds = 0;
+  double events_per_sec = 0;
+};
+
+// Thread safety: every method may be called from any thread. Mutations
+// are serialized on the writer connection. Reads share that connection
+// (and its lock) unless setReaderPool() gave them connections of their own.
 class EventStore {
 public:
   EventStore();
@@ -36,19 +221,154 @@ public:
   EventStore(const EventStore &) = delete;
   EventStore &operator=(const EventStore &) = delete;
 
-  // Open or create the database file; ensures schema exists.
-  // Returns empty string on success; otherwise error message.
-  std::string open(const std::string &db_path);
+  // Open or create the database file; ensures schema exists. A database
+  // already at kSchemaVersion opens without running any DDL; an older one
+  // is migrated in order first, and one written by a newer build is
+  // refused. `options` also applies to reader pool connections. Returns
+  // empty string on success; otherwise error message.
+  std::string open(const std::string &db_path,
+                   const OpenOptions &options = OpenOptions());
+
+  // Serve since/scanSince*, getTaskId/viewTask and the listTasks family
+  // from `readers` read-only connections, so they run in parallel with
+  // each other and with an open write transaction. 0 closes the pool and
+  // routes reads back to the writer connection. Needs a database file (not
+  // ":memory:"); call before the store is shared between threads. Returns
+  // empty string on success; otherwise error message.
+  std::string setReaderPool(std::size_t readers);
+  std::size_t readerPoolSize() const;
 
   // Append one event; returns new seq (>=1) or negative error code.
   long long append(const DeltaEvent &ev);
 
+  // Append all events in one transaction (one fsync for the whole batch).
+  // Seqs are contiguous and reported in out_range. Returns the last seq
+  // (0 for an empty batch) or a negative error code, in which case nothing
+  // was written.
+  long long appendBatch(const DeltaEvent *events, std::size_t count,
+                        SeqRange &out_range);
+  long long appendBatch(const std::vector<DeltaEvent> &events,
+                        SeqRange &out_range);
+
   // Return events with seq > since_seq (ascending).
   // On error, returns empty vector and sets out_error.
   std::vector<DeltaEvent> since(long long since_seq,
                                 std::string &out_error) const;
 
+  // Stream events with seq > since_seq (ascending) to `visit`, stopping at
+  // the budget. Memory use is one row regardless of log size. Always
+  // delivers at least one row if any remain, so paging makes progress.
+  // Returns false and sets out_error on failure.
+  bool scanSince(long long since_seq, const ReadBudget &budget,
+                 const EventVisitor &visit, ReadCursor &out_cursor,
+                 std::string &out_error) const;
+
+  // scanSince without copies: each row is handed over as a view.
+  bool scanSinceView(long long since_seq, const ReadBudget &budget,
+                     const EventViewVisitor &visit, ReadCursor &out_cursor,
+                     std::string &out_error) const;
+
+  // Events of one entity with seq > after_seq, ascending, paged like
+  // scanSince: pass out_cursor.next_seq back as after_seq. Seeks
+  // idx_event_log_entity, so the cost follows the entity's events, not the
+  // log. Compaction leaves one event per entity at or below its checkpoint.
+  bool entityHistory(const std::string &entity_type,
+                     const std::string &entity_id, long long after_seq,
+                     const ReadBudget &budget, const EventVisitor &visit,
+                     ReadCursor &out_cursor, std::string &out_error) const;
+
+  // Events with ts_from <= ts < ts_to in (ts, seq) order, from
+  // idx_event_log_ts. `after` is the previous page's cursor, ReadCursor{}
+  // for the first page (it may be the same object as out_cursor).
+  bool range(long long ts_from, long long ts_to, const ReadCursor &after,
+             const ReadBudget &budget, const EventVisitor &visit,
+             ReadCursor &out_cursor, std::string &out_error) const;
+
+  // ---- Compaction -------------------------------------------------------
+  //
+  // A checkpoint at seq C turns the log at or below C into a snapshot:
+  // compaction keeps only the newest event per (entity_type, entity_id)
+  // with seq <= C and never touches events above C. For the entities
+  // replay rebuilds (task, budget_tx, budget_limit) the kept event's
+  // payload becomes the whole row as the dropped events left it, other
+  // fields included; a deleted task keeps its delete event, carrying the
+  // row with status "deleted". since(0) then returns the snapshot followed
+  // by the live tail, and replay or a peer rebuilds the same rows from it.
+  // A peer that already synced to some 0 < since_seq < C may have missed
+  // dropped events; reads for it fail with the error "snapshot required"
+  // and the peer re-syncs from 0.
+
+  // Set the checkpoint to `checkpoint_seq` (at least the current one, at
+  // most the newest seq). Raising it restarts compaction from the start.
+  bool beginCompaction(long long checkpoint_seq, std::string &out_error);
+
+  // Compact the next window of at most `max_rows` seqs below the
+  // checkpoint in one short transaction, so writers are blocked only
+  // briefly. Call until out_progress.done.
+  bool compactStep(std::size_t max_rows, CompactionProgress &out_progress,
+                   std::string &out_error);
+
+  // Current checkpoint seq (0 if none) and whether a peer at since_seq
+  // must re-sync from a snapshot.
+  long long checkpointSeq() const { return checkpoint_seq_; }
+  bool snapshotRequired(long long since_seq) const {
+    return since_seq > 0 && since_seq < checkpoint_seq_;
+  }
+
+  // ---- Replay -----------------------------------------------------------
+  //
+  // Rebuild the entity tables (`task` and the budget tables) from
+  // event_log. Events stream in seq order and are applied to scratch
+  // tables in transactions of options.batch_events, so memory stays
+  // bounded. Upsert payloads supply the row: title, assignees, due_at,
+  // points, status and visibility_tag fields overwrite the previous values
+  // and absent fields keep them; the event ts becomes updated_at. An
+  // upsertTask event replays to the row upsertTask wrote, whatever its
+  // payload; any other upsert (from append or a peer) that finds no row
+  // starts one from the column defaults. A delete soft-deletes the row,
+  // like deleteTask; a compacted one that finds no row creates it from the
+  // row it carries. Budget events fold the same way (see Budget below), and
+  // budget_month is recomputed from the replayed budget_tx rows.
+  //
+  // Rebuild mode swaps the result in for the live tables in one
+  // transaction. Verify mode leaves the live tables alone and reports the
+  // rows that differ, budget_month totals as "budget_month:<category>@<month>".
+  bool replay(const ReplayOptions &options, ReplayReport &out_report,
+              std::string &out_error);
+
+  // Encode every event with seq > since_seq into one compressed,
+  // self-describing bundle (see DeltaBundle.h). Returns false and sets
+  // out_error on failure.
+  bool exportDelta(long long since_seq, std::string &out_bundle,
+                   std::string &out_error) const;
+
+  // Decode a bundle and merge its events through ingestRemote, as local
+  // writes (origin ""): task events update the task table, last writer
+  // wins, and an event already imported (same type, id, op, ts and
+  // payload) is dropped. Applied events get new local seqs, reported in
+  // out_range; their ts and payload are kept. Returns the last applied seq
+  // (0 if none) or a negative code; -8 means the bundle did not decode.
+  // Nothing is written on failure.
+  long long importDelta(std::string_view bundle, SeqRange &out_range,
+                        std::string &out_error);
+
+  // Merge a batch of events from other devices, last writer wins. Events
+  // whose remote_id was ingested before are dropped, so a batch can be
+  // delivered again safely. A task event applies only if its (ts, origin)
+  // is later than the task row's (updated_at, origin); local writes have
+  // origin "". The batch is sorted by entity and merged against the task
+  // table in one forward pass, and each task's winners are folded into
+  // its row as replay folds them, in (ts, origin) order. Other entity
+  // types are appended in that order after dedup. All in one transaction.
+  // Returns the last applied seq (0 if none) or a negative code: -4 for an
+  // event without remote_id, entity_type or entity_id; nothing is written
+  // on failure.
+  long long ingestRemote(const std::vector<RemoteEvent> &batch,
+                         IngestReport &out_report);
+
   // Insert or update a task row and append a matching event_log record.
+  // The event logs `payload_json` as given; the row written is recorded
+  // beside it (task_event_row) for replay.
   // Returns the event_log seq (>=1) on success; negative on error.
   long long upsertTask(const std::string &id, const std::string &title,
                        const std::string &assignees_csv, long long due_at,
@@ -57,6 +377,64 @@ public:
                        long long updated_at_millis,
                        const std::string &payload_json);
 
+  // Bulk upsertTask: every row and its event in one transaction, all or
+  // nothing. Same return convention as appendBatch.
+  long long upsertTasks(const std::vector<TaskUpsert> &tasks,
+                        SeqRange &out_range);
+
+  // ---- Asynchronous writes ----------------------------------------------
+  //
+  // The *Async methods queue a write and return at once. A background
+  // writer thread (started on first use) drains the queue and commits the
+  // writes that arrived within options.max_delay_micros of each other, up
+  // to options.max_batch, in one transaction: one fsync for many edits.
+  // Writes commit in the order they were queued. Each future yields what
+  // the synchronous method would have returned, and only once the write is
+  // durable. If one write in a group fails, the group is retried one
+  // transaction per write, so only that write reports the error.
+  //
+  // Synchronous writes are not ordered against queued ones; call flush()
+  // first when mixing them.
+  void setWriteQueueOptions(const WriteQueueOptions &options);
+  std::future<long long> appendAsync(DeltaEvent ev);
+  std::future<long long> upsertTaskAsync(TaskUpsert task);
+  std::future<long long> deleteTaskAsync(std::string id, long long ts_millis,
+                                         std::string payload_json);
+  // Durability barrier: blocks until every write queued before the call
+  // has committed (or failed).
+  void flush();
+
+  // Optional in-memory LRU cache in front of getTaskId/viewTask, bounded by
+  // an estimated memory budget (0 disables and frees it). Writes are
+  // applied to the cache only after their transaction commits.
+  void setTaskCacheBudget(std::size_t budget_bytes);
+  TaskCacheStats taskCacheStats() const;
+
+  // Task reminders (see DueScheduler.h). enableDueScheduler loads every
+  // open task with a due_at from idx_task_due, O(open tasks), and marks
+  // them pending; from then on each committed write updates the scheduler
+  // in O(log n) instead of reloading it. Calling it again reloads.
+  // nextDue / drainDue return nothing while the scheduler is disabled.
+  std::string enableDueScheduler();
+  void disableDueScheduler();
+  std::vector<DueTask> nextDue(long long now, std::size_t n) const;
+  std::vector<DueTask> drainDue(long long now);
+
+  // How new payloads are stored. With Binary, flat JSON objects are
+  // re-encoded with payload::encodeBinary on write (anything else is kept
+  // as JSON). Readers accept both: the owning read APIs (since, scanSince)
+  // always return JSON, while view APIs expose the stored bytes — use
+  // payload::decode / payload::toJson on DeltaEventView::payload.
+  void setPayloadFormat(PayloadFormat format) { payload_format_ = format; }
+  PayloadFormat payloadFormat() const { return payload_format_; }
+
+  // Operation counts and latency percentiles, bytes written and rows
+  // scanned since open (or the last resetStats). Cheap enough to leave on;
+  // build with -DTOGETHER_METRICS=OFF to compile the instrumentation out,
+  // in which case stats().enabled is false.
+  StoreStats stats() const;
+  void resetStats();
+
   static const char *version();
 
   long long deleteTask(const std::string &id, long long ts_millis,
@@ -69,11 +447,349 @@ public:
   std::vector<TaskRow> listTasks(const std::string &status_filter, int limit,
                             int offset, std::string &out_error) const;
 
+  // View-based variants of getTaskId / listTasks: no per-row allocation.
+  // viewTask returns false with out_error "not found" if the id is absent.
+  // forEachTask stops early when the visitor returns false.
+  bool viewTask(const std::string &id,
+                const std::function<void(const TaskRowView &)> &visit,
+                std::string &out_error) const;
+  bool forEachTask(const std::string &status_filter, int limit, int offset,
+                   const TaskViewVisitor &visit,
+                   std::string &out_error) const;
+
+  // Keyset-paginated listTasks, newest first (updated_at DESC, id DESC).
+  // Pass an empty page_token for the first page, then the returned
+  // out_next_token for each following page; it comes back empty after the
+  // last page. Every page is an index seek, so deep pages cost the same as
+  // the first.
+  std::vector<TaskRow> listTasksPage(const std::string &status_filter,
+                                     int limit, const std::string &page_token,
+                                     std::string &out_next_token,
+                                     std::string &out_error) const;
+  bool forEachTaskPage(const std::string &status_filter, int limit,
+                       const std::string &page_token,
+                       const TaskViewVisitor &visit,
+                       std::string &out_next_token,
+                       std::string &out_error) const;
+
+  // A member's tasks, paged exactly like listTasksPage: the tasks whose
+  // assignees_csv names member_id (entries match as written, like the
+  // custom_list check). Served by the task_assignee index, so a page reads
+  // only that member's rows. member_id must be non-empty.
+  std::vector<TaskRow> listTasksForMember(const std::string &member_id,
+                                          const std::string &status_filter,
+                                          int limit,
+                                          const std::string &page_token,
+                                          std::string &out_next_token,
+                                          std::string &out_error) const;
+  bool forEachTaskForMember(const std::string &member_id,
+                            const std::string &status_filter, int limit,
+                            const std::string &page_token,
+                            const TaskViewVisitor &visit,
+                            std::string &out_next_token,
+                            std::string &out_error) const;
+
+  // ---- Recurrence -------------------------------------------------------
+  //
+  // A recurring calendar event or chore is a single entity whose latest
+  // upsert payload carries the series as an "rrule" string field
+  // (Recurrence::encode): the rule plus its overrides, never expanded
+  // occurrences. Compaction keeps an entity's latest event, so the series
+  // survives it. Write the series with any upsert (append, upsertTask);
+  // expand it with Recurrence::occurrences.
+  //
+  // getRecurrence reads the entity's latest event; out_error is "not
+  // found" if there is none or it is a delete, and names the problem if
+  // the payload has no valid rrule.
+  bool getRecurrence(const std::string &entity_type,
+                     const std::string &entity_id, Recurrence &out,
+                     std::string &out_error) const;
+  // Cancel or move one occurrence: appends an upsert repeating the latest
+  // payload with the override added to its rrule, in one transaction.
+  // Returns the new seq, -3 if there is no series and -4 if
+  // change.original is not one of its occurrences.
+  long long overrideOccurrence(const std::string &entity_type,
+                               const std::string &entity_id,
+                               const RecurrenceOverride &change,
+                               long long ts_millis);
+
+  // ---- Budget -----------------------------------------------------------
+  //
+  // budget_tx events are household transactions: payload amount_cents
+  // (spending is negative), category, and month as YYYYMM or "YYYY-MM"
+  // (absent: the UTC month of the event ts). budget_limit events set a
+  // category's envelope from a month on: category, month, amount_cents
+  // (the limit) and rollover (default true). Every write path that appends
+  // one (append, appendBatch, appendAsync, importDelta) also folds it into
+  // the budget_tx / budget_limit rows, as replay would, and updates the
+  // per-category-per-month totals in budget_month, in the same
+  // transaction. A delete removes the entity's row.
+  //
+  // With rollover, what remains of a month's envelope (limit + carry_in +
+  // net, negative when overspent) carries into the next month. The carry
+  // is computed the first time a month is read and kept in budget_month
+  // until a write to an earlier month of the category clears it.
+
+  // Append a budget_limit event for (category, month); entity id
+  // "<category>@<month>". Returns the seq, or -4 for an empty category or
+  // a month that is not YYYYMM; otherwise as append.
+  long long setBudgetLimit(const std::string &category, int month,
+                           long long limit_cents, bool rollover,
+                           long long ts_millis);
+
+  // Envelopes for `month` (YYYYMM), by category: every category with a
+  // limit in force or a transaction that month. Reads one budget_month row
+  // and one budget_limit seek per category, whatever the number of
+  // transactions; writes only to cache carries not computed yet.
+  bool budgetSummary(int month, std::vector<BudgetEnvelope> &out,
+                     std::string &out_error);
+
+  // ---- Change subscriptions ---------------------------------------------
+  //
+  // A tailer subscribes to the entity types it follows (empty: all of them)
+  // instead of polling since(). After each commit that wrote any of them it
+  // gets one ChangeNotice with the seqs the commit added; rolled back
+  // writes notify nothing. Every write path notifies: append, appendBatch,
+  // the task writes, the write queue, importDelta, and the recurrence and
+  // budget helpers. Notices are delivered in commit order on the writing
+  // thread, before the write returns.
+  //
+  // A callback runs under the writer lock, so it should be quick; it may
+  // use the store, and a write it makes notifies once that write commits.
+  // A ChangeRing hands notices to another thread without ever blocking the
+  // writer; when it overflows, the consumer reads the gap with since().
+  // Returns 0 for an empty callback or ring.
+  using SubscriptionId = unsigned long long;
+  SubscriptionId subscribe(std::vector<std::string> entity_types,
+                           ChangeCallback on_change);
+  SubscriptionId subscribe(std::vector<std::string> entity_types,
+                           std::shared_ptr<ChangeRing> ring);
+  // No notice is delivered once this returns. Called from a callback, the
+  // notice being delivered still reaches the other subscribers.
+  void unsubscribe(SubscriptionId id);
+
+  // ---- Role-scoped reads ------------------------------------------------
+  //
+  // The reads above as seen by one household member (docs/PERMISSIONS.md,
+  // visibility::canSeeTask / canSeeEvent). The role's visible tags are
+  // compiled into a vis_mask IN (...) predicate that seeks the vis_mask
+  // indexes, so a Child or Guest query touches only rows it can return.
+  // member_id is matched against assignees_csv for custom_list tasks.
+  // Owner gets the unscoped queries.
+  std::vector<TaskRow> listTasks(Role role, const std::string &member_id,
+                                 const std::string &status_filter, int limit,
+                                 int offset, std::string &out_error) const;
+  bool forEachTask(Role role, const std::string &member_id,
+                   const std::string &status_filter, int limit, int offset,
+                   const TaskViewVisitor &visit, std::string &out_error) const;
+  std::vector<DeltaEvent> since(Role role, long long since_seq,
+                                std::string &out_error) const;
+  bool scanSince(Role role, long long since_seq, const ReadBudget &budget,
+                 const EventVisitor &visit, ReadCursor &out_cursor,
+                 std::string &out_error) const;
+  bool scanSinceView(Role role, long long since_seq, const ReadBudget &budget,
+                     const EventViewVisitor &visit, ReadCursor &out_cursor,
+                     std::string &out_error) const;
+
 private:
+  // Hot-path statements, compiled once in open() (see kStmtSql).
+  enum Stmt : std::size_t {
+    kBegin,
+    kCommit,
+    kRollback,
+    kAppendEvent,
+    kSinceEvents,
+    kGetTask,
+    kUpsertTask,
+    kDeleteTask,
+    kListTasks,
+    kListTasksByStatus,
+    kListTasksAfter,
+    kListTasksByStatusAfter,
+    kInternCode,
+    kCodeByName,
+    kCodeName,
+    kTaskVisMask,
+    kClearAssignees,
+    kAddAssignee,
+    kDeleteAssignees,
+    kMemberTasks,
+    kMemberTasksByStatus,
+    kMemberTasksAfter,
+    kMemberTasksByStatusAfter,
+    kDueTasks,
+    kLatestEvent,
+    kBudgetTxRow,
+    kBudgetTxUpsert,
+    kBudgetTxDelete,
+    kBudgetLimitRow,
+    kBudgetLimitUpsert,
+    kBudgetLimitDelete,
+    kBudgetMonthAdd,
+    kBudgetCarryReset,
+    kBudgetCarrySet,
+    kBudgetSummary,
+    kIngestTaskRows,
+    kRemoteSeen,
+    kRemoteSeq,
+    kEntityHistory,
+    kTsRange,
+    kTaskEventRow,
+    kStmtCount
+  };
+
+  // PRAGMA user_version written by initSchema. 2: event_log stores
+  // event_dict codes instead of entity_type / op text. 3: task and
+  // event_log carry vis_mask (see Visibility.h). 4: task_assignee.
+  // 5: budget_tx, budget_limit and budget_month. 6: task.origin and
+  // remote_event. 7: idx_event_log_ts replaces idx_event_log_seq.
+  // 8: task_event_row.
+  static constexpr int kSchemaVersion = 8;
+
   sqlite3 *db_ = nullptr;
+  std::string db_path_;
+  OpenOptions open_options_;
+  mutable StatementCache stmts_;
+
+  // Serializes the writer connection: every mutation, and reads when there
+  // is no reader pool. Recursive because composite operations (replay,
+  // importDelta) call other public methods.
+  mutable std::recursive_mutex write_mu_;
+  std::unique_ptr<ReaderPool> readers_;
+
+  // Connection a read runs on (see EventStore.cpp).
+  class ReadScope;
+
+  // Asynchronous write queue (see WriteQueue.cpp).
+  struct QueuedWrite {
+    enum class Kind { Append, Upsert, Delete, Flush };
+    Kind kind = Kind::Flush;
+    // Flush: monostate. Append: the event; Delete uses its entity_id,
+    // payload and ts. Upsert: the task.
+    std::variant<std::monostate, DeltaEvent, TaskUpsert> op;
+    std::promise<long long> done;
+  };
+  WriteQueueOptions queue_options_;
+  std::mutex queue_mu_;
+  std::condition_variable queue_cv_;
+  std::deque<QueuedWrite> queue_;
+  std::size_t queued_flushes_ = 0; // Flush entries in queue_
+  bool queue_stop_ = false;
+  std::thread queue_thread_;
+
+  // Task cache and due scheduler, plus the writes of the open transaction,
+  // applied to both on commit and discarded on rollback.
+  struct PendingCacheWrite {
+    TaskRow row;          // full row for an upsert; row.id for a delete
+    bool deleted = false; // soft delete at row.updated_at
+  };
+  // Readers fill the cache on a miss; cache_generation_ moves on every
+  // committed write, and a fill is dropped if it did, so a row read before
+  // a commit never replaces the committed one.
+  mutable std::mutex cache_mu_;
+  mutable std::unique_ptr<TaskCache> task_cache_;
+  unsigned long long cache_generation_ = 0;
+  std::vector<PendingCacheWrite> pending_cache_;
+  mutable std::mutex due_mu_; // after write_mu_ when both are held
+  std::unique_ptr<DueScheduler> due_;
+
+  // Change subscriptions (see ChangeFeed.cpp). The list is replaced, never
+  // modified, so publishing can iterate it while a callback subscribes.
+  // pending_changes_ holds the events of the open transaction while there
+  // are subscribers.
+  struct Subscriber {
+    SubscriptionId id = 0;
+    std::vector<std::string> entity_types;
+    ChangeCallback callback;
+    std::shared_ptr<ChangeRing> ring;
+  };
+  struct PendingChange {
+    long long seq = 0;
+    long long type_code = 0;
+  };
+  std::shared_ptr<const std::vector<Subscriber>> subscribers_; // null: none
+  SubscriptionId last_subscription_ = 0;
+  std::vector<PendingChange> pending_changes_;
 
-  // Create tables/indexes. Empty string on success, else error message.
-  std::string initSchema();
+  // event_log stores entity_type / op as event_dict codes (schema v2).
+  std::unique_ptr<EventCodes> codes_;
+
+  PayloadFormat payload_format_ = PayloadFormat::Json;
+  std::string payload_scratch_; // encode buffer reused across writes
+
+  // Compaction state, mirrored from the log_checkpoint table.
+  std::atomic<long long> checkpoint_seq_{0}; // read by pooled readers
+
+  std::unique_ptr<StoreMetrics> metrics_; // null unless TOGETHER_METRICS
+  long long compacted_through_ = 0;
+
+  std::future<long long> enqueue(QueuedWrite &&w);
+  void runWriteQueue();
+  void commitQueued(std::vector<QueuedWrite> &batch);
+  void stopWriteQueue();
+
+  std::string loadCheckpoint();
+  std::string loadDueTasks(std::vector<DueTask> &out);
+  bool execSql(const char *sql, std::string &out_error);
+
+  std::string prepareStatements();
+  bool beginImmediate();
+  bool commit();
+  void rollback();
+  SubscriptionId addSubscriber(std::vector<std::string> entity_types,
+                               ChangeCallback callback,
+                               std::shared_ptr<ChangeRing> ring);
+  void publishChanges();
+  bool writeTaskRow(std::string_view id, std::string_view title,
+                    std::string_view assignees_csv, long long due_at,
+                    int points, std::string_view status,
+                    std::string_view visibility_tag, long long updated_at,
+                    std::string_view origin = "");
+  long long upsertTaskInTxn(std::string_view id, std::string_view title,
+                            std::string_view assignees_csv, long long due_at,
+                            int points, std::string_view status,
+                            std::string_view visibility_tag,
+                            long long updated_at,
+                            std::string_view payload_json);
+  long long deleteTaskInTxn(std::string_view id, long long ts_millis,
+                            std::string_view payload_json);
+  long long insertEvent(std::string_view entity_type,
+                        std::string_view entity_id, std::string_view op,
+                        std::string_view payload, long long ts,
+                        unsigned vis_mask = 0);
+  unsigned eventVisMask(std::string_view entity_type,
+                        std::string_view entity_id, std::string_view payload);
+  bool applyBudgetEvent(std::string_view entity_type,
+                        std::string_view entity_id, std::string_view op,
+                        std::string_view payload, long long ts);
+  bool budgetCarryIn(std::string_view category, int month,
+                     long long &out_carry);
+  bool snapshotWindow(long long lo, long long hi, std::string &out_error);
+  long long ingestBatch(const std::vector<RemoteEvent> &batch, bool keep_order,
+                        IngestReport &out_report);
+
+  // Create tables/indexes and migrate a database below kSchemaVersion.
+  // Empty string on success, else error message.
+  std::string initSchema(int version);
+  // Bring an older database up to kSchemaVersion (see Migration.cpp).
+  std::string migrateSchema(int from_version);
+  std::string migrateEventLogToV2();
+  std::string addVisibilityMasks();
+  std::string backfillTaskAssignees();
+  std::string backfillBudget();
+  std::string addTaskOrigins();
+
+  // The row loop of the event_log reads: steps `st` (seq, type_code,
+  // entity_id, op_code, payload_blob, ts) into `visit` within the budget,
+  // advancing `cursor`. `code_name` is kCodeName on the same connection.
+  bool streamEvents(sqlite3_stmt *st, sqlite3_stmt *code_name,
+                    const ReadBudget &budget, const EventViewVisitor &visit,
+                    ReadCursor &cursor, std::string &out_error) const;
+
+  bool pageTasks(std::string_view member_id, const std::string &status_filter,
+                 int limit, const std::string &page_token,
+                 const TaskViewVisitor &visit, std::string &out_next_token,
+                 std::string &out_error) const;
 };
 
 } // namespace together
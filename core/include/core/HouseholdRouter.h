@@ -0,0 +1,148 @@
+#pragma once
+// One EventStore shard per household behind a bounded pool of open handles.
+#include "core/EventStore.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace together {
+
+struct RouterOptions {
+  std::string directory;      // shard files: <directory>/<household>.db
+  std::size_t max_open = 64;  // open shards; idle ones close LRU first
+  // Shards unused this long are closed by a background sweep; 0 keeps
+  // them open until evicted.
+  std::chrono::milliseconds idle_timeout{60000};
+  std::size_t fan_out_threads = 4; // pool threads for fanOut
+  OpenOptions open;                // tuning profile of every shard
+  // Called on each shard after it opens (reader pool, task cache, ...); a
+  // non-empty return fails the open.
+  std::function<std::string(EventStore &)> configure;
+};
+
+// Routes each household to its own database file, so households never
+// wait on each other's writes: write throughput grows with the number of
+// active households rather than being serialized by one SQLite writer.
+//
+// Shards open on first use and stay open while leased or recently used.
+// At max_open, acquiring a new household closes the least recently used
+// unleased shard, or blocks until one is released. A thread that already
+// holds a lease opens past the bound instead of waiting, so nested leases
+// (a fan-out visitor reading a second household) cannot deadlock; the
+// extra shard closes once the pool is back under the bound. Thread-safe.
+class HouseholdRouter {
+  struct Shard;
+  struct Workers;
+
+public:
+  explicit HouseholdRouter(RouterOptions options);
+  // Closes every shard. No lease may be outstanding.
+  ~HouseholdRouter();
+
+  HouseholdRouter(const HouseholdRouter &) = delete;
+  HouseholdRouter &operator=(const HouseholdRouter &) = delete;
+
+  // Shared use of one household's store until destroyed; the shard is not
+  // closed while any lease on it is held. A lease may be moved to and
+  // released on another thread; until then, the thread that acquired it
+  // keeps opening past the bound (see acquire).
+  class Lease {
+  public:
+    Lease() = default;
+    Lease(Lease &&other) noexcept;
+    Lease &operator=(Lease &&other) noexcept;
+    ~Lease() { reset(); }
+
+    explicit operator bool() const { return shard_ != nullptr; }
+    EventStore &operator*() const;
+    EventStore *operator->() const { return &**this; }
+    const std::string &household() const;
+
+  private:
+    friend class HouseholdRouter;
+    HouseholdRouter *router_ = nullptr;
+    Shard *shard_ = nullptr;
+    std::thread::id holder_; // the thread counted in router_->holders_
+
+    void reset();
+  };
+
+  // Lease the household's shard, opening (and creating) it if needed.
+  // Household ids are 1-64 characters of [A-Za-z0-9_-]. On failure the
+  // lease is empty and out_error is set.
+  Lease acquire(const std::string &household, std::string &out_error);
+
+  // Run visit(household, store) for every household, up to
+  // fan_out_threads + 1 at a time: the calling thread takes items too, so
+  // a visitor may fan out again. Returns once all have run. Returns empty
+  // string on success; otherwise "<household>: <error>" for the failed
+  // open earliest in `households` (the others still run).
+  using ShardVisitor =
+      std::function<void(const std::string &household, EventStore &store)>;
+  std::string fanOut(const std::vector<std::string> &households,
+                     const ShardVisitor &visit);
+
+  // Households with a shard file in the directory, sorted.
+  std::vector<std::string> households(std::string &out_error) const;
+
+  // Close the unleased shards unused for idle_timeout (every unleased
+  // shard if it is 0). Returns how many were closed.
+  std::size_t closeIdle();
+
+  std::size_t openShards() const;
+  unsigned long long opens() const; // shard opens since construction
+  unsigned long long waits() const; // acquisitions that waited for a slot
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Shard {
+    std::string household;
+    EventStore store;
+    std::size_t leases = 0;
+    bool ready = false; // open finished; until then other acquirers wait
+    Clock::time_point last_used;
+  };
+
+  RouterOptions options_;
+  mutable std::mutex mu_;
+  std::condition_variable cv_; // a shard became ready, released or closed
+  std::unordered_map<std::string, std::unique_ptr<Shard>> shards_;
+  // Households whose evicted shard is still closing: reopening waits, so
+  // no two connections to one file write at the same time.
+  std::unordered_set<std::string> closing_;
+  // Per thread, the leases it acquired and the nested fan-out work it
+  // runs. A thread listed here opens past max_open instead of waiting
+  // for a slot its own caller may be holding.
+  std::unordered_map<std::thread::id, std::size_t> holders_;
+  unsigned long long opens_ = 0;
+  unsigned long long waits_ = 0;
+
+  std::unique_ptr<Workers> workers_;
+  std::thread sweeper_;
+  std::condition_variable sweep_cv_;
+  bool stopping_ = false;
+
+  // Unleased shards to close, oldest first, until the pool holds at most
+  // `limit`; or those idle since before `idle_before`. Caller holds mu_
+  // and passes the returned shards to closeShards after releasing it.
+  std::vector<std::unique_ptr<Shard>> takeEvictable(std::size_t limit);
+  std::vector<std::unique_ptr<Shard>> takeIdle(Clock::time_point idle_before);
+  void closeShards(std::vector<std::unique_ptr<Shard>> &shards);
+  // Count (or uncount) work on `thread` that must not wait. Caller holds
+  // mu_.
+  void hold(std::thread::id thread, bool add);
+  void release(Shard *shard, std::thread::id holder);
+  void sweepLoop();
+};
+
+} // namespace together
@@ -0,0 +1,63 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace together {
+
+// Lock-free latency histogram over nanoseconds. Values below 16 ns get a
+// bucket each; above that every power of two is split into four buckets,
+// so a reported percentile is within 12.5% of the true value. record() is
+// a few relaxed atomic adds and may be called from any thread.
+class LatencyHistogram {
+public:
+  static constexpr std::size_t kBuckets = 256;
+
+  void record(std::uint64_t nanos);
+  void reset();
+
+  std::uint64_t count() const;
+  std::uint64_t totalNanos() const;
+  std::uint64_t maxNanos() const;
+  // Approximate value at quantile q in [0, 1] (bucket midpoint); 0 when
+  // empty. Concurrent records may or may not be included.
+  std::uint64_t percentileNanos(double q) const;
+
+  static std::size_t bucketOf(std::uint64_t nanos);
+  static std::uint64_t bucketLow(std::size_t bucket);
+
+private:
+  std::array<std::atomic<std::uint64_t>, kBuckets> buckets_{};
+  std::atomic<std::uint64_t> total_{0};
+  std::atomic<std::uint64_t> max_{0};
+};
+
+// Snapshot of one instrumented EventStore operation.
+struct OpLatencyStats {
+  const char *op = "";
+  std::uint64_t count = 0;
+  double total_ms = 0;
+  double p50_us = 0;
+  double p99_us = 0;
+  double p999_us = 0;
+  double max_us = 0;
+};
+
+// EventStore::stats() result. `enabled` is false when the library was built
+// without TOGETHER_METRICS; everything else is then zero.
+//
+// `commit` times COMMIT alone (the fsync), so a slow write operation whose
+// commit is fast is spending its time in statement steps.
+struct StoreStats {
+  bool enabled = false;
+  std::vector<OpLatencyStats> ops; // append, appendBatch, ..., commit
+  std::uint64_t payload_bytes_written = 0; // stored payload_blob bytes
+  std::uint64_t events_scanned = 0;        // rows read from event_log
+  std::uint64_t task_rows_scanned = 0;     // rows read by listTasks family
+  std::uint64_t rollbacks = 0;             // failed write transactions
+  std::uint64_t statements_prepared = 0;   // ad-hoc statement cache misses
+};
+
+} // namespace together
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace together {
+
+// Storage format for event_log.payload_blob.
+enum class PayloadFormat {
+  Json,   // caller's JSON text, stored as-is
+  Binary, // compact tagged encoding (see payload::encodeBinary)
+};
+
+// One member of a flat payload object.
+struct PayloadField {
+  enum class Kind : std::uint8_t { Null, Bool, Int, Double, String };
+
+  std::string name;
+  Kind kind = Kind::Null;
+  bool b = false;
+  long long i = 0;
+  double d = 0;
+  std::string s;
+};
+using PayloadFields = std::vector<PayloadField>;
+
+// Payload codec for flat JSON objects ({"k": string|number|bool|null}).
+//
+// Binary layout:
+//   0x00 <version=1> <dict id>           header; JSON never starts with NUL
+//   { varint(tag << 3 | wire) [name] value }*
+// Known field names for the entity type's dictionary are written as small
+// tags; tag 0 is followed by the name inline. Wire types: 0 zigzag varint,
+// 1 little-endian double, 2 varint length + bytes, 3 false, 4 true, 5 null.
+namespace payload {
+
+// True if `blob` carries the binary format marker.
+bool isBinary(std::string_view blob);
+
+// Parse a flat JSON object. Returns false for anything else (nested
+// values, trailing garbage), leaving `out` unspecified.
+bool parseJson(std::string_view json, PayloadFields &out);
+// Compact JSON text for `fields`, in order.
+std::string toJson(const PayloadFields &fields);
+
+// Encode using the dictionary for `entity_type` ("task", "event",
+// "budget_tx"; anything else uses inline names only).
+void encodeBinary(std::string_view entity_type, const PayloadFields &fields,
+                  std::string &out);
+bool decodeBinary(std::string_view blob, PayloadFields &out);
+
+// Format-agnostic helpers used by readers.
+bool decode(std::string_view blob, PayloadFields &out);
+// JSON text for a payload in either format. Binary payloads that fail to
+// decode, and JSON input, are returned unchanged.
+std::string toJson(std::string_view blob);
+// Binary encoding of a JSON payload; false if it is not a flat object.
+bool jsonToBinary(std::string_view entity_type, std::string_view json,
+                  std::string &out);
+
+} // namespace payload
+} // namespace together
@@ -0,0 +1,91 @@
+#pragma once
+#include "core/StatementCache.h"
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct sqlite3; // forward-declare
+
+namespace together {
+
+// Fixed set of read-only connections to one database file, lent to one
+// thread at a time.
+//
+// Each connection prepares its own copy of the read statements, in the
+// same slots the writer's StatementCache uses. With the database in WAL
+// mode readers see the last committed state and never wait for the writer
+// or for each other, so read throughput scales with the pool size.
+class ReaderPool {
+  struct Reader;
+
+public:
+  // A statement every reader prepares: (slot, sql).
+  using StmtSpec = std::pair<std::size_t, const char *>;
+
+  ReaderPool() = default;
+  ~ReaderPool();
+
+  ReaderPool(const ReaderPool &) = delete;
+  ReaderPool &operator=(const ReaderPool &) = delete;
+
+  // Open `readers` connections to `db_path`, run `pragmas` (connection
+  // tuning) and prepare `stmts` on each. Returns empty string on success;
+  // otherwise error message (and the pool is left empty).
+  std::string open(const std::string &db_path, std::size_t readers,
+                   const std::vector<StmtSpec> &stmts,
+                   const std::string &pragmas = std::string());
+  // Close every connection. No lease may be outstanding.
+  void close();
+
+  std::size_t size() const { return readers_.size(); }
+  // Acquisitions that found every connection busy and had to wait.
+  unsigned long long waits() const;
+
+  // Exclusive use of one connection until destroyed.
+  class Lease {
+  public:
+    Lease() = default;
+    Lease(Lease &&other) noexcept;
+    Lease &operator=(Lease &&other) noexcept;
+    ~Lease() { reset(); }
+
+    explicit operator bool() const { return reader_ != nullptr; }
+    sqlite3 *db() const;
+    StatementCache &stmts() const;
+
+  private:
+    friend class ReaderPool;
+    ReaderPool *pool_ = nullptr;
+    Reader *reader_ = nullptr;
+    bool owner_ = false; // false when nested inside this thread's own lease
+    const ReaderPool *prev_pool_ = nullptr;
+    Reader *prev_reader_ = nullptr;
+
+    void reset();
+  };
+
+  // Borrow a connection, blocking while all of them are lent out. A thread
+  // that already holds a lease on this pool gets the same connection back,
+  // so nested reads (a visitor that reads again) cannot deadlock.
+  Lease acquire();
+
+private:
+  struct Reader {
+    sqlite3 *db = nullptr;
+    StatementCache stmts;
+  };
+
+  std::vector<std::unique_ptr<Reader>> readers_;
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  std::vector<Reader *> free_;
+  unsigned long long waits_ = 0;
+
+  void release(Reader *reader);
+};
+
+} // namespace together
@@ -0,0 +1,134 @@
+#pragma once
+// Recurring calendar events and chores: an RRULE-style rule plus
+// per-occurrence overrides, expanded lazily over a time window.
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace together {
+
+enum class Frequency : std::uint8_t { Daily, Weekly, Monthly };
+
+// A change to one occurrence. `original` is a start the rule generates;
+// the occurrence is dropped, or moved to `start`.
+struct RecurrenceOverride {
+  long long original = 0;
+  long long start = 0; // ignored when cancelled
+  bool cancelled = false;
+};
+
+// Subset of RFC 5545 RRULE. Times are epoch millis; the rule is evaluated
+// on the wall clock utc_offset_minutes from UTC (a fixed offset: DST
+// changes are not followed). Every occurrence starts at dtstart's time of
+// day, and dtstart itself is the first occurrence only if it matches the
+// rule.
+struct RecurrenceRule {
+  Frequency freq = Frequency::Daily;
+  int interval = 1;            // every `interval` days / weeks / months
+  long long dtstart = 0;
+  int utc_offset_minutes = 0;
+  unsigned weekdays = 0;       // Weekly: bit 0 = Monday .. bit 6 = Sunday;
+                               // 0 = dtstart's weekday
+  int month_day = 0;           // Monthly: 1..31, or -1 for the last day;
+                               // 0 = dtstart's day. Months without that
+                               // day are skipped, as in RFC 5545.
+  int count = 0;               // occurrences, before overrides; 0 = no limit
+  long long until = 0;         // latest start, inclusive; 0 = no limit
+  std::vector<RecurrenceOverride> overrides;
+};
+
+// One expanded occurrence. `original` is the start the rule generated; it
+// differs from `start` for a moved occurrence.
+struct Occurrence {
+  long long start = 0;
+  long long original = 0;
+};
+
+class Recurrence;
+
+// Occurrences starting in [from, to), in start order. Holds only a pointer
+// to the Recurrence (which must outlive it) and a few integers: next()
+// never allocates. Construction skips periods before `from` in O(1) for
+// daily and weekly rules.
+class OccurrenceIterator {
+public:
+  OccurrenceIterator(const Recurrence &series, long long from, long long to);
+
+  bool next(Occurrence &out);
+
+private:
+  const Recurrence *series_;
+  long long from_;
+  long long to_;
+
+  // Rule generator position.
+  long long period_ = 0;    // days / weeks / months since dtstart's
+  unsigned weekday_ = 0;    // Weekly: next weekday to try in the period
+  long long generated_ = 0; // occurrences generated so far (for COUNT)
+  bool rule_done_ = false;
+
+  std::size_t override_ = 0; // next override by original
+  std::size_t moved_ = 0;    // next moved occurrence by start
+
+  bool pending_ = false; // `next_` holds the next rule occurrence
+  Occurrence next_;
+
+  bool nextGenerated(long long &out);
+  bool fillRule();
+  bool movedHead(const RecurrenceOverride *&out);
+};
+
+// A validated rule. Overrides are kept sorted by original start (and
+// indexed by new start), so iteration merges them in without searching.
+class Recurrence {
+public:
+  // Validates `rule` (and that every override names an occurrence).
+  // Returns false with out_error on a bad rule.
+  static bool compile(RecurrenceRule rule, Recurrence &out,
+                      std::string &out_error);
+
+  // Text form stored in event payloads ("rrule" field), e.g.
+  // "FREQ=WEEKLY;INTERVAL=2;DTSTART=1700000000000;BYDAY=MO,WE;
+  //  EXDATE=<start>,...;MOVED=<original>><start>,...".
+  std::string encode() const;
+  static bool parse(std::string_view text, Recurrence &out,
+                    std::string &out_error);
+
+  // Add or replace the override for change.original. False if original is
+  // not an occurrence of the rule.
+  bool setOverride(const RecurrenceOverride &change, std::string &out_error);
+
+  // Whether the rule (ignoring overrides) generates `start`.
+  bool isOccurrence(long long start) const;
+
+  OccurrenceIterator occurrences(long long from, long long to) const {
+    return OccurrenceIterator(*this, from, to);
+  }
+
+  const RecurrenceRule &rule() const { return rule_; }
+
+private:
+  friend class OccurrenceIterator;
+
+  RecurrenceRule rule_;
+  std::vector<std::uint32_t> moved_; // indices of moves in overrides, by start
+
+  // Derived from dtstart on the rule's wall clock.
+  long long day0_ = 0;    // days since 1970-01-01
+  long long tod_ = 0;     // millis into the day
+  long long week0_ = 0;   // Monday-based weeks since the epoch
+  long long month0_ = 0;  // year * 12 + month - 1
+  unsigned mask_ = 0;     // Weekly: resolved weekdays
+  int mday_ = 0;          // Monthly: resolved month_day
+
+  long long dayStart(long long day) const; // epoch millis of day + tod_
+  // Occurrences generated in periods before `period` (COUNT bookkeeping).
+  long long generatedBefore(long long period) const;
+  // Day of the occurrence in a monthly period, or -1 if the month has none.
+  long long monthlyDay(long long period) const;
+  void reindex();
+};
+
+} // namespace together
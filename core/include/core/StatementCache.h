@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct sqlite3;      // forward-declare
+struct sqlite3_stmt; // forward-declare
+
+namespace together {
+
+class ScopedStmt;
+
+// Prepared statements owned by a single sqlite3 connection.
+//
+// Hot-path statements are compiled once into numbered slots (prepareFixed)
+// and reused for the lifetime of the connection. Ad-hoc statements are
+// cached by SQL text and evicted least-recently-used once the cache holds
+// more than `adhoc_capacity` entries. An entry is pinned while a ScopedStmt
+// returned by adhoc() holds it and is never evicted then, so the cache can
+// run over capacity until the next adhoc() call after the pins are gone.
+// Asking for a pinned entry's SQL again (a visitor re-entering the read
+// that holds it) gets a private statement instead, finalized on release.
+class StatementCache {
+public:
+  explicit StatementCache(std::size_t adhoc_capacity = 16);
+  ~StatementCache();
+
+  StatementCache(const StatementCache &) = delete;
+  StatementCache &operator=(const StatementCache &) = delete;
+
+  // Bind to a connection. Finalizes anything prepared for a previous one.
+  void attach(sqlite3 *db);
+
+  // Finalize every statement. Must run before the connection is closed,
+  // and after every ScopedStmt from adhoc() has been released.
+  void clear();
+
+  // Compile `sql` into fixed slot `slot`. Returns SQLITE_OK or an sqlite
+  // error code.
+  int prepareFixed(std::size_t slot, const char *sql);
+
+  // Statement in fixed slot `slot`, or nullptr if it was never prepared.
+  sqlite3_stmt *fixed(std::size_t slot) const;
+
+  // Cached statement for `sql`, preparing it on a miss, pinned until the
+  // returned ScopedStmt is destroyed; a private one if the cached one is
+  // pinned already. Empty if the SQL fails to compile.
+  ScopedStmt adhoc(const std::string &sql);
+
+  std::size_t adhocSize() const { return lru_.size(); }
+  std::size_t adhocCapacity() const { return capacity_; }
+  void setAdhocCapacity(std::size_t capacity);
+
+  unsigned long long adhocHits() const { return hits_; }
+  unsigned long long adhocMisses() const { return misses_; }
+  unsigned long long adhocEvictions() const { return evictions_; }
+
+private:
+  struct Entry {
+    std::string sql;
+    sqlite3_stmt *stmt = nullptr;
+    std::size_t pins = 0; // live ScopedStmts holding stmt
+  };
+
+  sqlite3 *db_ = nullptr;
+  std::vector<sqlite3_stmt *> fixed_;
+
+  std::size_t capacity_;
+  std::list<Entry> lru_; // front = most recently used
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+
+  unsigned long long hits_ = 0;
+  unsigned long long misses_ = 0;
+  unsigned long long evictions_ = 0;
+
+  void evictOverflow();
+};
+
+// Resets and clears bindings of a cached statement when it goes out of
+// scope, so the next caller always starts from a clean statement. One from
+// StatementCache::adhoc also keeps its entry pinned until then.
+class ScopedStmt {
+public:
+  explicit ScopedStmt(sqlite3_stmt *stmt) : stmt_(stmt) {}
+  ScopedStmt(ScopedStmt &&other) noexcept;
+  ~ScopedStmt();
+
+  ScopedStmt(const ScopedStmt &) = delete;
+  ScopedStmt &operator=(const ScopedStmt &) = delete;
+  ScopedStmt &operator=(ScopedStmt &&other) noexcept;
+
+  sqlite3_stmt *get() const { return stmt_; }
+  explicit operator bool() const { return stmt_ != nullptr; }
+
+private:
+  friend class StatementCache;
+  ScopedStmt(sqlite3_stmt *stmt, std::size_t *pins, bool owned);
+
+  sqlite3_stmt *stmt_;
+  std::size_t *pins_ = nullptr; // the adhoc entry's pin count
+  bool owned_ = false;          // private statement: finalized on release
+
+  void release();
+};
+
+} // namespace together
@@ -0,0 +1,52 @@
+#pragma once
+#include "core/EventStore.h"
+#include <cstddef>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace together {
+
+// Bounded LRU cache of task rows keyed by id. Memory use is estimated from
+// the row's string capacities plus fixed per-entry overhead, and entries
+// are evicted from the cold end until the estimate fits the budget.
+// Not thread-safe; EventStore serializes access.
+class TaskCache {
+public:
+  explicit TaskCache(std::size_t budget_bytes);
+
+  // Copy the cached row into `out` and mark it recently used.
+  bool get(std::string_view id, TaskRow &out);
+  // Pointer to the cached row (valid until the next mutation), or nullptr.
+  const TaskRow *find(std::string_view id);
+
+  void put(const TaskRow &row);
+  // Apply a soft delete to the cached row, if present.
+  void markDeleted(std::string_view id, long long updated_at);
+  void erase(std::string_view id);
+  void clear();
+
+  void setBudget(std::size_t budget_bytes);
+  TaskCacheStats stats() const;
+
+private:
+  struct Entry {
+    TaskRow row;
+    std::size_t bytes = 0;
+  };
+
+  std::size_t budget_;
+  std::size_t bytes_ = 0;
+  std::list<Entry> lru_; // front = most recently used
+  std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+
+  unsigned long long hits_ = 0;
+  unsigned long long misses_ = 0;
+  unsigned long long evictions_ = 0;
+
+  static std::size_t entryBytes(const TaskRow &row);
+  void evictOverflow();
+};
+
+} // namespace together
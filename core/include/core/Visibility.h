@@ -0,0 +1,43 @@
+#pragma once
+// Household roles and record visibility tags (docs/PERMISSIONS.md).
+#include <string_view>
+
+namespace together {
+
+enum class Role { Owner, Adult, Teen, Child, Guest };
+
+// One bit per visibility tag. task.vis_mask and event_log.vis_mask hold
+// exactly one of these; 0 marks a row written before the column existed
+// and not yet classified, which only Owner sees.
+enum VisibilityBit : unsigned {
+  kVisFamily = 1u << 0,
+  kVisAdultsOnly = 1u << 1,
+  kVisKids = 1u << 2,
+  kVisOwnerOnly = 1u << 3,
+  kVisCustomList = 1u << 4,
+};
+constexpr unsigned kVisAll = (1u << 5) - 1;
+
+namespace visibility {
+
+// Bit for a visibility_tag value. Unknown or empty tags are treated as
+// owner_only, so a typo hides a record rather than exposing it.
+unsigned tagBit(std::string_view tag);
+const char *tagName(unsigned bit);
+const char *roleName(Role role);
+
+// Tags `role` sees on every record. custom_list records are additionally
+// visible to the members they list (see canSeeTask).
+unsigned visibleTags(Role role);
+
+// The role/tag matrix, as enforced by the role-scoped EventStore reads.
+// Tasks: custom_list is visible to Owner and to members named in
+// assignees_csv; Guests see no tasks. Events: custom_list is Owner-only
+// (events carry no member list) and budget_tx / budget_limit events are
+// visible to Owner and Adult only.
+bool canSeeTask(Role role, std::string_view visibility_tag, bool listed);
+bool canSeeEvent(Role role, std::string_view entity_type,
+                 std::string_view visibility_tag);
+
+} // namespace visibility
+} // namespace together
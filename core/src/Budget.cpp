@@ -0,0 +1,439 @@
+#include "core/EventStore.h"
+#include "BudgetLedger.h"
+#include "SqliteUtil.h"
+#include <sqlite3.h>
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace together {
+
+using sql::bindText;
+using sql::columnView;
+
+namespace budget {
+
+namespace {
+
+constexpr long long kDayMs = 86400000;
+
+// Year and month of a day count since 1970-01-01 (H. Hinnant's civil
+// calendar algorithm, as in Recurrence.cpp).
+void civilMonth(long long z, long long &y, unsigned &m) {
+  z += 719468;
+  const long long era = (z >= 0 ? z : z - 146096) / 146097;
+  const unsigned doe = (unsigned)(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y = (long long)yoe + era * 400 + (m <= 2);
+}
+
+void bindFields(sqlite3_stmt *st, Kind kind, const PayloadFields &fields) {
+  for (const PayloadField &f : fields) {
+    long long month = 0;
+    if (f.name == "category") {
+      if (f.kind == PayloadField::Kind::String)
+        bindText(st, 2, f.s);
+    } else if (f.name == "month") {
+      if (fieldMonth(f, month))
+        sqlite3_bind_int64(st, 3, (sqlite3_int64)month);
+    } else if (f.name == "amount_cents") {
+      if (f.kind == PayloadField::Kind::Int)
+        sqlite3_bind_int64(st, 4, (sqlite3_int64)f.i);
+      else if (f.kind == PayloadField::Kind::Double)
+        sqlite3_bind_int64(st, 4, (sqlite3_int64)f.d);
+    } else if (f.name == "rollover" && kind == Kind::Limit) {
+      if (f.kind == PayloadField::Kind::Bool)
+        sqlite3_bind_int(st, 7, f.b ? 1 : 0);
+      else if (f.kind == PayloadField::Kind::Int)
+        sqlite3_bind_int(st, 7, f.i != 0);
+    }
+  }
+}
+
+} // namespace
+
+bool fieldMonth(const PayloadField &f, long long &out) {
+  if (f.kind == PayloadField::Kind::Int) {
+    out = f.i;
+  } else if (f.kind == PayloadField::Kind::Double) {
+    out = (long long)f.d;
+  } else if (f.kind == PayloadField::Kind::String && f.s.size() == 7 &&
+             f.s[4] == '-') {
+    out = 0;
+    for (std::size_t i = 0; i < 7; ++i) {
+      if (i == 4)
+        continue;
+      if (f.s[i] < '0' || f.s[i] > '9')
+        return false;
+      out = out * 10 + (f.s[i] - '0');
+    }
+  } else {
+    return false;
+  }
+  return validMonth(out);
+} // budget::fieldMonth
+
+int monthOf(long long ts_millis) {
+  const long long day =
+      ts_millis >= 0 ? ts_millis / kDayMs : -((-ts_millis - 1) / kDayMs) - 1;
+  long long y;
+  unsigned m;
+  civilMonth(day, y, m);
+  return (int)(y * 100 + m);
+} // budget::monthOf
+
+int nextMonth(int month) {
+  return month % 100 == 12 ? (month / 100 + 1) * 100 + 1 : month + 1;
+} // budget::nextMonth
+
+bool validMonth(long long month) {
+  return month >= 100001 && month <= 999912 && month % 100 >= 1 &&
+         month % 100 <= 12;
+} // budget::validMonth
+
+int fold(Kind kind, sqlite3_stmt *upsert, sqlite3_stmt *del, string_view id,
+         string_view op, string_view payload, long long ts,
+         PayloadFields &scratch) {
+  if (!upsert || !del || kind == Kind::None)
+    return -1;
+  if (op == "upsert") {
+    if (!payload::decode(payload, scratch))
+      return 0;
+    ScopedStmt reset(upsert);
+    bindText(upsert, 1, id);
+    bindFields(upsert, kind, scratch);
+    sqlite3_bind_int64(upsert, 5, (sqlite3_int64)ts);
+    sqlite3_bind_int64(upsert, 6, (sqlite3_int64)monthOf(ts));
+    return sqlite3_step(upsert) == SQLITE_DONE ? 1 : -1;
+  }
+  if (op == "delete") {
+    ScopedStmt reset(del);
+    bindText(del, 1, id);
+    return sqlite3_step(del) == SQLITE_DONE ? 1 : -1;
+  }
+  return 0;
+} // budget::fold
+
+} // namespace budget
+
+namespace {
+
+// A budget_tx or budget_limit row as kBudgetTxRow / kBudgetLimitRow read
+// it; `cents` is the amount or the limit.
+struct BudgetRow {
+  string category;
+  int month = 0;
+  long long cents = 0;
+  int rollover = 0;
+
+  bool operator==(const BudgetRow &o) const {
+    return category == o.category && month == o.month && cents == o.cents &&
+           rollover == o.rollover;
+  }
+};
+
+bool readBudgetRow(sqlite3_stmt *st, string_view id, BudgetRow &out,
+                   bool &found) {
+  if (!st)
+    return false;
+  ScopedStmt reset(st);
+  bindText(st, 1, id);
+  const int rc = sqlite3_step(st);
+  found = rc == SQLITE_ROW;
+  if (found) {
+    out.category.assign(columnView(st, 0));
+    out.month = sqlite3_column_int(st, 1);
+    out.cents = sqlite3_column_int64(st, 2);
+    out.rollover = sqlite3_column_int(st, 3);
+  }
+  return found || rc == SQLITE_DONE;
+}
+
+} // namespace
+
+// Caller owns the transaction. The row is read before and after the fold,
+// so the month totals move by exactly the change, whatever the payload
+// left out.
+bool EventStore::applyBudgetEvent(string_view entity_type,
+                                  string_view entity_id, string_view op,
+                                  string_view payload, long long ts) {
+  const budget::Kind kind = budget::kindOf(entity_type);
+  const bool tx = kind == budget::Kind::Tx;
+  sqlite3_stmt *row = stmts_.fixed(tx ? kBudgetTxRow : kBudgetLimitRow);
+
+  BudgetRow before, after;
+  bool had = false, has = false;
+  if (!readBudgetRow(row, entity_id, before, had))
+    return false;
+  PayloadFields fields;
+  const int rc = budget::fold(
+      kind, stmts_.fixed(tx ? kBudgetTxUpsert : kBudgetLimitUpsert),
+      stmts_.fixed(tx ? kBudgetTxDelete : kBudgetLimitDelete), entity_id, op,
+      payload, ts, fields);
+  if (rc <= 0)
+    return rc == 0; // skipped, as replay skips it
+  if (!readBudgetRow(row, entity_id, after, has))
+    return false;
+  if (had && has && before == after)
+    return true;
+
+  auto addToMonth = [this](const BudgetRow &r, long long cents, int count) {
+    ScopedStmt st(stmts_.fixed(kBudgetMonthAdd));
+    if (!st)
+      return false;
+    bindText(st.get(), 1, r.category);
+    sqlite3_bind_int(st.get(), 2, r.month);
+    sqlite3_bind_int64(st.get(), 3, (sqlite3_int64)cents);
+    sqlite3_bind_int(st.get(), 4, count);
+    return sqlite3_step(st.get()) == SQLITE_DONE;
+  };
+  auto resetCarries = [this](const BudgetRow &r) {
+    ScopedStmt st(stmts_.fixed(kBudgetCarryReset));
+    if (!st)
+      return false;
+    bindText(st.get(), 1, r.category);
+    sqlite3_bind_int(st.get(), 2, r.month);
+    return sqlite3_step(st.get()) == SQLITE_DONE;
+  };
+  const bool moved = !had || !has || after.category != before.category ||
+                     after.month != before.month;
+  if (tx && !moved && !addToMonth(after, after.cents - before.cents, 0))
+    return false;
+  if (tx && moved && ((had && !addToMonth(before, -before.cents, -1)) ||
+                      (has && !addToMonth(after, after.cents, 1))))
+    return false;
+  if (had && !resetCarries(before))
+    return false;
+  if (has && moved)
+    return resetCarries(after);
+  return true;
+} // EventStore::applyBudgetEvent
+
+// Carry into (category, month), caching it and every uncached carry on the
+// way. Starts from the latest cached carry before the month, or from the
+// category's first month with nothing carried in, so a walk covers only
+// months nobody has read since they last changed. Caller owns the
+// transaction.
+bool EventStore::budgetCarryIn(string_view category, int month,
+                               long long &out_carry) {
+  auto setCarry = [this, category](int m, long long carry) {
+    ScopedStmt st(stmts_.fixed(kBudgetCarrySet));
+    if (!st)
+      return false;
+    bindText(st.get(), 1, category);
+    sqlite3_bind_int(st.get(), 2, m);
+    sqlite3_bind_int64(st.get(), 3, (sqlite3_int64)carry);
+    return sqlite3_step(st.get()) == SQLITE_DONE;
+  };
+
+  int from = 0;
+  long long carry = 0;
+  {
+    ScopedStmt st(stmts_.adhoc(
+        "SELECT month, carry_cents FROM budget_month "
+        "WHERE category = ?1 AND month < ?2 AND carry_cents IS NOT NULL "
+        "ORDER BY month DESC LIMIT 1"));
+    if (!st)
+      return false;
+    bindText(st.get(), 1, category);
+    sqlite3_bind_int(st.get(), 2, month);
+    const int rc = sqlite3_step(st.get());
+    if (rc == SQLITE_ROW) {
+      from = sqlite3_column_int(st.get(), 0);
+      carry = sqlite3_column_int64(st.get(), 1);
+    } else if (rc != SQLITE_DONE) {
+      return false;
+    }
+  }
+  if (!from) {
+    ScopedStmt st(stmts_.adhoc(
+        "SELECT MIN(month) FROM ("
+        "  SELECT month FROM budget_month WHERE category = ?1 "
+        "  UNION ALL "
+        "  SELECT month FROM budget_limit WHERE category = ?1)"));
+    if (!st)
+      return false;
+    bindText(st.get(), 1, category);
+    if (sqlite3_step(st.get()) != SQLITE_ROW)
+      return false;
+    from = sqlite3_column_int(st.get(), 0); // 0 when NULL: no history
+  }
+
+  if (from && from < month) {
+    struct MonthRow {
+      int month;
+      long long net;
+      bool cached;
+    };
+    struct LimitRow {
+      int month;
+      long long cents;
+      bool rollover;
+    };
+    vector<MonthRow> rows;
+    vector<LimitRow> limits;
+    {
+      ScopedStmt st(stmts_.adhoc(
+          "SELECT month, net_cents, carry_cents IS NOT NULL FROM budget_month "
+          "WHERE category = ?1 AND month >= ?2 AND month < ?3 ORDER BY month"));
+      if (!st)
+        return false;
+      bindText(st.get(), 1, category);
+      sqlite3_bind_int(st.get(), 2, from);
+      sqlite3_bind_int(st.get(), 3, month);
+      int rc;
+      while ((rc = sqlite3_step(st.get())) == SQLITE_ROW)
+        rows.push_back(MonthRow{sqlite3_column_int(st.get(), 0),
+                                sqlite3_column_int64(st.get(), 1),
+                                sqlite3_column_int(st.get(), 2) != 0});
+      if (rc != SQLITE_DONE)
+        return false;
+    }
+    {
+      ScopedStmt st(stmts_.adhoc(
+          "SELECT month, limit_cents, rollover FROM budget_limit "
+          "WHERE category = ?1 AND month < ?2 "
+          "ORDER BY month, updated_at, id"));
+      if (!st)
+        return false;
+      bindText(st.get(), 1, category);
+      sqlite3_bind_int(st.get(), 2, month);
+      int rc;
+      while ((rc = sqlite3_step(st.get())) == SQLITE_ROW)
+        limits.push_back(LimitRow{sqlite3_column_int(st.get(), 0),
+                                  sqlite3_column_int64(st.get(), 1),
+                                  sqlite3_column_int(st.get(), 2) != 0});
+      if (rc != SQLITE_DONE)
+        return false;
+    }
+
+    std::size_t r = 0, l = 0;
+    long long limit = 0;
+    bool rollover = false;
+    for (int m = from; m < month; m = budget::nextMonth(m)) {
+      for (; l < limits.size() && limits[l].month <= m; ++l) {
+        limit = limits[l].cents;
+        rollover = limits[l].rollover;
+      }
+      long long net = 0;
+      if (r < rows.size() && rows[r].month == m) {
+        net = rows[r].net;
+        if (!rows[r].cached && !setCarry(m, carry))
+          return false;
+        ++r;
+      }
+      carry = rollover ? limit + carry + net : 0;
+    }
+  } else {
+    carry = 0;
+  }
+  out_carry = carry;
+  return setCarry(month, carry);
+} // EventStore::budgetCarryIn
+
+long long EventStore::setBudgetLimit(const string &category, int month,
+                                     long long limit_cents, bool rollover,
+                                     long long ts_millis) {
+  if (category.empty() || !budget::validMonth(month))
+    return -4;
+  PayloadFields fields(4);
+  fields[0].name = "category";
+  fields[0].kind = PayloadField::Kind::String;
+  fields[0].s = category;
+  fields[1].name = "month";
+  fields[1].kind = PayloadField::Kind::Int;
+  fields[1].i = month;
+  fields[2].name = "amount_cents";
+  fields[2].kind = PayloadField::Kind::Int;
+  fields[2].i = limit_cents;
+  fields[3].name = "rollover";
+  fields[3].kind = PayloadField::Kind::Bool;
+  fields[3].b = rollover;
+
+  DeltaEvent ev;
+  ev.entity_type = "budget_limit";
+  ev.entity_id = category + "@" + std::to_string(month);
+  ev.op = "upsert";
+  ev.payload = payload::toJson(fields);
+  ev.ts = ts_millis;
+  return append(ev);
+} // EventStore::setBudgetLimit
+
+bool EventStore::budgetSummary(int month, vector<BudgetEnvelope> &out,
+                               string &out_error) {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  out.clear();
+  out_error.clear();
+  if (!db_) {
+    out_error = "database not open";
+    return false;
+  }
+  if (!budget::validMonth(month)) {
+    out_error = "month must be YYYYMM";
+    return false;
+  }
+
+  vector<std::size_t> uncached;
+  {
+    ScopedStmt st(stmts_.fixed(kBudgetSummary));
+    if (!st) {
+      out_error = "prepare failed in budgetSummary";
+      return false;
+    }
+    sqlite3_bind_int(st.get(), 1, month);
+    int rc;
+    while ((rc = sqlite3_step(st.get())) == SQLITE_ROW) {
+      BudgetEnvelope e;
+      e.category.assign(columnView(st.get(), 0));
+      e.net_cents = sqlite3_column_int64(st.get(), 1);
+      e.tx_count = sqlite3_column_int64(st.get(), 2);
+      if (sqlite3_column_type(st.get(), 3) == SQLITE_NULL)
+        uncached.push_back(out.size());
+      else
+        e.carry_in_cents = sqlite3_column_int64(st.get(), 3);
+      e.limit_cents = sqlite3_column_int64(st.get(), 4); // 0 when NULL
+      e.rollover = sqlite3_column_int(st.get(), 5) != 0;
+      out.push_back(std::move(e));
+    }
+    if (rc != SQLITE_DONE) {
+      out_error = sqlite3_errmsg(db_);
+      out.clear();
+      return false;
+    }
+  }
+
+  // Rollover: the first read of a month computes and keeps its carries.
+  if (!uncached.empty()) {
+    if (!beginImmediate()) {
+      out_error = "begin failed";
+      out.clear();
+      return false;
+    }
+    for (std::size_t i : uncached) {
+      if (!budgetCarryIn(out[i].category, month, out[i].carry_in_cents)) {
+        out_error = sqlite3_errmsg(db_);
+        rollback();
+        out.clear();
+        return false;
+      }
+    }
+    if (!commit()) {
+      rollback();
+      out_error = "commit failed";
+      out.clear();
+      return false;
+    }
+  }
+  for (BudgetEnvelope &e : out)
+    e.remaining_cents = e.limit_cents + e.carry_in_cents + e.net_cents;
+  return true;
+} // EventStore::budgetSummary
+
+} // namespace together
@@ -0,0 +1,78 @@
+#pragma once
+// Budget tables (schema v5): budget_tx and budget_limit hold the current
+// state of each budget_tx / budget_limit entity, folded from its events
+// the way replay folds tasks; budget_month holds per-category-per-month
+// totals of budget_tx, kept up to date by every write.
+#include "core/PayloadCodec.h"
+
+#include <sqlite3.h>
+
+#include <string_view>
+
+namespace together {
+namespace budget {
+
+enum class Kind { None, Tx, Limit };
+
+inline Kind kindOf(std::string_view entity_type) {
+  if (entity_type == "budget_tx")
+    return Kind::Tx;
+  if (entity_type == "budget_limit")
+    return Kind::Limit;
+  return Kind::None;
+}
+
+// Months are YYYYMM integers (202403), so they sort and compare as dates.
+int monthOf(long long ts_millis); // UTC
+int nextMonth(int month);
+bool validMonth(long long month);
+// A payload "month" field: YYYYMM as a number or "YYYY-MM". False for any
+// other value.
+bool fieldMonth(const PayloadField &f, long long &out);
+
+// Row upserts, parameterized by table so the live tables, the replay
+// scratch tables and the migration backfill share one fold. Absent
+// payload fields bind as NULL: a new row takes the default (the month of
+// the event's ts for `month`), an existing row keeps its value.
+// Parameters: ?1 id, ?2 category, ?3 month, ?4 amount_cents, ?5 ts,
+// ?6 monthOf(ts), ?7 rollover (limits only); bindFields fills ?2..?4, ?7.
+#define BUDGET_TX_UPSERT_SQL(table)                                            \
+  "INSERT INTO " table "(id, category, month, amount_cents, updated_at) "      \
+  "VALUES(?1, COALESCE(?2,''), COALESCE(?3,?6), COALESCE(?4,0), ?5) "          \
+  "ON CONFLICT(id) DO UPDATE SET "                                             \
+  "  category=COALESCE(?2,category), "                                         \
+  "  month=COALESCE(?3,month), "                                               \
+  "  amount_cents=COALESCE(?4,amount_cents), "                                 \
+  "  updated_at=?5"
+
+#define BUDGET_LIMIT_UPSERT_SQL(table)                                         \
+  "INSERT INTO " table "(id, category, month, limit_cents, rollover, "         \
+  "                      updated_at) "                                         \
+  "VALUES(?1, COALESCE(?2,''), COALESCE(?3,?6), COALESCE(?4,0), "              \
+  "       COALESCE(?7,1), ?5) "                                                \
+  "ON CONFLICT(id) DO UPDATE SET "                                             \
+  "  category=COALESCE(?2,category), "                                         \
+  "  month=COALESCE(?3,month), "                                               \
+  "  limit_cents=COALESCE(?4,limit_cents), "                                   \
+  "  rollover=COALESCE(?7,rollover), "                                         \
+  "  updated_at=?5"
+
+// Folds one event into a budget table through `upsert` (the statement
+// above for `kind`) or `del` (DELETE ... WHERE id = ?1). Payload fields of
+// the wrong type, and months that are not YYYYMM / "YYYY-MM", are ignored.
+// Returns 1 if applied, 0 if skipped (undecodable payload, unknown op) and
+// -1 on an SQLite error. `scratch` is reused between calls.
+int fold(Kind kind, sqlite3_stmt *upsert, sqlite3_stmt *del,
+         std::string_view id, std::string_view op, std::string_view payload,
+         long long ts, PayloadFields &scratch);
+
+// Recomputes budget_month from every budget_tx row. The caller clears
+// budget_month first; cached carries are dropped with it.
+constexpr const char *kMonthRebuildSql = R"SQL(
+    INSERT INTO main.budget_month(category, month, net_cents, tx_count)
+    SELECT category, month, SUM(amount_cents), COUNT(*)
+    FROM main.budget_tx GROUP BY category, month;
+)SQL";
+
+} // namespace budget
+} // namespace together
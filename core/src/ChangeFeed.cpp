@@ -0,0 +1,163 @@
+#include "core/ChangeFeed.h"
+#include "core/EventStore.h"
+#include "EventCodes.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace together {
+
+ChangeRing::ChangeRing(std::size_t capacity) {
+  std::size_t size = 2;
+  while (size < capacity)
+    size *= 2;
+  slots_.resize(size);
+  mask_ = size - 1;
+} // ChangeRing::ChangeRing
+
+bool ChangeRing::push(const ChangeNotice &notice) {
+  const std::size_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    overflow_.store(true);
+    if (sleeping_.load())
+      wake();
+    return false;
+  }
+  slots_[tail & mask_] = notice;
+  // Sequentially consistent, pairing with wait(): either the consumer sees
+  // the new tail, or this sees it asleep and wakes it.
+  tail_.store(tail + 1);
+  if (sleeping_.load())
+    wake();
+  return true;
+} // ChangeRing::push
+
+bool ChangeRing::pop(ChangeNotice &out) {
+  const std::size_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire))
+    return false;
+  out = slots_[head & mask_];
+  head_.store(head + 1, std::memory_order_release);
+  return true;
+} // ChangeRing::pop
+
+bool ChangeRing::wait(std::chrono::microseconds timeout) {
+  if (ready())
+    return true;
+  std::unique_lock<std::mutex> lock(wake_mu_);
+  sleeping_.store(true);
+  const bool ok = wake_cv_.wait_for(lock, timeout, [this] { return ready(); });
+  sleeping_.store(false);
+  return ok;
+} // ChangeRing::wait
+
+bool ChangeRing::takeOverflow() {
+  return overflow_.exchange(false);
+} // ChangeRing::takeOverflow
+
+bool ChangeRing::ready() const {
+  return head_.load(std::memory_order_relaxed) != tail_.load() ||
+         overflow_.load();
+} // ChangeRing::ready
+
+void ChangeRing::wake() {
+  // Taking the mutex orders the notify after the consumer's predicate
+  // check, so the wakeup cannot fall between the check and the sleep.
+  { std::lock_guard<std::mutex> lock(wake_mu_); }
+  wake_cv_.notify_one();
+} // ChangeRing::wake
+
+EventStore::SubscriptionId
+EventStore::addSubscriber(vector<string> entity_types, ChangeCallback callback,
+                          std::shared_ptr<ChangeRing> ring) {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  // Copy on write: a publish in progress (a callback subscribing) keeps
+  // iterating the list it started with.
+  auto next = subscribers_ ? std::make_shared<vector<Subscriber>>(*subscribers_)
+                           : std::make_shared<vector<Subscriber>>();
+  Subscriber s;
+  s.id = ++last_subscription_;
+  s.entity_types = std::move(entity_types);
+  s.callback = std::move(callback);
+  s.ring = std::move(ring);
+  next->push_back(std::move(s));
+  subscribers_ = std::move(next);
+  return last_subscription_;
+} // EventStore::addSubscriber
+
+EventStore::SubscriptionId EventStore::subscribe(vector<string> entity_types,
+                                                 ChangeCallback on_change) {
+  if (!on_change)
+    return 0;
+  return addSubscriber(std::move(entity_types), std::move(on_change), nullptr);
+} // EventStore::subscribe
+
+EventStore::SubscriptionId
+EventStore::subscribe(vector<string> entity_types,
+                      std::shared_ptr<ChangeRing> ring) {
+  if (!ring)
+    return 0;
+  return addSubscriber(std::move(entity_types), nullptr, std::move(ring));
+} // EventStore::subscribe
+
+void EventStore::unsubscribe(SubscriptionId id) {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  if (!subscribers_)
+    return;
+  auto next = std::make_shared<vector<Subscriber>>();
+  for (const Subscriber &s : *subscribers_)
+    if (s.id != id)
+      next->push_back(s);
+  if (next->empty())
+    next.reset();
+  subscribers_ = std::move(next);
+} // EventStore::unsubscribe
+
+// Writer lock held; the events in pending_changes_ are committed. One
+// notice per subscriber with a matching event.
+void EventStore::publishChanges() {
+  if (pending_changes_.empty())
+    return;
+  // Callbacks may write (and so publish) or change the subscriber list:
+  // work on the batch and the list as they are now.
+  vector<PendingChange> changes;
+  changes.swap(pending_changes_);
+  const std::shared_ptr<const vector<Subscriber>> subscribers = subscribers_;
+  sqlite3_stmt *code_name = stmts_.fixed(kCodeName);
+
+  if (subscribers) {
+    for (const Subscriber &s : *subscribers) {
+      ChangeNotice notice;
+      for (const PendingChange &c : changes) {
+        if (!s.entity_types.empty()) {
+          const string_view type = codes_->name(c.type_code, code_name);
+          if (std::find(s.entity_types.begin(), s.entity_types.end(), type) ==
+              s.entity_types.end())
+            continue;
+        }
+        if (!notice.events)
+          notice.first_seq = c.seq;
+        notice.last_seq = c.seq;
+        ++notice.events;
+      }
+      if (!notice.events)
+        continue;
+      if (s.ring)
+        s.ring->push(notice);
+      else
+        s.callback(notice);
+    }
+  }
+
+  changes.clear();
+  if (pending_changes_.empty())
+    pending_changes_.swap(changes); // keep the capacity
+} // EventStore::publishChanges
+
+} // namespace together
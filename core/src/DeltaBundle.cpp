@@ -0,0 +1,236 @@
+#include "core/DeltaBundle.h"
+#include "Varint.h"
+
+#include <cstring>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#ifdef TOGETHER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace together {
+namespace bundle {
+
+namespace {
+
+constexpr char kMagic[4] = {'2', 'G', 'D', 'B'};
+constexpr unsigned char kVersion = 1;
+constexpr unsigned char kStored = 0;
+constexpr unsigned char kDeflate = 1;
+constexpr std::size_t kHeaderFixed = sizeof(kMagic) + 2;
+
+// Upper bound on the decoded body, so a corrupt size cannot trigger a
+// huge allocation.
+constexpr unsigned long long kMaxRawSize = 1ull << 31;
+
+// Interns entity_type / op / entity_id strings. std::deque never moves
+// its elements on push_back, so the map can key on views into them.
+class StringTable {
+public:
+  unsigned long long index(string_view s) {
+    auto it = ids_.find(s);
+    if (it != ids_.end())
+      return it->second;
+    strings_.emplace_back(s);
+    unsigned long long id = strings_.size() - 1;
+    ids_.emplace(string_view(strings_.back()), id);
+    return id;
+  }
+  const std::deque<string> &strings() const { return strings_; }
+
+private:
+  std::deque<string> strings_;
+  std::unordered_map<string_view, unsigned long long> ids_;
+};
+
+bool getString(string_view in, std::size_t &pos, string &out) {
+  unsigned long long len = 0;
+  if (!varint::get(in, pos, len) || len > in.size() - pos)
+    return false;
+  out.assign(in.data() + pos, (std::size_t)len);
+  pos += (std::size_t)len;
+  return true;
+}
+
+} // namespace
+
+bool compressionAvailable() {
+#ifdef TOGETHER_HAVE_ZLIB
+  return true;
+#else
+  return false;
+#endif
+} // bundle::compressionAvailable
+
+void encode(const vector<DeltaEvent> &events, string &out) {
+  StringTable table;
+  vector<unsigned long long> type_idx, op_idx, id_idx;
+  type_idx.reserve(events.size());
+  op_idx.reserve(events.size());
+  id_idx.reserve(events.size());
+  for (const DeltaEvent &e : events) {
+    type_idx.push_back(table.index(e.entity_type));
+    op_idx.push_back(table.index(e.op));
+    id_idx.push_back(table.index(e.entity_id));
+  }
+
+  string body;
+  varint::put(body, events.size());
+
+  varint::put(body, table.strings().size());
+  for (const string &s : table.strings()) {
+    varint::put(body, s.size());
+    body += s;
+  }
+
+  long long prev_seq = 0, prev_ts = 0;
+  for (const DeltaEvent &e : events) {
+    varint::put(body, (unsigned long long)(e.seq - prev_seq));
+    prev_seq = e.seq;
+  }
+  for (const DeltaEvent &e : events) {
+    varint::put(body, varint::zigzag(e.ts - prev_ts));
+    prev_ts = e.ts;
+  }
+  for (unsigned long long i : type_idx)
+    varint::put(body, i);
+  for (unsigned long long i : op_idx)
+    varint::put(body, i);
+  for (unsigned long long i : id_idx)
+    varint::put(body, i);
+  for (const DeltaEvent &e : events) {
+    varint::put(body, e.payload.size());
+    body += e.payload;
+  }
+
+  out.assign(kMagic, sizeof(kMagic));
+  out.push_back((char)kVersion);
+
+#ifdef TOGETHER_HAVE_ZLIB
+  uLongf bound = compressBound((uLong)body.size());
+  string packed(bound, '\0');
+  if (compress2(reinterpret_cast<Bytef *>(&packed[0]), &bound,
+                reinterpret_cast<const Bytef *>(body.data()),
+                (uLong)body.size(), Z_DEFAULT_COMPRESSION) == Z_OK &&
+      bound < body.size()) {
+    out.push_back((char)kDeflate);
+    varint::put(out, body.size());
+    out.append(packed.data(), bound);
+    return;
+  }
+#endif
+  out.push_back((char)kStored);
+  varint::put(out, body.size());
+  out += body;
+} // bundle::encode
+
+bool decode(string_view in, vector<DeltaEvent> &out, string &out_error) {
+  out.clear();
+  out_error.clear();
+
+  if (in.size() < kHeaderFixed ||
+      std::memcmp(in.data(), kMagic, sizeof(kMagic)) != 0) {
+    out_error = "not a delta bundle";
+    return false;
+  }
+  if ((unsigned char)in[4] != kVersion) {
+    out_error = "unsupported bundle version";
+    return false;
+  }
+  unsigned char method = (unsigned char)in[5];
+  std::size_t pos = kHeaderFixed;
+  unsigned long long raw_size = 0;
+  if (!varint::get(in, pos, raw_size) || raw_size > kMaxRawSize) {
+    out_error = "corrupt bundle header";
+    return false;
+  }
+
+  string inflated;
+  string_view body;
+  if (method == kStored) {
+    body = in.substr(pos);
+    if (body.size() != raw_size) {
+      out_error = "corrupt bundle body";
+      return false;
+    }
+  } else if (method == kDeflate) {
+#ifdef TOGETHER_HAVE_ZLIB
+    inflated.resize((std::size_t)raw_size);
+    uLongf dest_len = (uLongf)raw_size;
+    if (uncompress(reinterpret_cast<Bytef *>(&inflated[0]), &dest_len,
+                   reinterpret_cast<const Bytef *>(in.data() + pos),
+                   (uLong)(in.size() - pos)) != Z_OK ||
+        dest_len != raw_size) {
+      out_error = "corrupt bundle body";
+      return false;
+    }
+    body = inflated;
+#else
+    out_error = "bundle is compressed but zlib support is not built in";
+    return false;
+#endif
+  } else {
+    out_error = "unsupported bundle compression";
+    return false;
+  }
+
+  pos = 0;
+  unsigned long long count = 0, nstrings = 0;
+  // Every event takes several body bytes, so both counts are bounded by
+  // the body size; this rejects corrupt counts before allocating.
+  if (!varint::get(body, pos, count) || count > body.size() ||
+      !varint::get(body, pos, nstrings) || nstrings > body.size()) {
+    out_error = "corrupt bundle body";
+    return false;
+  }
+
+  vector<string> strings((std::size_t)nstrings);
+  for (string &s : strings)
+    if (!getString(body, pos, s)) {
+      out_error = "corrupt string table";
+      return false;
+    }
+
+  out.resize((std::size_t)count);
+  bool ok = true;
+  long long seq = 0, ts = 0;
+  for (DeltaEvent &e : out) {
+    unsigned long long d = 0;
+    ok = ok && varint::get(body, pos, d);
+    seq += (long long)d;
+    e.seq = seq;
+  }
+  for (DeltaEvent &e : out) {
+    unsigned long long d = 0;
+    ok = ok && varint::get(body, pos, d);
+    ts += varint::unzigzag(d);
+    e.ts = ts;
+  }
+  for (string DeltaEvent::*field :
+       {&DeltaEvent::entity_type, &DeltaEvent::op, &DeltaEvent::entity_id}) {
+    for (DeltaEvent &e : out) {
+      unsigned long long idx = 0;
+      ok = ok && varint::get(body, pos, idx) && idx < strings.size();
+      if (ok)
+        e.*field = strings[(std::size_t)idx];
+    }
+  }
+  for (DeltaEvent &e : out)
+    ok = ok && getString(body, pos, e.payload);
+
+  if (!ok || pos != body.size()) {
+    out.clear();
+    out_error = "corrupt bundle body";
+    return false;
+  }
+  return true;
+} // bundle::decode
+
+} // namespace bundle
+} // namespace together
@@ -0,0 +1,165 @@
+#include "core/DueScheduler.h"
+
+#include <queue>
+#include <string>
+#include <utility>
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace together {
+
+bool DueScheduler::tracks(long long due_at, string_view status) {
+  return due_at > 0 && status != "done" && status != "deleted";
+} // DueScheduler::tracks
+
+void DueScheduler::load(vector<DueTask> tasks) {
+  clear();
+  slots_.reserve(tasks.size());
+  heap_.reserve(tasks.size());
+  for (DueTask &t : tasks) {
+    auto res = slots_.try_emplace(std::move(t.id));
+    res.first->second.due_at = t.due_at;
+    if (res.second)
+      heap_.push_back(&*res.first); // element pointers survive rehashing
+  }
+  for (std::size_t i = 0; i < heap_.size(); ++i)
+    heap_[i]->second.heap = i;
+  // Bottom-up heapify: O(n), where n pushes would be O(n log n).
+  for (std::size_t i = heap_.size() / 2; i-- > 0;)
+    siftDown(i);
+} // DueScheduler::load
+
+void DueScheduler::clear() {
+  heap_.clear();
+  slots_.clear();
+} // DueScheduler::clear
+
+void DueScheduler::update(string_view id, long long due_at,
+                          string_view status) {
+  if (!tracks(due_at, status)) {
+    remove(id);
+    return;
+  }
+  auto res = slots_.try_emplace(string(id));
+  Slot &slot = res.first->second;
+  if (res.second) {
+    slot.due_at = due_at;
+    push(&*res.first);
+    return;
+  }
+  if (slot.due_at == due_at)
+    return; // pending stays pending, fired stays fired
+  const bool earlier = due_at < slot.due_at;
+  slot.due_at = due_at;
+  if (slot.heap == kFired)
+    push(&*res.first); // rescheduled: remind again
+  else if (earlier)
+    siftUp(slot.heap);
+  else
+    siftDown(slot.heap);
+} // DueScheduler::update
+
+void DueScheduler::remove(string_view id) {
+  auto it = slots_.find(string(id));
+  if (it == slots_.end())
+    return;
+  if (it->second.heap != kFired)
+    erase(it->second.heap);
+  slots_.erase(it);
+} // DueScheduler::remove
+
+vector<DueTask> DueScheduler::nextDue(long long now, std::size_t n) const {
+  vector<DueTask> out;
+  if (n == 0 || heap_.empty())
+    return out;
+  // Best-first walk of the heap: a node is only visited after its parent,
+  // so this costs O((k + n) log(k + n)) for k reminders at or before `now`
+  // that have not been drained yet.
+  auto later = [this](std::size_t a, std::size_t b) { return less(b, a); };
+  std::priority_queue<std::size_t, vector<std::size_t>, decltype(later)>
+      frontier(later);
+  frontier.push(0);
+  while (!frontier.empty() && out.size() < n) {
+    const std::size_t i = frontier.top();
+    frontier.pop();
+    if (heap_[i]->second.due_at > now)
+      out.push_back(DueTask{heap_[i]->first, heap_[i]->second.due_at});
+    for (std::size_t c = 2 * i + 1; c <= 2 * i + 2 && c < heap_.size(); ++c)
+      frontier.push(c);
+  }
+  return out;
+} // DueScheduler::nextDue
+
+vector<DueTask> DueScheduler::drainDue(long long now) {
+  vector<DueTask> out;
+  while (!heap_.empty() && heap_.front()->second.due_at <= now) {
+    SlotMap::value_type *top = heap_.front();
+    out.push_back(DueTask{top->first, top->second.due_at});
+    erase(0);
+  }
+  return out;
+} // DueScheduler::drainDue
+
+bool DueScheduler::less(std::size_t a, std::size_t b) const {
+  const Slot &x = heap_[a]->second;
+  const Slot &y = heap_[b]->second;
+  if (x.due_at != y.due_at)
+    return x.due_at < y.due_at;
+  return heap_[a]->first < heap_[b]->first;
+} // DueScheduler::less
+
+void DueScheduler::place(std::size_t i, SlotMap::value_type *entry) {
+  if (i < heap_.size())
+    heap_[i] = entry;
+  entry->second.heap = i;
+} // DueScheduler::place
+
+void DueScheduler::siftUp(std::size_t i) {
+  while (i > 0) {
+    const std::size_t parent = (i - 1) / 2;
+    if (!less(i, parent))
+      break;
+    SlotMap::value_type *child = heap_[i];
+    place(i, heap_[parent]);
+    place(parent, child);
+    i = parent;
+  }
+} // DueScheduler::siftUp
+
+void DueScheduler::siftDown(std::size_t i) {
+  for (;;) {
+    std::size_t smallest = i;
+    for (std::size_t c = 2 * i + 1; c <= 2 * i + 2 && c < heap_.size(); ++c)
+      if (less(c, smallest))
+        smallest = c;
+    if (smallest == i)
+      break;
+    SlotMap::value_type *parent = heap_[i];
+    place(i, heap_[smallest]);
+    place(smallest, parent);
+    i = smallest;
+  }
+} // DueScheduler::siftDown
+
+void DueScheduler::push(SlotMap::value_type *entry) {
+  heap_.push_back(entry);
+  entry->second.heap = heap_.size() - 1;
+  siftUp(heap_.size() - 1);
+} // DueScheduler::push
+
+// Removes heap_[i], leaving its slot marked fired.
+void DueScheduler::erase(std::size_t i) {
+  SlotMap::value_type *gone = heap_[i];
+  SlotMap::value_type *last = heap_.back();
+  heap_.pop_back();
+  gone->second.heap = kFired;
+  if (gone == last)
+    return;
+  place(i, last);
+  siftUp(i);
+  siftDown(last->second.heap);
+} // DueScheduler::erase
+
+} // namespace together
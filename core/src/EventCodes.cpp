@@ -0,0 +1,123 @@
+#include "EventCodes.h"
+#include "SqliteUtil.h"
+#include "core/StatementCache.h"
+#include <sqlite3.h>
+
+#include <algorithm>
+
+using std::string;
+using std::string_view;
+
+namespace together {
+
+bool EventCodes::load(sqlite3 *db) {
+  sqlite3_stmt *st = nullptr;
+  if (sqlite3_prepare_v2(db, "SELECT code, name FROM event_dict", -1, &st,
+                         nullptr) != SQLITE_OK) {
+    sqlite3_finalize(st);
+    return false;
+  }
+  by_name_.clear();
+  pending_.clear();
+  int rc;
+  while ((rc = sqlite3_step(st)) == SQLITE_ROW) {
+    long long code = sqlite3_column_int64(st, 0);
+    string_view name = sql::columnView(st, 1);
+    publish(code, name);
+    by_name_.emplace_back(string(name), code);
+  }
+  sqlite3_finalize(st);
+  return rc == SQLITE_DONE;
+} // EventCodes::load
+
+const string *EventCodes::publish(long long code, string_view name) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto it = by_code_.find(code);
+  if (it != by_code_.end() && *it->second == name)
+    return it->second;
+  storage_.emplace_back(name);
+  const string *p = &storage_.back();
+  by_code_[code] = p;
+  if (code > 0 && (std::size_t)code < kFastCodes)
+    fast_[(std::size_t)code].store(p, std::memory_order_release);
+  return p;
+} // EventCodes::publish
+
+long long EventCodes::intern(sqlite3 *db, string_view name,
+                             sqlite3_stmt *insert, sqlite3_stmt *select) {
+  for (const auto &entry : by_name_)
+    if (entry.first == name)
+      return entry.second;
+  if (!insert || !select || name.empty())
+    return 0;
+
+  bool inserted = false;
+  {
+    ScopedStmt reset(insert);
+    sql::bindText(insert, 1, name);
+    if (sqlite3_step(insert) != SQLITE_DONE)
+      return 0;
+    inserted = sqlite3_changes(db) > 0;
+  }
+  long long code = 0;
+  {
+    ScopedStmt reset(select);
+    sql::bindText(select, 1, name);
+    if (sqlite3_step(select) != SQLITE_ROW)
+      return 0;
+    code = sqlite3_column_int64(select, 0);
+  }
+
+  publish(code, name);
+  by_name_.emplace_back(string(name), code);
+  if (inserted && !sqlite3_get_autocommit(db))
+    pending_.push_back(code);
+  return code;
+} // EventCodes::intern
+
+void EventCodes::commitPending() { pending_.clear(); } // EventCodes::commitPending
+
+void EventCodes::rollbackPending() {
+  if (pending_.empty())
+    return;
+  std::lock_guard<std::mutex> lock(mu_);
+  for (long long code : pending_) {
+    // The name string stays in storage_; only the mapping goes.
+    by_code_.erase(code);
+    if (code > 0 && (std::size_t)code < kFastCodes)
+      fast_[(std::size_t)code].store(nullptr, std::memory_order_release);
+    by_name_.erase(std::remove_if(by_name_.begin(), by_name_.end(),
+                                  [code](const auto &entry) {
+                                    return entry.second == code;
+                                  }),
+                   by_name_.end());
+  }
+  pending_.clear();
+} // EventCodes::rollbackPending
+
+string_view EventCodes::name(long long code, sqlite3_stmt *lookup) {
+  if (code > 0 && (std::size_t)code < kFastCodes)
+    if (const string *p = fast_[(std::size_t)code].load(std::memory_order_acquire))
+      return *p;
+
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = by_code_.find(code);
+    if (it != by_code_.end())
+      return *it->second;
+  }
+  if (!lookup)
+    return {};
+
+  string found;
+  {
+    ScopedStmt reset(lookup);
+    sqlite3_bind_int64(lookup, 1, (sqlite3_int64)code);
+    if (sqlite3_step(lookup) != SQLITE_ROW)
+      return {};
+    found = string(sql::columnView(lookup, 0));
+  }
+  return *publish(code, found);
+} // EventCodes::name
+
+} // namespace together
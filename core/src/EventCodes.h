@@ -0,0 +1,60 @@
+#pragma once
+// In-memory mirror of the event_dict table: the small integer codes that
+// event_log stores in place of entity_type / op strings.
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct sqlite3;      // forward-declare
+struct sqlite3_stmt; // forward-declare
+
+namespace together {
+
+// Names are stored once and never move or go away, so readers can hand out
+// string_views of them for the lifetime of the store. Looking up a code
+// below kFastCodes is a single atomic load; anything else takes a mutex.
+class EventCodes {
+public:
+  static constexpr std::size_t kFastCodes = 256;
+
+  // Replace the contents with every row of event_dict. False on error.
+  bool load(sqlite3 *db);
+
+  // Code for `name`, adding it to event_dict if needed. Writer connection
+  // only (the caller holds the writer lock). `insert` is
+  // "INSERT ... ON CONFLICT DO NOTHING" and `select` looks the name up.
+  // Returns 0 on failure.
+  long long intern(sqlite3 *db, std::string_view name, sqlite3_stmt *insert,
+                   sqlite3_stmt *select);
+
+  // Codes interned inside a transaction exist only if it commits.
+  void commitPending();
+  void rollbackPending();
+
+  // Name for `code`, or an empty view if event_dict has no such code.
+  // `lookup` (SELECT name ... WHERE code = ?) runs on the caller's
+  // connection and resolves codes another connection added.
+  std::string_view name(long long code, sqlite3_stmt *lookup);
+
+private:
+  std::array<std::atomic<const std::string *>, kFastCodes> fast_{};
+
+  std::mutex mu_; // guards storage_ and by_code_
+  std::deque<std::string> storage_;
+  std::unordered_map<long long, const std::string *> by_code_;
+
+  // Writer-only: a handful of entries, so a linear scan beats hashing and
+  // needs no std::string temporary for the key.
+  std::vector<std::pair<std::string, long long>> by_name_;
+  std::vector<long long> pending_;
+
+  const std::string *publish(long long code, std::string_view name);
+};
+
+} // namespace together
@@ -1,20 +1,487 @@
 #include "core/EventStore.h"
+#include "core/DeltaBundle.h"
+#include "core/ReaderPool.h"
+#include "core/TaskCache.h"
+#include "BudgetLedger.h"
+#include "EventCodes.h"
+#include "Snapshot.h"
+#include "SqliteUtil.h"
+#include "StoreMetrics.h"
+#include "TaskAssignees.h"
+#include "VisibilityPolicy.h"
 #include <cstddef>
 #include <sqlite3.h>
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 using std::string;
+using std::string_view;
 using std::vector;
 
 namespace together {
 
-EventStore::EventStore() = default; // EventStore::EventStore
+using sql::bindBlob;
+using sql::bindText;
+using sql::blobView;
+using sql::columnView;
+
+namespace {
+
+constexpr std::size_t kRoleCount = (std::size_t)Role::Guest + 1;
+
+// SQL for each EventStore::Stmt slot, in enum order.
+const char *const kStmtSql[] = {
+    // kBegin
+    "BEGIN IMMEDIATE",
+    // kCommit
+    "COMMIT",
+    // kRollback
+    "ROLLBACK",
+    // kAppendEvent
+    "INSERT INTO event_log(type_code, entity_id, op_code, payload_blob, ts, "
+    "                      vis_mask) "
+    "VALUES(?,?,?,?,?,?)",
+    // kSinceEvents
+    "SELECT seq, type_code, entity_id, op_code, payload_blob, ts "
+    "FROM event_log WHERE seq > ? ORDER BY seq ASC",
+    // kGetTask
+    "SELECT id, title, assignees_csv, due_at, points, status, "
+    "visibility_tag, updated_at "
+    "FROM task WHERE id = ?",
+    // kUpsertTask
+    "INSERT INTO task(id, title, assignees_csv, due_at, "
+    "points, status, visibility_tag, updated_at, vis_mask, origin) "
+    "VALUES(?,?,?,?,?,?,?,?,?,?) "
+    "ON CONFLICT(id) DO UPDATE SET "
+    "  title=excluded.title, "
+    "  assignees_csv=excluded.assignees_csv, "
+    "  due_at=excluded.due_at, "
+    "  points=excluded.points, "
+    "  status=excluded.status, "
+    "  visibility_tag=excluded.visibility_tag, "
+    "  updated_at=excluded.updated_at, "
+    "  vis_mask=excluded.vis_mask, "
+    "  origin=excluded.origin",
+    // kDeleteTask (soft delete)
+    "UPDATE task SET status='deleted', updated_at=? WHERE id=?",
+    // kListTasks (idx_task_updated)
+    "SELECT id, title, assignees_csv, due_at, points, status, visibility_tag, "
+    "updated_at "
+    "FROM task "
+    "ORDER BY updated_at DESC, id DESC "
+    "LIMIT ? OFFSET ?",
+    // kListTasksByStatus (idx_task_status_updated)
+    "SELECT id, title, assignees_csv, due_at, points, status, visibility_tag, "
+    "updated_at "
+    "FROM task "
+    "WHERE status = ? "
+    "ORDER BY updated_at DESC, id DESC "
+    "LIMIT ? OFFSET ?",
+    // kListTasksAfter: keyset page following (updated_at, id)
+    "SELECT id, title, assignees_csv, due_at, points, status, visibility_tag, "
+    "updated_at "
+    "FROM task "
+    "WHERE (updated_at, id) < (?, ?) "
+    "ORDER BY updated_at DESC, id DESC "
+    "LIMIT ?",
+    // kListTasksByStatusAfter
+    "SELECT id, title, assignees_csv, due_at, points, status, visibility_tag, "
+    "updated_at "
+    "FROM task "
+    "WHERE status = ? AND (updated_at, id) < (?, ?) "
+    "ORDER BY updated_at DESC, id DESC "
+    "LIMIT ?",
+    // kInternCode
+    "INSERT INTO event_dict(name) VALUES(?) ON CONFLICT(name) DO NOTHING",
+    // kCodeByName
+    "SELECT code FROM event_dict WHERE name = ?",
+    // kCodeName
+    "SELECT name FROM event_dict WHERE code = ?",
+    // kTaskVisMask
+    "SELECT vis_mask FROM task WHERE id = ?",
+    // kClearAssignees
+    "DELETE FROM task_assignee WHERE task_id = ?",
+    // kAddAssignee
+    "INSERT OR IGNORE INTO task_assignee(member_id, updated_at, task_id, "
+    "                                    status) "
+    "VALUES(?,?,?,?)",
+    // kDeleteAssignees (mirrors kDeleteTask)
+    "UPDATE task_assignee SET status='deleted', updated_at=? WHERE task_id=?",
+    // kMemberTasks (task_assignee primary key)
+    "SELECT t.id, t.title, t.assignees_csv, t.due_at, t.points, t.status, "
+    "t.visibility_tag, t.updated_at "
+    "FROM task_assignee AS a JOIN task AS t ON t.id = a.task_id "
+    "WHERE a.member_id = ? "
+    "ORDER BY a.updated_at DESC, a.task_id DESC "
+    "LIMIT ?",
+    // kMemberTasksByStatus (idx_task_assignee_status)
+    "SELECT t.id, t.title, t.assignees_csv, t.due_at, t.points, t.status, "
+    "t.visibility_tag, t.updated_at "
+    "FROM task_assignee AS a JOIN task AS t ON t.id = a.task_id "
+    "WHERE a.member_id = ? AND a.status = ? "
+    "ORDER BY a.updated_at DESC, a.task_id DESC "
+    "LIMIT ?",
+    // kMemberTasksAfter
+    "SELECT t.id, t.title, t.assignees_csv, t.due_at, t.points, t.status, "
+    "t.visibility_tag, t.updated_at "
+    "FROM task_assignee AS a JOIN task AS t ON t.id = a.task_id "
+    "WHERE a.member_id = ? AND (a.updated_at, a.task_id) < (?, ?) "
+    "ORDER BY a.updated_at DESC, a.task_id DESC "
+    "LIMIT ?",
+    // kMemberTasksByStatusAfter
+    "SELECT t.id, t.title, t.assignees_csv, t.due_at, t.points, t.status, "
+    "t.visibility_tag, t.updated_at "
+    "FROM task_assignee AS a JOIN task AS t ON t.id = a.task_id "
+    "WHERE a.member_id = ? AND a.status = ? "
+    "  AND (a.updated_at, a.task_id) < (?, ?) "
+    "ORDER BY a.updated_at DESC, a.task_id DESC "
+    "LIMIT ?",
+    // kDueTasks (idx_task_due; the predicate is DueScheduler::tracks)
+    "SELECT id, due_at FROM task "
+    "WHERE due_at > 0 AND status NOT IN ('done', 'deleted')",
+    // kLatestEvent (idx_event_log_entity): ?1 entity_type, ?2 entity_id
+    "SELECT e.payload_blob, o.name FROM event_log AS e "
+    "JOIN event_dict AS o ON o.code = e.op_code "
+    "WHERE e.type_code = (SELECT code FROM event_dict WHERE name = ?1) "
+    "  AND e.entity_id = ?2 "
+    "ORDER BY e.seq DESC LIMIT 1",
+    // kBudgetTxRow
+    "SELECT category, month, amount_cents, 0 FROM budget_tx WHERE id = ?",
+    // kBudgetTxUpsert
+    BUDGET_TX_UPSERT_SQL("budget_tx"),
+    // kBudgetTxDelete
+    "DELETE FROM budget_tx WHERE id = ?",
+    // kBudgetLimitRow
+    "SELECT category, month, limit_cents, rollover FROM budget_limit "
+    "WHERE id = ?",
+    // kBudgetLimitUpsert
+    BUDGET_LIMIT_UPSERT_SQL("budget_limit"),
+    // kBudgetLimitDelete
+    "DELETE FROM budget_limit WHERE id = ?",
+    // kBudgetMonthAdd: ?1 category, ?2 month, ?3 cents, ?4 change in tx_count
+    "INSERT INTO budget_month(category, month, net_cents, tx_count) "
+    "VALUES(?1,?2,?3,?4) "
+    "ON CONFLICT(category, month) DO UPDATE SET "
+    "  net_cents = net_cents + ?3, tx_count = tx_count + ?4",
+    // kBudgetCarryReset: carries after ?2 depend on it
+    "UPDATE budget_month SET carry_cents = NULL "
+    "WHERE category = ?1 AND month > ?2 AND carry_cents IS NOT NULL",
+    // kBudgetCarrySet
+    "INSERT INTO budget_month(category, month, carry_cents) VALUES(?1,?2,?3) "
+    "ON CONFLICT(category, month) DO UPDATE SET carry_cents = ?3",
+    // kBudgetSummary: ?1 month. Categories with a limit in force or a
+    // transaction that month, each with its budget_month row and the
+    // latest limit at or before the month (idx_budget_limit_category).
+    "SELECT c.category, COALESCE(m.net_cents, 0), COALESCE(m.tx_count, 0), "
+    "       m.carry_cents, l.limit_cents, l.rollover "
+    "FROM (SELECT category FROM budget_limit WHERE month <= ?1 "
+    "      UNION "
+    "      SELECT category FROM budget_month "
+    "      WHERE month = ?1 AND tx_count > 0) AS c "
+    "LEFT JOIN budget_month AS m "
+    "  ON m.category = c.category AND m.month = ?1 "
+    "LEFT JOIN budget_limit AS l ON l.id = ("
+    "  SELECT id FROM budget_limit "
+    "  WHERE category = c.category AND month <= ?1 "
+    "  ORDER BY month DESC, updated_at DESC, id DESC LIMIT 1) "
+    "ORDER BY c.category",
+    // kIngestTaskRows: ingestRemote's merge cursor, in primary key order
+    "SELECT id, title, assignees_csv, due_at, points, status, visibility_tag, "
+    "updated_at, origin "
+    "FROM task WHERE id >= ?1 ORDER BY id",
+    // kRemoteSeen: no change when remote_id was ingested before
+    "INSERT INTO remote_event(remote_id, origin, seq) VALUES(?1, ?2, 0) "
+    "ON CONFLICT(remote_id) DO NOTHING",
+    // kRemoteSeq
+    "UPDATE remote_event SET seq = ?1 WHERE remote_id = ?2",
+    // kEntityHistory (idx_event_log_entity): ?1 entity_type, ?2 entity_id,
+    // ?3 after seq
+    "SELECT seq, type_code, entity_id, op_code, payload_blob, ts "
+    "FROM event_log WHERE type_code = (SELECT code FROM event_dict "
+    "                                  WHERE name = ?1) "
+    "AND entity_id = ?2 AND seq > ?3 ORDER BY seq ASC",
+    // kTsRange (idx_event_log_ts): after (?1 ts, ?2 seq), ts < ?3
+    "SELECT seq, type_code, entity_id, op_code, payload_blob, ts "
+    "FROM event_log WHERE (ts, seq) > (?1, ?2) AND ts < ?3 "
+    "ORDER BY ts ASC, seq ASC",
+    // kTaskEventRow: ?1 seq, then the task row
+    "INSERT OR REPLACE INTO task_event_row(seq, title, assignees_csv, due_at, "
+    "                                      points, status, visibility_tag) "
+    "VALUES(?1,?2,?3,?4,?5,?6,?7)",
+};
+
+// Indexes on columns added by migrations, so created after them.
+// idx_event_log_entity serves entityHistory and compaction's per-entity
+// probe, idx_event_log_ts serves range() (seq is the rowid, so the index
+// is in (ts, seq) order); the vis_mask indexes serve the role-scoped
+// reads, which seek one range per visible tag and touch only rows the
+// role can see.
+const char *const kVersionedIndexDdl = R"SQL(
+    CREATE INDEX IF NOT EXISTS idx_event_log_entity
+      ON event_log(type_code, entity_id, seq);
+    CREATE INDEX IF NOT EXISTS idx_event_log_ts ON event_log(ts);
+    CREATE INDEX IF NOT EXISTS idx_event_log_vis ON event_log(vis_mask, seq);
+    CREATE INDEX IF NOT EXISTS idx_task_vis_updated
+      ON task(vis_mask, updated_at DESC, id DESC);
+    CREATE INDEX IF NOT EXISTS idx_task_vis_status_updated
+      ON task(vis_mask, status, updated_at DESC, id DESC);
+)SQL";
+
+// Connection tuning every connection gets: page cache and memory map.
+string readerPragmas(const OpenOptions &o) {
+  return "PRAGMA cache_size = -" + std::to_string(o.cache_kib) +
+         "; PRAGMA mmap_size = " + std::to_string(o.mmap_bytes) + ";";
+}
+
+// The writer's: also commit durability and the WAL checkpoint interval.
+string writerPragmas(const OpenOptions &o) {
+  return readerPragmas(o) + " PRAGMA synchronous = " +
+         (o.sync_normal ? "NORMAL" : "FULL") +
+         "; PRAGMA wal_autocheckpoint = " +
+         std::to_string(o.wal_autocheckpoint) + ";";
+}
+
+// Adapts an owning visitor to the view-based row loop. One reusable row:
+// assign() keeps string capacity across iterations. Binary payloads are
+// handed out as JSON so callers see one format.
+EventViewVisitor ownedEvents(DeltaEvent &e, const EventVisitor &visit) {
+  return [&e, &visit](const DeltaEventView &v) {
+    v.copyTo(e);
+    if (payload::isBinary(e.payload))
+      e.payload = payload::toJson(v.payload);
+    return visit(e);
+  };
+}
+
+// Role-scoped reads: the unscoped statement plus the role's visibility
+// predicate, built once per role. Empty if the role sees nothing.
+// Parameters: ?1 since_seq.
+const string &roleSinceSql(Role role) {
+  static const auto sql = [] {
+    std::array<string, kRoleCount> out;
+    for (std::size_t r = 0; r < kRoleCount; ++r) {
+      string pred = visibility::eventPredicateSql((Role)r);
+      if (!pred.empty())
+        out[r] = "SELECT seq, type_code, entity_id, op_code, payload_blob, ts "
+                 "FROM event_log WHERE seq > ?1 AND " +
+                 pred + " ORDER BY seq ASC";
+    }
+    return out;
+  }();
+  return sql[(std::size_t)role];
+}
+
+// One statement per visible tag, each walking its vis_mask index in page
+// order and cut at limit + offset rows; forEachTask(Role, ...) merges them.
+// A page reads at most (limit + offset) rows per tag and never a row the
+// role cannot see. (A compound UNION ALL ... ORDER BY materializes and
+// re-sorts every arm, which costs more than the rows it saves.)
+// Parameters: ?1 member_id, ?2 status (by_status only), ?3 limit + offset.
+const vector<string> &roleTaskArmsSql(Role role, bool by_status) {
+  static const auto sql = [] {
+    std::array<std::array<vector<string>, 2>, kRoleCount> out;
+    for (std::size_t r = 0; r < kRoleCount; ++r)
+      for (const string &term : visibility::taskPredicatesSql((Role)r))
+        for (int s = 0; s < 2; ++s)
+          out[r][s].push_back(
+              "SELECT id, title, assignees_csv, due_at, points, status, "
+              "visibility_tag, updated_at FROM task WHERE " +
+              term + (s ? " AND status = ?2" : "") +
+              " ORDER BY updated_at DESC, id DESC LIMIT ?3");
+    return out;
+  }();
+  return sql[(std::size_t)role][by_status ? 1 : 0];
+}
+
+// Fields of the latest event of (entity_type, entity_id) and the index of
+// its "rrule" field. `st` is kLatestEvent on the caller's connection.
+bool loadSeries(sqlite3_stmt *st, string_view entity_type,
+                string_view entity_id, PayloadFields &fields,
+                std::size_t &rrule, string &out_error) {
+  if (!st) {
+    out_error = "prepare failed in getRecurrence";
+    return false;
+  }
+  ScopedStmt reset(st);
+  bindText(st, 1, entity_type);
+  bindText(st, 2, entity_id);
+  if (sqlite3_step(st) != SQLITE_ROW || columnView(st, 1) == "delete") {
+    out_error = "not found";
+    return false;
+  }
+  if (!payload::decode(blobView(st, 0), fields)) {
+    out_error = "payload is not a flat object";
+    return false;
+  }
+  for (rrule = 0; rrule < fields.size(); ++rrule)
+    if (fields[rrule].name == "rrule" &&
+        fields[rrule].kind == PayloadField::Kind::String)
+      return true;
+  out_error = "no rrule in payload";
+  return false;
+}
+
+// Page tokens are "<updated_at>:<id>" of the last row delivered. Callers
+// treat them as opaque.
+string encodePageToken(long long updated_at, string_view id) {
+  string token = std::to_string(updated_at);
+  token += ':';
+  token.append(id.data(), id.size());
+  return token;
+}
+
+bool decodePageToken(const string &token, long long &updated_at,
+                     string_view &id) {
+  std::size_t colon = token.find(':');
+  if (colon == string::npos || colon == 0)
+    return false;
+  char *end = nullptr;
+  updated_at = std::strtoll(token.c_str(), &end, 10);
+  if (end != token.c_str() + colon)
+    return false;
+  id = string_view(token).substr(colon + 1);
+  return true;
+}
+
+// remote_id of an imported event: its content, hashed (64-bit FNV-1a, so
+// the id is stable across builds), so a bundle imported twice applies once.
+string importId(const DeltaEvent &ev) {
+  std::uint64_t h = 14695981039346656037ull;
+  auto mix = [&h](string_view bytes) {
+    for (unsigned char c : bytes)
+      h = (h ^ c) * 1099511628211ull;
+    h = (h ^ 0xff) * 1099511628211ull; // field separator
+  };
+  mix(ev.entity_type);
+  mix(ev.entity_id);
+  mix(ev.op);
+  mix(std::to_string(ev.ts));
+  mix(ev.payload);
+  char hex[17];
+  std::snprintf(hex, sizeof hex, "%016llx", (unsigned long long)h);
+  return "import:" + string(hex);
+}
+
+void readTaskView(sqlite3_stmt *st, TaskRowView &out) {
+  out.id = columnView(st, 0);
+  out.title = columnView(st, 1);
+  out.assignees_csv = columnView(st, 2);
+  out.due_at = sqlite3_column_int64(st, 3);
+  out.points = sqlite3_column_int(st, 4);
+  out.status = columnView(st, 5);
+  out.visibility_tag = columnView(st, 6);
+  out.updated_at = sqlite3_column_int64(st, 7);
+}
+
+// Reads a task_event_row joined at columns col.. (title first) as payload
+// fields; false if the event has none.
+bool readEventRow(sqlite3_stmt *st, int col, PayloadFields &out) {
+  if (sqlite3_column_type(st, col) == SQLITE_NULL)
+    return false;
+  static constexpr const char *kNames[] = {"title",  "assignees",
+                                           "due_at", "points",
+                                           "status", "visibility_tag"};
+  out.resize(std::size(kNames));
+  for (std::size_t i = 0; i < out.size(); ++i) {
+    PayloadField &f = out[i];
+    f.name = kNames[i];
+    if (i == 2 || i == 3) {
+      f.kind = PayloadField::Kind::Int;
+      f.i = sqlite3_column_int64(st, col + (int)i);
+    } else {
+      f.kind = PayloadField::Kind::String;
+      f.s = columnView(st, col + (int)i);
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+// Pins the connection a read runs on: a leased pool reader, or the writer
+// connection under write_mu_ when there is no pool. Destroy any ScopedStmt
+// taken from stmts() first (declare it after the scope).
+class EventStore::ReadScope {
+public:
+  explicit ReadScope(const EventStore &store) {
+    if (store.readers_)
+      lease_ = store.readers_->acquire();
+    if (lease_) {
+      stmts_ = &lease_.stmts();
+    } else {
+      lock_ = std::unique_lock<std::recursive_mutex>(store.write_mu_);
+      stmts_ = &store.stmts_;
+    }
+  }
+  StatementCache &stmts() const { return *stmts_; }
+
+  // The statement in fixed slot `slot`. If it is mid-step, a visitor has
+  // re-entered a read on this connection while the outer read iterates
+  // it: that read gets its own copy, so the outer cursor is not reset.
+  ScopedStmt fixed(Stmt slot) const {
+    sqlite3_stmt *st = stmts_->fixed(slot);
+    if (st && sqlite3_stmt_busy(st))
+      return stmts_->adhoc(kStmtSql[slot]);
+    return ScopedStmt(st);
+  }
+
+private:
+  ReaderPool::Lease lease_;
+  std::unique_lock<std::recursive_mutex> lock_;
+  StatementCache *stmts_ = nullptr;
+};
+
+TaskRow TaskRowView::toOwned() const {
+  TaskRow out;
+  copyTo(out);
+  return out;
+} // TaskRowView::toOwned
+
+void TaskRowView::copyTo(TaskRow &out) const {
+  out.id.assign(id.data(), id.size());
+  out.title.assign(title.data(), title.size());
+  out.assignees_csv.assign(assignees_csv.data(), assignees_csv.size());
+  out.due_at = due_at;
+  out.points = points;
+  out.status.assign(status.data(), status.size());
+  out.visibility_tag.assign(visibility_tag.data(), visibility_tag.size());
+  out.updated_at = updated_at;
+} // TaskRowView::copyTo
+
+DeltaEvent DeltaEventView::toOwned() const {
+  DeltaEvent out;
+  copyTo(out);
+  return out;
+} // DeltaEventView::toOwned
+
+void DeltaEventView::copyTo(DeltaEvent &out) const {
+  out.seq = seq;
+  out.entity_type.assign(entity_type.data(), entity_type.size());
+  out.entity_id.assign(entity_id.data(), entity_id.size());
+  out.op.assign(op.data(), op.size());
+  out.payload.assign(payload.data(), payload.size());
+  out.ts = ts;
+} // DeltaEventView::copyTo
+
+EventStore::EventStore() : codes_(std::make_unique<EventCodes>()) {
+#ifdef TOGETHER_METRICS
+  metrics_ = std::make_unique<StoreMetrics>();
+#endif
+} // EventStore::EventStore
 
 EventStore::~EventStore() {
+  stopWriteQueue(); // drains: queued writes still commit
+  readers_.reset();
+  stmts_.clear(); // statements must be finalized before close
   if (db_) {
     sqlite3_close(db_);
     db_ = nullptr;
@@ -25,7 +492,35 @@ const char *EventStore::version() {
   return "2gether_core/0.2.0";
 } // EventStore::version
 
-string EventStore::open(const string &db_path) {
+OpenOptions OpenOptions::phone() {
+  OpenOptions o;
+  o.cache_kib = 1024;
+  o.mmap_bytes = 64LL << 20;
+  o.sync_normal = true;
+  o.wal_autocheckpoint = 256;
+  return o;
+} // OpenOptions::phone
+
+OpenOptions OpenOptions::desktop() {
+  OpenOptions o;
+  o.cache_kib = 16 * 1024;
+  o.mmap_bytes = 256LL << 20;
+  o.sync_normal = true;
+  return o;
+} // OpenOptions::desktop
+
+OpenOptions OpenOptions::server() {
+  OpenOptions o;
+  o.page_size = 8192;
+  o.cache_kib = 64 * 1024;
+  o.mmap_bytes = 1LL << 30;
+  o.sync_normal = true;
+  o.wal_autocheckpoint = 4000;
+  return o;
+} // OpenOptions::server
+
+string EventStore::open(const string &db_path, const OpenOptions &options) {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
   if (db_)
     return {}; // already open
 
@@ -35,32 +530,140 @@ string EventStore::open(const string &db_path) {
     db_ = nullptr;
     return "sqlite open failed: " + err;
   }
+  db_path_ = db_path;
+  open_options_ = options;
 
-  string ierr = initSchema();
-  if (!ierr.empty())
-    return ierr;
+  // Statements are not prepared yet; read the version directly. A current
+  // database skips the DDL script: opening it reads the schema only.
+  int version = 0;
+  sqlite3_stmt *st = nullptr;
+  if (sqlite3_prepare_v2(db_, "PRAGMA user_version", -1, &st, nullptr) ==
+          SQLITE_OK &&
+      sqlite3_step(st) == SQLITE_ROW)
+    version = sqlite3_column_int(st, 0);
+  sqlite3_finalize(st);
+  if (version > kSchemaVersion) {
+    // Written by a newer build: its tables may not match these statements.
+    sqlite3_close(db_);
+    db_ = nullptr;
+    db_path_.clear();
+    return "database schema v" + std::to_string(version) +
+           " is newer than supported v" + std::to_string(kSchemaVersion);
+  }
+
+  string err;
+  if (version < kSchemaVersion) {
+    // page_size only applies to a file without tables yet.
+    const string sizing =
+        "PRAGMA page_size = " + std::to_string(options.page_size);
+    execSql(sizing.c_str(), err);
+    string ierr = initSchema(version);
+    if (!ierr.empty())
+      return ierr;
+    // WAL improves durability/concurrency. The mode is stored in the
+    // file, so it is set along with the schema.
+    execSql("PRAGMA journal_mode=WAL;", err);
+  }
+  if (!execSql(writerPragmas(options).c_str(), err))
+    return "connection setup failed: " + err;
+
+  string perr = prepareStatements();
+  if (!perr.empty())
+    return perr;
+  if (!codes_->load(db_))
+    return "event_dict load failed: " + string(sqlite3_errmsg(db_));
+  return loadCheckpoint();
+} // EventStore::open
 
-  // WAL improves durability/concurrency
+string EventStore::setReaderPool(std::size_t readers) {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  if (!db_)
+    return "database not open";
+  if (readers == 0) {
+    readers_.reset();
+    return {};
+  }
+  if (db_path_.empty() || db_path_ == ":memory:")
+    return "reader pool needs a database file";
+
+  // Readers prepare only the statements the read paths use.
+  vector<ReaderPool::StmtSpec> specs;
+  for (Stmt slot : {kSinceEvents, kGetTask, kListTasks, kListTasksByStatus,
+                    kListTasksAfter, kListTasksByStatusAfter, kCodeName,
+                    kMemberTasks, kMemberTasksByStatus, kMemberTasksAfter,
+                    kMemberTasksByStatusAfter, kLatestEvent, kEntityHistory,
+                    kTsRange})
+    specs.emplace_back(slot, kStmtSql[slot]);
+  auto pool = std::make_unique<ReaderPool>();
+  string err =
+      pool->open(db_path_, readers, specs, readerPragmas(open_options_));
+  if (!err.empty())
+    return err;
+  readers_ = std::move(pool);
+  return {};
+} // EventStore::setReaderPool
+
+std::size_t EventStore::readerPoolSize() const {
+  return readers_ ? readers_->size() : 0;
+} // EventStore::readerPoolSize
+
+string EventStore::prepareStatements() {
+  static_assert(kStmtCount == sizeof(kStmtSql) / sizeof(kStmtSql[0]),
+                "kStmtSql out of sync with EventStore::Stmt");
+  stmts_.attach(db_);
+  for (std::size_t i = 0; i < kStmtCount; ++i) {
+    if (stmts_.prepareFixed(i, kStmtSql[i]) != SQLITE_OK) {
+      string err = sqlite3_errmsg(db_);
+      stmts_.clear();
+      return "prepare failed: " + err;
+    }
+  }
+  return {};
+} // EventStore::prepareStatements
+
+string EventStore::loadCheckpoint() {
+  checkpoint_seq_ = 0;
+  compacted_through_ = 0;
+  ScopedStmt st(stmts_.adhoc(
+      "SELECT checkpoint_seq, compacted_through FROM log_checkpoint "
+      "WHERE id = 1"));
+  if (!st)
+    return "prepare failed: " + string(sqlite3_errmsg(db_));
+  if (sqlite3_step(st.get()) == SQLITE_ROW) {
+    checkpoint_seq_ = sqlite3_column_int64(st.get(), 0);
+    compacted_through_ = sqlite3_column_int64(st.get(), 1);
+  }
+  return {};
+} // EventStore::loadCheckpoint
+
+bool EventStore::execSql(const char *sql, string &out_error) {
   char *errmsg = nullptr;
-  sqlite3_exec(db_, "PRAGMA journal_mode=WAL;", nullptr, nullptr, &errmsg);
+  if (sqlite3_exec(db_, sql, nullptr, nullptr, &errmsg) == SQLITE_OK)
+    return true;
+  out_error = errmsg ? errmsg : "exec failed";
   if (errmsg)
     sqlite3_free(errmsg);
+  return false;
+} // EventStore::execSql
 
-  return {};
-} // EventStore::open
-
-string EventStore::initSchema() {
+string EventStore::initSchema(int version) {
   const char *ddl = R"SQL(
-    -- Event log: append-only history
-    CREATE TABLE IF NOT EXISTS event_log(
-      seq INTEGER PRIMARY KEY AUTOINCREMENT,
-      entity_type TEXT NOT NULL,
-      entity_id   TEXT NOT NULL,
-      op          TEXT NOT NULL,     -- 'upsert' | 'delete'
-      payload_blob BLOB NOT NULL,    -- JSON now; protobuf later
-      ts          INTEGER NOT NULL   -- epoch millis
+    -- Entity type / op names; event_log stores the codes. Fixed codes for
+    -- the built-in names, new names are appended on first use.
+    CREATE TABLE IF NOT EXISTS event_dict(
+      code INTEGER PRIMARY KEY,
+      name TEXT NOT NULL UNIQUE
+    );
+    INSERT OR IGNORE INTO event_dict(code, name) VALUES
+      (1, 'task'), (2, 'event'), (3, 'budget_tx'),
+      (4, 'upsert'), (5, 'delete');
+
+    -- Compaction checkpoint: at most one row
+    CREATE TABLE IF NOT EXISTS log_checkpoint(
+      id INTEGER PRIMARY KEY CHECK (id = 1),
+      checkpoint_seq    INTEGER NOT NULL,  -- log <= this is a snapshot
+      compacted_through INTEGER NOT NULL   -- compaction progress
     );
-    CREATE INDEX IF NOT EXISTS idx_event_log_seq ON event_log(seq);
 
     -- Task table: current state of tasks
     CREATE TABLE IF NOT EXISTS task (
@@ -73,7 +676,88 @@ string EventStore::initSchema() {
       visibility_tag TEXT DEFAULT 'family',
       updated_at INTEGER NOT NULL
     );
-    CREATE INDEX IF NOT EXISTS idx_task_status ON task(status);
+    -- Listing/paging indexes match ORDER BY updated_at DESC, id DESC so
+    -- both OFFSET and keyset pages are index walks. The composite index
+    -- makes the old single-column status index redundant.
+    DROP INDEX IF EXISTS idx_task_status;
+    CREATE INDEX IF NOT EXISTS idx_task_status_updated
+      ON task(status, updated_at DESC, id DESC);
+    CREATE INDEX IF NOT EXISTS idx_task_updated
+      ON task(updated_at DESC, id DESC);
+    -- Open tasks with a due date only, so loading the due scheduler reads
+    -- O(open tasks) entries whatever the table size.
+    CREATE INDEX IF NOT EXISTS idx_task_due ON task(due_at, id)
+      WHERE due_at > 0 AND status NOT IN ('done', 'deleted');
+
+    -- One row per (member, task) in task.assignees_csv, written with the
+    -- task row. updated_at / status are copies of the task's, so a
+    -- member's tasks page straight off the primary key (or the status
+    -- index) in listing order; idx_task_assignee_task serves the rewrite.
+    CREATE TABLE IF NOT EXISTS task_assignee (
+      member_id TEXT NOT NULL,
+      updated_at INTEGER NOT NULL,
+      task_id TEXT NOT NULL,
+      status TEXT,
+      PRIMARY KEY (member_id, updated_at DESC, task_id DESC)
+    ) WITHOUT ROWID;
+    CREATE INDEX IF NOT EXISTS idx_task_assignee_status
+      ON task_assignee(member_id, status, updated_at DESC, task_id DESC);
+    CREATE INDEX IF NOT EXISTS idx_task_assignee_task
+      ON task_assignee(task_id);
+
+    -- Events merged by ingestRemote, so a redelivered one is dropped. seq
+    -- is its local seq, 0 if it lost to a later write.
+    CREATE TABLE IF NOT EXISTS remote_event (
+      remote_id TEXT PRIMARY KEY,
+      origin TEXT NOT NULL,
+      seq INTEGER NOT NULL
+    ) WITHOUT ROWID;
+    CREATE INDEX IF NOT EXISTS idx_remote_event_seq ON remote_event(seq);
+
+    -- The row each upsertTask wrote, by the seq of its event, so replay
+    -- rebuilds it whatever the caller's payload held. Compaction drops the
+    -- rows of the events it drops.
+    CREATE TABLE IF NOT EXISTS task_event_row (
+      seq INTEGER PRIMARY KEY,
+      title TEXT NOT NULL,
+      assignees_csv TEXT NOT NULL,
+      due_at INTEGER NOT NULL,
+      points INTEGER NOT NULL,
+      status TEXT NOT NULL,
+      visibility_tag TEXT NOT NULL
+    );
+
+    -- Budget (see BudgetLedger.h). Months are YYYYMM integers.
+    CREATE TABLE IF NOT EXISTS budget_tx (
+      id TEXT PRIMARY KEY,
+      category TEXT NOT NULL,
+      month INTEGER NOT NULL,
+      amount_cents INTEGER NOT NULL,  -- spending is negative
+      updated_at INTEGER NOT NULL
+    ) WITHOUT ROWID;
+    CREATE TABLE IF NOT EXISTS budget_limit (
+      id TEXT PRIMARY KEY,
+      category TEXT NOT NULL,
+      month INTEGER NOT NULL,         -- in force from this month on
+      limit_cents INTEGER NOT NULL,
+      rollover INTEGER NOT NULL,
+      updated_at INTEGER NOT NULL
+    );
+    CREATE INDEX IF NOT EXISTS idx_budget_limit_category
+      ON budget_limit(category, month, updated_at);
+    -- Totals of budget_tx per category and month. carry_cents is the
+    -- rollover into the month: NULL until the month is first read, and
+    -- reset to NULL when an earlier month of the category changes.
+    CREATE TABLE IF NOT EXISTS budget_month (
+      category TEXT NOT NULL,
+      month INTEGER NOT NULL,
+      net_cents INTEGER NOT NULL DEFAULT 0,
+      tx_count INTEGER NOT NULL DEFAULT 0,
+      carry_cents INTEGER,
+      PRIMARY KEY (category, month)
+    ) WITHOUT ROWID;
+    CREATE INDEX IF NOT EXISTS idx_budget_month_month
+      ON budget_month(month);
   )SQL";
 
   char *errmsg = nullptr;
@@ -84,289 +768,1199 @@ string EventStore::initSchema() {
       sqlite3_free(errmsg);
     return "schema creation failed: " + err;
   }
+
+  string merr = migrateSchema(version);
+  if (!merr.empty())
+    return merr;
+
+  string err;
+  if (!execSql(kVersionedIndexDdl, err))
+    return "schema creation failed: " + err;
   return {};
 } // EventStore::initSchema
 
-long long EventStore::append(const DeltaEvent &ev) {
-  if (!db_)
-    return -1;
+bool EventStore::beginImmediate() {
+  ScopedStmt st(stmts_.fixed(kBegin));
+  return st && sqlite3_step(st.get()) == SQLITE_DONE;
+} // EventStore::beginImmediate
+
+bool EventStore::commit() {
+  bool ok = false;
+  {
+    TOGETHER_TIME_OP(metrics_.get(), Commit);
+    ScopedStmt st(stmts_.fixed(kCommit));
+    ok = st && sqlite3_step(st.get()) == SQLITE_DONE;
+  }
+  if (ok && !pending_cache_.empty()) {
+    std::lock_guard<std::mutex> lock(cache_mu_);
+    ++cache_generation_;
+    for (const PendingCacheWrite &w : pending_cache_) {
+      if (!task_cache_)
+        break;
+      if (w.deleted)
+        task_cache_->markDeleted(w.row.id, w.row.updated_at);
+      else
+        task_cache_->put(w.row);
+    }
+  }
+  if (ok && !pending_cache_.empty()) {
+    std::lock_guard<std::mutex> lock(due_mu_);
+    for (const PendingCacheWrite &w : pending_cache_) {
+      if (!due_)
+        break;
+      if (w.deleted)
+        due_->remove(w.row.id);
+      else
+        due_->update(w.row.id, w.row.due_at, w.row.status);
+    }
+  }
+  if (ok) {
+    pending_cache_.clear();
+    codes_->commitPending();
+    publishChanges();
+  }
+  return ok;
+} // EventStore::commit
+
+void EventStore::rollback() {
+  pending_cache_.clear();
+  pending_changes_.clear();
+  codes_->rollbackPending();
+  TOGETHER_COUNT(metrics_.get(), rollbacks, 1);
+  // A failed COMMIT may already have ended the transaction.
+  if (sqlite3_get_autocommit(db_))
+    return;
+  ScopedStmt st(stmts_.fixed(kRollback));
+  if (st)
+    sqlite3_step(st.get());
+} // EventStore::rollback
+
+// Caller owns the transaction.
+bool EventStore::writeTaskRow(string_view id, string_view title,
+                              string_view assignees_csv, long long due_at,
+                              int points, string_view status,
+                              string_view visibility_tag,
+                              long long updated_at, string_view origin) {
+  ScopedStmt st(stmts_.fixed(kUpsertTask));
+  if (!st || id.empty())
+    return false;
 
-  const char *sql =
-      "INSERT INTO event_log(entity_type, entity_id, op, payload_blob, ts) "
-      "VALUES(?,?,?,?,?)";
+  bindText(st.get(), 1, id);
+  bindText(st.get(), 2, title);
+  bindText(st.get(), 3, assignees_csv);
+  sqlite3_bind_int64(st.get(), 4, (sqlite3_int64)due_at);
+  sqlite3_bind_int(st.get(), 5, points);
+  bindText(st.get(), 6, status);
+  bindText(st.get(), 7, visibility_tag);
+  sqlite3_bind_int64(st.get(), 8, (sqlite3_int64)updated_at);
+  sqlite3_bind_int(st.get(), 9, (int)visibility::tagBit(visibility_tag));
+  bindText(st.get(), 10, origin);
+  if (sqlite3_step(st.get()) != SQLITE_DONE)
+    return false;
 
-  sqlite3_stmt *stmt = nullptr;
-  if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-    return -2;
+  // Rewrite the task's task_assignee rows: its key columns may all have
+  // changed.
+  {
+    ScopedStmt clear(stmts_.fixed(kClearAssignees));
+    if (!clear)
+      return false;
+    bindText(clear.get(), 1, id);
+    if (sqlite3_step(clear.get()) != SQLITE_DONE)
+      return false;
   }
+  bool ok = true;
+  assignees::forEachMember(assignees_csv, [&](string_view member) {
+    ScopedStmt add(stmts_.fixed(kAddAssignee));
+    if (!ok || !add) {
+      ok = false;
+      return;
+    }
+    bindText(add.get(), 1, member);
+    sqlite3_bind_int64(add.get(), 2, (sqlite3_int64)updated_at);
+    bindText(add.get(), 3, id);
+    bindText(add.get(), 4, status);
+    ok = sqlite3_step(add.get()) == SQLITE_DONE;
+  });
+  return ok;
+} // EventStore::writeTaskRow
+
+// vis_mask for an event appended without one: the payload's
+// visibility_tag, else the current tag of the task it belongs to, else
+// family.
+unsigned EventStore::eventVisMask(string_view entity_type,
+                                  string_view entity_id,
+                                  string_view payload) {
+  if (unsigned bit = visibility::payloadTagBit(payload))
+    return bit;
+  if (entity_type == "task") {
+    ScopedStmt st(stmts_.fixed(kTaskVisMask));
+    if (st) {
+      bindText(st.get(), 1, entity_id);
+      if (sqlite3_step(st.get()) == SQLITE_ROW)
+        if (unsigned bit = (unsigned)sqlite3_column_int(st.get(), 0))
+          return bit;
+    }
+  }
+  return kVisFamily;
+} // EventStore::eventVisMask
+
+// Returns the new seq, or 0 if the event is malformed or the insert failed.
+// A vis_mask of 0 is derived with eventVisMask.
+long long EventStore::insertEvent(string_view entity_type,
+                                  string_view entity_id, string_view op,
+                                  string_view payload, long long ts,
+                                  unsigned vis_mask) {
+  ScopedStmt st(stmts_.fixed(kAppendEvent));
+  if (!st || entity_type.empty() || entity_id.empty() || op.empty())
+    return 0;
+  if (!vis_mask)
+    vis_mask = eventVisMask(entity_type, entity_id, payload);
+
+  if (payload_format_ == PayloadFormat::Binary && !payload::isBinary(payload) &&
+      payload::jsonToBinary(entity_type, payload, payload_scratch_))
+    payload = payload_scratch_;
+
+  const long long type_code = codes_->intern(
+      db_, entity_type, stmts_.fixed(kInternCode), stmts_.fixed(kCodeByName));
+  const long long op_code = codes_->intern(
+      db_, op, stmts_.fixed(kInternCode), stmts_.fixed(kCodeByName));
+  if (!type_code || !op_code)
+    return 0;
+
+  sqlite3_bind_int64(st.get(), 1, (sqlite3_int64)type_code);
+  bindText(st.get(), 2, entity_id);
+  sqlite3_bind_int64(st.get(), 3, (sqlite3_int64)op_code);
+  bindBlob(st.get(), 4, payload);
+  sqlite3_bind_int64(st.get(), 5, (sqlite3_int64)ts);
+  sqlite3_bind_int(st.get(), 6, (int)vis_mask);
+
+  if (sqlite3_step(st.get()) != SQLITE_DONE)
+    return 0;
+  const long long seq = (long long)sqlite3_last_insert_rowid(db_);
+  if (budget::kindOf(entity_type) != budget::Kind::None &&
+      !applyBudgetEvent(entity_type, entity_id, op, payload, ts))
+    return 0;
+  TOGETHER_COUNT(metrics_.get(), payload_bytes_written, payload.size());
+  if (subscribers_) {
+    pending_changes_.push_back(PendingChange{seq, type_code});
+    if (sqlite3_get_autocommit(db_)) // not in a transaction: committed
+      publishChanges();
+  }
+  return seq;
+} // EventStore::insertEvent
 
-  sqlite3_bind_text(stmt, 1, ev.entity_type.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(stmt, 2, ev.entity_id.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(stmt, 3, ev.op.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_blob(stmt, 4, ev.payload.data(), (int)ev.payload.size(),
-                    SQLITE_TRANSIENT);
-  sqlite3_bind_int64(stmt, 5, (sqlite3_int64)ev.ts);
+long long EventStore::append(const DeltaEvent &ev) {
+  TOGETHER_TIME_OP(metrics_.get(), Append);
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  if (!db_)
+    return -1;
+  if (!stmts_.fixed(kAppendEvent))
+    return -2;
 
-  int step_rc = sqlite3_step(stmt);
-  if (step_rc != SQLITE_DONE) {
-    sqlite3_finalize(stmt);
+  // A budget event also writes the budget tables: one transaction for all.
+  const bool budget_event =
+      budget::kindOf(ev.entity_type) != budget::Kind::None;
+  if (budget_event && !beginImmediate())
+    return -2;
+  long long new_seq =
+      insertEvent(ev.entity_type, ev.entity_id, ev.op, ev.payload, ev.ts);
+  if (new_seq < 1) {
+    if (budget_event)
+      rollback();
     return -3;
   }
-  long long new_seq = (long long)sqlite3_last_insert_rowid(db_);
-  sqlite3_finalize(stmt);
+  if (budget_event && !commit()) {
+    rollback();
+    return -7;
+  }
   return new_seq;
 } // EventStore::append
 
+long long EventStore::appendBatch(const DeltaEvent *events, std::size_t count,
+                                  SeqRange &out_range) {
+  TOGETHER_TIME_OP(metrics_.get(), AppendBatch);
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  out_range = SeqRange{};
+  if (!db_)
+    return -1;
+  if (count == 0)
+    return 0;
+  if (!stmts_.fixed(kAppendEvent))
+    return -3;
+
+  if (!beginImmediate())
+    return -2;
+
+  SeqRange range;
+  for (std::size_t i = 0; i < count; ++i) {
+    const DeltaEvent &ev = events[i];
+    long long seq =
+        insertEvent(ev.entity_type, ev.entity_id, ev.op, ev.payload, ev.ts);
+    if (seq < 1) {
+      rollback();
+      return -6;
+    }
+    if (i == 0)
+      range.first = seq;
+    range.last = seq;
+  }
+
+  if (!commit()) {
+    rollback();
+    return -7;
+  }
+
+  out_range = range;
+  return range.last;
+} // EventStore::appendBatch
+
+long long EventStore::appendBatch(const vector<DeltaEvent> &events,
+                                  SeqRange &out_range) {
+  return appendBatch(events.data(), events.size(), out_range);
+} // EventStore::appendBatch
+
 vector<DeltaEvent> EventStore::since(long long since_seq,
                                      string &out_error) const {
+  return since(Role::Owner, since_seq, out_error);
+} // EventStore::since
+
+vector<DeltaEvent> EventStore::since(Role role, long long since_seq,
+                                     string &out_error) const {
   vector<DeltaEvent> out;
+  ReadCursor cursor;
+  scanSince(
+      role, since_seq, ReadBudget{},
+      [&out](const DeltaEvent &e) {
+        out.push_back(e);
+        return true;
+      },
+      cursor, out_error);
+  if (!out_error.empty())
+    out.clear();
+  return out;
+} // EventStore::since
+
+bool EventStore::scanSince(long long since_seq, const ReadBudget &budget,
+                           const EventVisitor &visit, ReadCursor &out_cursor,
+                           string &out_error) const {
+  return scanSince(Role::Owner, since_seq, budget, visit, out_cursor,
+                   out_error);
+} // EventStore::scanSince
+
+bool EventStore::scanSince(Role role, long long since_seq,
+                           const ReadBudget &budget, const EventVisitor &visit,
+                           ReadCursor &out_cursor, string &out_error) const {
+  DeltaEvent e;
+  return scanSinceView(role, since_seq, budget, ownedEvents(e, visit),
+                       out_cursor, out_error);
+} // EventStore::scanSince
+
+bool EventStore::scanSinceView(long long since_seq, const ReadBudget &budget,
+                               const EventViewVisitor &visit,
+                               ReadCursor &out_cursor,
+                               string &out_error) const {
+  return scanSinceView(Role::Owner, since_seq, budget, visit, out_cursor,
+                       out_error);
+} // EventStore::scanSinceView
+
+bool EventStore::scanSinceView(Role role, long long since_seq,
+                               const ReadBudget &budget,
+                               const EventViewVisitor &visit,
+                               ReadCursor &out_cursor,
+                               string &out_error) const {
+  TOGETHER_TIME_OP(metrics_.get(), Since);
+  TOGETHER_COUNT_AT_EXIT(metrics_.get(), events_scanned, out_cursor.rows);
+  out_cursor = ReadCursor{};
+  out_cursor.next_seq = since_seq;
   out_error.clear();
 
   if (!db_) {
     out_error = "database not open";
-    return out;
+    return false;
+  }
+  if (snapshotRequired(since_seq)) {
+    out_error = "snapshot required";
+    return false;
   }
 
-  const char *sql = "SELECT seq, entity_type, entity_id, op, payload_blob, ts "
-                    "FROM event_log WHERE seq > ? ORDER BY seq ASC";
+  const string *role_sql = nullptr;
+  if (role != Role::Owner) {
+    role_sql = &roleSinceSql(role);
+    if (role_sql->empty()) {
+      out_cursor.done = true; // the role sees no events
+      return true;
+    }
+  }
 
-  sqlite3_stmt *stmt = nullptr;
-  if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+  ReadScope rd(*this);
+  ScopedStmt stmt(role_sql ? rd.stmts().adhoc(*role_sql)
+                           : rd.fixed(kSinceEvents));
+  sqlite3_stmt *code_name = rd.stmts().fixed(kCodeName);
+  if (!stmt) {
     out_error = "prepare failed";
-    return out;
+    return false;
   }
 
-  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)since_seq);
+  sqlite3_bind_int64(stmt.get(), 1, (sqlite3_int64)since_seq);
+  return streamEvents(stmt.get(), code_name, budget, visit, out_cursor,
+                      out_error);
+} // EventStore::scanSinceView
+
+bool EventStore::entityHistory(const string &entity_type,
+                               const string &entity_id, long long after_seq,
+                               const ReadBudget &budget,
+                               const EventVisitor &visit,
+                               ReadCursor &out_cursor,
+                               string &out_error) const {
+  TOGETHER_COUNT_AT_EXIT(metrics_.get(), events_scanned, out_cursor.rows);
+  out_cursor = ReadCursor{};
+  out_cursor.next_seq = after_seq;
+  out_error.clear();
+  if (!db_) {
+    out_error = "database not open";
+    return false;
+  }
 
-  while (sqlite3_step(stmt) == SQLITE_ROW) {
-    DeltaEvent e;
-    e.seq = sqlite3_column_int64(stmt, 0);
-    e.entity_type =
-        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
-    e.entity_id = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2));
-    e.op = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3));
+  ReadScope rd(*this);
+  ScopedStmt stmt(rd.fixed(kEntityHistory));
+  if (!stmt) {
+    out_error = "prepare failed";
+    return false;
+  }
+  bindText(stmt.get(), 1, entity_type);
+  bindText(stmt.get(), 2, entity_id);
+  sqlite3_bind_int64(stmt.get(), 3, (sqlite3_int64)after_seq);
+  DeltaEvent e;
+  return streamEvents(stmt.get(), rd.stmts().fixed(kCodeName), budget,
+                      ownedEvents(e, visit), out_cursor, out_error);
+} // EventStore::entityHistory
+
+bool EventStore::range(long long ts_from, long long ts_to,
+                       const ReadCursor &after, const ReadBudget &budget,
+                       const EventVisitor &visit, ReadCursor &out_cursor,
+                       string &out_error) const {
+  TOGETHER_COUNT_AT_EXIT(metrics_.get(), events_scanned, out_cursor.rows);
+  // Resume after the later of (ts_from, 0) and the cursor's row; read
+  // before out_cursor, which may be the same object, is reset.
+  long long from_ts = ts_from, from_seq = 0;
+  if (after.next_seq > 0 && after.next_ts >= ts_from) {
+    from_ts = after.next_ts;
+    from_seq = after.next_seq;
+  }
+  out_cursor = ReadCursor{};
+  out_cursor.next_ts = from_ts;
+  out_cursor.next_seq = from_seq;
+  out_error.clear();
+  if (!db_) {
+    out_error = "database not open";
+    return false;
+  }
+  if (ts_from >= ts_to) {
+    out_cursor.done = true;
+    return true;
+  }
 
-    const void *blob = sqlite3_column_blob(stmt, 4);
-    int bsz = sqlite3_column_bytes(stmt, 4);
-    if (blob && bsz > 0) {
-      e.payload.assign((const char *)blob, (const char *)blob + bsz);
+  ReadScope rd(*this);
+  ScopedStmt stmt(rd.fixed(kTsRange));
+  if (!stmt) {
+    out_error = "prepare failed";
+    return false;
+  }
+  sqlite3_bind_int64(stmt.get(), 1, (sqlite3_int64)from_ts);
+  sqlite3_bind_int64(stmt.get(), 2, (sqlite3_int64)from_seq);
+  sqlite3_bind_int64(stmt.get(), 3, (sqlite3_int64)ts_to);
+  DeltaEvent e;
+  return streamEvents(stmt.get(), rd.stmts().fixed(kCodeName), budget,
+                      ownedEvents(e, visit), out_cursor, out_error);
+} // EventStore::range
+
+bool EventStore::streamEvents(sqlite3_stmt *st, sqlite3_stmt *code_name,
+                              const ReadBudget &budget,
+                              const EventViewVisitor &visit,
+                              ReadCursor &cursor, string &out_error) const {
+  DeltaEventView e;
+  int rc;
+  while ((rc = sqlite3_step(st)) == SQLITE_ROW) {
+    if (budget.max_rows && cursor.rows >= budget.max_rows)
+      return true; // a row remains, so not done
+
+    e.seq = sqlite3_column_int64(st, 0);
+    e.entity_type = codes_->name(sqlite3_column_int64(st, 1), code_name);
+    e.entity_id = columnView(st, 2);
+    e.op = codes_->name(sqlite3_column_int64(st, 3), code_name);
+    if (e.entity_type.empty() || e.op.empty()) {
+      out_error = "unknown event code";
+      return false;
     }
+    e.payload = blobView(st, 4);
+    e.ts = sqlite3_column_int64(st, 5);
+
+    std::size_t row_bytes = e.entity_type.size() + e.entity_id.size() +
+                            e.op.size() + e.payload.size();
+    if (budget.max_bytes && cursor.rows > 0 &&
+        cursor.bytes + row_bytes > budget.max_bytes)
+      return true;
+
+    cursor.next_seq = e.seq;
+    cursor.next_ts = e.ts;
+    ++cursor.rows;
+    cursor.bytes += row_bytes;
+    if (!visit(e))
+      return true;
+  }
 
-    e.ts = sqlite3_column_int64(stmt, 5);
-    out.push_back(std::move(e));
+  if (rc != SQLITE_DONE) {
+    out_error = "step failed";
+    return false;
   }
+  cursor.done = true;
+  return true;
+} // EventStore::streamEvents
 
-  sqlite3_finalize(stmt);
-  return out;
-} // EventStore::since
+bool EventStore::beginCompaction(long long checkpoint_seq,
+                                 string &out_error) {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  out_error.clear();
+  if (!db_) {
+    out_error = "database not open";
+    return false;
+  }
+  if (checkpoint_seq < checkpoint_seq_) {
+    out_error = "checkpoint cannot move backwards";
+    return false;
+  }
+  if (!beginImmediate()) {
+    out_error = "begin failed";
+    return false;
+  }
+
+  long long max_seq = 0;
+  {
+    ScopedStmt st(stmts_.adhoc("SELECT COALESCE(MAX(seq), 0) FROM event_log"));
+    if (st && sqlite3_step(st.get()) == SQLITE_ROW)
+      max_seq = sqlite3_column_int64(st.get(), 0);
+  }
+  if (checkpoint_seq > max_seq) {
+    rollback();
+    out_error = "checkpoint beyond the end of the log";
+    return false;
+  }
+
+  // A higher checkpoint can supersede events below the old one, so the
+  // pass restarts; windows that were already compacted are cheap.
+  long long through =
+      checkpoint_seq == checkpoint_seq_ ? compacted_through_ : 0;
+  {
+    ScopedStmt st(stmts_.adhoc(
+        "INSERT INTO log_checkpoint(id, checkpoint_seq, compacted_through) "
+        "VALUES(1, ?, ?) ON CONFLICT(id) DO UPDATE SET "
+        "checkpoint_seq = excluded.checkpoint_seq, "
+        "compacted_through = excluded.compacted_through"));
+    if (!st) {
+      rollback();
+      out_error = "prepare failed";
+      return false;
+    }
+    sqlite3_bind_int64(st.get(), 1, (sqlite3_int64)checkpoint_seq);
+    sqlite3_bind_int64(st.get(), 2, (sqlite3_int64)through);
+    if (sqlite3_step(st.get()) != SQLITE_DONE) {
+      rollback();
+      out_error = "checkpoint write failed";
+      return false;
+    }
+  }
+  if (!commit()) {
+    rollback();
+    out_error = "commit failed";
+    return false;
+  }
+
+  checkpoint_seq_ = checkpoint_seq;
+  compacted_through_ = through;
+  return true;
+} // EventStore::beginCompaction
+
+// The first half of a compaction step: every task and budget event in
+// (lo, hi] that a newer event at or below the checkpoint supersedes is
+// folded (snapshot::fold, then snapshot::foldTaskRow for an upsertTask
+// event's task_event_row) into the event after it, so the entity's
+// survivor carries the whole row once the step drops the rest. Events are
+// folded in seq order and each into its direct successor, so a pass that
+// stops between steps, or restarts under a higher checkpoint, folds every
+// event exactly once. Caller owns the transaction.
+#define EVENT_ROW_COLUMNS                                                      \
+  "r.title, r.assignees_csv, r.due_at, r.points, r.status, r.visibility_tag"
+
+bool EventStore::snapshotWindow(long long lo, long long hi,
+                                string &out_error) {
+  // Superseded events and the events that supersede one of them in the
+  // window (idx_event_log_entity probes).
+  ScopedStmt chain(stmts_.adhoc(
+      "SELECT w.seq, w.type_code, w.entity_id, w.op_code, w.payload_blob, "
+      "       w.ts, w.superseded, " EVENT_ROW_COLUMNS " FROM ("
+      "  SELECT e.*, EXISTS (SELECT 1 FROM event_log AS newer "
+      "    WHERE newer.type_code = e.type_code "
+      "      AND newer.entity_id = e.entity_id "
+      "      AND newer.seq > e.seq AND newer.seq <= ?3) AS superseded, "
+      "  EXISTS (SELECT 1 FROM event_log AS older "
+      "    WHERE older.type_code = e.type_code "
+      "      AND older.entity_id = e.entity_id "
+      "      AND older.seq < e.seq AND older.seq > ?1) AS folds "
+      "  FROM event_log AS e WHERE e.seq > ?1 AND e.seq <= ?2) AS w "
+      "LEFT JOIN task_event_row AS r ON r.seq = w.seq "
+      "WHERE superseded OR folds ORDER BY w.seq"));
+  ScopedStmt next(stmts_.adhoc(
+      "SELECT e.seq, e.op_code, e.payload_blob, e.ts, " EVENT_ROW_COLUMNS
+      " FROM event_log AS e LEFT JOIN task_event_row AS r ON r.seq = e.seq "
+      "WHERE e.type_code = ? AND e.entity_id = ? AND e.seq > ? "
+      "ORDER BY e.seq LIMIT 1"));
+  ScopedStmt write(stmts_.adhoc(
+      "UPDATE event_log SET payload_blob = ?1, "
+      "vis_mask = CASE WHEN ?2 THEN ?2 ELSE vis_mask END WHERE seq = ?3"));
+  sqlite3_stmt *code_name = stmts_.fixed(kCodeName);
+  if (!chain || !next || !write || !code_name) {
+    out_error = "prepare failed";
+    return false;
+  }
+
+  // One entry per entity, in order of its first event in the window.
+  struct Chain {
+    long long type_code = 0;
+    string entity_id;
+    string_view entity_type;
+    snapshot::State state;
+    long long last_seq = 0;
+    bool superseded = false;
+  };
+  vector<Chain> chains;
+  std::unordered_map<string, std::size_t> by_entity;
+  PayloadFields scratch;
+  PayloadFields row; // task_event_row of the event folded
+
+  sqlite3_bind_int64(chain.get(), 1, (sqlite3_int64)lo);
+  sqlite3_bind_int64(chain.get(), 2, (sqlite3_int64)hi);
+  sqlite3_bind_int64(chain.get(), 3, (sqlite3_int64)checkpoint_seq_);
+  int rc;
+  while ((rc = sqlite3_step(chain.get())) == SQLITE_ROW) {
+    const long long type_code = sqlite3_column_int64(chain.get(), 1);
+    const string_view type = codes_->name(type_code, code_name);
+    const string_view op =
+        codes_->name(sqlite3_column_int64(chain.get(), 3), code_name);
+    if (!snapshot::folds(type))
+      continue;
+    const string_view id = columnView(chain.get(), 2);
+    string key = std::to_string(type_code);
+    key += ':';
+    key.append(id.data(), id.size());
+    auto [it, added] = by_entity.emplace(std::move(key), chains.size());
+    if (added) {
+      chains.emplace_back();
+      chains.back().type_code = type_code;
+      chains.back().entity_id = string(id);
+      chains.back().entity_type = type;
+    }
+    Chain &c = chains[it->second];
+    const long long ts = sqlite3_column_int64(chain.get(), 5);
+    snapshot::fold(type, op, blobView(chain.get(), 4), ts, c.state, scratch);
+    if (readEventRow(chain.get(), 7, row))
+      snapshot::foldTaskRow(row, ts, c.state);
+    c.last_seq = sqlite3_column_int64(chain.get(), 0);
+    c.superseded = sqlite3_column_int(chain.get(), 6) != 0;
+  }
+  if (rc != SQLITE_DONE) {
+    out_error = "compaction scan failed";
+    return false;
+  }
+
+  string json;
+  for (Chain &c : chains) {
+    long long target = c.last_seq;
+    if (c.superseded) {
+      // The successor lies above the window, at or below the checkpoint.
+      ScopedStmt reset(next.get());
+      sqlite3_bind_int64(next.get(), 1, (sqlite3_int64)c.type_code);
+      bindText(next.get(), 2, c.entity_id);
+      sqlite3_bind_int64(next.get(), 3, (sqlite3_int64)c.last_seq);
+      if (sqlite3_step(next.get()) != SQLITE_ROW) {
+        out_error = "compaction scan failed";
+        return false;
+      }
+      target = sqlite3_column_int64(next.get(), 0);
+      const long long ts = sqlite3_column_int64(next.get(), 3);
+      snapshot::fold(c.entity_type,
+                     codes_->name(sqlite3_column_int64(next.get(), 1),
+                                  code_name),
+                     blobView(next.get(), 2), ts, c.state, scratch);
+      if (readEventRow(next.get(), 4, row))
+        snapshot::foldTaskRow(row, ts, c.state);
+    }
+    if (!c.state.exists)
+      continue; // nothing to carry: the survivor replays to no row
+
+    string_view payload;
+    if (payload_format_ == PayloadFormat::Binary) {
+      payload::encodeBinary(c.entity_type, c.state.fields, payload_scratch_);
+      payload = payload_scratch_;
+    } else {
+      json = payload::toJson(c.state.fields);
+      payload = json;
+    }
+    ScopedStmt reset(write.get());
+    bindBlob(write.get(), 1, payload);
+    sqlite3_bind_int(write.get(), 2, (int)visibility::payloadTagBit(payload));
+    sqlite3_bind_int64(write.get(), 3, (sqlite3_int64)target);
+    if (sqlite3_step(write.get()) != SQLITE_DONE) {
+      out_error = "snapshot write failed";
+      return false;
+    }
+  }
+  return true;
+} // EventStore::snapshotWindow
+
+#undef EVENT_ROW_COLUMNS
+
+bool EventStore::compactStep(std::size_t max_rows,
+                             CompactionProgress &out_progress,
+                             string &out_error) {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  out_progress = CompactionProgress{};
+  out_error.clear();
+  if (!db_) {
+    out_error = "database not open";
+    return false;
+  }
+
+  out_progress.checkpoint_seq = checkpoint_seq_;
+  out_progress.compacted_through = compacted_through_;
+  if (compacted_through_ >= checkpoint_seq_) {
+    out_progress.done = true;
+    return true;
+  }
+
+  const long long lo = compacted_through_;
+  const long long hi = std::min<long long>(
+      checkpoint_seq_.load(), lo + (long long)(max_rows ? max_rows : 1));
+
+  if (!beginImmediate()) {
+    out_error = "begin failed";
+    return false;
+  }
+
+  if (!snapshotWindow(lo, hi, out_error)) {
+    rollback();
+    return false;
+  }
+
+  // Drop every event in (lo, hi] that a newer event for the same entity
+  // at or below the checkpoint supersedes (idx_event_log_entity probe).
+  {
+    ScopedStmt st(stmts_.adhoc(
+        "DELETE FROM event_log WHERE seq > ?1 AND seq <= ?2 AND EXISTS ("
+        "  SELECT 1 FROM event_log AS newer "
+        "  WHERE newer.type_code = event_log.type_code "
+        "    AND newer.entity_id = event_log.entity_id "
+        "    AND newer.seq > event_log.seq AND newer.seq <= ?3)"));
+    if (!st) {
+      rollback();
+      out_error = "prepare failed";
+      return false;
+    }
+    sqlite3_bind_int64(st.get(), 1, (sqlite3_int64)lo);
+    sqlite3_bind_int64(st.get(), 2, (sqlite3_int64)hi);
+    sqlite3_bind_int64(st.get(), 3, (sqlite3_int64)checkpoint_seq_);
+    if (sqlite3_step(st.get()) != SQLITE_DONE) {
+      rollback();
+      out_error = "compaction delete failed";
+      return false;
+    }
+    out_progress.rows_deleted = sqlite3_changes(db_);
+  }
+  {
+    ScopedStmt st(stmts_.adhoc(
+        "DELETE FROM task_event_row WHERE seq > ?1 AND seq <= ?2 AND NOT "
+        "EXISTS (SELECT 1 FROM event_log WHERE seq = task_event_row.seq)"));
+    if (!st) {
+      rollback();
+      out_error = "prepare failed";
+      return false;
+    }
+    sqlite3_bind_int64(st.get(), 1, (sqlite3_int64)lo);
+    sqlite3_bind_int64(st.get(), 2, (sqlite3_int64)hi);
+    if (sqlite3_step(st.get()) != SQLITE_DONE) {
+      rollback();
+      out_error = "compaction delete failed";
+      return false;
+    }
+  }
+  {
+    ScopedStmt st(stmts_.adhoc(
+        "UPDATE log_checkpoint SET compacted_through = ? WHERE id = 1"));
+    if (!st) {
+      rollback();
+      out_error = "prepare failed";
+      return false;
+    }
+    sqlite3_bind_int64(st.get(), 1, (sqlite3_int64)hi);
+    if (sqlite3_step(st.get()) != SQLITE_DONE) {
+      rollback();
+      out_error = "checkpoint write failed";
+      return false;
+    }
+  }
+  if (!commit()) {
+    rollback();
+    out_error = "commit failed";
+    return false;
+  }
+
+  compacted_through_ = hi;
+  out_progress.compacted_through = hi;
+  out_progress.done = hi >= checkpoint_seq_;
+  return true;
+} // EventStore::compactStep
+
+bool EventStore::exportDelta(long long since_seq, string &out_bundle,
+                             string &out_error) const {
+  out_bundle.clear();
+  vector<DeltaEvent> events;
+  ReadCursor cursor;
+  if (!scanSinceView(
+          since_seq, ReadBudget{},
+          [&events](const DeltaEventView &v) {
+            events.push_back(v.toOwned()); // stored bytes, either format
+            return true;
+          },
+          cursor, out_error))
+    return false;
+  bundle::encode(events, out_bundle);
+  return true;
+} // EventStore::exportDelta
+
+long long EventStore::importDelta(string_view bundle_bytes,
+                                  SeqRange &out_range, string &out_error) {
+  out_range = SeqRange{};
+  vector<DeltaEvent> events;
+  if (!bundle::decode(bundle_bytes, events, out_error))
+    return -8;
+  // Imported events merge like any peer's: task events reach the task
+  // table, and an event imported before is dropped.
+  vector<RemoteEvent> batch(events.size());
+  for (std::size_t i = 0; i < events.size(); ++i) {
+    batch[i].remote_id = importId(events[i]);
+    batch[i].event = std::move(events[i]);
+  }
+  IngestReport report;
+  long long rc = ingestBatch(batch, true, report);
+  if (rc < 0)
+    out_error = "import failed";
+  else
+    out_range = report.range;
+  return rc;
+} // EventStore::importDelta
 
 bool EventStore::getTaskId(const string &id, TaskRow &out,
                            string &out_error) const {
+  return viewTask(
+      id, [&out](const TaskRowView &v) { v.copyTo(out); }, out_error);
+} // EventStore::getTaskId
+
+bool EventStore::viewTask(const string &id,
+                          const std::function<void(const TaskRowView &)> &visit,
+                          string &out_error) const {
+  TOGETHER_TIME_OP(metrics_.get(), GetTask);
   out_error.clear();
   if (!db_) {
     out_error = "database not open";
     return false;
   }
 
-  const char *sql = "SELECT id, title, assignees_csv, due_at, points, status, "
-                    "visibility_tag, updated_at "
-                    "FROM task WHERE id = ?";
-  sqlite3_stmt *st = nullptr;
-  if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) != SQLITE_OK) {
+  // A hit is copied out so the visitor runs without cache_mu_ held. The
+  // copy lives on this frame: a visitor may call viewTask again.
+  unsigned long long generation = 0;
+  {
+    std::unique_lock<std::mutex> lock(cache_mu_);
+    if (task_cache_) {
+      TaskRow hit;
+      if (task_cache_->get(id, hit)) {
+        lock.unlock();
+        TaskRowView v;
+        v.id = hit.id;
+        v.title = hit.title;
+        v.assignees_csv = hit.assignees_csv;
+        v.due_at = hit.due_at;
+        v.points = hit.points;
+        v.status = hit.status;
+        v.visibility_tag = hit.visibility_tag;
+        v.updated_at = hit.updated_at;
+        visit(v);
+        return true;
+      }
+      generation = cache_generation_;
+    }
+  }
+
+  ReadScope rd(*this);
+  ScopedStmt st(rd.fixed(kGetTask));
+  if (!st) {
     out_error = "prepare failed";
     return false;
   }
 
-  // TODO: bind id
-  sqlite3_bind_text(st, 1, id.c_str(), -1, SQLITE_TRANSIENT);
-  bool ok = false;
-  if (sqlite3_step(st) == SQLITE_ROW) {
-    out.id = reinterpret_cast<const char *>(sqlite3_column_text(st, 0));
-    out.title = reinterpret_cast<const char *>(sqlite3_column_text(st, 1));
-    out.assignees_csv =
-        reinterpret_cast<const char *>(sqlite3_column_text(st, 2));
-    out.due_at = sqlite3_column_int64(st, 3);
-    out.points = sqlite3_column_int(st, 4);
-    out.status = reinterpret_cast<const char *>(sqlite3_column_text(st, 5));
-    out.visibility_tag =
-        reinterpret_cast<const char *>(sqlite3_column_text(st, 6));
-    out.updated_at = sqlite3_column_int64(st, 7);
-
-    ok = true;
-  } else {
+  bindText(st.get(), 1, id);
+  if (sqlite3_step(st.get()) != SQLITE_ROW) {
     out_error = "not found";
+    return false;
   }
 
-  sqlite3_finalize(st);
-  return ok;
-} // EventStore::getTaskId
+  TaskRowView row;
+  readTaskView(st.get(), row);
+  {
+    std::lock_guard<std::mutex> lock(cache_mu_);
+    if (task_cache_ && generation == cache_generation_)
+      task_cache_->put(row.toOwned());
+  }
+  visit(row);
+  return true;
+} // EventStore::viewTask
+
+void EventStore::setTaskCacheBudget(std::size_t budget_bytes) {
+  std::lock_guard<std::mutex> lock(cache_mu_);
+  if (budget_bytes == 0) {
+    task_cache_.reset();
+    return;
+  }
+  if (task_cache_)
+    task_cache_->setBudget(budget_bytes);
+  else
+    task_cache_ = std::make_unique<TaskCache>(budget_bytes);
+} // EventStore::setTaskCacheBudget
+
+string EventStore::loadDueTasks(vector<DueTask> &out) {
+  ScopedStmt st(stmts_.fixed(kDueTasks));
+  if (!st)
+    return "database not open";
+  int rc;
+  while ((rc = sqlite3_step(st.get())) == SQLITE_ROW)
+    out.push_back(DueTask{string(columnView(st.get(), 0)),
+                          sqlite3_column_int64(st.get(), 1)});
+  if (rc != SQLITE_DONE)
+    return "due task load failed: " + string(sqlite3_errmsg(db_));
+  return {};
+} // EventStore::loadDueTasks
 
-long long EventStore::upsertTask(const string &id, const string &title,
-                                 const string &assignees_csv, long long due_at,
-                                 int points, const string &status,
-                                 const string &visibility_tag,
-                                 long long updated_at_millis,
-                                 const string &payload_json) {
+string EventStore::enableDueScheduler() {
+  // Under the writer lock no write can commit between the load and the
+  // scheduler going live.
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  if (!db_)
+    return "database not open";
+  vector<DueTask> tasks;
+  string err = loadDueTasks(tasks);
+  if (!err.empty())
+    return err;
+  std::lock_guard<std::mutex> due_lock(due_mu_);
+  if (!due_)
+    due_ = std::make_unique<DueScheduler>();
+  due_->load(std::move(tasks));
+  return {};
+} // EventStore::enableDueScheduler
+
+void EventStore::disableDueScheduler() {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  std::lock_guard<std::mutex> due_lock(due_mu_);
+  due_.reset();
+} // EventStore::disableDueScheduler
+
+vector<DueTask> EventStore::nextDue(long long now, std::size_t n) const {
+  std::lock_guard<std::mutex> lock(due_mu_);
+  return due_ ? due_->nextDue(now, n) : vector<DueTask>{};
+} // EventStore::nextDue
+
+vector<DueTask> EventStore::drainDue(long long now) {
+  std::lock_guard<std::mutex> lock(due_mu_);
+  return due_ ? due_->drainDue(now) : vector<DueTask>{};
+} // EventStore::drainDue
+
+bool EventStore::getRecurrence(const string &entity_type,
+                               const string &entity_id, Recurrence &out,
+                               string &out_error) const {
+  out_error.clear();
+  if (!db_) {
+    out_error = "database not open";
+    return false;
+  }
+  PayloadFields fields;
+  std::size_t rrule = 0;
+  {
+    ReadScope rd(*this);
+    if (!loadSeries(rd.stmts().fixed(kLatestEvent), entity_type, entity_id,
+                    fields, rrule, out_error))
+      return false;
+  }
+  return Recurrence::parse(fields[rrule].s, out, out_error);
+} // EventStore::getRecurrence
+
+long long EventStore::overrideOccurrence(const string &entity_type,
+                                         const string &entity_id,
+                                         const RecurrenceOverride &change,
+                                         long long ts_millis) {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
   if (!db_)
     return -1;
-
-  // Begin a transaction so the table write and event append are atomic
-  char *errmsg = nullptr;
-  if (sqlite3_exec(db_, "BEGIN IMMEDIATE;", nullptr, nullptr, &errmsg) !=
-      SQLITE_OK) {
-    string err = errmsg ? errmsg : "begin failed";
-    if (errmsg)
-      sqlite3_free(errmsg);
+  if (!beginImmediate())
     return -2;
-  }
 
-  // 1) Upsert task row
-  const char *sql_task = "INSERT INTO task(id, title, assignees_csv, due_at, "
-                         "points, status, visibility_tag, updated_at) "
-                         "VALUES(?,?,?,?,?,?,?,?) "
-                         "ON CONFLICT(id) DO UPDATE SET "
-                         "  title=excluded.title, "
-                         "  assignees_csv=excluded.assignees_csv, "
-                         "  due_at=excluded.due_at, "
-                         "  points=excluded.points, "
-                         "  status=excluded.status, "
-                         "  visibility_tag=excluded.visibility_tag, "
-                         "  updated_at=excluded.updated_at";
-
-  sqlite3_stmt *st_task = nullptr;
-  if (sqlite3_prepare_v2(db_, sql_task, -1, &st_task, nullptr) != SQLITE_OK) {
-    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+  PayloadFields fields;
+  std::size_t rrule = 0;
+  Recurrence series;
+  string err;
+  if (!loadSeries(stmts_.fixed(kLatestEvent), entity_type, entity_id, fields,
+                  rrule, err) ||
+      !Recurrence::parse(fields[rrule].s, series, err)) {
+    rollback();
     return -3;
   }
+  if (!series.setOverride(change, err)) {
+    rollback();
+    return -4;
+  }
+  fields[rrule].s = series.encode();
 
-  sqlite3_bind_text(st_task, 1, id.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(st_task, 2, title.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(st_task, 3, assignees_csv.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(st_task, 4, (sqlite3_int64)due_at);
-  sqlite3_bind_int(st_task, 5, points); // <-- this was wrong before
-  sqlite3_bind_text(st_task, 6, status.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(st_task, 7, visibility_tag.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(st_task, 8, (sqlite3_int64)updated_at_millis);
+  long long seq = insertEvent(entity_type, entity_id, "upsert",
+                              payload::toJson(fields), ts_millis);
+  if (seq < 1) {
+    rollback();
+    return -6;
+  }
+  if (!commit()) {
+    rollback();
+    return -7;
+  }
+  return seq;
+} // EventStore::overrideOccurrence
 
-  if (sqlite3_step(st_task) != SQLITE_DONE) {
-    sqlite3_finalize(st_task);
-    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+StoreStats EventStore::stats() const {
+  StoreStats out;
+  if (!metrics_)
+    return out;
+  out.enabled = true;
+  for (std::size_t i = 0; i < (std::size_t)StoreOp::kCount; ++i) {
+    const LatencyHistogram &h = metrics_->latency[i];
+    OpLatencyStats op;
+    op.op = kStoreOpNames[i];
+    op.count = h.count();
+    op.total_ms = h.totalNanos() / 1e6;
+    op.p50_us = h.percentileNanos(0.50) / 1e3;
+    op.p99_us = h.percentileNanos(0.99) / 1e3;
+    op.p999_us = h.percentileNanos(0.999) / 1e3;
+    op.max_us = h.maxNanos() / 1e3;
+    out.ops.push_back(op);
+  }
+  auto load = [](const std::atomic<std::uint64_t> &v) {
+    return v.load(std::memory_order_relaxed);
+  };
+  out.payload_bytes_written = load(metrics_->payload_bytes_written);
+  out.events_scanned = load(metrics_->events_scanned);
+  out.task_rows_scanned = load(metrics_->task_rows_scanned);
+  out.rollbacks = load(metrics_->rollbacks);
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  out.statements_prepared = stmts_.adhocMisses();
+  return out;
+} // EventStore::stats
+
+void EventStore::resetStats() {
+  if (!metrics_)
+    return;
+  for (LatencyHistogram &h : metrics_->latency)
+    h.reset();
+  for (auto *counter :
+       {&metrics_->payload_bytes_written, &metrics_->events_scanned,
+        &metrics_->task_rows_scanned, &metrics_->rollbacks})
+    counter->store(0, std::memory_order_relaxed);
+} // EventStore::resetStats
+
+TaskCacheStats EventStore::taskCacheStats() const {
+  std::lock_guard<std::mutex> lock(cache_mu_);
+  return task_cache_ ? task_cache_->stats() : TaskCacheStats{};
+} // EventStore::taskCacheStats
+
+// Caller owns the transaction. Returns the event seq or the negative code
+// the public write methods report.
+long long EventStore::upsertTaskInTxn(string_view id, string_view title,
+                                      string_view assignees_csv,
+                                      long long due_at, int points,
+                                      string_view status,
+                                      string_view visibility_tag,
+                                      long long updated_at,
+                                      string_view payload_json) {
+  // 1) Upsert task row
+  if (!stmts_.fixed(kUpsertTask))
+    return -3;
+  if (!writeTaskRow(id, title, assignees_csv, due_at, points, status,
+                    visibility_tag, updated_at))
     return -4;
+  if (task_cache_ || due_) {
+    PendingCacheWrite w;
+    w.row = TaskRow{string(id),     string(title),  string(assignees_csv),
+                    due_at,         points,         string(status),
+                    string(visibility_tag), updated_at};
+    pending_cache_.push_back(std::move(w));
   }
-  sqlite3_finalize(st_task);
 
   // 2) Append corresponding event_log record
-  const char *sql_ev =
-      "INSERT INTO event_log(entity_type, entity_id, op, payload_blob, ts) "
-      "VALUES(?,?,?,?,?)";
+  if (!stmts_.fixed(kAppendEvent))
+    return -5;
+  long long ev_seq = insertEvent("task", id, "upsert", payload_json, updated_at,
+                                visibility::tagBit(visibility_tag));
+  if (ev_seq < 1)
+    return -6;
 
-  sqlite3_stmt *st_ev = nullptr;
-  if (sqlite3_prepare_v2(db_, sql_ev, -1, &st_ev, nullptr) != SQLITE_OK) {
-    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+  // 3) Record the row beside it for replay
+  ScopedStmt st(stmts_.fixed(kTaskEventRow));
+  if (!st)
     return -5;
-  }
+  sqlite3_bind_int64(st.get(), 1, (sqlite3_int64)ev_seq);
+  bindText(st.get(), 2, title);
+  bindText(st.get(), 3, assignees_csv);
+  sqlite3_bind_int64(st.get(), 4, (sqlite3_int64)due_at);
+  sqlite3_bind_int(st.get(), 5, points);
+  bindText(st.get(), 6, status);
+  bindText(st.get(), 7, visibility_tag);
+  if (sqlite3_step(st.get()) != SQLITE_DONE)
+    return -6;
+  return ev_seq;
+} // EventStore::upsertTaskInTxn
 
-  const char *entity_type = "task";
-  const char *op = "upsert";
+// Caller owns the transaction; same return convention as upsertTaskInTxn.
+long long EventStore::deleteTaskInTxn(string_view id, long long ts_millis,
+                                      string_view payload_json) {
+  // soft-delete the task
+  {
+    ScopedStmt st_task(stmts_.fixed(kDeleteTask));
+    if (!st_task)
+      return -3;
 
-  sqlite3_bind_text(st_ev, 1, entity_type, -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(st_ev, 2, id.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(st_ev, 3, op, -1, SQLITE_TRANSIENT);
-  sqlite3_bind_blob(st_ev, 4, payload_json.data(), (int)payload_json.size(),
-                    SQLITE_TRANSIENT);
-  sqlite3_bind_int64(st_ev, 5, (sqlite3_int64)updated_at_millis);
+    sqlite3_bind_int64(st_task.get(), 1, (sqlite3_int64)ts_millis);
+    bindText(st_task.get(), 2, id);
 
-  if (sqlite3_step(st_ev) != SQLITE_DONE) {
-    sqlite3_finalize(st_ev);
-    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
-    return -6;
+    if (sqlite3_step(st_task.get()) != SQLITE_DONE)
+      return -4;
+  }
+  {
+    ScopedStmt st_members(stmts_.fixed(kDeleteAssignees));
+    if (!st_members)
+      return -3;
+    sqlite3_bind_int64(st_members.get(), 1, (sqlite3_int64)ts_millis);
+    bindText(st_members.get(), 2, id);
+    if (sqlite3_step(st_members.get()) != SQLITE_DONE)
+      return -4;
+  }
+  if (task_cache_ || due_) {
+    PendingCacheWrite w;
+    w.row.id = string(id);
+    w.row.updated_at = ts_millis;
+    w.deleted = true;
+    pending_cache_.push_back(std::move(w));
   }
 
-  long long ev_seq = (long long)sqlite3_last_insert_rowid(db_);
-  sqlite3_finalize(st_ev);
+  //  Append delete event
+  if (!stmts_.fixed(kAppendEvent))
+    return -5;
+  long long ev_seq = insertEvent("task", id, "delete", payload_json, ts_millis);
+  return ev_seq < 1 ? -6 : ev_seq;
+} // EventStore::deleteTaskInTxn
 
-  // 3) Commit
-  if (sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, &errmsg) != SQLITE_OK) {
-    string err = errmsg ? errmsg : "commit failed";
-    if (errmsg)
-      sqlite3_free(errmsg);
-    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+long long EventStore::upsertTask(const string &id, const string &title,
+                                 const string &assignees_csv, long long due_at,
+                                 int points, const string &status,
+                                 const string &visibility_tag,
+                                 long long updated_at_millis,
+                                 const string &payload_json) {
+  TOGETHER_TIME_OP(metrics_.get(), UpsertTask);
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  if (!db_)
+    return -1;
+
+  // Begin a transaction so the table write and event append are atomic
+  if (!beginImmediate())
+    return -2;
+
+  long long ev_seq =
+      upsertTaskInTxn(id, title, assignees_csv, due_at, points, status,
+                      visibility_tag, updated_at_millis, payload_json);
+  if (ev_seq < 1) {
+    rollback();
+    return ev_seq;
+  }
+
+  // Commit
+  if (!commit()) {
+    rollback();
     return -7;
   }
 
   return ev_seq;
 } // EventStore::upsertTask
-long long EventStore::deleteTask(const std::string &id, long long ts_millis,
-                                 const std::string &json_payload) {
+
+long long EventStore::upsertTasks(const vector<TaskUpsert> &tasks,
+                                  SeqRange &out_range) {
+  TOGETHER_TIME_OP(metrics_.get(), UpsertTasks);
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  out_range = SeqRange{};
   if (!db_)
     return -1;
+  if (tasks.empty())
+    return 0;
+  if (!stmts_.fixed(kUpsertTask) || !stmts_.fixed(kAppendEvent))
+    return -3;
 
-  // Begin transaction
-  char *errmsg = nullptr;
-  if (sqlite3_exec(db_, "BEGIN IMMEDIATE;", nullptr, nullptr, &errmsg) !=
-      SQLITE_OK) {
-    string err = errmsg ? errmsg : "begin failed";
-    if (errmsg)
-      sqlite3_free(errmsg);
+  if (!beginImmediate())
     return -2;
-  }
-
-  // soft-delete the task
-  const char *sql_task =
-      "UPDATE task SET status='deleted', updated_at=? WHERE id=?";
 
-  sqlite3_stmt *st_task = nullptr;
-  if (sqlite3_prepare_v2(db_, sql_task, -1, &st_task, nullptr) != SQLITE_OK) {
-    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
-    return -3;
+  SeqRange range;
+  for (std::size_t i = 0; i < tasks.size(); ++i) {
+    const TaskRow &r = tasks[i].row;
+    long long seq = upsertTaskInTxn(r.id, r.title, r.assignees_csv, r.due_at,
+                                    r.points, r.status, r.visibility_tag,
+                                    r.updated_at, tasks[i].payload_json);
+    if (seq < 1) {
+      rollback();
+      return seq;
+    }
+    if (i == 0)
+      range.first = seq;
+    range.last = seq;
   }
 
-  sqlite3_bind_int64(st_task, 1, (sqlite3_int64)ts_millis);
-  sqlite3_bind_text(st_task, 2, id.c_str(), -1, SQLITE_TRANSIENT);
-
-  int rc_task = sqlite3_step(st_task);
-  sqlite3_finalize(st_task);
-  if (rc_task != SQLITE_DONE) {
-    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
-    return -4;
+  if (!commit()) {
+    rollback();
+    return -7;
   }
 
-  //  Append delete event
-  const char *sql_ev =
-      "INSERT INTO event_log(entity_type, entity_id, op, payload_blob, ts) "
-      "VALUES(?,?,?,?,?)";
+  out_range = range;
+  return range.last;
+} // EventStore::upsertTasks
 
-  sqlite3_stmt *st_ev = nullptr;
-  if (sqlite3_prepare_v2(db_, sql_ev, -1, &st_ev, nullptr) != SQLITE_OK) {
-    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
-    return -5;
-  }
-
-  const char *entity_type = "task";
-  const char *op = "delete";
+long long EventStore::deleteTask(const std::string &id, long long ts_millis,
+                                 const std::string &json_payload) {
+  TOGETHER_TIME_OP(metrics_.get(), DeleteTask);
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  if (!db_)
+    return -1;
 
-  sqlite3_bind_text(st_ev, 1, entity_type, -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(st_ev, 2, id.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(st_ev, 3, op, -1, SQLITE_TRANSIENT);
-  sqlite3_bind_blob(st_ev, 4, json_payload.data(), (int)json_payload.size(),
-                    SQLITE_TRANSIENT);
-  sqlite3_bind_int64(st_ev, 5, (sqlite3_int64)ts_millis);
+  // Begin transaction
+  if (!beginImmediate())
+    return -2;
 
-  int rc_ev = sqlite3_step(st_ev);
-  if (rc_ev != SQLITE_DONE) {
-    sqlite3_finalize(st_ev);
-    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
-    return -6;
+  long long ev_seq = deleteTaskInTxn(id, ts_millis, json_payload);
+  if (ev_seq < 1) {
+    rollback();
+    return ev_seq;
   }
-  long long ev_seq = (long long)sqlite3_last_insert_rowid(db_);
-  sqlite3_finalize(st_ev);
 
   // Commit
-  if (sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, &errmsg) != SQLITE_OK) {
-    std::string err = errmsg ? errmsg : "commit failed";
-    if (errmsg)
-      sqlite3_free(errmsg);
-    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+  if (!commit()) {
+    rollback();
     return -7;
   }
 
@@ -378,50 +1972,288 @@ std::vector<TaskRow> EventStore::listTasks(const std::string &status_filter,
                                            int offset,
                                            std::string &out_error) const {
     std::vector<TaskRow> results;
-    out_error.clear();
+    forEachTask(status_filter, limit, offset,
+                [&results](const TaskRowView &v) {
+                    results.push_back(v.toOwned());
+                    return true;
+                },
+                out_error);
+    return results;
+} // EventStore::listTasks
+
+bool EventStore::forEachTask(const string &status_filter, int limit,
+                             int offset, const TaskViewVisitor &visit,
+                             string &out_error) const {
+  TOGETHER_TIME_OP(metrics_.get(), ListTasks);
+  std::size_t scanned = 0;
+  TOGETHER_COUNT_AT_EXIT(metrics_.get(), task_rows_scanned, scanned);
+  out_error.clear();
 
-    if (!db_) {
-        out_error = "database not open";
-        return results;
-    }
+  if (!db_) {
+    out_error = "database not open";
+    return false;
+  }
 
-    const char *sql =
-        "SELECT id, title, assignees_csv, due_at, points, status, visibility_tag, updated_at "
-        "FROM task "
-        "WHERE (? = '' OR status = ?) "
-        "ORDER BY updated_at DESC "
-        "LIMIT ? OFFSET ?";
-
-    sqlite3_stmt *stmt = nullptr;
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        out_error = "prepare failed in listTasks";
-        return results;
+  // Separate statements for the filtered and unfiltered cases so each
+  // can walk its own index.
+  const bool by_status = !status_filter.empty();
+  ReadScope rd(*this);
+  ScopedStmt stmt(rd.fixed(by_status ? kListTasksByStatus : kListTasks));
+  if (!stmt) {
+    out_error = "prepare failed in listTasks";
+    return false;
+  }
+
+  // bind filter, limit, offset
+  int idx = 1;
+  if (by_status)
+    bindText(stmt.get(), idx++, status_filter);
+  sqlite3_bind_int(stmt.get(), idx++, limit);
+  sqlite3_bind_int(stmt.get(), idx++, offset);
+
+  TaskRowView row;
+  while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+    ++scanned;
+    readTaskView(stmt.get(), row);
+    if (!visit(row))
+      break;
+  }
+  return true;
+} // EventStore::forEachTask
+
+std::vector<TaskRow> EventStore::listTasks(Role role, const string &member_id,
+                                           const string &status_filter,
+                                           int limit, int offset,
+                                           string &out_error) const {
+  std::vector<TaskRow> results;
+  forEachTask(role, member_id, status_filter, limit, offset,
+              [&results](const TaskRowView &v) {
+                results.push_back(v.toOwned());
+                return true;
+              },
+              out_error);
+  return results;
+} // EventStore::listTasks
+
+bool EventStore::forEachTask(Role role, const string &member_id,
+                             const string &status_filter, int limit,
+                             int offset, const TaskViewVisitor &visit,
+                             string &out_error) const {
+  if (role == Role::Owner)
+    return forEachTask(status_filter, limit, offset, visit, out_error);
+
+  TOGETHER_TIME_OP(metrics_.get(), ListTasks);
+  std::size_t scanned = 0;
+  TOGETHER_COUNT_AT_EXIT(metrics_.get(), task_rows_scanned, scanned);
+  out_error.clear();
+
+  if (!db_) {
+    out_error = "database not open";
+    return false;
+  }
+  if (limit <= 0)
+    return true;
+  const bool by_status = !status_filter.empty();
+  const vector<string> &arms = roleTaskArmsSql(role, by_status);
+  if (arms.empty())
+    return true; // the role sees no tasks
+
+  // Each arm is stepped to its first row as soon as it is fetched; its
+  // ScopedStmt pins it in the adhoc cache until the arm is exhausted and
+  // dropped, so later fetches cannot finalize it.
+  ReadScope rd(*this);
+  vector<ScopedStmt> heads;
+  heads.reserve(arms.size());
+  for (const string &sql : arms) {
+    ScopedStmt arm = rd.stmts().adhoc(sql);
+    sqlite3_stmt *st = arm.get();
+    if (!st) {
+      out_error = "prepare failed in listTasks";
+      return false;
     }
+    if (!member_id.empty())
+      bindText(st, 1, member_id);
+    if (by_status)
+      bindText(st, 2, status_filter);
+    sqlite3_bind_int64(st, 3, (sqlite3_int64)limit + std::max(offset, 0));
+    if (sqlite3_step(st) == SQLITE_ROW)
+      heads.push_back(std::move(arm));
+  }
 
-    // bind filter, limit, offset
-    sqlite3_bind_text(stmt, 1, status_filter.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, status_filter.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, 3, limit);
-    sqlite3_bind_int(stmt, 4, offset);
-
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        TaskRow row;
-        row.id            = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-        row.title         = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
-        row.assignees_csv = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2));
-        row.due_at        = sqlite3_column_int64(stmt, 3);
-        row.points        = sqlite3_column_int(stmt, 4);
-        row.status        = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 5));
-        row.visibility_tag= reinterpret_cast<const char *>(sqlite3_column_text(stmt, 6));
-        row.updated_at    = sqlite3_column_int64(stmt, 7);
-
-        results.push_back(std::move(row));
+  // Merge on (updated_at DESC, id DESC), the order every arm already has.
+  auto before = [](sqlite3_stmt *a, sqlite3_stmt *b) {
+    const long long ua = sqlite3_column_int64(a, 7);
+    const long long ub = sqlite3_column_int64(b, 7);
+    if (ua != ub)
+      return ua > ub;
+    return columnView(a, 0) > columnView(b, 0);
+  };
+  TaskRowView row;
+  int skip = std::max(offset, 0);
+  int left = limit;
+  while (!heads.empty() && left > 0) {
+    std::size_t best = 0;
+    for (std::size_t i = 1; i < heads.size(); ++i)
+      if (before(heads[i].get(), heads[best].get()))
+        best = i;
+    sqlite3_stmt *st = heads[best].get();
+    ++scanned;
+    if (skip > 0) {
+      --skip;
+    } else {
+      readTaskView(st, row);
+      --left;
+      if (!visit(row))
+        break;
     }
+    if (sqlite3_step(st) != SQLITE_ROW)
+      heads.erase(heads.begin() + (std::ptrdiff_t)best);
+  }
+  return true;
+} // EventStore::forEachTask
+
+std::vector<TaskRow> EventStore::listTasksPage(const string &status_filter,
+                                               int limit,
+                                               const string &page_token,
+                                               string &out_next_token,
+                                               string &out_error) const {
+  std::vector<TaskRow> results;
+  forEachTaskPage(
+      status_filter, limit, page_token,
+      [&results](const TaskRowView &v) {
+        results.push_back(v.toOwned());
+        return true;
+      },
+      out_next_token, out_error);
+  return results;
+} // EventStore::listTasksPage
+
+bool EventStore::forEachTaskPage(const string &status_filter, int limit,
+                                 const string &page_token,
+                                 const TaskViewVisitor &visit,
+                                 string &out_next_token,
+                                 string &out_error) const {
+  return pageTasks({}, status_filter, limit, page_token, visit, out_next_token,
+                   out_error);
+} // EventStore::forEachTaskPage
+
+std::vector<TaskRow> EventStore::listTasksForMember(
+    const string &member_id, const string &status_filter, int limit,
+    const string &page_token, string &out_next_token,
+    string &out_error) const {
+  std::vector<TaskRow> results;
+  forEachTaskForMember(
+      member_id, status_filter, limit, page_token,
+      [&results](const TaskRowView &v) {
+        results.push_back(v.toOwned());
+        return true;
+      },
+      out_next_token, out_error);
+  return results;
+} // EventStore::listTasksForMember
+
+bool EventStore::forEachTaskForMember(const string &member_id,
+                                      const string &status_filter, int limit,
+                                      const string &page_token,
+                                      const TaskViewVisitor &visit,
+                                      string &out_next_token,
+                                      string &out_error) const {
+  if (member_id.empty()) {
+    out_next_token.clear();
+    out_error = "member_id must not be empty";
+    return false;
+  }
+  return pageTasks(member_id, status_filter, limit, page_token, visit,
+                   out_next_token, out_error);
+} // EventStore::forEachTaskForMember
+
+// Keyset pages over every task, or over member_id's tasks (task_assignee)
+// when it is non-empty.
+bool EventStore::pageTasks(string_view member_id, const string &status_filter,
+                           int limit, const string &page_token,
+                           const TaskViewVisitor &visit,
+                           string &out_next_token, string &out_error) const {
+  TOGETHER_TIME_OP(metrics_.get(), ListTasks);
+  std::size_t scanned = 0;
+  TOGETHER_COUNT_AT_EXIT(metrics_.get(), task_rows_scanned, scanned);
+  out_next_token.clear();
+  out_error.clear();
 
-    sqlite3_finalize(stmt);
-    return results;
-}
+  if (!db_) {
+    out_error = "database not open";
+    return false;
+  }
+  if (limit <= 0) {
+    out_error = "limit must be positive";
+    return false;
+  }
+
+  long long after_updated = 0;
+  string_view after_id;
+  const bool first_page = page_token.empty();
+  if (!first_page && !decodePageToken(page_token, after_updated, after_id)) {
+    out_error = "invalid page token";
+    return false;
+  }
 
+  // The first page is the OFFSET 0 query; later pages seek past the
+  // token's (updated_at, id), so page N costs the same as page 1.
+  const bool by_status = !status_filter.empty();
+  const bool by_member = !member_id.empty();
+  Stmt slot;
+  if (by_member)
+    slot = first_page ? (by_status ? kMemberTasksByStatus : kMemberTasks)
+                      : (by_status ? kMemberTasksByStatusAfter
+                                   : kMemberTasksAfter);
+  else
+    slot = first_page ? (by_status ? kListTasksByStatus : kListTasks)
+                      : (by_status ? kListTasksByStatusAfter
+                                   : kListTasksAfter);
+  ReadScope rd(*this);
+  ScopedStmt stmt(rd.fixed(slot));
+  if (!stmt) {
+    out_error = "prepare failed in listTasksPage";
+    return false;
+  }
+
+  int idx = 1;
+  if (by_member)
+    bindText(stmt.get(), idx++, member_id);
+  if (by_status)
+    bindText(stmt.get(), idx++, status_filter);
+  if (!first_page) {
+    sqlite3_bind_int64(stmt.get(), idx++, (sqlite3_int64)after_updated);
+    bindText(stmt.get(), idx++, after_id);
+  }
+  // One extra row tells us whether another page exists.
+  sqlite3_bind_int64(stmt.get(), idx++, (sqlite3_int64)limit + 1);
+  if (first_page && !by_member)
+    sqlite3_bind_int(stmt.get(), idx++, 0);
+
+  TaskRowView row;
+  long long last_updated = 0;
+  string last_id;
+  int delivered = 0;
+  bool more = false;
+  while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+    ++scanned;
+    if (delivered == limit) {
+      more = true;
+      break;
+    }
+    readTaskView(stmt.get(), row);
+    ++delivered;
+    last_updated = row.updated_at;
+    last_id.assign(row.id.data(), row.id.size());
+    if (!visit(row)) {
+      more = true; // caller stopped early; resume after this row
+      break;
+    }
+  }
 
+  if (more)
+    out_next_token = encodePageToken(last_updated, last_id);
+  return true;
+} // EventStore::pageTasks
 
 } // namespace together
@@ -0,0 +1,443 @@
+#include "core/HouseholdRouter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include <utility>
+
+using std::string;
+using std::vector;
+
+namespace together {
+
+namespace {
+
+bool validHousehold(const string &id) {
+  if (id.empty() || id.size() > 64)
+    return false;
+  return std::all_of(id.begin(), id.end(), [](char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_' || c == '-';
+  });
+}
+
+} // namespace
+
+// Fan-out threads: a queue of jobs, run in order.
+struct HouseholdRouter::Workers {
+  std::mutex mu;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> jobs;
+  bool stop = false;
+  vector<std::thread> threads;
+
+  explicit Workers(std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i)
+      threads.emplace_back([this] { run(); });
+  }
+
+  // Runs the jobs still queued, then joins.
+  ~Workers() {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      stop = true;
+    }
+    cv.notify_all();
+    for (std::thread &t : threads)
+      t.join();
+  }
+
+  void post(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      jobs.push_back(std::move(job));
+    }
+    cv.notify_one();
+  }
+
+  void run() {
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mu);
+        cv.wait(lock, [this] { return stop || !jobs.empty(); });
+        if (jobs.empty())
+          return;
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      job();
+    }
+  }
+};
+
+HouseholdRouter::HouseholdRouter(RouterOptions options)
+    : options_(std::move(options)) {
+  options_.max_open = std::max<std::size_t>(options_.max_open, 1);
+  if (!options_.directory.empty()) {
+    std::error_code ec; // a bad directory fails each open instead
+    std::filesystem::create_directories(options_.directory, ec);
+  }
+  if (options_.fan_out_threads)
+    workers_ = std::make_unique<Workers>(options_.fan_out_threads);
+  if (options_.idle_timeout.count() > 0)
+    sweeper_ = std::thread([this] { sweepLoop(); });
+} // HouseholdRouter::HouseholdRouter
+
+HouseholdRouter::~HouseholdRouter() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stopping_ = true;
+  }
+  sweep_cv_.notify_all();
+  if (sweeper_.joinable())
+    sweeper_.join();
+  workers_.reset();
+  shards_.clear();
+} // HouseholdRouter::~HouseholdRouter
+
+HouseholdRouter::Lease HouseholdRouter::acquire(const string &household,
+                                                string &out_error) {
+  out_error.clear();
+  if (!validHousehold(household)) {
+    out_error = "invalid household id";
+    return Lease{};
+  }
+
+  const std::thread::id self = std::this_thread::get_id();
+  vector<std::unique_ptr<Shard>> closing; // closed after mu_ is released
+  Shard *shard = nullptr;
+  bool open_it = false;
+  {
+    std::unique_lock<std::mutex> lock(mu_);
+    const bool no_wait = holders_.count(self) != 0;
+    bool waited = false;
+    for (;;) {
+      if (closing_.count(household)) {
+        cv_.wait(lock); // its evicted shard is still closing
+        continue;
+      }
+      auto it = shards_.find(household);
+      if (it != shards_.end()) {
+        if (it->second->ready) {
+          shard = it->second.get();
+          ++shard->leases;
+          hold(self, true);
+          break;
+        }
+        cv_.wait(lock); // another thread is opening it
+        continue;
+      }
+      if (shards_.size() >= options_.max_open) {
+        for (auto &s : takeEvictable(options_.max_open - 1))
+          closing.push_back(std::move(s));
+        if (shards_.size() >= options_.max_open && !no_wait) {
+          if (!closing.empty()) {
+            // Their households wait on closing_: close them first.
+            lock.unlock();
+            closeShards(closing);
+            lock.lock();
+            continue;
+          }
+          if (!waited)
+            ++waits_;
+          waited = true;
+          cv_.wait(lock);
+          continue;
+        }
+      }
+      auto s = std::make_unique<Shard>();
+      s->household = household;
+      s->leases = 1;
+      shard = s.get();
+      shards_.emplace(household, std::move(s));
+      hold(self, true);
+      ++opens_;
+      open_it = true;
+      break;
+    }
+  }
+  closeShards(closing);
+
+  if (open_it) {
+    // Opening runs the schema setup: not under mu_, so other households
+    // are served meanwhile.
+    const string path =
+        (std::filesystem::path(options_.directory) / (household + ".db"))
+            .string();
+    string err = shard->store.open(path, options_.open);
+    if (err.empty() && options_.configure)
+      err = options_.configure(shard->store);
+    vector<std::unique_ptr<Shard>> failed; // open if configure failed
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (err.empty()) {
+        shard->ready = true;
+      } else {
+        auto it = shards_.find(household);
+        closing_.insert(household);
+        failed.push_back(std::move(it->second));
+        shards_.erase(it);
+        hold(self, false);
+      }
+    }
+    cv_.notify_all();
+    if (!failed.empty()) {
+      closeShards(failed);
+      out_error = err;
+      return Lease{};
+    }
+  }
+
+  Lease lease;
+  lease.router_ = this;
+  lease.shard_ = shard;
+  lease.holder_ = self;
+  return lease;
+} // HouseholdRouter::acquire
+
+void HouseholdRouter::release(Shard *shard, std::thread::id holder) {
+  vector<std::unique_ptr<Shard>> closing;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    shard->last_used = Clock::now();
+    --shard->leases;
+    hold(holder, false);
+    // Shards opened past the bound close as soon as they can.
+    if (shards_.size() > options_.max_open)
+      closing = takeEvictable(options_.max_open);
+  }
+  cv_.notify_all();
+  closeShards(closing);
+} // HouseholdRouter::release
+
+void HouseholdRouter::hold(std::thread::id thread, bool add) {
+  if (add) {
+    ++holders_[thread];
+  } else if (auto it = holders_.find(thread);
+             it != holders_.end() && --it->second == 0) {
+    holders_.erase(it);
+  }
+} // HouseholdRouter::hold
+
+void HouseholdRouter::closeShards(vector<std::unique_ptr<Shard>> &shards) {
+  if (shards.empty())
+    return;
+  vector<string> households;
+  for (const auto &s : shards)
+    households.push_back(s->household);
+  shards.clear(); // closes the stores, outside mu_
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (const string &h : households)
+      closing_.erase(h);
+  }
+  cv_.notify_all();
+} // HouseholdRouter::closeShards
+
+string HouseholdRouter::fanOut(const vector<string> &households,
+                               const ShardVisitor &visit) {
+  struct State {
+    vector<string> households;
+    ShardVisitor visit;
+    bool nested = false;
+    std::atomic<std::size_t> next{0};
+    std::mutex mu;
+    std::condition_variable cv;
+    std::size_t done = 0;
+    std::size_t error_at = 0; // index of `error`'s household
+    string error;
+  };
+  if (households.empty())
+    return {};
+  auto state = std::make_shared<State>();
+  state->households = households;
+  state->visit = visit;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    state->nested = holders_.count(std::this_thread::get_id()) != 0;
+  }
+
+  // Helpers that start after the last item was taken find nothing to do,
+  // so they touch only `state`, never this call's frame.
+  auto work = [this, state] {
+    const std::size_t n = state->households.size();
+    const std::thread::id self = std::this_thread::get_id();
+    if (state->nested) {
+      std::lock_guard<std::mutex> lock(mu_);
+      hold(self, true);
+    }
+    for (std::size_t i; (i = state->next.fetch_add(1)) < n;) {
+      const string &household = state->households[i];
+      string err;
+      {
+        Lease lease = acquire(household, err);
+        if (lease)
+          state->visit(household, *lease);
+      }
+      std::lock_guard<std::mutex> lock(state->mu);
+      if (!err.empty() && (state->error.empty() || i < state->error_at)) {
+        state->error = household + ": " + err;
+        state->error_at = i;
+      }
+      if (++state->done == n)
+        state->cv.notify_all();
+    }
+    if (state->nested) {
+      std::lock_guard<std::mutex> lock(mu_);
+      hold(self, false);
+    }
+  };
+  if (workers_) {
+    const std::size_t helpers =
+        std::min(options_.fan_out_threads, households.size() - 1);
+    for (std::size_t i = 0; i < helpers; ++i)
+      workers_->post(work);
+  }
+  work();
+
+  std::unique_lock<std::mutex> lock(state->mu);
+  state->cv.wait(lock,
+                 [&] { return state->done == state->households.size(); });
+  return state->error;
+} // HouseholdRouter::fanOut
+
+vector<string> HouseholdRouter::households(string &out_error) const {
+  out_error.clear();
+  vector<string> out;
+  std::error_code ec;
+  std::filesystem::directory_iterator it(
+      options_.directory.empty() ? "." : options_.directory, ec);
+  for (; !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    const std::filesystem::path &p = it->path();
+    if (p.extension() != ".db")
+      continue;
+    string household = p.stem().string();
+    if (validHousehold(household))
+      out.push_back(std::move(household));
+  }
+  if (ec) {
+    out_error = "list households failed: " + ec.message();
+    out.clear();
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+} // HouseholdRouter::households
+
+std::size_t HouseholdRouter::closeIdle() {
+  vector<std::unique_ptr<Shard>> closing;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    closing = takeIdle(options_.idle_timeout.count() > 0
+                           ? Clock::now() - options_.idle_timeout
+                           : Clock::time_point::max());
+  }
+  const std::size_t closed = closing.size();
+  closeShards(closing);
+  return closed;
+} // HouseholdRouter::closeIdle
+
+std::size_t HouseholdRouter::openShards() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return shards_.size();
+} // HouseholdRouter::openShards
+
+unsigned long long HouseholdRouter::opens() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return opens_;
+} // HouseholdRouter::opens
+
+unsigned long long HouseholdRouter::waits() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return waits_;
+} // HouseholdRouter::waits
+
+vector<std::unique_ptr<HouseholdRouter::Shard>>
+HouseholdRouter::takeEvictable(std::size_t limit) {
+  vector<std::unique_ptr<Shard>> out;
+  while (shards_.size() > limit) {
+    auto oldest = shards_.end();
+    for (auto it = shards_.begin(); it != shards_.end(); ++it) {
+      const Shard &s = *it->second;
+      if (s.ready && s.leases == 0 &&
+          (oldest == shards_.end() ||
+           s.last_used < oldest->second->last_used))
+        oldest = it;
+    }
+    if (oldest == shards_.end())
+      break;
+    closing_.insert(oldest->first);
+    out.push_back(std::move(oldest->second));
+    shards_.erase(oldest);
+  }
+  return out;
+} // HouseholdRouter::takeEvictable
+
+vector<std::unique_ptr<HouseholdRouter::Shard>>
+HouseholdRouter::takeIdle(Clock::time_point idle_before) {
+  vector<std::unique_ptr<Shard>> out;
+  for (auto it = shards_.begin(); it != shards_.end();) {
+    const Shard &s = *it->second;
+    if (s.ready && s.leases == 0 && s.last_used < idle_before) {
+      closing_.insert(it->first);
+      out.push_back(std::move(it->second));
+      it = shards_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return out;
+} // HouseholdRouter::takeIdle
+
+void HouseholdRouter::sweepLoop() {
+  const auto period = std::max<std::chrono::milliseconds>(
+      options_.idle_timeout / 2, std::chrono::milliseconds(1));
+  std::unique_lock<std::mutex> lock(mu_);
+  while (!stopping_) {
+    sweep_cv_.wait_for(lock, period);
+    if (stopping_)
+      break;
+    vector<std::unique_ptr<Shard>> closing =
+        takeIdle(Clock::now() - options_.idle_timeout);
+    if (closing.empty())
+      continue;
+    lock.unlock();
+    closeShards(closing);
+    lock.lock();
+  }
+} // HouseholdRouter::sweepLoop
+
+HouseholdRouter::Lease::Lease(Lease &&other) noexcept
+    : router_(other.router_), shard_(other.shard_), holder_(other.holder_) {
+  other.shard_ = nullptr;
+} // HouseholdRouter::Lease::Lease
+
+HouseholdRouter::Lease &
+HouseholdRouter::Lease::operator=(Lease &&other) noexcept {
+  if (this != &other) {
+    reset();
+    router_ = other.router_;
+    shard_ = other.shard_;
+    holder_ = other.holder_;
+    other.shard_ = nullptr;
+  }
+  return *this;
+} // HouseholdRouter::Lease::operator=
+
+EventStore &HouseholdRouter::Lease::operator*() const {
+  return shard_->store;
+} // HouseholdRouter::Lease::operator*
+
+const string &HouseholdRouter::Lease::household() const {
+  return shard_->household;
+} // HouseholdRouter::Lease::household
+
+void HouseholdRouter::Lease::reset() {
+  if (shard_)
+    router_->release(shard_, holder_);
+  shard_ = nullptr;
+} // HouseholdRouter::Lease::reset
+
+} // namespace together
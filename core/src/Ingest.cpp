@@ -0,0 +1,309 @@
+#include "core/EventStore.h"
+#include "core/PayloadCodec.h"
+#include "Snapshot.h"
+#include "SqliteUtil.h"
+#include "VisibilityPolicy.h"
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace together {
+
+using sql::bindText;
+using sql::columnView;
+
+namespace {
+
+// Rows the merge cursor steps over before it seeks instead: a dense batch
+// reads the task table in order, a sparse one pays a seek per task.
+constexpr int kMergeSteps = 16;
+
+// Last writer wins: the later ts, then the greater origin.
+bool newer(long long ts, string_view origin, long long than_ts,
+           string_view than_origin) {
+  return ts != than_ts ? ts > than_ts : origin > than_origin;
+}
+
+// An upsert payload folded into the row as replay folds it: fields the
+// payload leaves out keep their values.
+void foldTaskFields(const PayloadFields &fields, TaskRow &row) {
+  for (const PayloadField &f : fields) {
+    const bool text = f.kind == PayloadField::Kind::String;
+    const bool number = f.kind == PayloadField::Kind::Int ||
+                        f.kind == PayloadField::Kind::Double;
+    const long long n =
+        f.kind == PayloadField::Kind::Int ? f.i : (long long)f.d;
+    if (f.name == "title" && text)
+      row.title = f.s;
+    else if (f.name == "assignees" && text)
+      row.assignees_csv = f.s;
+    else if (f.name == "due_at" && number)
+      row.due_at = n;
+    else if (f.name == "points" && number)
+      row.points = (int)n;
+    else if (f.name == "status" && text)
+      row.status = f.s;
+    else if (f.name == "visibility_tag" && text)
+      row.visibility_tag = f.s;
+  }
+}
+
+// One entity's events: order[begin, end). For a task, the row as it was
+// before the batch (`existed`, its LWW key) and as the winners leave it.
+struct EntityRun {
+  std::size_t begin = 0;
+  std::size_t end = 0;
+  bool task = false;
+  bool existed = false;
+  long long was_ts = 0;
+  string was_origin;
+  TaskRow row;
+  string origin;
+  bool exists = false;
+  bool changed = false;
+  bool deleted = false; // by a delete event, last
+};
+
+} // namespace
+
+long long EventStore::ingestRemote(const vector<RemoteEvent> &batch,
+                                   IngestReport &out_report) {
+  return ingestBatch(batch, false, out_report);
+} // EventStore::ingestRemote
+
+// keep_order appends the applied events in batch order instead of entity
+// order. An entity's events still go in the order they apply, moved into
+// the batch positions its events held, so replay folds them the same way.
+long long EventStore::ingestBatch(const vector<RemoteEvent> &batch,
+                                  bool keep_order, IngestReport &out_report) {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  out_report = IngestReport{};
+  out_report.received = (long long)batch.size();
+  if (!db_)
+    return -1;
+  if (batch.empty())
+    return 0;
+  for (const RemoteEvent &r : batch)
+    if (r.remote_id.empty() || r.event.entity_type.empty() ||
+        r.event.entity_id.empty())
+      return -4;
+  if (!stmts_.fixed(kAppendEvent) || !stmts_.fixed(kUpsertTask) ||
+      !stmts_.fixed(kIngestTaskRows) || !stmts_.fixed(kRemoteSeen) ||
+      !stmts_.fixed(kRemoteSeq))
+    return -3;
+
+  // Sort by entity, then by LWW key: an entity's events are adjacent and
+  // in the order they apply, and tasks come out in primary key order.
+  vector<std::uint32_t> order(batch.size());
+  std::iota(order.begin(), order.end(), 0u);
+  std::sort(order.begin(), order.end(), [&batch](std::uint32_t a,
+                                                 std::uint32_t b) {
+    const RemoteEvent &x = batch[a];
+    const RemoteEvent &y = batch[b];
+    if (int c = x.event.entity_type.compare(y.event.entity_type))
+      return c < 0;
+    if (int c = x.event.entity_id.compare(y.event.entity_id))
+      return c < 0;
+    if (x.event.ts != y.event.ts)
+      return x.event.ts < y.event.ts;
+    if (int c = x.origin.compare(y.origin))
+      return c < 0;
+    return x.remote_id < y.remote_id;
+  });
+  vector<EntityRun> runs;
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    const DeltaEvent &ev = batch[order[i]].event;
+    if (runs.empty() ||
+        batch[order[runs.back().begin]].event.entity_id != ev.entity_id ||
+        batch[order[runs.back().begin]].event.entity_type != ev.entity_type) {
+      runs.emplace_back();
+      runs.back().begin = i;
+      runs.back().task = ev.entity_type == "task";
+    }
+    runs.back().end = i + 1;
+  }
+
+  if (!beginImmediate())
+    return -2;
+  auto fail = [&](long long code) {
+    rollback();
+    const long long received = out_report.received;
+    out_report = IngestReport{};
+    out_report.received = received;
+    return code;
+  };
+
+  // The batch's tasks as they are now, merged against the task table in
+  // one forward walk of its primary key.
+  {
+    ScopedStmt cursor(stmts_.fixed(kIngestTaskRows));
+    sqlite3_stmt *c = cursor.get();
+    bool positioned = false, exhausted = false, ok = true;
+    auto advance = [&] {
+      const int rc = sqlite3_step(c);
+      positioned = rc == SQLITE_ROW;
+      exhausted = rc == SQLITE_DONE;
+      ok = positioned || exhausted;
+    };
+    for (EntityRun &run : runs) {
+      if (!run.task)
+        continue;
+      const string &want = batch[order[run.begin]].event.entity_id;
+      for (int i = 0; ok && positioned && i < kMergeSteps &&
+                      columnView(c, 0) < want;
+           ++i)
+        advance();
+      if (ok && !exhausted && (!positioned || columnView(c, 0) < want)) {
+        sqlite3_reset(c);
+        bindText(c, 1, want); // outlives the statement: batch is const
+        advance();
+      }
+      if (!ok)
+        return fail(-3);
+      if (!positioned || columnView(c, 0) != want)
+        continue; // a new task
+      TaskRow &row = run.row;
+      row.title.assign(columnView(c, 1));
+      row.assignees_csv.assign(columnView(c, 2));
+      row.due_at = sqlite3_column_int64(c, 3);
+      row.points = sqlite3_column_int(c, 4);
+      row.status.assign(columnView(c, 5));
+      row.visibility_tag.assign(columnView(c, 6));
+      row.updated_at = sqlite3_column_int64(c, 7);
+      run.origin.assign(columnView(c, 8));
+      run.existed = run.exists = true;
+      run.was_ts = row.updated_at;
+      run.was_origin = run.origin;
+    }
+  }
+
+  auto append = [&](const RemoteEvent &r, unsigned vis_mask) {
+    const DeltaEvent &ev = r.event;
+    const long long seq = insertEvent(ev.entity_type, ev.entity_id, ev.op,
+                                      ev.payload, ev.ts, vis_mask);
+    if (seq < 1)
+      return false;
+    ScopedStmt st(stmts_.fixed(kRemoteSeq));
+    sqlite3_bind_int64(st.get(), 1, (sqlite3_int64)seq);
+    bindText(st.get(), 2, r.remote_id);
+    if (sqlite3_step(st.get()) != SQLITE_DONE)
+      return false;
+    if (!out_report.applied++)
+      out_report.range.first = seq;
+    out_report.range.last = seq;
+    return true;
+  };
+  // keep_order: (batch position, event index, vis_mask) of each event to
+  // append once every run is merged.
+  struct Deferred {
+    std::uint32_t slot;
+    std::uint32_t index;
+    unsigned vis_mask;
+  };
+  vector<Deferred> deferred;
+  vector<std::uint32_t> slots;
+
+  PayloadFields fields;
+  for (EntityRun &run : runs) {
+    if (keep_order) {
+      slots.assign(order.begin() + run.begin, order.begin() + run.end);
+      std::sort(slots.begin(), slots.end());
+    }
+    for (std::size_t i = run.begin; i < run.end; ++i) {
+      const RemoteEvent &r = batch[order[i]];
+      const DeltaEvent &ev = r.event;
+      {
+        ScopedStmt seen(stmts_.fixed(kRemoteSeen));
+        bindText(seen.get(), 1, r.remote_id);
+        bindText(seen.get(), 2, r.origin);
+        if (sqlite3_step(seen.get()) != SQLITE_DONE)
+          return fail(-6);
+      }
+      if (sqlite3_changes(db_) == 0) {
+        ++out_report.duplicates;
+        continue;
+      }
+
+      unsigned vis_mask = 0;
+      if (run.task) {
+        if (run.existed &&
+            !newer(ev.ts, r.origin, run.was_ts, run.was_origin)) {
+          ++out_report.superseded;
+          continue;
+        }
+        // As replay: a delete of a missing task (unless it carries the
+        // row, as a compacted one does) and an undecodable or unknown
+        // event leave the row's fields alone. The row's origin is still
+        // the one of its latest event, which a rebuild restores.
+        const bool upsert =
+            ev.op == "upsert" && payload::decode(ev.payload, fields);
+        const bool del =
+            ev.op == "delete" &&
+            (run.exists || (payload::decode(ev.payload, fields) &&
+                            snapshot::carriesTaskRow(fields)));
+        if ((upsert || del) && !run.exists) {
+          run.row = TaskRow{};
+          run.row.status = "open";
+          run.row.visibility_tag = "family";
+          run.exists = true;
+          if (del)
+            foldTaskFields(fields, run.row);
+        }
+        if (upsert) {
+          foldTaskFields(fields, run.row);
+          run.row.updated_at = ev.ts;
+          run.deleted = false;
+        } else if (del) {
+          run.row.status = "deleted";
+          run.row.updated_at = ev.ts;
+          run.deleted = true;
+        }
+        if (run.exists) {
+          run.origin = r.origin;
+          run.changed = true;
+          vis_mask = visibility::tagBit(run.row.visibility_tag);
+        }
+      }
+
+      if (keep_order)
+        deferred.push_back(Deferred{slots[i - run.begin], order[i], vis_mask});
+      else if (!append(r, vis_mask))
+        return fail(-6);
+    }
+
+    if (!run.changed)
+      continue;
+    TaskRow &row = run.row;
+    row.id = batch[order[run.begin]].event.entity_id;
+    if (!writeTaskRow(row.id, row.title, row.assignees_csv, row.due_at,
+                      row.points, row.status, row.visibility_tag,
+                      row.updated_at, run.origin))
+      return fail(-6);
+    if (task_cache_ || due_) {
+      PendingCacheWrite w;
+      w.row = row;
+      w.deleted = run.deleted;
+      pending_cache_.push_back(std::move(w));
+    }
+  }
+
+  std::sort(deferred.begin(), deferred.end(),
+            [](const Deferred &a, const Deferred &b) { return a.slot < b.slot; });
+  for (const Deferred &d : deferred)
+    if (!append(batch[d.index], d.vis_mask))
+      return fail(-6);
+
+  if (!commit())
+    return fail(-7);
+  return out_report.range.last;
+} // EventStore::ingestBatch
+
+} // namespace together
@@ -0,0 +1,96 @@
+#include "core/Metrics.h"
+
+#include <algorithm>
+
+namespace together {
+
+namespace {
+
+// Index of the highest set bit; v must be non-zero.
+int log2Floor(std::uint64_t v) {
+  int e = 0;
+  while (v >>= 1)
+    ++e;
+  return e;
+}
+
+} // namespace
+
+std::size_t LatencyHistogram::bucketOf(std::uint64_t nanos) {
+  if (nanos < 16)
+    return (std::size_t)nanos;
+  const int e = log2Floor(nanos); // 4..63
+  const std::uint64_t sub = (nanos >> (e - 2)) & 3;
+  return 16 + (std::size_t)(e - 4) * 4 + (std::size_t)sub;
+} // LatencyHistogram::bucketOf
+
+std::uint64_t LatencyHistogram::bucketLow(std::size_t bucket) {
+  if (bucket < 16)
+    return bucket;
+  const int e = (int)(bucket - 16) / 4 + 4;
+  const std::uint64_t sub = (bucket - 16) % 4;
+  return (4 + sub) << (e - 2);
+} // LatencyHistogram::bucketLow
+
+void LatencyHistogram::record(std::uint64_t nanos) {
+  buckets_[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+  total_.fetch_add(nanos, std::memory_order_relaxed);
+  std::uint64_t prev = max_.load(std::memory_order_relaxed);
+  while (nanos > prev &&
+         !max_.compare_exchange_weak(prev, nanos, std::memory_order_relaxed))
+    ;
+} // LatencyHistogram::record
+
+void LatencyHistogram::reset() {
+  for (auto &b : buckets_)
+    b.store(0, std::memory_order_relaxed);
+  total_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+} // LatencyHistogram::reset
+
+std::uint64_t LatencyHistogram::count() const {
+  std::uint64_t n = 0;
+  for (const auto &b : buckets_)
+    n += b.load(std::memory_order_relaxed);
+  return n;
+} // LatencyHistogram::count
+
+std::uint64_t LatencyHistogram::totalNanos() const {
+  return total_.load(std::memory_order_relaxed);
+} // LatencyHistogram::totalNanos
+
+std::uint64_t LatencyHistogram::maxNanos() const {
+  return max_.load(std::memory_order_relaxed);
+} // LatencyHistogram::maxNanos
+
+std::uint64_t LatencyHistogram::percentileNanos(double q) const {
+  std::array<std::uint64_t, kBuckets> counts;
+  std::uint64_t n = 0;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    n += counts[i];
+  }
+  if (n == 0)
+    return 0;
+
+  // Rank of the requested sample, 1-based.
+  q = std::min(1.0, std::max(0.0, q));
+  const std::uint64_t rank =
+      std::max<std::uint64_t>(1, (std::uint64_t)(q * (double)n + 0.5));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      if (i < 16)
+        return i;
+      const std::uint64_t low = bucketLow(i);
+      const std::uint64_t high =
+          i + 1 < kBuckets ? bucketLow(i + 1) : low + (low >> 2);
+      // Never report more than the largest value actually seen.
+      return std::min(low + (high - low) / 2, maxNanos());
+    }
+  }
+  return maxNanos();
+} // LatencyHistogram::percentileNanos
+
+} // namespace together
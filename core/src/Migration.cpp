@@ -0,0 +1,343 @@
+#include "core/EventStore.h"
+#include "BudgetLedger.h"
+#include "SqliteUtil.h"
+#include "TaskAssignees.h"
+#include "VisibilityPolicy.h"
+#include <sqlite3.h>
+
+#include <string>
+
+using std::string;
+
+namespace together {
+
+namespace {
+
+// Rows copied per transaction by the v1 -> v2 event_log migration. Each
+// batch commits, which bounds the WAL and lets an interrupted migration
+// resume where it stopped. open() holds write_mu_ throughout, so nothing
+// else writes in between.
+constexpr long long kMigrationBatchRows = 50000;
+
+// v2 event_log. Built as event_log_v2 when migrating, then renamed.
+string eventLogDdl(const char *table) {
+  return string("CREATE TABLE IF NOT EXISTS ") + table +
+         "("
+         "  seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+         "  type_code INTEGER NOT NULL,"   // event_dict.code
+         "  entity_id TEXT NOT NULL,"
+         "  op_code INTEGER NOT NULL,"     // event_dict.code
+         "  payload_blob BLOB NOT NULL,"   // JSON or binary (PayloadCodec)
+         "  ts INTEGER NOT NULL"           // epoch millis
+         ");";
+}
+
+long long queryInt(sqlite3 *db, const char *sql) {
+  sqlite3_stmt *st = nullptr;
+  long long v = 0;
+  if (sqlite3_prepare_v2(db, sql, -1, &st, nullptr) == SQLITE_OK &&
+      sqlite3_step(st) == SQLITE_ROW)
+    v = sqlite3_column_int64(st, 0);
+  sqlite3_finalize(st);
+  return v;
+}
+
+bool hasColumn(sqlite3 *db, const char *table, const char *column) {
+  const string sql = string("SELECT COUNT(*) FROM pragma_table_info('") +
+                     table + "') WHERE name = '" + column + "'";
+  return queryInt(db, sql.c_str()) > 0;
+}
+
+// payload_vis_mask(blob): tagBit of the payload's visibility_tag, or NULL
+// if it has none. Registered only while the v3 backfill runs.
+void payloadVisMaskFn(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  const void *p = sqlite3_value_blob(argv[0]);
+  const int n = sqlite3_value_bytes(argv[0]);
+  const unsigned bit = visibility::payloadTagBit(
+      p ? std::string_view(static_cast<const char *>(p), (std::size_t)n)
+        : std::string_view());
+  if (bit)
+    sqlite3_result_int(ctx, (int)bit);
+  else
+    sqlite3_result_null(ctx);
+}
+
+} // namespace
+
+string EventStore::migrateSchema(int from_version) {
+  string err;
+  if (from_version < 2) {
+    // v1 stored entity_type / op as text. A database without event_log
+    // (or already on v2 columns) just needs the v2 table.
+    if (hasColumn(db_, "event_log", "entity_type")) {
+      err = migrateEventLogToV2();
+      if (!err.empty())
+        return "migration to v2 failed: " + err;
+    } else if (!execSql(eventLogDdl("event_log").c_str(), err)) {
+      return "schema creation failed: " + err;
+    }
+  }
+  if (from_version < 3) {
+    err = addVisibilityMasks();
+    if (!err.empty())
+      return "migration to v3 failed: " + err;
+  }
+  if (from_version < 4) {
+    err = backfillTaskAssignees();
+    if (!err.empty())
+      return "migration to v4 failed: " + err;
+  }
+  if (from_version < 5) {
+    err = backfillBudget();
+    if (!err.empty())
+      return "migration to v5 failed: " + err;
+  }
+  if (from_version < 6) {
+    err = addTaskOrigins();
+    if (!err.empty())
+      return "migration to v6 failed: " + err;
+  }
+  // idx_event_log_seq duplicated the rowid; idx_event_log_ts comes with
+  // the versioned indexes.
+  if (from_version < 7 &&
+      !execSql("DROP INDEX IF EXISTS idx_event_log_seq", err))
+    return "migration to v7 failed: " + err;
+  // v8's task_event_row starts empty: earlier events replay from their
+  // payloads, as before.
+
+  const string pragma =
+      "PRAGMA user_version = " + std::to_string(kSchemaVersion);
+  if (!execSql(pragma.c_str(), err))
+    return "schema creation failed: " + err;
+  return {};
+} // EventStore::migrateSchema
+
+// Copies event_log into event_log_v2 in seq order, translating names to
+// event_dict codes, then swaps the tables in one transaction. Each step is
+// idempotent, so a crash at any point leaves either the v1 table intact
+// (plus a partial copy that the next open continues) or the finished v2.
+string EventStore::migrateEventLogToV2() {
+  string err;
+  const string setup =
+      "BEGIN IMMEDIATE;" + eventLogDdl("event_log_v2") +
+      "INSERT OR IGNORE INTO event_dict(name)"
+      "  SELECT DISTINCT entity_type FROM event_log;"
+      "INSERT OR IGNORE INTO event_dict(name)"
+      "  SELECT DISTINCT op FROM event_log;"
+      "COMMIT;";
+  string ignored;
+  if (!execSql(setup.c_str(), err)) {
+    execSql("ROLLBACK", ignored);
+    return err;
+  }
+
+  // Resume after the highest seq already copied; seq order makes the
+  // source side a rowid range scan.
+  const string copy =
+      "BEGIN IMMEDIATE;"
+      "INSERT INTO event_log_v2(seq, type_code, entity_id, op_code, "
+      "                         payload_blob, ts) "
+      "SELECT l.seq, t.code, l.entity_id, o.code, l.payload_blob, l.ts "
+      "FROM event_log AS l "
+      "JOIN event_dict AS t ON t.name = l.entity_type "
+      "JOIN event_dict AS o ON o.name = l.op "
+      "WHERE l.seq > (SELECT COALESCE(MAX(seq), 0) FROM event_log_v2) "
+      "ORDER BY l.seq LIMIT " +
+      std::to_string(kMigrationBatchRows) + ";";
+  for (;;) {
+    if (!execSql(copy.c_str(), err)) {
+      execSql("ROLLBACK", ignored);
+      return err;
+    }
+    const long long copied = sqlite3_changes(db_);
+    if (!execSql("COMMIT", err)) {
+      execSql("ROLLBACK", ignored);
+      return err;
+    }
+    if (copied < kMigrationBatchRows)
+      break;
+  }
+
+  // Swap. The new table keeps the AUTOINCREMENT high-water mark of the old
+  // one so seqs of compacted-away events are never reused. Dropping v1
+  // also drops its indexes; initSchema recreates them on v2 columns.
+  const string swap =
+      "BEGIN IMMEDIATE;"
+      "CREATE TEMP TABLE migrate_seq AS SELECT MAX("
+      "  COALESCE((SELECT seq FROM sqlite_sequence WHERE name = 'event_log'), 0),"
+      "  COALESCE((SELECT MAX(seq) FROM event_log_v2), 0)) AS seq;"
+      "DROP TABLE event_log;"
+      "ALTER TABLE event_log_v2 RENAME TO event_log;"
+      "DELETE FROM sqlite_sequence WHERE name IN ('event_log', 'event_log_v2');"
+      "INSERT INTO sqlite_sequence(name, seq) "
+      "  SELECT 'event_log', seq FROM temp.migrate_seq WHERE seq > 0;"
+      "DROP TABLE temp.migrate_seq;"
+      "PRAGMA user_version = 2;"
+      "COMMIT;";
+  if (!execSql(swap.c_str(), err)) {
+    execSql("ROLLBACK", ignored);
+    execSql("DROP TABLE IF EXISTS temp.migrate_seq", ignored);
+    return err;
+  }
+  return {};
+} // EventStore::migrateEventLogToV2
+
+// Adds task.vis_mask and event_log.vis_mask (schema v3). Rows written
+// before the column existed start at 0, which only Owner sees, and are
+// classified here: tasks from visibility_tag in one statement, events in
+// seq batches from their payload's visibility_tag, falling back to the
+// task's tag for task events and to family otherwise. A crash part-way
+// leaves the remaining rows at 0 for the next open to finish.
+string EventStore::addVisibilityMasks() {
+  string err, ignored;
+  if (!execSql("BEGIN IMMEDIATE", err))
+    return err;
+  if (!hasColumn(db_, "task", "vis_mask") &&
+      !execSql("ALTER TABLE task ADD COLUMN vis_mask INTEGER NOT NULL "
+               "DEFAULT 0",
+               err)) {
+    execSql("ROLLBACK", ignored);
+    return err;
+  }
+  if (!hasColumn(db_, "event_log", "vis_mask") &&
+      !execSql("ALTER TABLE event_log ADD COLUMN vis_mask INTEGER NOT NULL "
+               "DEFAULT 0",
+               err)) {
+    execSql("ROLLBACK", ignored);
+    return err;
+  }
+  const string tasks = "UPDATE task SET vis_mask = " +
+                       visibility::tagMaskSql("visibility_tag") +
+                       " WHERE vis_mask = 0";
+  if (!execSql(tasks.c_str(), err) || !execSql("COMMIT", err)) {
+    execSql("ROLLBACK", ignored);
+    return err;
+  }
+
+  long long lo =
+      queryInt(db_, "SELECT COALESCE(MIN(seq), 0) - 1 FROM event_log "
+                    "WHERE vis_mask = 0");
+  const long long hi =
+      queryInt(db_, "SELECT COALESCE(MAX(seq), 0) FROM event_log");
+  if (lo < 0)
+    return {}; // nothing to classify
+
+  if (sqlite3_create_function(db_, "payload_vis_mask", 1,
+                              SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                              payloadVisMaskFn, nullptr,
+                              nullptr) != SQLITE_OK)
+    return sqlite3_errmsg(db_);
+  const string update =
+      "UPDATE event_log SET vis_mask = COALESCE(payload_vis_mask(payload_blob),"
+      "  CASE WHEN type_code = (SELECT code FROM event_dict WHERE name = 'task')"
+      "       THEN (SELECT t.vis_mask FROM task AS t"
+      "             WHERE t.id = event_log.entity_id) END, " +
+      std::to_string(kVisFamily) +
+      ") WHERE seq > ?1 AND seq <= ?2 AND vis_mask = 0";
+  sqlite3_stmt *st = nullptr;
+  if (sqlite3_prepare_v2(db_, update.c_str(), -1, &st, nullptr) != SQLITE_OK)
+    err = sqlite3_errmsg(db_);
+  for (; err.empty() && lo < hi; lo += kMigrationBatchRows) {
+    if (!execSql("BEGIN IMMEDIATE", err))
+      break;
+    sqlite3_bind_int64(st, 1, (sqlite3_int64)lo);
+    sqlite3_bind_int64(st, 2, (sqlite3_int64)(lo + kMigrationBatchRows));
+    const int rc = sqlite3_step(st);
+    sqlite3_reset(st);
+    if (rc != SQLITE_DONE) {
+      err = sqlite3_errmsg(db_);
+      execSql("ROLLBACK", ignored);
+      break;
+    }
+    if (!execSql("COMMIT", err))
+      execSql("ROLLBACK", ignored);
+  }
+  sqlite3_finalize(st);
+  sqlite3_create_function(db_, "payload_vis_mask", 1, SQLITE_UTF8, nullptr,
+                          nullptr, nullptr, nullptr);
+  return err;
+} // EventStore::addVisibilityMasks
+
+// Fills task_assignee (schema v4; initSchema has created it empty) from
+// every task's assignees_csv. One transaction: the table is only an index,
+// so a crash simply rebuilds it on the next open.
+string EventStore::backfillTaskAssignees() {
+  string err, ignored;
+  const string sql = string("BEGIN IMMEDIATE;"
+                            "DELETE FROM task_assignee;") +
+                     assignees::kRebuildSql + "COMMIT;";
+  if (!execSql(sql.c_str(), err)) {
+    execSql("ROLLBACK", ignored);
+    return err;
+  }
+  return {};
+} // EventStore::backfillTaskAssignees
+
+// Folds every budget_tx / budget_limit event into the budget tables
+// (schema v5; initSchema has created them) and totals budget_month. Runs
+// before the statement cache exists, so it prepares its own. One
+// transaction: a crash leaves the tables empty and user_version
+// unchanged, and the next open starts over.
+string EventStore::backfillBudget() {
+  string err, ignored;
+  if (!execSql("BEGIN IMMEDIATE;"
+               "DELETE FROM budget_tx;"
+               "DELETE FROM budget_limit;"
+               "DELETE FROM budget_month;",
+               err)) {
+    execSql("ROLLBACK", ignored);
+    return err;
+  }
+
+  const char *const sql[] = {
+      "SELECT t.name, e.entity_id, o.name, e.payload_blob, e.ts "
+      "FROM event_log AS e "
+      "JOIN event_dict AS t ON t.code = e.type_code "
+      "JOIN event_dict AS o ON o.code = e.op_code "
+      "WHERE t.name IN ('budget_tx', 'budget_limit') ORDER BY e.seq",
+      BUDGET_TX_UPSERT_SQL("budget_tx"),
+      "DELETE FROM budget_tx WHERE id = ?1",
+      BUDGET_LIMIT_UPSERT_SQL("budget_limit"),
+      "DELETE FROM budget_limit WHERE id = ?1",
+  };
+  sqlite3_stmt *st[5] = {};
+  for (int i = 0; i < 5 && err.empty(); ++i)
+    if (sqlite3_prepare_v2(db_, sql[i], -1, &st[i], nullptr) != SQLITE_OK)
+      err = sqlite3_errmsg(db_);
+
+  PayloadFields fields;
+  int rc = SQLITE_DONE;
+  while (err.empty() && (rc = sqlite3_step(st[0])) == SQLITE_ROW) {
+    const budget::Kind kind = budget::kindOf(sql::columnView(st[0], 0));
+    const bool tx = kind == budget::Kind::Tx;
+    if (budget::fold(kind, tx ? st[1] : st[3], tx ? st[2] : st[4],
+                     sql::columnView(st[0], 1), sql::columnView(st[0], 2),
+                     sql::blobView(st[0], 3), sqlite3_column_int64(st[0], 4),
+                     fields) < 0)
+      err = sqlite3_errmsg(db_);
+  }
+  if (err.empty() && rc != SQLITE_DONE)
+    err = sqlite3_errmsg(db_);
+  for (sqlite3_stmt *s : st)
+    sqlite3_finalize(s);
+
+  if (!err.empty() || !execSql(budget::kMonthRebuildSql, err) ||
+      !execSql("COMMIT", err)) {
+    execSql("ROLLBACK", ignored);
+    return err;
+  }
+  return {};
+} // EventStore::backfillBudget
+
+// Adds task.origin (schema v6), the device whose write the row holds.
+// Rows written before it existed were written here: origin "".
+string EventStore::addTaskOrigins() {
+  string err;
+  if (!hasColumn(db_, "task", "origin") &&
+      !execSql("ALTER TABLE task ADD COLUMN origin TEXT NOT NULL DEFAULT ''",
+               err))
+    return err;
+  return {};
+} // EventStore::addTaskOrigins
+
+} // namespace together
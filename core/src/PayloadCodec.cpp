@@ -0,0 +1,481 @@
+#include "core/PayloadCodec.h"
+#include "Varint.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using std::string;
+using std::string_view;
+
+namespace together {
+namespace payload {
+
+namespace {
+
+constexpr unsigned char kMarker = 0x00;
+constexpr unsigned char kVersion = 1;
+
+enum Wire : unsigned {
+  kWireVarint = 0,
+  kWireDouble = 1,
+  kWireBytes = 2,
+  kWireFalse = 3,
+  kWireTrue = 4,
+  kWireNull = 5,
+};
+
+// Field-name dictionaries; a name's tag is its index + 1. Append only:
+// existing tags are part of the stored format.
+struct Dict {
+  const char *entity_type;
+  const char *const *names;
+  std::size_t count;
+};
+
+const char *const kGenericNames[] = {"id", "reason"};
+const char *const kTaskNames[] = {"title",  "assignees",      "points",
+                                  "due_at", "status",         "visibility_tag",
+                                  "reason", "updated_at",     "id"};
+const char *const kEventNames[] = {"title",   "start",          "end",
+                                   "location", "all_day",       "visibility_tag",
+                                   "rrule",   "reason",         "id"};
+const char *const kBudgetNames[] = {"amount_cents", "category", "note",
+                                    "month",        "is_sensitive", "reason",
+                                    "id",           "ts"};
+
+const Dict kDicts[] = {
+    {"", kGenericNames, sizeof(kGenericNames) / sizeof(kGenericNames[0])},
+    {"task", kTaskNames, sizeof(kTaskNames) / sizeof(kTaskNames[0])},
+    {"event", kEventNames, sizeof(kEventNames) / sizeof(kEventNames[0])},
+    {"budget_tx", kBudgetNames, sizeof(kBudgetNames) / sizeof(kBudgetNames[0])},
+};
+constexpr std::size_t kDictCount = sizeof(kDicts) / sizeof(kDicts[0]);
+
+std::size_t dictFor(string_view entity_type) {
+  for (std::size_t i = 1; i < kDictCount; ++i)
+    if (entity_type == kDicts[i].entity_type)
+      return i;
+  return 0;
+}
+
+unsigned tagFor(const Dict &dict, string_view name) {
+  for (std::size_t i = 0; i < dict.count; ++i)
+    if (name == dict.names[i])
+      return (unsigned)i + 1;
+  return 0;
+}
+
+// ---- JSON ---------------------------------------------------------------
+
+void skipWs(string_view in, std::size_t &pos) {
+  while (pos < in.size() && (in[pos] == ' ' || in[pos] == '\t' ||
+                             in[pos] == '\n' || in[pos] == '\r'))
+    ++pos;
+}
+
+void putUtf8(string &out, unsigned cp) {
+  if (cp < 0x80) {
+    out.push_back((char)cp);
+  } else if (cp < 0x800) {
+    out.push_back((char)(0xC0 | (cp >> 6)));
+    out.push_back((char)(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    out.push_back((char)(0xE0 | (cp >> 12)));
+    out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back((char)(0x80 | (cp & 0x3F)));
+  } else {
+    out.push_back((char)(0xF0 | (cp >> 18)));
+    out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+    out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back((char)(0x80 | (cp & 0x3F)));
+  }
+}
+
+bool parseHex4(string_view in, std::size_t &pos, unsigned &cp) {
+  if (pos + 4 > in.size())
+    return false;
+  cp = 0;
+  for (int i = 0; i < 4; ++i) {
+    char c = in[pos++];
+    cp <<= 4;
+    if (c >= '0' && c <= '9')
+      cp |= (unsigned)(c - '0');
+    else if (c >= 'a' && c <= 'f')
+      cp |= (unsigned)(c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F')
+      cp |= (unsigned)(c - 'A' + 10);
+    else
+      return false;
+  }
+  return true;
+}
+
+bool parseString(string_view in, std::size_t &pos, string &out) {
+  if (pos >= in.size() || in[pos] != '"')
+    return false;
+  ++pos;
+  out.clear();
+  while (pos < in.size()) {
+    char c = in[pos++];
+    if (c == '"')
+      return true;
+    if (c != '\\') {
+      out.push_back(c);
+      continue;
+    }
+    if (pos >= in.size())
+      return false;
+    char e = in[pos++];
+    switch (e) {
+    case '"': out.push_back('"'); break;
+    case '\\': out.push_back('\\'); break;
+    case '/': out.push_back('/'); break;
+    case 'b': out.push_back('\b'); break;
+    case 'f': out.push_back('\f'); break;
+    case 'n': out.push_back('\n'); break;
+    case 'r': out.push_back('\r'); break;
+    case 't': out.push_back('\t'); break;
+    case 'u': {
+      unsigned cp = 0;
+      if (!parseHex4(in, pos, cp))
+        return false;
+      if (cp >= 0xD800 && cp <= 0xDBFF) { // surrogate pair
+        unsigned lo = 0;
+        if (pos + 2 > in.size() || in[pos] != '\\' || in[pos + 1] != 'u')
+          return false;
+        pos += 2;
+        if (!parseHex4(in, pos, lo) || lo < 0xDC00 || lo > 0xDFFF)
+          return false;
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+      }
+      putUtf8(out, cp);
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+  return false;
+}
+
+bool parseNumber(string_view in, std::size_t &pos, PayloadField &f) {
+  std::size_t start = pos;
+  bool is_int = true;
+  if (pos < in.size() && in[pos] == '-')
+    ++pos;
+  while (pos < in.size()) {
+    char c = in[pos];
+    if (c >= '0' && c <= '9') {
+      ++pos;
+    } else if (c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+      is_int = false;
+      ++pos;
+    } else {
+      break;
+    }
+  }
+  if (pos == start)
+    return false;
+
+  string text(in.substr(start, pos - start));
+  char *end = nullptr;
+  if (is_int) {
+    errno = 0;
+    long long v = std::strtoll(text.c_str(), &end, 10);
+    if (errno == 0 && end == text.c_str() + text.size()) {
+      f.kind = PayloadField::Kind::Int;
+      f.i = v;
+      return true;
+    }
+  }
+  double d = std::strtod(text.c_str(), &end);
+  if (end != text.c_str() + text.size())
+    return false;
+  f.kind = PayloadField::Kind::Double;
+  f.d = d;
+  return true;
+}
+
+bool parseLiteral(string_view in, std::size_t &pos, string_view word) {
+  if (in.substr(pos, word.size()) != word)
+    return false;
+  pos += word.size();
+  return true;
+}
+
+void putJsonString(string &out, string_view s) {
+  out.push_back('"');
+  for (char c : s) {
+    switch (c) {
+    case '"': out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    case '\n': out += "\\n"; break;
+    case '\r': out += "\\r"; break;
+    case '\t': out += "\\t"; break;
+    case '\b': out += "\\b"; break;
+    case '\f': out += "\\f"; break;
+    default:
+      if ((unsigned char)c < 0x20) {
+        char buf[8];
+        std::snprintf(buf, sizeof buf, "\\u%04x", (unsigned)(unsigned char)c);
+        out += buf;
+      } else {
+        out.push_back(c);
+      }
+    }
+  }
+  out.push_back('"');
+}
+
+void putJsonDouble(string &out, double d) {
+  if (!std::isfinite(d)) { // JSON has no inf/nan
+    out += "null";
+    return;
+  }
+  char buf[32];
+  // Shortest of %.15g / %.17g that round-trips.
+  std::snprintf(buf, sizeof buf, "%.15g", d);
+  if (std::strtod(buf, nullptr) != d)
+    std::snprintf(buf, sizeof buf, "%.17g", d);
+  out += buf;
+  // Keep it a double on the way back in.
+  if (!std::strpbrk(buf, ".eE"))
+    out += ".0";
+}
+
+} // namespace
+
+bool isBinary(string_view blob) {
+  return blob.size() >= 3 && (unsigned char)blob[0] == kMarker;
+} // payload::isBinary
+
+bool parseJson(string_view json, PayloadFields &out) {
+  out.clear();
+  std::size_t pos = 0;
+  skipWs(json, pos);
+  if (pos >= json.size() || json[pos] != '{')
+    return false;
+  ++pos;
+  skipWs(json, pos);
+  if (pos < json.size() && json[pos] == '}') {
+    ++pos;
+  } else {
+    for (;;) {
+      PayloadField f;
+      skipWs(json, pos);
+      if (!parseString(json, pos, f.name))
+        return false;
+      skipWs(json, pos);
+      if (pos >= json.size() || json[pos++] != ':')
+        return false;
+      skipWs(json, pos);
+      if (pos >= json.size())
+        return false;
+
+      char c = json[pos];
+      if (c == '"') {
+        f.kind = PayloadField::Kind::String;
+        if (!parseString(json, pos, f.s))
+          return false;
+      } else if (c == 't') {
+        if (!parseLiteral(json, pos, "true"))
+          return false;
+        f.kind = PayloadField::Kind::Bool;
+        f.b = true;
+      } else if (c == 'f') {
+        if (!parseLiteral(json, pos, "false"))
+          return false;
+        f.kind = PayloadField::Kind::Bool;
+      } else if (c == 'n') {
+        if (!parseLiteral(json, pos, "null"))
+          return false;
+        f.kind = PayloadField::Kind::Null;
+      } else if (!parseNumber(json, pos, f)) {
+        return false; // also rejects nested objects/arrays
+      }
+      out.push_back(std::move(f));
+
+      skipWs(json, pos);
+      if (pos >= json.size())
+        return false;
+      if (json[pos] == ',') {
+        ++pos;
+        continue;
+      }
+      if (json[pos] == '}') {
+        ++pos;
+        break;
+      }
+      return false;
+    }
+  }
+  skipWs(json, pos);
+  return pos == json.size();
+} // payload::parseJson
+
+string toJson(const PayloadFields &fields) {
+  string out;
+  out.push_back('{');
+  for (std::size_t i = 0; i < fields.size(); ++i) {
+    const PayloadField &f = fields[i];
+    if (i)
+      out.push_back(',');
+    putJsonString(out, f.name);
+    out.push_back(':');
+    switch (f.kind) {
+    case PayloadField::Kind::Null: out += "null"; break;
+    case PayloadField::Kind::Bool: out += f.b ? "true" : "false"; break;
+    case PayloadField::Kind::Int: out += std::to_string(f.i); break;
+    case PayloadField::Kind::Double: putJsonDouble(out, f.d); break;
+    case PayloadField::Kind::String: putJsonString(out, f.s); break;
+    }
+  }
+  out.push_back('}');
+  return out;
+} // payload::toJson
+
+void encodeBinary(string_view entity_type, const PayloadFields &fields,
+                  string &out) {
+  std::size_t dict_id = dictFor(entity_type);
+  const Dict &dict = kDicts[dict_id];
+
+  out.clear();
+  out.push_back((char)kMarker);
+  out.push_back((char)kVersion);
+  out.push_back((char)dict_id);
+
+  for (const PayloadField &f : fields) {
+    unsigned wire = kWireNull;
+    switch (f.kind) {
+    case PayloadField::Kind::Null: wire = kWireNull; break;
+    case PayloadField::Kind::Bool: wire = f.b ? kWireTrue : kWireFalse; break;
+    case PayloadField::Kind::Int: wire = kWireVarint; break;
+    case PayloadField::Kind::Double: wire = kWireDouble; break;
+    case PayloadField::Kind::String: wire = kWireBytes; break;
+    }
+
+    unsigned tag = tagFor(dict, f.name);
+    varint::put(out, ((unsigned long long)tag << 3) | wire);
+    if (tag == 0) {
+      varint::put(out, f.name.size());
+      out += f.name;
+    }
+
+    switch (wire) {
+    case kWireVarint:
+      varint::put(out, varint::zigzag(f.i));
+      break;
+    case kWireDouble: {
+      unsigned long long bits = 0;
+      std::memcpy(&bits, &f.d, sizeof bits);
+      for (int b = 0; b < 8; ++b)
+        out.push_back((char)(bits >> (8 * b)));
+      break;
+    }
+    case kWireBytes:
+      varint::put(out, f.s.size());
+      out += f.s;
+      break;
+    default:
+      break; // value is in the wire type
+    }
+  }
+} // payload::encodeBinary
+
+bool decodeBinary(string_view blob, PayloadFields &out) {
+  out.clear();
+  if (!isBinary(blob) || (unsigned char)blob[1] != kVersion ||
+      (unsigned char)blob[2] >= kDictCount)
+    return false;
+  const Dict &dict = kDicts[(unsigned char)blob[2]];
+
+  std::size_t pos = 3;
+  while (pos < blob.size()) {
+    unsigned long long key = 0, len = 0;
+    if (!varint::get(blob, pos, key))
+      return false;
+    unsigned wire = (unsigned)(key & 7);
+    unsigned long long tag = key >> 3;
+
+    PayloadField f;
+    if (tag == 0) {
+      if (!varint::get(blob, pos, len) || len > blob.size() - pos)
+        return false;
+      f.name.assign(blob.data() + pos, (std::size_t)len);
+      pos += (std::size_t)len;
+    } else if (tag <= dict.count) {
+      f.name = dict.names[tag - 1];
+    } else {
+      return false;
+    }
+
+    switch (wire) {
+    case kWireVarint: {
+      unsigned long long v = 0;
+      if (!varint::get(blob, pos, v))
+        return false;
+      f.kind = PayloadField::Kind::Int;
+      f.i = varint::unzigzag(v);
+      break;
+    }
+    case kWireDouble: {
+      if (blob.size() - pos < 8)
+        return false;
+      unsigned long long bits = 0;
+      for (int b = 0; b < 8; ++b)
+        bits |= (unsigned long long)(unsigned char)blob[pos + b] << (8 * b);
+      pos += 8;
+      f.kind = PayloadField::Kind::Double;
+      std::memcpy(&f.d, &bits, sizeof bits);
+      break;
+    }
+    case kWireBytes:
+      if (!varint::get(blob, pos, len) || len > blob.size() - pos)
+        return false;
+      f.kind = PayloadField::Kind::String;
+      f.s.assign(blob.data() + pos, (std::size_t)len);
+      pos += (std::size_t)len;
+      break;
+    case kWireFalse:
+    case kWireTrue:
+      f.kind = PayloadField::Kind::Bool;
+      f.b = wire == kWireTrue;
+      break;
+    case kWireNull:
+      f.kind = PayloadField::Kind::Null;
+      break;
+    default:
+      return false;
+    }
+    out.push_back(std::move(f));
+  }
+  return true;
+} // payload::decodeBinary
+
+bool decode(string_view blob, PayloadFields &out) {
+  return isBinary(blob) ? decodeBinary(blob, out) : parseJson(blob, out);
+} // payload::decode
+
+string toJson(string_view blob) {
+  if (!isBinary(blob))
+    return string(blob);
+  PayloadFields fields;
+  if (!decodeBinary(blob, fields))
+    return string(blob);
+  return toJson(fields);
+} // payload::toJson
+
+bool jsonToBinary(string_view entity_type, string_view json, string &out) {
+  PayloadFields fields;
+  if (!parseJson(json, fields))
+    return false;
+  encodeBinary(entity_type, fields, out);
+  return true;
+} // payload::jsonToBinary
+
+} // namespace payload
+} // namespace together
@@ -0,0 +1,153 @@
+#include "core/ReaderPool.h"
+#include <sqlite3.h>
+
+#include <string>
+
+using std::string;
+using std::vector;
+
+namespace together {
+
+namespace {
+
+// The connection this thread currently holds, if any, so acquire() can
+// hand it back to nested reads instead of waiting on itself.
+thread_local const ReaderPool *tl_pool = nullptr;
+thread_local void *tl_reader = nullptr;
+
+} // namespace
+
+ReaderPool::~ReaderPool() { close(); } // ReaderPool::~ReaderPool
+
+string ReaderPool::open(const string &db_path, std::size_t readers,
+                        const vector<StmtSpec> &stmts,
+                        const string &pragmas) {
+  close();
+  for (std::size_t i = 0; i < readers; ++i) {
+    auto r = std::make_unique<Reader>();
+    // NOMUTEX: a connection is only ever used by the thread leasing it.
+    if (sqlite3_open_v2(db_path.c_str(), &r->db,
+                        SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                        nullptr) != SQLITE_OK) {
+      string err = sqlite3_errmsg(r->db);
+      sqlite3_close(r->db);
+      close();
+      return "reader open failed: " + err;
+    }
+    // Readers only wait while a checkpoint or recovery holds the WAL index.
+    sqlite3_busy_timeout(r->db, 5000);
+    if (!pragmas.empty() &&
+        sqlite3_exec(r->db, pragmas.c_str(), nullptr, nullptr, nullptr) !=
+            SQLITE_OK) {
+      string err = sqlite3_errmsg(r->db);
+      sqlite3_close(r->db);
+      close();
+      return "reader setup failed: " + err;
+    }
+
+    r->stmts.attach(r->db);
+    for (const StmtSpec &spec : stmts) {
+      if (r->stmts.prepareFixed(spec.first, spec.second) != SQLITE_OK) {
+        string err = sqlite3_errmsg(r->db);
+        r->stmts.clear();
+        sqlite3_close(r->db);
+        close();
+        return "reader prepare failed: " + err;
+      }
+    }
+    free_.push_back(r.get());
+    readers_.push_back(std::move(r));
+  }
+  return {};
+} // ReaderPool::open
+
+void ReaderPool::close() {
+  std::lock_guard<std::mutex> lock(mu_);
+  for (auto &r : readers_) {
+    r->stmts.clear(); // statements must be finalized before close
+    sqlite3_close(r->db);
+  }
+  readers_.clear();
+  free_.clear();
+} // ReaderPool::close
+
+unsigned long long ReaderPool::waits() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return waits_;
+} // ReaderPool::waits
+
+ReaderPool::Lease ReaderPool::acquire() {
+  Lease lease;
+  lease.pool_ = this;
+  if (tl_pool == this) {
+    lease.reader_ = static_cast<Reader *>(tl_reader);
+    return lease;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mu_);
+    if (readers_.empty())
+      return Lease{};
+    if (free_.empty()) {
+      ++waits_;
+      cv_.wait(lock, [this] { return !free_.empty(); });
+    }
+    lease.reader_ = free_.back();
+    free_.pop_back();
+  }
+  lease.owner_ = true;
+  lease.prev_pool_ = tl_pool;
+  lease.prev_reader_ = static_cast<Reader *>(tl_reader);
+  tl_pool = this;
+  tl_reader = lease.reader_;
+  return lease;
+} // ReaderPool::acquire
+
+void ReaderPool::release(Reader *reader) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    free_.push_back(reader);
+  }
+  cv_.notify_one();
+} // ReaderPool::release
+
+ReaderPool::Lease::Lease(Lease &&other) noexcept
+    : pool_(other.pool_), reader_(other.reader_), owner_(other.owner_),
+      prev_pool_(other.prev_pool_), prev_reader_(other.prev_reader_) {
+  other.reader_ = nullptr;
+  other.owner_ = false;
+} // ReaderPool::Lease::Lease
+
+ReaderPool::Lease &ReaderPool::Lease::operator=(Lease &&other) noexcept {
+  if (this != &other) {
+    reset();
+    pool_ = other.pool_;
+    reader_ = other.reader_;
+    owner_ = other.owner_;
+    prev_pool_ = other.prev_pool_;
+    prev_reader_ = other.prev_reader_;
+    other.reader_ = nullptr;
+    other.owner_ = false;
+  }
+  return *this;
+} // ReaderPool::Lease::operator=
+
+sqlite3 *ReaderPool::Lease::db() const {
+  return reader_ ? reader_->db : nullptr;
+} // ReaderPool::Lease::db
+
+StatementCache &ReaderPool::Lease::stmts() const {
+  return reader_->stmts;
+} // ReaderPool::Lease::stmts
+
+void ReaderPool::Lease::reset() {
+  if (reader_ && owner_) {
+    tl_pool = prev_pool_;
+    tl_reader = prev_reader_;
+    pool_->release(reader_);
+  }
+  reader_ = nullptr;
+  owner_ = false;
+} // ReaderPool::Lease::reset
+
+} // namespace together
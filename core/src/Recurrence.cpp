@@ -0,0 +1,517 @@
+#include "core/Recurrence.h"
+
+#include <algorithm>
+#include <charconv>
+#include <string>
+
+using std::string;
+using std::string_view;
+
+namespace together {
+
+namespace {
+
+constexpr long long kDayMs = 86400000;
+constexpr long long kMinuteMs = 60000;
+
+// Months in a row a monthly rule may find no matching day before it is
+// considered exhausted (BYMONTHDAY=31 with INTERVAL=12 in April, say).
+constexpr int kMaxEmptyMonths = 48;
+
+const char *const kWeekdayCodes[7] = {"MO", "TU", "WE", "TH",
+                                      "FR", "SA", "SU"};
+
+long long floorDiv(long long a, long long b) {
+  long long q = a / b;
+  return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+long long floorMod(long long a, long long b) { return a - floorDiv(a, b) * b; }
+
+// Days since 1970-01-01 for a proleptic Gregorian date, and back
+// (H. Hinnant's civil calendar algorithms).
+long long daysFromCivil(long long y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const long long era = floorDiv(y, 400);
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (long long)doe - 719468;
+}
+
+void civilFromDays(long long z, long long &y, unsigned &m, unsigned &d) {
+  z += 719468;
+  const long long era = floorDiv(z, 146097);
+  const unsigned doe = (unsigned)(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  d = doy - (153 * mp + 2) / 5 + 1;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y = (long long)yoe + era * 400 + (m <= 2);
+}
+
+unsigned daysInMonth(long long y, unsigned m) {
+  static const unsigned kDays[12] = {31, 28, 31, 30, 31, 30,
+                                     31, 31, 30, 31, 30, 31};
+  const bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+  return m == 2 && leap ? 29 : kDays[m - 1];
+}
+
+long long monthIndex(long long day) {
+  long long y;
+  unsigned m, d;
+  civilFromDays(day, y, m, d);
+  return y * 12 + (long long)m - 1;
+}
+
+unsigned popcount(unsigned v) {
+  unsigned n = 0;
+  for (; v; v &= v - 1)
+    ++n;
+  return n;
+}
+
+bool parseInt(string_view s, long long &out) {
+  const char *end = s.data() + s.size();
+  auto res = std::from_chars(s.data(), end, out);
+  return !s.empty() && res.ec == std::errc() && res.ptr == end;
+}
+
+bool overrideBefore(const RecurrenceOverride &a, const RecurrenceOverride &b) {
+  return a.original < b.original;
+}
+
+} // namespace
+
+// ---- Recurrence --------------------------------------------------------
+
+bool Recurrence::compile(RecurrenceRule rule, Recurrence &out,
+                         string &out_error) {
+  if (rule.interval < 1 || rule.interval > 10000) {
+    out_error = "interval must be between 1 and 10000";
+    return false;
+  }
+  if (rule.utc_offset_minutes < -24 * 60 || rule.utc_offset_minutes > 24 * 60) {
+    out_error = "utc offset out of range";
+    return false;
+  }
+  if (rule.weekdays > 0x7f || rule.month_day < -1 || rule.month_day > 31 ||
+      rule.count < 0 || (rule.until != 0 && rule.until < rule.dtstart)) {
+    out_error = "invalid rule";
+    return false;
+  }
+
+  Recurrence r;
+  r.rule_ = std::move(rule);
+  const RecurrenceRule &R = r.rule_;
+  const long long local = R.dtstart + R.utc_offset_minutes * kMinuteMs;
+  r.day0_ = floorDiv(local, kDayMs);
+  r.tod_ = local - r.day0_ * kDayMs;
+  r.week0_ = floorDiv(r.day0_ + 3, 7); // 1970-01-01 was a Thursday
+  r.month0_ = monthIndex(r.day0_);
+  const unsigned wd0 = (unsigned)floorMod(r.day0_ + 3, 7);
+  r.mask_ = R.weekdays ? R.weekdays : 1u << wd0;
+  if (R.month_day != 0) {
+    r.mday_ = R.month_day;
+  } else {
+    long long y;
+    unsigned m, d;
+    civilFromDays(r.day0_, y, m, d);
+    r.mday_ = (int)d;
+  }
+
+  // Overrides: one per original (the last one given wins), each naming an
+  // occurrence of the rule.
+  std::stable_sort(r.rule_.overrides.begin(), r.rule_.overrides.end(),
+                   overrideBefore);
+  std::vector<RecurrenceOverride> unique;
+  for (const RecurrenceOverride &o : r.rule_.overrides) {
+    if (!r.isOccurrence(o.original)) {
+      out_error = "override " + std::to_string(o.original) +
+                  " is not an occurrence";
+      return false;
+    }
+    if (!unique.empty() && unique.back().original == o.original)
+      unique.back() = o;
+    else
+      unique.push_back(o);
+  }
+  r.rule_.overrides = std::move(unique);
+  r.reindex();
+  out = std::move(r);
+  return true;
+} // Recurrence::compile
+
+void Recurrence::reindex() {
+  moved_.clear();
+  const auto &ov = rule_.overrides;
+  for (std::size_t i = 0; i < ov.size(); ++i)
+    if (!ov[i].cancelled)
+      moved_.push_back((std::uint32_t)i);
+  std::sort(moved_.begin(), moved_.end(),
+            [&ov](std::uint32_t a, std::uint32_t b) {
+              return ov[a].start != ov[b].start ? ov[a].start < ov[b].start
+                                                : ov[a].original < ov[b].original;
+            });
+} // Recurrence::reindex
+
+bool Recurrence::setOverride(const RecurrenceOverride &change,
+                             string &out_error) {
+  if (!isOccurrence(change.original)) {
+    out_error = "not an occurrence";
+    return false;
+  }
+  auto &ov = rule_.overrides;
+  auto it = std::lower_bound(ov.begin(), ov.end(), change, overrideBefore);
+  if (it != ov.end() && it->original == change.original)
+    *it = change;
+  else
+    ov.insert(it, change);
+  reindex();
+  return true;
+} // Recurrence::setOverride
+
+long long Recurrence::dayStart(long long day) const {
+  return day * kDayMs + tod_ - rule_.utc_offset_minutes * kMinuteMs;
+} // Recurrence::dayStart
+
+long long Recurrence::monthlyDay(long long period) const {
+  const long long month = month0_ + period * rule_.interval;
+  const long long y = floorDiv(month, 12);
+  const unsigned m = (unsigned)(month - y * 12) + 1;
+  const unsigned dim = daysInMonth(y, m);
+  const unsigned d = mday_ > 0 ? (unsigned)mday_ : dim;
+  if (d > dim)
+    return -1;
+  const long long day = daysFromCivil(y, m, d);
+  return day < day0_ ? -1 : day;
+} // Recurrence::monthlyDay
+
+long long Recurrence::generatedBefore(long long period) const {
+  if (period <= 0)
+    return 0;
+  switch (rule_.freq) {
+  case Frequency::Daily:
+    return period;
+  case Frequency::Weekly: {
+    // Full weeks, less the first week's days before dtstart.
+    const unsigned wd0 = (unsigned)floorMod(day0_ + 3, 7);
+    return period * popcount(mask_) - popcount(mask_ & ((1u << wd0) - 1));
+  }
+  case Frequency::Monthly: {
+    long long n = 0;
+    for (long long p = 0; p < period; ++p)
+      n += monthlyDay(p) >= 0;
+    return n;
+  }
+  }
+  return 0;
+} // Recurrence::generatedBefore
+
+bool Recurrence::isOccurrence(long long start) const {
+  const long long local = start + rule_.utc_offset_minutes * kMinuteMs;
+  const long long day = floorDiv(local, kDayMs);
+  if (local - day * kDayMs != tod_ || day < day0_)
+    return false;
+  if (rule_.until != 0 && start > rule_.until)
+    return false;
+
+  long long index = 0;
+  switch (rule_.freq) {
+  case Frequency::Daily: {
+    const long long diff = day - day0_;
+    if (diff % rule_.interval != 0)
+      return false;
+    index = diff / rule_.interval;
+    break;
+  }
+  case Frequency::Weekly: {
+    const unsigned wd = (unsigned)floorMod(day + 3, 7);
+    const long long diff = floorDiv(day + 3, 7) - week0_;
+    if (!(mask_ >> wd & 1u) || diff % rule_.interval != 0)
+      return false;
+    const long long period = diff / rule_.interval;
+    index = generatedBefore(period) + popcount(mask_ & ((1u << wd) - 1));
+    if (period == 0)
+      index -= popcount(mask_ & ((1u << floorMod(day0_ + 3, 7)) - 1));
+    break;
+  }
+  case Frequency::Monthly: {
+    const long long diff = monthIndex(day) - month0_;
+    if (diff % rule_.interval != 0 || monthlyDay(diff / rule_.interval) != day)
+      return false;
+    index = rule_.count ? generatedBefore(diff / rule_.interval) : 0;
+    break;
+  }
+  }
+  return rule_.count == 0 || index < rule_.count;
+} // Recurrence::isOccurrence
+
+string Recurrence::encode() const {
+  const RecurrenceRule &R = rule_;
+  static const char *const kFreq[] = {"DAILY", "WEEKLY", "MONTHLY"};
+  string out = "FREQ=";
+  out += kFreq[(int)R.freq];
+  out += ";DTSTART=" + std::to_string(R.dtstart);
+  if (R.interval != 1)
+    out += ";INTERVAL=" + std::to_string(R.interval);
+  if (R.utc_offset_minutes != 0)
+    out += ";TZOFFSET=" + std::to_string(R.utc_offset_minutes);
+  if (R.weekdays != 0) {
+    out += ";BYDAY=";
+    bool first = true;
+    for (unsigned wd = 0; wd < 7; ++wd)
+      if (R.weekdays >> wd & 1u) {
+        if (!first)
+          out += ',';
+        out += kWeekdayCodes[wd];
+        first = false;
+      }
+  }
+  if (R.month_day != 0)
+    out += ";BYMONTHDAY=" + std::to_string(R.month_day);
+  if (R.count != 0)
+    out += ";COUNT=" + std::to_string(R.count);
+  if (R.until != 0)
+    out += ";UNTIL=" + std::to_string(R.until);
+  string exdates, moved;
+  for (const RecurrenceOverride &o : R.overrides) {
+    string &list = o.cancelled ? exdates : moved;
+    if (!list.empty())
+      list += ',';
+    list += std::to_string(o.original);
+    if (!o.cancelled)
+      list += '>' + std::to_string(o.start);
+  }
+  if (!exdates.empty())
+    out += ";EXDATE=" + exdates;
+  if (!moved.empty())
+    out += ";MOVED=" + moved;
+  return out;
+} // Recurrence::encode
+
+bool Recurrence::parse(string_view text, Recurrence &out, string &out_error) {
+  RecurrenceRule rule;
+  bool have_freq = false, have_start = false;
+  auto bad = [&out_error](string_view part) {
+    out_error = "bad rrule part: " + string(part);
+    return false;
+  };
+  while (!text.empty()) {
+    const std::size_t semi = text.find(';');
+    const string_view part = text.substr(0, semi);
+    text.remove_prefix(semi == string_view::npos ? text.size() : semi + 1);
+    if (part.empty())
+      continue;
+    const std::size_t eq = part.find('=');
+    if (eq == string_view::npos)
+      return bad(part);
+    const string_view key = part.substr(0, eq);
+    string_view value = part.substr(eq + 1);
+    long long n = 0;
+
+    if (key == "FREQ") {
+      if (value == "DAILY")
+        rule.freq = Frequency::Daily;
+      else if (value == "WEEKLY")
+        rule.freq = Frequency::Weekly;
+      else if (value == "MONTHLY")
+        rule.freq = Frequency::Monthly;
+      else
+        return bad(part);
+      have_freq = true;
+    } else if (key == "BYDAY") {
+      while (!value.empty()) {
+        const string_view code = value.substr(0, value.find(','));
+        unsigned wd = 0;
+        while (wd < 7 && code != kWeekdayCodes[wd])
+          ++wd;
+        if (wd == 7)
+          return bad(part);
+        rule.weekdays |= 1u << wd;
+        value.remove_prefix(std::min(value.size(), code.size() + 1));
+      }
+    } else if (key == "EXDATE" || key == "MOVED") {
+      const bool moved = key == "MOVED";
+      while (!value.empty()) {
+        const string_view item = value.substr(0, value.find(','));
+        RecurrenceOverride o;
+        o.cancelled = !moved;
+        const std::size_t gt = item.find('>');
+        if (moved != (gt != string_view::npos) ||
+            !parseInt(item.substr(0, gt), o.original) ||
+            (moved && !parseInt(item.substr(gt + 1), o.start)))
+          return bad(part);
+        rule.overrides.push_back(o);
+        value.remove_prefix(std::min(value.size(), item.size() + 1));
+      }
+    } else if (!parseInt(value, n)) {
+      return bad(part);
+    } else if (key == "DTSTART") {
+      rule.dtstart = n;
+      have_start = true;
+    } else if (key == "INTERVAL") {
+      rule.interval = (int)std::max(-1LL, std::min(n, 1LL << 30));
+    } else if (key == "TZOFFSET") {
+      rule.utc_offset_minutes = (int)std::max(-(1LL << 30), std::min(n, 1LL << 30));
+    } else if (key == "BYMONTHDAY") {
+      rule.month_day = (int)std::max(-2LL, std::min(n, 32LL));
+    } else if (key == "COUNT") {
+      rule.count = (int)std::max(-1LL, std::min(n, 1LL << 30));
+    } else if (key == "UNTIL") {
+      rule.until = n;
+    } else {
+      return bad(part);
+    }
+  }
+  if (!have_freq || !have_start) {
+    out_error = "rrule needs FREQ and DTSTART";
+    return false;
+  }
+  return compile(std::move(rule), out, out_error);
+} // Recurrence::parse
+
+// ---- OccurrenceIterator ------------------------------------------------
+
+OccurrenceIterator::OccurrenceIterator(const Recurrence &series, long long from,
+                                       long long to)
+    : series_(&series), from_(from), to_(to) {
+  const RecurrenceRule &R = series.rule_;
+  if (to <= from) {
+    rule_done_ = true;
+    moved_ = series.moved_.size();
+    return;
+  }
+  // Start at the period holding `from`; earlier periods only feed COUNT.
+  const long long from_day =
+      floorDiv(from + R.utc_offset_minutes * kMinuteMs, kDayMs);
+  long long periods = 0;
+  switch (R.freq) {
+  case Frequency::Daily:
+    periods = floorDiv(from_day - series.day0_, R.interval);
+    break;
+  case Frequency::Weekly:
+    periods = floorDiv(floorDiv(from_day + 3, 7) - series.week0_, R.interval);
+    break;
+  case Frequency::Monthly:
+    periods = floorDiv(monthIndex(from_day) - series.month0_, R.interval);
+    break;
+  }
+  period_ = std::max(0LL, periods);
+  if (R.count != 0)
+    generated_ = series.generatedBefore(period_);
+
+  const auto &ov = R.overrides;
+  RecurrenceOverride key;
+  key.original = from;
+  override_ = (std::size_t)(std::lower_bound(ov.begin(), ov.end(), key,
+                                             overrideBefore) -
+                            ov.begin());
+  const auto &mv = series.moved_;
+  moved_ = (std::size_t)(std::lower_bound(mv.begin(), mv.end(), from,
+                                          [&ov](std::uint32_t i, long long t) {
+                                            return ov[i].start < t;
+                                          }) -
+                         mv.begin());
+} // OccurrenceIterator::OccurrenceIterator
+
+bool OccurrenceIterator::nextGenerated(long long &out) {
+  const Recurrence &S = *series_;
+  const RecurrenceRule &R = S.rule_;
+  int empty_months = 0;
+  for (;;) {
+    if (R.count != 0 && generated_ >= R.count)
+      return false;
+    long long day = 0;
+    switch (R.freq) {
+    case Frequency::Daily:
+      day = S.day0_ + period_ * R.interval;
+      ++period_;
+      break;
+    case Frequency::Weekly: {
+      const unsigned rest = weekday_ < 7 ? S.mask_ >> weekday_ : 0;
+      if (rest == 0) {
+        ++period_;
+        weekday_ = 0;
+        continue;
+      }
+      unsigned wd = weekday_;
+      while (!(S.mask_ >> wd & 1u))
+        ++wd;
+      weekday_ = wd + 1;
+      day = (S.week0_ + period_ * R.interval) * 7 - 3 + wd;
+      if (day < S.day0_)
+        continue; // dtstart's week, before dtstart
+      break;
+    }
+    case Frequency::Monthly:
+      day = S.monthlyDay(period_);
+      ++period_;
+      if (day < 0) {
+        if (++empty_months > kMaxEmptyMonths)
+          return false;
+        continue;
+      }
+      break;
+    }
+    const long long start = S.dayStart(day);
+    ++generated_;
+    if (R.until != 0 && start > R.until)
+      return false;
+    out = start;
+    return true;
+  }
+} // OccurrenceIterator::nextGenerated
+
+bool OccurrenceIterator::fillRule() {
+  const auto &ov = series_->rule_.overrides;
+  while (!pending_ && !rule_done_) {
+    long long start;
+    if (!nextGenerated(start) || start >= to_) {
+      rule_done_ = true;
+      break;
+    }
+    if (start < from_)
+      continue;
+    while (override_ < ov.size() && ov[override_].original < start)
+      ++override_;
+    if (override_ < ov.size() && ov[override_].original == start)
+      continue; // cancelled, or emitted at its new start
+    next_.start = next_.original = start;
+    pending_ = true;
+  }
+  return pending_;
+} // OccurrenceIterator::fillRule
+
+bool OccurrenceIterator::movedHead(const RecurrenceOverride *&out) {
+  const auto &mv = series_->moved_;
+  if (moved_ >= mv.size())
+    return false;
+  const RecurrenceOverride &o = series_->rule_.overrides[mv[moved_]];
+  if (o.start >= to_) {
+    moved_ = mv.size();
+    return false;
+  }
+  out = &o;
+  return true;
+} // OccurrenceIterator::movedHead
+
+bool OccurrenceIterator::next(Occurrence &out) {
+  const bool have_rule = fillRule();
+  const RecurrenceOverride *moved = nullptr;
+  const bool have_moved = movedHead(moved);
+  if (have_moved && (!have_rule || moved->start < next_.start)) {
+    out.start = moved->start;
+    out.original = moved->original;
+    ++moved_;
+    return true;
+  }
+  if (!have_rule)
+    return false;
+  out = next_;
+  pending_ = false;
+  return true;
+} // OccurrenceIterator::next
+
+} // namespace together
@@ -0,0 +1,442 @@
+#include "core/EventStore.h"
+#include "core/PayloadCodec.h"
+#include "core/TaskCache.h"
+#include "BudgetLedger.h"
+#include "Snapshot.h"
+#include "SqliteUtil.h"
+#include "TaskAssignees.h"
+#include "VisibilityPolicy.h"
+#include <sqlite3.h>
+
+#include <chrono>
+#include <string>
+#include <utility>
+
+using std::string;
+using std::string_view;
+
+namespace together {
+
+using sql::bindText;
+using sql::columnView;
+
+namespace {
+
+// Column list shared by the live table and its scratch copy, so the
+// verify diff and the rebuild copy line up column for column.
+#define TASK_COLUMNS                                                           \
+  "id, title, assignees_csv, due_at, points, status, visibility_tag, "         \
+  "updated_at"
+
+// Replay targets live in TEMP so a crashed replay leaves nothing behind in
+// the database file and verify mode never writes to it.
+const char *const kTaskScratchDdl =
+    "DROP TABLE IF EXISTS temp.task_replay;"
+    "CREATE TEMP TABLE task_replay ("
+    "  id TEXT PRIMARY KEY,"
+    "  title TEXT NOT NULL,"
+    "  assignees_csv TEXT DEFAULT '',"
+    "  due_at INTEGER DEFAULT 0,"
+    "  points INTEGER DEFAULT 0,"
+    "  status TEXT DEFAULT 'open',"
+    "  visibility_tag TEXT DEFAULT 'family',"
+    "  updated_at INTEGER NOT NULL"
+    ");";
+
+// Absent payload fields bind as NULL: a new row takes the column default,
+// an existing row keeps its value.
+const char *const kTaskReplayUpsert =
+    "INSERT INTO temp.task_replay(" TASK_COLUMNS ") "
+    "VALUES(?1, COALESCE(?2,''), COALESCE(?3,''), COALESCE(?4,0), "
+    "       COALESCE(?5,0), COALESCE(?6,'open'), COALESCE(?7,'family'), ?8) "
+    "ON CONFLICT(id) DO UPDATE SET "
+    "  title=COALESCE(?2,title), "
+    "  assignees_csv=COALESCE(?3,assignees_csv), "
+    "  due_at=COALESCE(?4,due_at), "
+    "  points=COALESCE(?5,points), "
+    "  status=COALESCE(?6,status), "
+    "  visibility_tag=COALESCE(?7,visibility_tag), "
+    "  updated_at=?8";
+
+// The row upsertTask wrote, in kTaskReplayUpsert parameter order from ?2.
+const char *const kTaskEventRowSelect =
+    "SELECT title, assignees_csv, due_at, points, status, visibility_tag "
+    "FROM main.task_event_row WHERE seq = ?";
+
+const char *const kTaskReplayDelete =
+    "UPDATE temp.task_replay SET status='deleted', updated_at=? WHERE id=?";
+
+const char *const kTaskDiff =
+    "SELECT id FROM (SELECT " TASK_COLUMNS " FROM main.task "
+    "                EXCEPT SELECT " TASK_COLUMNS " FROM temp.task_replay) "
+    "UNION "
+    "SELECT id FROM (SELECT " TASK_COLUMNS " FROM temp.task_replay "
+    "                EXCEPT SELECT " TASK_COLUMNS " FROM main.task) "
+    "ORDER BY id";
+
+// vis_mask and task_assignee are derived from the task columns, so they
+// are not replayed. origin is the device of the task's latest event, from
+// remote_event (none: a local write).
+string taskSwapSql() {
+  return "DELETE FROM main.task;"
+         "INSERT INTO main.task(" TASK_COLUMNS ", vis_mask) "
+         "SELECT " TASK_COLUMNS ", " +
+         visibility::tagMaskSql("visibility_tag") +
+         " FROM temp.task_replay;"
+         "UPDATE main.task SET origin = COALESCE(("
+         "  SELECT r.origin FROM main.remote_event AS r WHERE r.seq = ("
+         "    SELECT MAX(e.seq) FROM main.event_log AS e"
+         "    WHERE e.type_code = (SELECT code FROM main.event_dict"
+         "                         WHERE name = 'task')"
+         "      AND e.entity_id = task.id)), '')"
+         " WHERE EXISTS (SELECT 1 FROM main.remote_event);"
+         "DELETE FROM main.task_assignee;" +
+         assignees::kRebuildSql;
+}
+
+const char *const kTaskReplayCount = "SELECT COUNT(*) FROM temp.task_replay";
+
+const char *const kTaskScratchDrop = "DROP TABLE IF EXISTS temp.task_replay";
+
+#undef TASK_COLUMNS
+
+// Budget rows fold exactly as the live writes fold them (BudgetLedger.h);
+// budget_month is then recomputed from the rows with a GROUP BY, which
+// checks the incrementally maintained totals against the log.
+#define BUDGET_TX_COLUMNS "id, category, month, amount_cents, updated_at"
+#define BUDGET_LIMIT_COLUMNS                                                   \
+  "id, category, month, limit_cents, rollover, updated_at"
+
+const char *const kBudgetScratchDdl =
+    "DROP TABLE IF EXISTS temp.budget_tx_replay;"
+    "DROP TABLE IF EXISTS temp.budget_limit_replay;"
+    "CREATE TEMP TABLE budget_tx_replay ("
+    "  id TEXT PRIMARY KEY,"
+    "  category TEXT NOT NULL,"
+    "  month INTEGER NOT NULL,"
+    "  amount_cents INTEGER NOT NULL,"
+    "  updated_at INTEGER NOT NULL"
+    ");"
+    "CREATE TEMP TABLE budget_limit_replay ("
+    "  id TEXT PRIMARY KEY,"
+    "  category TEXT NOT NULL,"
+    "  month INTEGER NOT NULL,"
+    "  limit_cents INTEGER NOT NULL,"
+    "  rollover INTEGER NOT NULL,"
+    "  updated_at INTEGER NOT NULL"
+    ");";
+
+const char *const kBudgetTxReplayUpsert =
+    BUDGET_TX_UPSERT_SQL("temp.budget_tx_replay");
+const char *const kBudgetTxReplayDelete =
+    "DELETE FROM temp.budget_tx_replay WHERE id = ?1";
+const char *const kBudgetLimitReplayUpsert =
+    BUDGET_LIMIT_UPSERT_SQL("temp.budget_limit_replay");
+const char *const kBudgetLimitReplayDelete =
+    "DELETE FROM temp.budget_limit_replay WHERE id = ?1";
+
+// Each diff yields (key) rows; the key is prefixed with the table name.
+const char *const kBudgetTxDiff =
+    "SELECT id FROM (SELECT " BUDGET_TX_COLUMNS " FROM main.budget_tx "
+    "                EXCEPT SELECT " BUDGET_TX_COLUMNS
+    "                FROM temp.budget_tx_replay) "
+    "UNION "
+    "SELECT id FROM (SELECT " BUDGET_TX_COLUMNS " FROM temp.budget_tx_replay "
+    "                EXCEPT SELECT " BUDGET_TX_COLUMNS " FROM main.budget_tx) "
+    "ORDER BY id";
+
+const char *const kBudgetLimitDiff =
+    "SELECT id FROM (SELECT " BUDGET_LIMIT_COLUMNS " FROM main.budget_limit "
+    "                EXCEPT SELECT " BUDGET_LIMIT_COLUMNS
+    "                FROM temp.budget_limit_replay) "
+    "UNION "
+    "SELECT id FROM (SELECT " BUDGET_LIMIT_COLUMNS
+    "                FROM temp.budget_limit_replay "
+    "                EXCEPT SELECT " BUDGET_LIMIT_COLUMNS
+    "                FROM main.budget_limit) "
+    "ORDER BY id";
+
+// Rows left at zero by deletes (or created by a carry) count as absent.
+const char *const kBudgetMonthDiff =
+    "WITH live AS (SELECT category, month, net_cents, tx_count "
+    "              FROM main.budget_month "
+    "              WHERE tx_count <> 0 OR net_cents <> 0), "
+    "     log AS (SELECT category, month, SUM(amount_cents), COUNT(*) "
+    "             FROM temp.budget_tx_replay GROUP BY category, month) "
+    "SELECT category || '@' || month AS k "
+    "FROM (SELECT * FROM live EXCEPT SELECT * FROM log) "
+    "UNION "
+    "SELECT category || '@' || month "
+    "FROM (SELECT * FROM log EXCEPT SELECT * FROM live) "
+    "ORDER BY k";
+
+const char *const kBudgetSwap =
+    "DELETE FROM main.budget_tx;"
+    "INSERT INTO main.budget_tx(" BUDGET_TX_COLUMNS ") "
+    "SELECT " BUDGET_TX_COLUMNS " FROM temp.budget_tx_replay;"
+    "DELETE FROM main.budget_limit;"
+    "INSERT INTO main.budget_limit(" BUDGET_LIMIT_COLUMNS ") "
+    "SELECT " BUDGET_LIMIT_COLUMNS " FROM temp.budget_limit_replay;"
+    "DELETE FROM main.budget_month;";
+
+const char *const kBudgetReplayCount =
+    "SELECT (SELECT COUNT(*) FROM temp.budget_tx_replay) + "
+    "       (SELECT COUNT(*) FROM temp.budget_limit_replay)";
+
+const char *const kBudgetScratchDrop =
+    "DROP TABLE IF EXISTS temp.budget_tx_replay;"
+    "DROP TABLE IF EXISTS temp.budget_limit_replay;";
+
+#undef BUDGET_TX_COLUMNS
+#undef BUDGET_LIMIT_COLUMNS
+
+// Parameter slot in kTaskReplayUpsert for each payload field it honours.
+struct FieldSlot {
+  const char *name;
+  int param;
+  bool integer;
+};
+
+constexpr FieldSlot kTaskSlots[] = {
+    {"title", 2, false},  {"assignees", 3, false}, {"due_at", 4, true},
+    {"points", 5, true},  {"status", 6, false},    {"visibility_tag", 7, false},
+};
+
+void bindTaskField(sqlite3_stmt *st, const PayloadField &f) {
+  for (const FieldSlot &slot : kTaskSlots) {
+    if (f.name != slot.name)
+      continue;
+    if (slot.integer) {
+      if (f.kind == PayloadField::Kind::Int)
+        sqlite3_bind_int64(st, slot.param, (sqlite3_int64)f.i);
+      else if (f.kind == PayloadField::Kind::Double)
+        sqlite3_bind_int64(st, slot.param, (sqlite3_int64)f.d);
+    } else if (f.kind == PayloadField::Kind::String) {
+      bindText(st, slot.param, f.s);
+    }
+    return;
+  }
+}
+
+} // namespace
+
+bool EventStore::replay(const ReplayOptions &options, ReplayReport &out_report,
+                        string &out_error) {
+  std::lock_guard<std::recursive_mutex> lock(write_mu_);
+  out_report = ReplayReport{};
+  out_error.clear();
+  if (!db_) {
+    out_error = "database not open";
+    return false;
+  }
+
+  const auto started = std::chrono::steady_clock::now();
+  if (!execSql(kTaskScratchDdl, out_error) ||
+      !execSql(kBudgetScratchDdl, out_error))
+    return false;
+
+  auto fail = [&](const string &err) {
+    string ignored;
+    if (!sqlite3_get_autocommit(db_))
+      execSql("ROLLBACK", ignored);
+    execSql(kTaskScratchDrop, ignored);
+    execSql(kBudgetScratchDrop, ignored);
+    out_error = err;
+    return false;
+  };
+
+  // Pinned in the adhoc cache for the whole replay.
+  const ScopedStmt upsert_pin = stmts_.adhoc(kTaskReplayUpsert);
+  const ScopedStmt row_pin = stmts_.adhoc(kTaskEventRowSelect);
+  const ScopedStmt del_pin = stmts_.adhoc(kTaskReplayDelete);
+  const ScopedStmt tx_upsert_pin = stmts_.adhoc(kBudgetTxReplayUpsert);
+  const ScopedStmt tx_del_pin = stmts_.adhoc(kBudgetTxReplayDelete);
+  const ScopedStmt limit_upsert_pin = stmts_.adhoc(kBudgetLimitReplayUpsert);
+  const ScopedStmt limit_del_pin = stmts_.adhoc(kBudgetLimitReplayDelete);
+  sqlite3_stmt *upsert = upsert_pin.get();
+  sqlite3_stmt *event_row = row_pin.get();
+  sqlite3_stmt *del = del_pin.get();
+  sqlite3_stmt *tx_upsert = tx_upsert_pin.get();
+  sqlite3_stmt *tx_del = tx_del_pin.get();
+  sqlite3_stmt *limit_upsert = limit_upsert_pin.get();
+  sqlite3_stmt *limit_del = limit_del_pin.get();
+  if (!upsert || !event_row || !del || !tx_upsert || !tx_del ||
+      !limit_upsert || !limit_del)
+    return fail("prepare failed");
+
+  // One reusable field list; decode() assigns into existing strings.
+  PayloadFields fields;
+  bool apply_failed = false;
+  ReadBudget budget;
+  budget.max_rows = options.batch_events ? options.batch_events : 20000;
+  ReadCursor cursor;
+  long long next_seq = 0;
+  do {
+    // Deferred: the scratch table is TEMP, so a batch never needs the
+    // database write lock.
+    if (!execSql("BEGIN", out_error))
+      return fail(out_error);
+
+    bool ok = scanSinceView(
+        next_seq, budget,
+        [&](const DeltaEventView &e) {
+          ++out_report.events;
+          if (const budget::Kind kind = budget::kindOf(e.entity_type);
+              kind != budget::Kind::None) {
+            const bool tx = kind == budget::Kind::Tx;
+            const int folded = budget::fold(
+                kind, tx ? tx_upsert : limit_upsert, tx ? tx_del : limit_del,
+                e.entity_id, e.op, e.payload, e.ts, fields);
+            if (folded < 0) {
+              apply_failed = true;
+              return false;
+            }
+            ++(folded ? out_report.applied : out_report.skipped);
+            return true;
+          }
+          if (e.entity_type != "task") {
+            ++out_report.skipped;
+            return true;
+          }
+
+          int rc;
+          if (e.op == "upsert") {
+            // An upsertTask event replays to the row it wrote; other
+            // upserts supply what their payload carries.
+            ScopedStmt row(event_row);
+            sqlite3_bind_int64(event_row, 1, (sqlite3_int64)e.seq);
+            rc = sqlite3_step(event_row);
+            if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+              apply_failed = true;
+              return false;
+            }
+            const bool written = rc == SQLITE_ROW;
+            if (!written && !payload::decode(e.payload, fields)) {
+              ++out_report.skipped;
+              return true;
+            }
+            ScopedStmt st(upsert);
+            bindText(upsert, 1, e.entity_id);
+            if (written) {
+              for (int i = 0; i < 6; ++i)
+                sqlite3_bind_value(upsert, i + 2,
+                                   sqlite3_column_value(event_row, i));
+            } else {
+              for (const PayloadField &f : fields)
+                bindTaskField(upsert, f);
+            }
+            sqlite3_bind_int64(upsert, 8, (sqlite3_int64)e.ts);
+            rc = sqlite3_step(upsert);
+          } else if (e.op == "delete") {
+            {
+              ScopedStmt st(del);
+              sqlite3_bind_int64(del, 1, (sqlite3_int64)e.ts);
+              bindText(del, 2, e.entity_id);
+              rc = sqlite3_step(del);
+            }
+            // A compacted delete carries the row it leaves behind.
+            if (rc == SQLITE_DONE && sqlite3_changes(db_) == 0 &&
+                payload::decode(e.payload, fields) &&
+                snapshot::carriesTaskRow(fields)) {
+              ScopedStmt st(upsert);
+              bindText(upsert, 1, e.entity_id);
+              for (const PayloadField &f : fields)
+                bindTaskField(upsert, f);
+              bindText(upsert, 6, "deleted");
+              sqlite3_bind_int64(upsert, 8, (sqlite3_int64)e.ts);
+              rc = sqlite3_step(upsert);
+            }
+          } else {
+            ++out_report.skipped;
+            return true;
+          }
+
+          if (rc != SQLITE_DONE) {
+            apply_failed = true;
+            return false;
+          }
+          ++out_report.applied;
+          return true;
+        },
+        cursor, out_error);
+    if (!ok)
+      return fail(out_error);
+    if (apply_failed)
+      return fail("apply failed: " + string(sqlite3_errmsg(db_)));
+    if (!execSql("COMMIT", out_error))
+      return fail(out_error);
+    next_seq = cursor.next_seq;
+  } while (!cursor.done);
+
+  {
+    ScopedStmt st(stmts_.adhoc(kTaskReplayCount));
+    if (!st || sqlite3_step(st.get()) != SQLITE_ROW)
+      return fail("count failed");
+    out_report.rows = sqlite3_column_int64(st.get(), 0);
+  }
+  {
+    ScopedStmt st(stmts_.adhoc(kBudgetReplayCount));
+    if (!st || sqlite3_step(st.get()) != SQLITE_ROW)
+      return fail("count failed");
+    out_report.budget_rows = sqlite3_column_int64(st.get(), 0);
+  }
+
+  if (options.verify_only) {
+    const std::pair<const char *, const char *> diffs[] = {
+        {kTaskDiff, "task:"},
+        {kBudgetTxDiff, "budget_tx:"},
+        {kBudgetLimitDiff, "budget_limit:"},
+        {kBudgetMonthDiff, "budget_month:"},
+    };
+    for (const auto &diff : diffs) {
+      ScopedStmt st(stmts_.adhoc(diff.first));
+      if (!st)
+        return fail("prepare failed");
+      int rc;
+      while ((rc = sqlite3_step(st.get())) == SQLITE_ROW) {
+        if (out_report.diff_ids.size() < options.max_reported_diffs)
+          out_report.diff_ids.push_back(diff.second +
+                                        string(columnView(st.get(), 0)));
+        ++out_report.mismatches;
+      }
+      if (rc != SQLITE_DONE)
+        return fail("diff failed");
+    }
+  } else {
+    if (!beginImmediate())
+      return fail("begin failed");
+    if (!execSql(taskSwapSql().c_str(), out_error) ||
+        !execSql(kBudgetSwap, out_error) ||
+        !execSql(budget::kMonthRebuildSql, out_error)) {
+      rollback();
+      return fail(out_error);
+    }
+    if (!commit())
+      return fail("commit failed");
+    // Reminders reload from the rebuilt rows (due_ changes only under
+    // write_mu_, which replay holds).
+    if (due_) {
+      string due_err = enableDueScheduler();
+      if (!due_err.empty())
+        return fail(due_err);
+    }
+    // Every cached row may predate the rebuild.
+    std::lock_guard<std::mutex> cache_lock(cache_mu_);
+    ++cache_generation_;
+    if (task_cache_)
+      task_cache_->clear();
+  }
+
+  execSql(kTaskScratchDrop, out_error);
+  execSql(kBudgetScratchDrop, out_error);
+  out_error.clear();
+
+  out_report.seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - started)
+                           .count();
+  if (out_report.seconds > 0)
+    out_report.events_per_sec = out_report.events / out_report.seconds;
+  return true;
+} // EventStore::replay
+
+} // namespace together
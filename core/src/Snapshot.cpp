@@ -0,0 +1,210 @@
+#include "Snapshot.h"
+#include "BudgetLedger.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <utility>
+
+using std::string_view;
+
+namespace together {
+namespace snapshot {
+
+namespace {
+
+// How replay reads a row field from a payload; values of any other kind
+// are ignored.
+enum class Slot : std::uint8_t {
+  Text,   // string
+  Number, // int, or a double truncated to one
+  Month,  // budget::fieldMonth, stored as YYYYMM
+  Flag,   // bool, or an int (non-zero is true)
+};
+
+// A row field and the value a new row takes without it. Month defaults to
+// the month of the creating event's ts.
+struct RowField {
+  const char *name;
+  Slot slot;
+  const char *text;
+  long long number;
+};
+
+constexpr RowField kTaskRow[] = {
+    {"title", Slot::Text, "", 0},
+    {"assignees", Slot::Text, "", 0},
+    {"due_at", Slot::Number, nullptr, 0},
+    {"points", Slot::Number, nullptr, 0},
+    {"status", Slot::Text, "open", 0},
+    {"visibility_tag", Slot::Text, "family", 0},
+};
+constexpr std::size_t kTaskStatus = 4; // index of "status" in kTaskRow
+
+constexpr RowField kBudgetTxRow[] = {
+    {"category", Slot::Text, "", 0},
+    {"month", Slot::Month, nullptr, 0},
+    {"amount_cents", Slot::Number, nullptr, 0},
+};
+
+constexpr RowField kBudgetLimitRow[] = {
+    {"category", Slot::Text, "", 0},
+    {"month", Slot::Month, nullptr, 0},
+    {"amount_cents", Slot::Number, nullptr, 0},
+    {"rollover", Slot::Flag, nullptr, 1},
+};
+
+struct RowShape {
+  const RowField *fields = nullptr;
+  std::size_t size = 0;
+};
+
+RowShape shapeOf(string_view entity_type) {
+  if (entity_type == "task")
+    return {kTaskRow, std::size(kTaskRow)};
+  switch (budget::kindOf(entity_type)) {
+  case budget::Kind::Tx:
+    return {kBudgetTxRow, std::size(kBudgetTxRow)};
+  case budget::Kind::Limit:
+    return {kBudgetLimitRow, std::size(kBudgetLimitRow)};
+  case budget::Kind::None:
+    break;
+  }
+  return {};
+}
+
+void startRow(const RowShape &shape, long long ts, PayloadFields &out) {
+  out.clear();
+  for (std::size_t i = 0; i < shape.size; ++i) {
+    const RowField &rf = shape.fields[i];
+    PayloadField f;
+    f.name = rf.name;
+    switch (rf.slot) {
+    case Slot::Text:
+      f.kind = PayloadField::Kind::String;
+      f.s = rf.text;
+      break;
+    case Slot::Number:
+      f.kind = PayloadField::Kind::Int;
+      f.i = rf.number;
+      break;
+    case Slot::Month:
+      f.kind = PayloadField::Kind::Int;
+      f.i = budget::monthOf(ts);
+      break;
+    case Slot::Flag:
+      f.kind = PayloadField::Kind::Bool;
+      f.b = rf.number != 0;
+      break;
+    }
+    out.push_back(std::move(f));
+  }
+}
+
+// Stores `in` into the row field `out` if replay would take it.
+void assign(Slot slot, const PayloadField &in, PayloadField &out) {
+  long long month = 0;
+  switch (slot) {
+  case Slot::Text:
+    if (in.kind == PayloadField::Kind::String)
+      out.s = in.s;
+    return;
+  case Slot::Number:
+    if (in.kind == PayloadField::Kind::Int)
+      out.i = in.i;
+    else if (in.kind == PayloadField::Kind::Double)
+      out.i = (long long)in.d;
+    return;
+  case Slot::Month:
+    if (budget::fieldMonth(in, month))
+      out.i = month;
+    return;
+  case Slot::Flag:
+    if (in.kind == PayloadField::Kind::Bool)
+      out.b = in.b;
+    else if (in.kind == PayloadField::Kind::Int)
+      out.b = in.i != 0;
+    return;
+  }
+}
+
+// Folds upsert fields into a row started by startRow: row fields as
+// assign() takes them, anything else replaces a field of the same name.
+void merge(const RowShape &shape, const PayloadFields &in,
+           PayloadFields &row) {
+  for (const PayloadField &f : in) {
+    std::size_t i = 0;
+    while (i < row.size() && row[i].name != f.name)
+      ++i;
+    if (i < shape.size)
+      assign(shape.fields[i].slot, f, row[i]);
+    else if (i < row.size())
+      row[i] = f;
+    else
+      row.push_back(f);
+  }
+}
+
+} // namespace
+
+bool folds(string_view entity_type) {
+  return shapeOf(entity_type).size != 0;
+} // snapshot::folds
+
+void fold(string_view entity_type, string_view op, string_view payload,
+          long long ts, State &state, PayloadFields &scratch) {
+  const RowShape shape = shapeOf(entity_type);
+  if (!shape.size)
+    return;
+
+  if (op == "upsert") {
+    if (!payload::decode(payload, scratch))
+      return;
+    if (!state.exists) {
+      startRow(shape, ts, state.fields);
+      state.exists = true;
+    }
+    merge(shape, scratch, state.fields);
+    return;
+  }
+  if (op != "delete")
+    return;
+  if (entity_type != "task") {
+    state = State{}; // budget deletes drop the row
+    return;
+  }
+  // A task delete marks the row deleted; one that carries the row (an
+  // earlier snapshot) also creates it when it is missing.
+  if (!state.exists) {
+    if (!payload::decode(payload, scratch) || !carriesTaskRow(scratch))
+      return;
+    startRow(shape, ts, state.fields);
+    state.exists = true;
+    merge(shape, scratch, state.fields);
+  }
+  state.fields[kTaskStatus].s = "deleted";
+} // snapshot::fold
+
+void foldTaskRow(const PayloadFields &row, long long ts, State &state) {
+  const RowShape shape = shapeOf("task");
+  if (!state.exists) {
+    startRow(shape, ts, state.fields);
+    state.exists = true;
+  }
+  merge(shape, row, state.fields);
+} // snapshot::foldTaskRow
+
+bool carriesTaskRow(const PayloadFields &fields) {
+  for (const RowField &rf : kTaskRow) {
+    bool found = false;
+    for (const PayloadField &f : fields)
+      found = found || f.name == rf.name;
+    if (!found)
+      return false;
+  }
+  return true;
+} // snapshot::carriesTaskRow
+
+} // namespace snapshot
+} // namespace together
@@ -0,0 +1,42 @@
+#pragma once
+// Compaction snapshots: the state an entity's events fold to under
+// replay's rules. Compaction writes it into the event that supersedes the
+// ones it drops, so replay (and a peer syncing from zero) rebuilds the row
+// from the surviving event alone.
+#include "core/PayloadCodec.h"
+
+#include <string_view>
+
+namespace together {
+namespace snapshot {
+
+// The folded payload of one task, budget_tx or budget_limit entity.
+// `exists` is false until an upsert creates the row, and again after a
+// budget delete drops it; `fields` then holds every row field, defaults
+// filled in, followed by the other fields the upserts carried.
+struct State {
+  bool exists = false;
+  PayloadFields fields;
+};
+
+// True for the entity types replay rebuilds, whose events compaction folds.
+bool folds(std::string_view entity_type);
+
+// Folds one event into `state` the way replay applies it: undecodable
+// payloads, unknown ops and fields of the wrong type change nothing, and
+// a task delete sets status "deleted". `scratch` is reused between calls.
+void fold(std::string_view entity_type, std::string_view op,
+          std::string_view payload, long long ts, State &state,
+          PayloadFields &scratch);
+
+// Sets the task row fields of `state` to `row`, the row upsertTask wrote
+// beside the event just folded (see EventStore::replay); creates the row
+// if it is missing.
+void foldTaskRow(const PayloadFields &row, long long ts, State &state);
+
+// True if `fields` name every task row field, as a compacted task delete
+// does: replay and ingest create the row, deleted, if it is missing.
+bool carriesTaskRow(const PayloadFields &fields);
+
+} // namespace snapshot
+} // namespace together
@@ -0,0 +1,37 @@
+#pragma once
+// Small sqlite3 helpers shared by the EventStore translation units.
+#include <sqlite3.h>
+
+#include <cstddef>
+#include <string_view>
+
+namespace together {
+namespace sql {
+
+// Bind a view without copying; the caller keeps it alive until the
+// statement is reset (ScopedStmt does that on scope exit).
+inline void bindText(sqlite3_stmt *st, int idx, std::string_view v) {
+  sqlite3_bind_text(st, idx, v.data(), (int)v.size(), SQLITE_STATIC);
+}
+
+inline void bindBlob(sqlite3_stmt *st, int idx, std::string_view v) {
+  sqlite3_bind_blob(st, idx, v.data(), (int)v.size(), SQLITE_STATIC);
+}
+
+// NULL-safe view of a text column; valid until the next step/reset.
+inline std::string_view columnView(sqlite3_stmt *st, int col) {
+  const unsigned char *p = sqlite3_column_text(st, col);
+  return p ? std::string_view(reinterpret_cast<const char *>(p),
+                              (std::size_t)sqlite3_column_bytes(st, col))
+           : std::string_view();
+}
+
+inline std::string_view blobView(sqlite3_stmt *st, int col) {
+  const void *p = sqlite3_column_blob(st, col);
+  return p ? std::string_view(static_cast<const char *>(p),
+                              (std::size_t)sqlite3_column_bytes(st, col))
+           : std::string_view();
+}
+
+} // namespace sql
+} // namespace together
@@ -0,0 +1,151 @@
+#include "core/StatementCache.h"
+#include <sqlite3.h>
+
+#include <cassert>
+#include <string>
+
+using std::string;
+
+namespace together {
+
+StatementCache::StatementCache(std::size_t adhoc_capacity)
+    : capacity_(adhoc_capacity) {} // StatementCache::StatementCache
+
+StatementCache::~StatementCache() { clear(); } // StatementCache::~StatementCache
+
+void StatementCache::attach(sqlite3 *db) {
+  clear();
+  db_ = db;
+} // StatementCache::attach
+
+void StatementCache::clear() {
+  for (sqlite3_stmt *st : fixed_)
+    sqlite3_finalize(st); // finalize(nullptr) is a harmless no-op
+  fixed_.clear();
+
+  for (Entry &e : lru_) {
+    // A ScopedStmt still holding the entry would be left with a finalized
+    // statement and a dangling pin count.
+    assert(e.pins == 0 && "StatementCache cleared under a live ScopedStmt");
+    sqlite3_finalize(e.stmt);
+  }
+  lru_.clear();
+  index_.clear();
+} // StatementCache::clear
+
+int StatementCache::prepareFixed(std::size_t slot, const char *sql) {
+  if (!db_)
+    return SQLITE_MISUSE;
+  if (slot >= fixed_.size())
+    fixed_.resize(slot + 1, nullptr);
+
+  sqlite3_finalize(fixed_[slot]);
+  fixed_[slot] = nullptr;
+
+  // PERSISTENT: these statements live as long as the connection does.
+  return sqlite3_prepare_v3(db_, sql, -1, SQLITE_PREPARE_PERSISTENT,
+                            &fixed_[slot], nullptr);
+} // StatementCache::prepareFixed
+
+sqlite3_stmt *StatementCache::fixed(std::size_t slot) const {
+  return slot < fixed_.size() ? fixed_[slot] : nullptr;
+} // StatementCache::fixed
+
+ScopedStmt StatementCache::adhoc(const string &sql) {
+  if (!db_)
+    return ScopedStmt(nullptr);
+
+  auto it = index_.find(sql);
+  if (it != index_.end() && it->second->pins) {
+    // In use further up this connection's stack: resetting or rebinding
+    // it would break that caller's iteration.
+    ++misses_;
+    sqlite3_stmt *st = nullptr;
+    if (sqlite3_prepare_v2(db_, sql.c_str(), -1, &st, nullptr) != SQLITE_OK) {
+      sqlite3_finalize(st);
+      return ScopedStmt(nullptr);
+    }
+    return ScopedStmt(st, nullptr, true);
+  }
+  if (it != index_.end()) {
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second);
+  } else {
+    ++misses_;
+    sqlite3_stmt *st = nullptr;
+    if (sqlite3_prepare_v3(db_, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT,
+                           &st, nullptr) != SQLITE_OK) {
+      sqlite3_finalize(st);
+      evictOverflow();
+      return ScopedStmt(nullptr);
+    }
+    lru_.push_front(Entry{sql, st});
+    index_.emplace(sql, lru_.begin());
+  }
+  // Pinned before evicting, so the entry handed out always survives.
+  Entry &e = lru_.front();
+  ++e.pins;
+  evictOverflow();
+  return ScopedStmt(e.stmt, &e.pins, false);
+} // StatementCache::adhoc
+
+void StatementCache::setAdhocCapacity(std::size_t capacity) {
+  capacity_ = capacity;
+  evictOverflow();
+} // StatementCache::setAdhocCapacity
+
+void StatementCache::evictOverflow() {
+  // Walk from the cold end; never finalize a statement a ScopedStmt still
+  // holds, stepped or not.
+  auto it = lru_.end();
+  while (lru_.size() > capacity_ && it != lru_.begin()) {
+    --it;
+    if (it->pins)
+      continue;
+    sqlite3_finalize(it->stmt);
+    index_.erase(it->sql);
+    it = lru_.erase(it);
+    ++evictions_;
+  }
+} // StatementCache::evictOverflow
+
+ScopedStmt::ScopedStmt(sqlite3_stmt *stmt, std::size_t *pins, bool owned)
+    : stmt_(stmt), pins_(pins), owned_(owned) {} // ScopedStmt::ScopedStmt
+
+ScopedStmt::ScopedStmt(ScopedStmt &&other) noexcept
+    : stmt_(other.stmt_), pins_(other.pins_), owned_(other.owned_) {
+  other.stmt_ = nullptr;
+  other.pins_ = nullptr;
+  other.owned_ = false;
+} // ScopedStmt::ScopedStmt
+
+ScopedStmt &ScopedStmt::operator=(ScopedStmt &&other) noexcept {
+  if (this != &other) {
+    release();
+    stmt_ = other.stmt_;
+    pins_ = other.pins_;
+    owned_ = other.owned_;
+    other.stmt_ = nullptr;
+    other.pins_ = nullptr;
+    other.owned_ = false;
+  }
+  return *this;
+} // ScopedStmt::operator=
+
+ScopedStmt::~ScopedStmt() { release(); } // ScopedStmt::~ScopedStmt
+
+void ScopedStmt::release() {
+  if (owned_) {
+    sqlite3_finalize(stmt_);
+  } else if (stmt_) {
+    sqlite3_reset(stmt_);
+    sqlite3_clear_bindings(stmt_);
+  }
+  if (pins_)
+    --*pins_;
+  stmt_ = nullptr;
+  pins_ = nullptr;
+  owned_ = false;
+} // ScopedStmt::release
+
+} // namespace together
@@ -0,0 +1,108 @@
+#pragma once
+// EventStore instrumentation. Compiled in only with TOGETHER_METRICS; the
+// macros below expand to nothing otherwise, and EventStore never allocates
+// a StoreMetrics.
+#include "core/Metrics.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace together {
+
+enum class StoreOp : std::size_t {
+  Append,
+  AppendBatch,
+  UpsertTask,
+  UpsertTasks,
+  DeleteTask,
+  Since,
+  GetTask,
+  ListTasks,
+  Commit,
+  kCount
+};
+
+constexpr const char *kStoreOpNames[] = {
+    "append",      "appendBatch", "upsertTask", "upsertTasks", "deleteTask",
+    "since",       "getTask",     "listTasks",  "commit",
+};
+static_assert(sizeof(kStoreOpNames) / sizeof(kStoreOpNames[0]) ==
+                  (std::size_t)StoreOp::kCount,
+              "kStoreOpNames out of sync with StoreOp");
+
+struct StoreMetrics {
+  std::array<LatencyHistogram, (std::size_t)StoreOp::kCount> latency;
+  std::atomic<std::uint64_t> payload_bytes_written{0};
+  std::atomic<std::uint64_t> events_scanned{0};
+  std::atomic<std::uint64_t> task_rows_scanned{0};
+  std::atomic<std::uint64_t> rollbacks{0};
+};
+
+// Records the lifetime of the enclosing scope into one histogram.
+class OpTimer {
+public:
+  OpTimer(StoreMetrics *metrics, StoreOp op)
+      : metrics_(metrics), op_(op),
+        start_(metrics ? std::chrono::steady_clock::now()
+                       : std::chrono::steady_clock::time_point()) {}
+  ~OpTimer() {
+    if (metrics_)
+      metrics_->latency[(std::size_t)op_].record(
+          (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start_)
+              .count());
+  }
+
+  OpTimer(const OpTimer &) = delete;
+  OpTimer &operator=(const OpTimer &) = delete;
+
+private:
+  StoreMetrics *metrics_;
+  StoreOp op_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Adds `value` to a counter when the enclosing scope exits, so functions
+// with several return paths report what they did on all of them.
+class ScopedCount {
+public:
+  ScopedCount(StoreMetrics *metrics,
+              std::atomic<std::uint64_t> StoreMetrics::*field,
+              const std::size_t &value)
+      : metrics_(metrics), field_(field), value_(value) {}
+  ~ScopedCount() {
+    if (metrics_ && value_)
+      (metrics_->*field_).fetch_add(value_, std::memory_order_relaxed);
+  }
+
+  ScopedCount(const ScopedCount &) = delete;
+  ScopedCount &operator=(const ScopedCount &) = delete;
+
+private:
+  StoreMetrics *metrics_;
+  std::atomic<std::uint64_t> StoreMetrics::*field_;
+  const std::size_t &value_;
+};
+
+} // namespace together
+
+#ifdef TOGETHER_METRICS
+#define TOGETHER_TIME_OP(metrics, op)                                          \
+  ::together::OpTimer together_op_timer_((metrics), ::together::StoreOp::op)
+#define TOGETHER_COUNT(metrics, field, n)                                      \
+  do {                                                                         \
+    if (metrics)                                                               \
+      (metrics)->field.fetch_add((std::uint64_t)(n),                           \
+                                 std::memory_order_relaxed);                   \
+  } while (0)
+#define TOGETHER_COUNT_AT_EXIT(metrics, field, value)                          \
+  ::together::ScopedCount together_count_##field##_(                           \
+      (metrics), &::together::StoreMetrics::field, (value))
+#else
+#define TOGETHER_TIME_OP(metrics, op) ((void)0)
+#define TOGETHER_COUNT(metrics, field, n) ((void)0)
+#define TOGETHER_COUNT_AT_EXIT(metrics, field, value) ((void)0)
+#endif
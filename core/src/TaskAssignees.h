@@ -0,0 +1,42 @@
+#pragma once
+// task_assignee (schema v4): one row per (member, task) named in
+// task.assignees_csv, so a member's tasks are an index range scan instead
+// of a table scan that splits every CSV.
+#include <string_view>
+
+namespace together {
+namespace assignees {
+
+// Calls fn(member) for each non-empty comma-separated entry of `csv`,
+// exactly as written: the same matching the custom_list predicate uses.
+template <typename Fn> void forEachMember(std::string_view csv, Fn &&fn) {
+  while (!csv.empty()) {
+    const std::size_t comma = csv.find(',');
+    const std::string_view member = csv.substr(0, comma);
+    if (!member.empty())
+      fn(member);
+    if (comma == std::string_view::npos)
+      break;
+    csv.remove_prefix(comma + 1);
+  }
+}
+
+// Repopulates task_assignee from every task row, splitting assignees_csv
+// the way forEachMember does. The caller clears the table first.
+constexpr const char *kRebuildSql = R"SQL(
+    WITH RECURSIVE split(task_id, member, rest, status, updated_at) AS (
+      SELECT id, '', COALESCE(assignees_csv, '') || ',', status, updated_at
+      FROM main.task
+      UNION ALL
+      SELECT task_id, substr(rest, 1, instr(rest, ',') - 1),
+             substr(rest, instr(rest, ',') + 1), status, updated_at
+      FROM split WHERE rest <> ''
+    )
+    INSERT OR IGNORE INTO main.task_assignee(member_id, updated_at, task_id,
+                                             status)
+    SELECT member, updated_at, task_id, status FROM split
+    WHERE member <> '';
+)SQL";
+
+} // namespace assignees
+} // namespace together
@@ -0,0 +1,114 @@
+#include "core/TaskCache.h"
+
+#include <string>
+
+using std::string_view;
+
+namespace together {
+
+TaskCache::TaskCache(std::size_t budget_bytes)
+    : budget_(budget_bytes) {} // TaskCache::TaskCache
+
+std::size_t TaskCache::entryBytes(const TaskRow &row) {
+  // Row + list node + hash node, plus heap storage of every string that
+  // outgrew its inline buffer.
+  std::size_t bytes = sizeof(Entry) + 4 * sizeof(void *) +
+                      sizeof(std::pair<string_view, void *>) +
+                      2 * sizeof(void *);
+  for (const std::string *s :
+       {&row.id, &row.title, &row.assignees_csv, &row.status,
+        &row.visibility_tag})
+    if (s->capacity() > 15)
+      bytes += s->capacity() + 1;
+  return bytes;
+} // TaskCache::entryBytes
+
+bool TaskCache::get(string_view id, TaskRow &out) {
+  const TaskRow *row = find(id);
+  if (!row)
+    return false;
+  out = *row;
+  return true;
+} // TaskCache::get
+
+const TaskRow *TaskCache::find(string_view id) {
+  auto it = index_.find(id);
+  if (it == index_.end()) {
+    ++misses_;
+    return nullptr;
+  }
+  ++hits_;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return &it->second->row;
+} // TaskCache::find
+
+void TaskCache::put(const TaskRow &row) {
+  if (budget_ == 0)
+    return;
+  erase(row.id);
+
+  lru_.push_front(Entry{row, 0});
+  Entry &e = lru_.front();
+  e.bytes = entryBytes(e.row);
+  bytes_ += e.bytes;
+  // Key views the id stored inside the entry, which never moves.
+  index_.emplace(string_view(e.row.id), lru_.begin());
+  evictOverflow();
+} // TaskCache::put
+
+void TaskCache::markDeleted(string_view id, long long updated_at) {
+  auto it = index_.find(id);
+  if (it == index_.end())
+    return;
+  Entry &e = *it->second;
+  bytes_ -= e.bytes;
+  e.row.status = "deleted";
+  e.row.updated_at = updated_at;
+  e.bytes = entryBytes(e.row);
+  bytes_ += e.bytes;
+  evictOverflow();
+} // TaskCache::markDeleted
+
+void TaskCache::erase(string_view id) {
+  auto it = index_.find(id);
+  if (it == index_.end())
+    return;
+  auto node = it->second;
+  bytes_ -= node->bytes;
+  index_.erase(it);
+  lru_.erase(node);
+} // TaskCache::erase
+
+void TaskCache::clear() {
+  index_.clear();
+  lru_.clear();
+  bytes_ = 0;
+} // TaskCache::clear
+
+void TaskCache::setBudget(std::size_t budget_bytes) {
+  budget_ = budget_bytes;
+  evictOverflow();
+} // TaskCache::setBudget
+
+TaskCacheStats TaskCache::stats() const {
+  TaskCacheStats s;
+  s.hits = hits_;
+  s.misses = misses_;
+  s.evictions = evictions_;
+  s.entries = lru_.size();
+  s.bytes = bytes_;
+  s.budget_bytes = budget_;
+  return s;
+} // TaskCache::stats
+
+void TaskCache::evictOverflow() {
+  while (bytes_ > budget_ && !lru_.empty()) {
+    Entry &victim = lru_.back();
+    bytes_ -= victim.bytes;
+    index_.erase(string_view(victim.row.id));
+    lru_.pop_back();
+    ++evictions_;
+  }
+} // TaskCache::evictOverflow
+
+} // namespace together
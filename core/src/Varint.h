@@ -0,0 +1,40 @@
+#pragma once
+// LEB128 varint and zigzag helpers shared by the payload and bundle codecs.
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace together {
+namespace varint {
+
+inline void put(std::string &out, unsigned long long v) {
+  while (v >= 0x80) {
+    out.push_back((char)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((char)v);
+}
+
+inline bool get(std::string_view in, std::size_t &pos, unsigned long long &v) {
+  v = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (pos >= in.size())
+      return false;
+    unsigned char byte = (unsigned char)in[pos++];
+    v |= (unsigned long long)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+inline unsigned long long zigzag(long long v) {
+  return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+inline long long unzigzag(unsigned long long v) {
+  return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+} // namespace varint
+} // namespace together
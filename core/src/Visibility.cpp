@@ -0,0 +1,156 @@
+#include "core/Visibility.h"
+#include "core/PayloadCodec.h"
+#include "VisibilityPolicy.h"
+
+using std::string;
+using std::string_view;
+
+namespace together {
+namespace visibility {
+
+namespace {
+
+struct TagEntry {
+  const char *name;
+  unsigned bit;
+};
+
+constexpr TagEntry kTags[] = {
+    {"family", kVisFamily},         {"adults_only", kVisAdultsOnly},
+    {"kids", kVisKids},             {"owner_only", kVisOwnerOnly},
+    {"custom_list", kVisCustomList},
+};
+
+// Tags each role sees on every record, indexed by Role.
+constexpr unsigned kRoleTags[] = {
+    kVisAll,                                // Owner
+    kVisFamily | kVisAdultsOnly | kVisKids, // Adult
+    kVisFamily | kVisKids,                  // Teen
+    kVisFamily | kVisKids,                  // Child
+    0,                                      // Guest
+};
+
+// Budget entries (transactions and envelope limits) are limited to Owner
+// and Adult. Teens are meant to see their allowance only, which budget
+// events cannot express yet.
+bool seesBudget(Role role) { return role == Role::Owner || role == Role::Adult; }
+
+bool isBudget(string_view entity_type) {
+  return entity_type == "budget_tx" || entity_type == "budget_limit";
+}
+
+constexpr const char *kRoleNames[] = {"owner", "adult", "teen", "child",
+                                      "guest"};
+
+} // namespace
+
+unsigned tagBit(string_view tag) {
+  for (const TagEntry &t : kTags)
+    if (tag == t.name)
+      return t.bit;
+  return kVisOwnerOnly;
+} // visibility::tagBit
+
+const char *tagName(unsigned bit) {
+  for (const TagEntry &t : kTags)
+    if (bit == t.bit)
+      return t.name;
+  return "";
+} // visibility::tagName
+
+const char *roleName(Role role) {
+  return kRoleNames[(int)role];
+} // visibility::roleName
+
+unsigned visibleTags(Role role) {
+  return kRoleTags[(int)role];
+} // visibility::visibleTags
+
+bool canSeeTask(Role role, string_view visibility_tag, bool listed) {
+  if (role == Role::Owner)
+    return true;
+  if (role == Role::Guest)
+    return false;
+  const unsigned bit = tagBit(visibility_tag);
+  return (visibleTags(role) & bit) || (bit == kVisCustomList && listed);
+} // visibility::canSeeTask
+
+bool canSeeEvent(Role role, string_view entity_type,
+                 string_view visibility_tag) {
+  if (role == Role::Owner)
+    return true;
+  if (isBudget(entity_type) && !seesBudget(role))
+    return false;
+  return (visibleTags(role) & tagBit(visibility_tag)) != 0;
+} // visibility::canSeeEvent
+
+string tagMaskSql(string_view column) {
+  string sql = "CASE ";
+  sql.append(column.data(), column.size());
+  for (const TagEntry &t : kTags) {
+    sql += " WHEN '";
+    sql += t.name;
+    sql += "' THEN ";
+    sql += std::to_string(t.bit);
+  }
+  sql += " ELSE " + std::to_string(kVisOwnerOnly) + " END";
+  return sql;
+} // visibility::tagMaskSql
+
+std::vector<string> taskPredicatesSql(Role role) {
+  std::vector<string> terms;
+  if (role == Role::Guest)
+    return terms;
+  const unsigned tags = visibleTags(role) | kVisCustomList;
+  for (const TagEntry &t : kTags) {
+    if (!(tags & t.bit))
+      continue;
+    string term = "vis_mask = " + std::to_string(t.bit);
+    if (t.bit == kVisCustomList && !(visibleTags(role) & kVisCustomList))
+      term += " AND instr(',' || assignees_csv || ',', ',' || ?1 || ',') > 0";
+    terms.push_back(std::move(term));
+  }
+  return terms;
+} // visibility::taskPredicatesSql
+
+string eventPredicateSql(Role role) {
+  const unsigned tags = visibleTags(role) & ~(unsigned)kVisCustomList;
+  if (!tags)
+    return {};
+  string sql = "vis_mask IN " + inListSql(tags);
+  if (!seesBudget(role))
+    sql += " AND type_code NOT IN "
+           "(SELECT code FROM event_dict "
+           " WHERE name IN ('budget_tx', 'budget_limit'))";
+  return sql;
+} // visibility::eventPredicateSql
+
+string inListSql(unsigned mask) {
+  string sql = "(";
+  for (unsigned bit = 1; bit <= mask; bit <<= 1) {
+    if (!(mask & bit))
+      continue;
+    if (sql.size() > 1)
+      sql += ',';
+    sql += std::to_string(bit);
+  }
+  sql += ')';
+  return sql;
+} // visibility::inListSql
+
+unsigned payloadTagBit(string_view payload) {
+  // Most payloads carry no tag; skip the decode for JSON without one.
+  if (!payload::isBinary(payload) &&
+      payload.find("visibility_tag") == string_view::npos)
+    return 0;
+  PayloadFields fields;
+  if (!payload::decode(payload, fields))
+    return 0;
+  for (const PayloadField &f : fields)
+    if (f.name == "visibility_tag" && f.kind == PayloadField::Kind::String)
+      return tagBit(f.s);
+  return 0;
+} // visibility::payloadTagBit
+
+} // namespace visibility
+} // namespace together
@@ -0,0 +1,35 @@
+#pragma once
+// SQL and payload helpers behind the role-scoped reads (see Visibility.h).
+#include "core/Visibility.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace together {
+namespace visibility {
+
+// SQL expression mapping a visibility_tag column to its tagBit().
+std::string tagMaskSql(std::string_view column);
+
+// "(1,4)": the single-bit vis_mask values in `mask`, for an IN predicate
+// the vis_mask indexes can seek on. `mask` must be non-zero.
+std::string inListSql(unsigned mask);
+
+// WHERE-clause terms for a role's reads. Owner sees everything and is
+// served by the unscoped queries.
+//
+// Tasks: one term per visible tag, each an equality on vis_mask, so every
+// term walks its own index range in (updated_at, id) order and the caller
+// can merge them instead of sorting. Empty if the role sees no tasks. The
+// custom_list term reads the member id from parameter ?1.
+std::vector<std::string> taskPredicatesSql(Role role);
+// Events: one term, or "" if the role sees no events.
+std::string eventPredicateSql(Role role);
+
+// tagBit() of the payload's "visibility_tag" field (JSON or binary), or 0
+// if it has none.
+unsigned payloadTagBit(std::string_view payload);
+
+} // namespace visibility
+} // namespace together
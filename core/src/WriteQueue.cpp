@@ -0,0 +1,209 @@
+#include "core/EventStore.h"
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <variant>
+
+using std::string;
+using std::vector;
+
+namespace together {
+
+void EventStore::setWriteQueueOptions(const WriteQueueOptions &options) {
+  {
+    std::lock_guard<std::mutex> lock(queue_mu_);
+    queue_options_ = options;
+  }
+  queue_cv_.notify_one();
+} // EventStore::setWriteQueueOptions
+
+std::future<long long> EventStore::appendAsync(DeltaEvent ev) {
+  QueuedWrite w;
+  w.kind = QueuedWrite::Kind::Append;
+  w.op = std::move(ev);
+  return enqueue(std::move(w));
+} // EventStore::appendAsync
+
+std::future<long long> EventStore::upsertTaskAsync(TaskUpsert task) {
+  QueuedWrite w;
+  w.kind = QueuedWrite::Kind::Upsert;
+  w.op = std::move(task);
+  return enqueue(std::move(w));
+} // EventStore::upsertTaskAsync
+
+std::future<long long> EventStore::deleteTaskAsync(string id,
+                                                   long long ts_millis,
+                                                   string payload_json) {
+  DeltaEvent ev;
+  ev.entity_id = std::move(id);
+  ev.payload = std::move(payload_json);
+  ev.ts = ts_millis;
+  QueuedWrite w;
+  w.kind = QueuedWrite::Kind::Delete;
+  w.op = std::move(ev);
+  return enqueue(std::move(w));
+} // EventStore::deleteTaskAsync
+
+void EventStore::flush() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mu_);
+    if (!queue_thread_.joinable())
+      return; // nothing was ever queued
+  }
+  enqueue(QueuedWrite{}).wait();
+} // EventStore::flush
+
+std::future<long long> EventStore::enqueue(QueuedWrite &&w) {
+  std::future<long long> done = w.done.get_future();
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(queue_mu_);
+    if (!queue_thread_.joinable())
+      queue_thread_ = std::thread(&EventStore::runWriteQueue, this);
+    const bool flush = w.kind == QueuedWrite::Kind::Flush;
+    if (flush)
+      ++queued_flushes_;
+    queue_.push_back(std::move(w));
+    // The writer sleeps until the queue is non-empty, then until the
+    // window closes, the batch fills or a flush arrives.
+    wake = flush || queue_.size() == 1 ||
+           queue_.size() >= queue_options_.max_batch;
+  }
+  if (wake)
+    queue_cv_.notify_one();
+  return done;
+} // EventStore::enqueue
+
+void EventStore::runWriteQueue() {
+  vector<QueuedWrite> batch;
+  std::unique_lock<std::mutex> lock(queue_mu_);
+  for (;;) {
+    queue_cv_.wait(lock, [this] { return queue_stop_ || !queue_.empty(); });
+    if (queue_.empty())
+      return; // stopping, and everything queued has been committed
+
+    // Group-commit window, opened by the oldest queued write.
+    const std::size_t max_batch = std::max<std::size_t>(
+        1, queue_options_.max_batch);
+    const auto deadline =
+        std::chrono::steady_clock::now() +
+        std::chrono::microseconds(queue_options_.max_delay_micros);
+    queue_cv_.wait_until(lock, deadline, [&] {
+      return queue_stop_ || queued_flushes_ > 0 || queue_.size() >= max_batch;
+    });
+
+    while (!queue_.empty() && batch.size() < max_batch) {
+      if (queue_.front().kind == QueuedWrite::Kind::Flush)
+        --queued_flushes_;
+      batch.push_back(std::move(queue_.front()));
+      queue_.pop_front();
+    }
+
+    lock.unlock();
+    commitQueued(batch);
+    batch.clear();
+    lock.lock();
+  }
+} // EventStore::runWriteQueue
+
+void EventStore::commitQueued(vector<QueuedWrite> &batch) {
+  using Kind = QueuedWrite::Kind;
+  vector<long long> results(batch.size(), 0);
+  {
+    std::lock_guard<std::recursive_mutex> lock(write_mu_);
+
+    const bool any_writes =
+        std::any_of(batch.begin(), batch.end(),
+                    [](const QueuedWrite &w) { return w.kind != Kind::Flush; });
+    bool ok = true;
+    if (any_writes) {
+      ok = db_ && stmts_.fixed(kAppendEvent) && beginImmediate();
+      for (std::size_t i = 0; ok && i < batch.size(); ++i) {
+        const QueuedWrite &w = batch[i];
+        switch (w.kind) {
+        case Kind::Append: {
+          const DeltaEvent &ev = std::get<DeltaEvent>(w.op);
+          results[i] =
+              insertEvent(ev.entity_type, ev.entity_id, ev.op, ev.payload, ev.ts);
+          if (results[i] < 1)
+            results[i] = -3;
+          break;
+        }
+        case Kind::Upsert: {
+          const TaskUpsert &t = std::get<TaskUpsert>(w.op);
+          const TaskRow &r = t.row;
+          results[i] = upsertTaskInTxn(r.id, r.title, r.assignees_csv,
+                                       r.due_at, r.points, r.status,
+                                       r.visibility_tag, r.updated_at,
+                                       t.payload_json);
+          break;
+        }
+        case Kind::Delete: {
+          const DeltaEvent &ev = std::get<DeltaEvent>(w.op);
+          results[i] = deleteTaskInTxn(ev.entity_id, ev.ts, ev.payload);
+          break;
+        }
+        case Kind::Flush:
+          break;
+        }
+        ok = results[i] >= 0;
+      }
+      if (ok)
+        ok = commit();
+      if (!ok && db_)
+        rollback();
+    }
+
+    // Isolate the failure: each write on its own, through the synchronous
+    // path, so one bad write does not fail its neighbours.
+    if (!ok) {
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+        const QueuedWrite &w = batch[i];
+        switch (w.kind) {
+        case Kind::Append:
+          results[i] = append(std::get<DeltaEvent>(w.op));
+          break;
+        case Kind::Upsert: {
+          const TaskUpsert &t = std::get<TaskUpsert>(w.op);
+          const TaskRow &r = t.row;
+          results[i] = upsertTask(r.id, r.title, r.assignees_csv, r.due_at,
+                                  r.points, r.status, r.visibility_tag,
+                                  r.updated_at, t.payload_json);
+          break;
+        }
+        case Kind::Delete: {
+          const DeltaEvent &ev = std::get<DeltaEvent>(w.op);
+          results[i] = deleteTask(ev.entity_id, ev.ts, ev.payload);
+          break;
+        }
+        case Kind::Flush:
+          results[i] = 0;
+          break;
+        }
+      }
+    }
+  }
+
+  // Completion only after the commit, so a ready future means durable.
+  for (std::size_t i = 0; i < batch.size(); ++i)
+    batch[i].done.set_value(results[i]);
+} // EventStore::commitQueued
+
+void EventStore::stopWriteQueue() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mu_);
+    if (!queue_thread_.joinable())
+      return;
+    queue_stop_ = true;
+  }
+  queue_cv_.notify_one();
+  queue_thread_.join();
+  std::lock_guard<std::mutex> lock(queue_mu_);
+  queue_thread_ = std::thread();
+  queue_stop_ = false;
+} // EventStore::stopWriteQueue
+
+} // namespace together
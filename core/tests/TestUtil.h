@@ -0,0 +1,47 @@
+#pragma once
+// Helpers shared by the test executables.
+#include <sqlite3.h>
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+// Report a failed check. Returns 1, to be or-ed into the exit code.
+inline int fail(const std::string &msg) {
+  std::cerr << "TEST FAIL: " << msg << std::endl;
+  return 1;
+}
+
+// Directory freshDbPath puts databases in. core_tests, whose scenarios run
+// as overlapping processes under ctest -j, points it at one per process.
+inline std::string &scratchDir() {
+  static std::string dir = "tmp";
+  return dir;
+}
+
+// Path to an empty database: the file and its WAL/SHM are removed.
+inline std::string freshDbPath(const std::string &name) {
+  std::filesystem::create_directories(scratchDir());
+  std::string path = scratchDir() + "/" + name + ".db";
+  for (const char *suffix : {"", "-wal", "-shm"})
+    std::filesystem::remove(path + suffix);
+  return path;
+}
+
+// Run `sql` on its own connection, outside any EventStore.
+inline bool execRaw(const std::string &path, const char *sql,
+                    std::string &err) {
+  sqlite3 *db = nullptr;
+  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+    err = db ? sqlite3_errmsg(db) : "open failed";
+    sqlite3_close(db);
+    return false;
+  }
+  char *errmsg = nullptr;
+  const bool ok = sqlite3_exec(db, sql, nullptr, nullptr, &errmsg) == SQLITE_OK;
+  if (!ok)
+    err = errmsg ? errmsg : "";
+  sqlite3_free(errmsg);
+  sqlite3_close(db);
+  return ok;
+}
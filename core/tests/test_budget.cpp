@@ -0,0 +1,383 @@
+#include "core/EventStore.h"
+#include "core/Visibility.h"
+#include "TestUtil.h"
+#include <sqlite3.h>
+
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using together::BudgetEnvelope;
+using together::DeltaEvent;
+using together::EventStore;
+using together::ReplayOptions;
+using together::ReplayReport;
+using together::Role;
+using together::SeqRange;
+
+// 2024-01-01T00:00Z; the test months are January to July 2024.
+constexpr long long kJan1 = 1704067200000LL;
+constexpr long long kDay = 24LL * 3600000;
+constexpr int kMonths = 7;
+
+static int month(int i) { return 202401 + i; }
+
+static long long monthStart(int i) {
+  static const int kDaysBefore[] = {0, 31, 60, 91, 121, 152, 182};
+  return kJan1 + kDaysBefore[i] * kDay;
+}
+
+// What the budget tables should hold, folded the way the docs describe.
+struct Model {
+  struct Tx {
+    std::string category;
+    int month = 0;
+    long long amount = 0;
+  };
+  struct Limit {
+    long long cents = 0;
+    bool rollover = true;
+  };
+  std::map<std::string, Tx> tx;
+  std::map<std::pair<std::string, int>, Limit> limits;
+
+  std::vector<BudgetEnvelope> summary(int m) const {
+    std::map<std::string, BudgetEnvelope> by_category;
+    for (const auto &[key, limit] : limits)
+      if (key.second <= m)
+        by_category[key.first].category = key.first;
+    for (const auto &[id, t] : tx)
+      if (t.month == m)
+        by_category[t.category].category = t.category;
+
+    std::vector<BudgetEnvelope> out;
+    for (auto &[category, e] : by_category) {
+      long long carry = 0;
+      for (int i = 0; month(i) <= m; ++i) {
+        long long limit = 0, net = 0, count = 0;
+        bool rollover = false;
+        for (const auto &[key, l] : limits)
+          if (key.first == category && key.second <= month(i)) {
+            limit = l.cents;
+            rollover = l.rollover;
+          }
+        for (const auto &[id, t] : tx)
+          if (t.category == category && t.month == month(i)) {
+            net += t.amount;
+            ++count;
+          }
+        if (month(i) == m) {
+          e.limit_cents = limit;
+          e.rollover = rollover;
+          e.carry_in_cents = carry;
+          e.net_cents = net;
+          e.tx_count = count;
+          e.remaining_cents = limit + carry + net;
+          break;
+        }
+        carry = rollover ? limit + carry + net : 0;
+      }
+      out.push_back(e);
+    }
+    return out;
+  }
+};
+
+static std::string describe(const std::vector<BudgetEnvelope> &envelopes) {
+  std::string out;
+  for (const BudgetEnvelope &e : envelopes)
+    out += "[" + e.category + " limit=" + std::to_string(e.limit_cents) +
+           (e.rollover ? "r" : "") + " carry=" +
+           std::to_string(e.carry_in_cents) + " net=" +
+           std::to_string(e.net_cents) + " n=" + std::to_string(e.tx_count) +
+           " left=" + std::to_string(e.remaining_cents) + "]";
+  return out;
+}
+
+static int compareAll(EventStore &store, const Model &model,
+                      const std::string &label) {
+  for (int i = 0; i < kMonths; ++i) {
+    std::vector<BudgetEnvelope> got;
+    std::string err;
+    if (!store.budgetSummary(month(i), got, err))
+      return fail(label + ": budgetSummary: " + err);
+    const std::string want = describe(model.summary(month(i)));
+    if (describe(got) != want)
+      return fail(label + ": " + std::to_string(month(i)) + " got " +
+                  describe(got) + " want " + want);
+  }
+  return 0;
+}
+
+static int verify(EventStore &store, long long want_mismatches,
+                  const std::string &want_diff, const std::string &label) {
+  ReplayOptions options;
+  options.verify_only = true;
+  ReplayReport report;
+  std::string err;
+  if (!store.replay(options, report, err))
+    return fail(label + ": replay verify: " + err);
+  if (report.mismatches != want_mismatches)
+    return fail(label + ": " + std::to_string(report.mismatches) +
+                " mismatches, want " + std::to_string(want_mismatches) +
+                (report.diff_ids.empty() ? "" : " first " + report.diff_ids[0]));
+  if (!want_diff.empty() &&
+      (report.diff_ids.empty() || report.diff_ids[0] != want_diff))
+    return fail(label + ": diff ids must name " + want_diff);
+  return 0;
+}
+
+// Random transaction edits through every write path, with limits set
+// along the way; the summary must match the model after each round, and
+// replay must agree with the incrementally maintained tables.
+static int checkAggregates() {
+  int rc = 0;
+  const std::string path = freshDbPath("budget");
+  Model model;
+  {
+    EventStore store;
+    if (auto err = store.open(path); !err.empty())
+      return fail("open: " + err);
+
+    static const char *kCategories[] = {"groceries", "fun", "rent"};
+    std::mt19937 rng(20);
+    std::vector<DeltaEvent> batch;
+    std::vector<std::future<long long>> queued;
+    long long ts = 0, tick = 0;
+    // Events wait in `batch` until another write path is used, so the
+    // log order is the order the model applied them in.
+    auto writeBatch = [&] {
+      SeqRange range;
+      if (!batch.empty() && store.appendBatch(batch, range) < 1)
+        rc |= fail("appendBatch");
+      batch.clear();
+    };
+    for (int round = 0; round < 12 && rc == 0; ++round) {
+      for (int op = 0; op < 40; ++op) {
+        const int m = (int)(rng() % kMonths);
+        ts = monthStart(m) + ++tick;
+        if (rng() % 10 == 0) {
+          writeBatch();
+          const std::string category = kCategories[rng() % 3];
+          const long long cents = 10000 * (long long)(1 + rng() % 5);
+          const bool rollover = rng() % 3 != 0;
+          const int at = month((int)(rng() % kMonths));
+          if (store.setBudgetLimit(category, at, cents, rollover, ts) < 1)
+            rc |= fail("setBudgetLimit");
+          model.limits[{category, at}] = {cents, rollover};
+          continue;
+        }
+
+        DeltaEvent ev;
+        ev.entity_type = "budget_tx";
+        ev.entity_id = "tx" + std::to_string(rng() % 60);
+        ev.ts = ts;
+        auto found = model.tx.find(ev.entity_id);
+        const int shape = (int)(rng() % 8);
+        if (shape == 0) {
+          ev.op = "delete";
+          ev.payload = "{}";
+          if (found != model.tx.end())
+            model.tx.erase(found);
+        } else {
+          // Partial upserts keep the fields they leave out; a new row
+          // starts in the month of its ts.
+          Model::Tx t = found != model.tx.end() ? found->second : Model::Tx{};
+          if (found == model.tx.end())
+            t.month = month(m);
+          std::string fields;
+          if (shape != 1) {
+            t.category = kCategories[rng() % 3];
+            fields += R"("category":")" + t.category + "\"";
+          }
+          if (shape != 2) {
+            t.amount = -(long long)(rng() % 20000) + 2500;
+            fields += (fields.empty() ? "" : ",") + std::string("\"amount_cents\":") +
+                      std::to_string(t.amount);
+          }
+          if (shape == 3 || shape == 4) {
+            t.month = month((int)(rng() % kMonths));
+            std::string text =
+                shape == 3 ? std::to_string(t.month)
+                           : "\"" + std::to_string(t.month / 100) + "-" +
+                                 std::to_string(t.month % 100 / 10) +
+                                 std::to_string(t.month % 10) + "\"";
+            fields += (fields.empty() ? "" : ",") + std::string("\"month\":") + text;
+          }
+          ev.op = "upsert";
+          ev.payload = "{" + fields + "}";
+          model.tx[ev.entity_id] = t;
+        }
+
+        switch (rng() % 3) {
+        case 0:
+          writeBatch();
+          if (store.append(ev) < 1)
+            rc |= fail("append");
+          break;
+        case 1:
+          batch.push_back(ev);
+          break;
+        default:
+          // Queued writes are not ordered against the synchronous ones.
+          writeBatch();
+          queued.push_back(store.appendAsync(ev));
+          store.flush();
+          break;
+        }
+      }
+      writeBatch();
+      for (auto &f : queued)
+        if (f.get() < 1)
+          rc |= fail("appendAsync");
+      queued.clear();
+      rc |= compareAll(store, model, "round " + std::to_string(round));
+    }
+    if (rc)
+      return rc;
+
+    // A batch that fails writes nothing, aggregates included.
+    std::vector<DeltaEvent> bad(2);
+    bad[0].entity_type = bad[1].entity_type = "budget_tx";
+    bad[0].entity_id = "tx0";
+    bad[0].op = bad[1].op = "upsert";
+    bad[0].payload = R"({"category":"rent","amount_cents":-999999})";
+    bad[1].payload = "{}"; // no entity id
+    bad[0].ts = bad[1].ts = ++ts;
+    SeqRange range;
+    if (store.appendBatch(bad, range) >= 0)
+      rc |= fail("a batch with an empty entity id must fail");
+    rc |= compareAll(store, model, "failed batch");
+
+    if (store.setBudgetLimit("", 202401, 1, true, ts) != -4 ||
+        store.setBudgetLimit("rent", 202413, 1, true, ts) != -4 ||
+        store.setBudgetLimit("rent", 2024, 1, true, ts) != -4)
+      rc |= fail("setBudgetLimit must reject bad categories and months");
+    std::vector<BudgetEnvelope> none;
+    std::string err;
+    if (store.budgetSummary(202400, none, err))
+      rc |= fail("budgetSummary must reject a month that is not YYYYMM");
+
+    // Replay recomputes everything from the log and finds no drift.
+    rc |= verify(store, 0, "", "incremental");
+
+    // Budget entities are Owner and Adult only.
+    auto teen = store.since(Role::Teen, 0, err);
+    auto adult = store.since(Role::Adult, 0, err);
+    for (const DeltaEvent &e : teen)
+      if (e.entity_type.rfind("budget_", 0) == 0)
+        return fail("Teen must not see " + e.entity_type + " events");
+    if (adult.empty() || adult.size() != store.since(0, err).size())
+      rc |= fail("Adult must see budget events");
+  }
+  if (rc)
+    return rc;
+
+  // Drift in budget_month is reported by category and month, and a
+  // rebuild repairs it.
+  std::string err;
+  if (!execRaw(path,
+               "INSERT INTO budget_month(category, month, net_cents, tx_count) "
+               "VALUES('ghost', 202402, 500, 1)",
+               err))
+    return fail("corrupting budget_month: " + err);
+  {
+    EventStore store;
+    if (auto open_err = store.open(path); !open_err.empty())
+      return fail("reopen: " + open_err);
+    rc |= verify(store, 1, "budget_month:ghost@202402", "drift");
+    ReplayReport report;
+    if (!store.replay(ReplayOptions{}, report, err))
+      return fail("replay: " + err);
+    if (report.budget_rows != (long long)(model.tx.size() + model.limits.size()))
+      rc |= fail("replay must report " +
+                 std::to_string(model.tx.size() + model.limits.size()) +
+                 " budget rows, got " + std::to_string(report.budget_rows));
+    rc |= verify(store, 0, "", "rebuilt");
+    rc |= compareAll(store, model, "rebuilt");
+  }
+
+  // A v4 database has no budget tables worth keeping: opening it
+  // backfills them from the log.
+  if (!execRaw(path,
+               "UPDATE budget_tx SET amount_cents = amount_cents + 1;"
+               "DELETE FROM budget_limit;"
+               "DELETE FROM budget_month;"
+               "PRAGMA user_version = 4;",
+               err))
+    return fail("downgrading to v4: " + err);
+  {
+    EventStore store;
+    if (auto open_err = store.open(path); !open_err.empty())
+      return fail("open (migrate): " + open_err);
+    rc |= compareAll(store, model, "migrated");
+    rc |= verify(store, 0, "", "migrated");
+  }
+  return rc;
+}
+
+// Rollover carries are cached on first read and recomputed after a write
+// to an earlier month.
+static int checkRollover() {
+  int rc = 0;
+  const std::string path = freshDbPath("budget_rollover");
+  EventStore store;
+  if (auto err = store.open(path); !err.empty())
+    return fail("open: " + err);
+
+  auto spend = [&store](const std::string &id, int m, long long cents) {
+    DeltaEvent ev;
+    ev.entity_type = "budget_tx";
+    ev.entity_id = id;
+    ev.op = "upsert";
+    ev.payload = R"({"category":"groceries","amount_cents":)" +
+                 std::to_string(cents) + "}";
+    ev.ts = monthStart(m) + 1;
+    return store.append(ev);
+  };
+  auto envelope = [&store](int m, BudgetEnvelope &out) {
+    std::vector<BudgetEnvelope> all;
+    std::string err;
+    if (!store.budgetSummary(month(m), all, err) || all.size() != 1)
+      return false;
+    out = all[0];
+    return true;
+  };
+
+  store.setBudgetLimit("groceries", month(0), 40000, true, 1);
+  spend("a", 0, -30000); // 10000 left
+  spend("b", 2, -45000); // nothing in February: 50000 carries into March
+  BudgetEnvelope e;
+  if (!envelope(3, e) || e.carry_in_cents != 50000 + 40000 - 45000 ||
+      e.remaining_cents != 45000 + 40000)
+    rc |= fail("carry into April: " + describe({e}));
+
+  // A January edit changes every later carry, cached or not.
+  spend("a", 0, -50000);
+  if (!envelope(3, e) || e.carry_in_cents != 25000)
+    rc |= fail("carry after editing January: " + describe({e}));
+  if (!envelope(1, e) || e.carry_in_cents != -10000 || e.tx_count != 0 ||
+      e.remaining_cents != 30000)
+    rc |= fail("February with nothing spent: " + describe({e}));
+
+  // A new limit from March on; rollover off stops the carry.
+  store.setBudgetLimit("groceries", month(2), 20000, false, 2);
+  if (!envelope(2, e) || e.carry_in_cents != 30000 || e.limit_cents != 20000 ||
+      e.rollover)
+    rc |= fail("March under the new limit: " + describe({e}));
+  if (!envelope(3, e) || e.carry_in_cents != 0 || e.remaining_cents != 20000)
+    rc |= fail("April without rollover: " + describe({e}));
+  return rc;
+}
+
+int main() {
+  int rc = checkAggregates();
+  rc |= checkRollover();
+  if (rc == 0)
+    std::cout << "OK: budget tests passed\n";
+  return rc;
+}
@@ -0,0 +1,217 @@
+#include "core/ChangeFeed.h"
+#include "core/EventStore.h"
+#include "TestUtil.h"
+
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using together::ChangeNotice;
+using together::ChangeRing;
+using together::DeltaEvent;
+using together::EventStore;
+using together::SeqRange;
+using together::TaskUpsert;
+
+static DeltaEvent event(const std::string &type, const std::string &id,
+                        long long ts) {
+  DeltaEvent ev;
+  ev.entity_type = type;
+  ev.entity_id = id;
+  ev.op = "upsert";
+  ev.payload = R"({"n":)" + std::to_string(ts) + "}";
+  ev.ts = ts;
+  return ev;
+}
+
+static std::string describe(const std::vector<ChangeNotice> &notices) {
+  std::string out;
+  for (const ChangeNotice &n : notices)
+    out += "[" + std::to_string(n.first_seq) + "-" +
+           std::to_string(n.last_seq) + "/" + std::to_string(n.events) + "]";
+  return out;
+}
+
+static int checkRing() {
+  int rc = 0;
+  ChangeRing ring(3);
+  if (ring.capacity() != 4)
+    rc |= fail("capacity must round up to a power of two");
+  for (long long i = 1; i <= 5; ++i)
+    ring.push(ChangeNotice{i, i, 1});
+  if (ring.dropped() != 1 || !ring.takeOverflow() || ring.takeOverflow())
+    rc |= fail("a full ring must drop and flag the overflow once");
+  ChangeNotice n;
+  std::vector<long long> got;
+  while (ring.pop(n))
+    got.push_back(n.first_seq);
+  if (got != std::vector<long long>{1, 2, 3, 4})
+    rc |= fail("ring must keep the oldest notices in order");
+  if (ring.wait(std::chrono::microseconds(1000)))
+    rc |= fail("wait on an empty ring must time out");
+
+  // The slots are reused as the indexes wrap.
+  for (long long i = 0; i < 100; ++i) {
+    if (!ring.push(ChangeNotice{i, i, 1}) || !ring.pop(n) || n.first_seq != i)
+      return fail("ring wrap-around at " + std::to_string(i));
+  }
+  return rc;
+}
+
+// Every write path notifies once per commit, after the commit, with the
+// subscriber's entity types only.
+static int checkWritePaths() {
+  int rc = 0;
+  EventStore store;
+  if (auto err = store.open(freshDbPath("change_feed")); !err.empty())
+    return fail("open: " + err);
+
+  std::vector<ChangeNotice> all, tasks, notes;
+  std::string err;
+  auto everything = store.subscribe({}, [&](const ChangeNotice &n) {
+    // Delivered after the commit: the events are already readable.
+    if ((long long)store.since(n.first_seq - 1, err).size() <
+        n.last_seq - n.first_seq + 1)
+      rc |= fail("notice before the events were readable");
+    all.push_back(n);
+  });
+  store.subscribe({"task"}, [&](const ChangeNotice &n) { tasks.push_back(n); });
+  store.subscribe({"note", "budget_tx"},
+                  [&](const ChangeNotice &n) { notes.push_back(n); });
+  if (!everything || store.subscribe({"task"}, together::ChangeCallback()) != 0)
+    rc |= fail("subscribe ids");
+
+  store.append(event("note", "n1", 1));                         // 1
+  SeqRange range;
+  store.appendBatch({event("note", "n2", 2), event("event", "e1", 3),
+                     event("note", "n3", 4)},
+                    range);                                      // 2-4
+  store.upsertTask("t1", "Dishes", "", 0, 1, "open", "family", 5,
+                   R"({"title":"Dishes"})");                     // 5
+  store.upsertTasks({TaskUpsert{}, TaskUpsert{}}, range); // fails: no ids
+  TaskUpsert t;
+  t.row.id = "t2";
+  t.row.status = "open";
+  t.row.visibility_tag = "family";
+  t.row.updated_at = 6;
+  t.payload_json = "{}";
+  store.upsertTaskAsync(t).get();                                // 6
+  store.deleteTask("t1", 7, "{}");                               // 7
+  DeltaEvent budget = event("budget_tx", "b1", 8);
+  budget.payload = R"({"category":"fun","amount_cents":-100})";
+  store.append(budget);                                          // 8
+
+  if (describe(all) != "[1-1/1][2-4/3][5-5/1][6-6/1][7-7/1][8-8/1]")
+    rc |= fail("all types: " + describe(all));
+  if (describe(tasks) != "[5-5/1][6-6/1][7-7/1]")
+    rc |= fail("task filter: " + describe(tasks));
+  if (describe(notes) != "[1-1/1][2-4/2][8-8/1]")
+    rc |= fail("note filter: " + describe(notes));
+
+  // A callback may write; that write notifies after it commits, and
+  // unsubscribing stops delivery.
+  all.clear();
+  notes.clear();
+  SeqRange echoed;
+  auto echo = store.subscribe({"event"}, [&](const ChangeNotice &) {
+    store.unsubscribe(everything);
+    store.appendBatch({event("note", "echo", 10)}, echoed);
+  });
+  store.append(event("event", "e2", 9));                         // 9, 10
+  store.unsubscribe(echo);
+  store.append(event("event", "e3", 11));                        // 11
+  if (describe(all) != "[9-9/1]" || describe(notes) != "[10-10/1]" ||
+      echoed.first != 10)
+    rc |= fail("write from a callback: " + describe(all) + " " +
+               describe(notes));
+  return rc;
+}
+
+// A consumer thread tailing the log through a small ring: what it gets
+// from notices plus since() catch-up after overflows is every note event,
+// once each, in order.
+static int checkTail() {
+  EventStore store;
+  if (auto err = store.open(freshDbPath("change_feed_tail")); !err.empty())
+    return fail("open: " + err);
+  auto ring = std::make_shared<ChangeRing>(2);
+  store.subscribe({"note"}, ring);
+
+  constexpr long long kEvents = 3000;
+  std::vector<long long> seen;
+  std::atomic<bool> done{false};
+  std::thread consumer([&] {
+    long long last = 0;
+    auto take = [&](long long seq) {
+      if (seq > last) {
+        seen.push_back(seq);
+        last = seq;
+      }
+    };
+    // Reads the notes after `last` up to `through` (0: to the end).
+    auto catchUp = [&](long long through) {
+      std::string err;
+      for (const DeltaEvent &e : store.since(last, err)) {
+        if (through && e.seq > through)
+          break;
+        if (e.entity_type == "note")
+          take(e.seq);
+      }
+    };
+    for (;;) {
+      const bool finished = done; // every notice was pushed before this
+      if (!ring->wait(std::chrono::milliseconds(10))) {
+        if (finished)
+          break;
+        continue;
+      }
+      // A slow consumer, so the ring overflows now and then.
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      if (ring->takeOverflow())
+        catchUp(0);
+      ChangeNotice n;
+      while (ring->pop(n))
+        if (n.last_seq > last)
+          catchUp(n.last_seq);
+    }
+  });
+
+  SeqRange range;
+  long long notes = 0;
+  for (long long i = 0; i < kEvents; i += 3) {
+    std::vector<DeltaEvent> batch{event("note", "n" + std::to_string(i), i),
+                                  event("task", "x", i)};
+    if (i % 2)
+      batch.push_back(event("note", "m" + std::to_string(i), i));
+    store.appendBatch(batch, range);
+    notes += i % 2 ? 2 : 1;
+  }
+  done = true;
+  consumer.join();
+
+  std::string err;
+  std::vector<long long> want;
+  for (const DeltaEvent &e : store.since(0, err))
+    if (e.entity_type == "note")
+      want.push_back(e.seq);
+  if ((long long)want.size() != notes || seen != want)
+    return fail("tail saw " + std::to_string(seen.size()) + " of " +
+                std::to_string(want.size()) + " note events");
+  if (ring->dropped() == 0)
+    return fail("the ring never overflowed");
+  return 0;
+}
+
+int main() {
+  int rc = checkRing();
+  rc |= checkWritePaths();
+  rc |= checkTail();
+  if (rc == 0)
+    std::cout << "OK: change feed tests passed\n";
+  return rc;
+}
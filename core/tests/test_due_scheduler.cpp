@@ -0,0 +1,181 @@
+#include "core/DueScheduler.h"
+#include "core/EventStore.h"
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using together::DueScheduler;
+using together::DueTask;
+using together::EventStore;
+using together::ReplayOptions;
+using together::ReplayReport;
+using together::SeqRange;
+using together::TaskUpsert;
+
+static std::string ids(const std::vector<DueTask> &tasks) {
+  std::string out;
+  for (const DueTask &t : tasks)
+    out += (out.empty() ? "" : ",") + t.id + "@" + std::to_string(t.due_at);
+  return out;
+}
+
+// Reference model: every tracked task with its due_at and fired flag.
+struct Model {
+  std::map<std::string, std::pair<long long, bool>> tasks;
+
+  std::vector<DueTask> pendingSorted() const {
+    std::vector<DueTask> out;
+    for (const auto &t : tasks)
+      if (!t.second.second)
+        out.push_back(DueTask{t.first, t.second.first});
+    std::sort(out.begin(), out.end(), [](const DueTask &a, const DueTask &b) {
+      return a.due_at != b.due_at ? a.due_at < b.due_at : a.id < b.id;
+    });
+    return out;
+  }
+};
+
+static int checkHeap() {
+  int rc = 0;
+  DueScheduler s;
+  s.load({{"b", 30}, {"a", 10}, {"c", 20}, {"d", 20}});
+  if (ids(s.nextDue(0, 10)) != "a@10,c@20,d@20,b@30")
+    rc |= fail("load order: " + ids(s.nextDue(0, 10)));
+  if (ids(s.nextDue(15, 2)) != "c@20,d@20")
+    rc |= fail("nextDue after now: " + ids(s.nextDue(15, 2)));
+
+  if (ids(s.drainDue(20)) != "a@10,c@20,d@20" || s.pending() != 1)
+    rc |= fail("drainDue");
+  // A fired reminder stays fired across writes that keep its due_at...
+  s.update("c", 20, "open");
+  if (!s.drainDue(25).empty())
+    rc |= fail("unchanged due_at re-armed a fired reminder");
+  // ...and is re-armed when it moves.
+  s.update("c", 40, "open");
+  s.update("b", 5, "open");
+  if (ids(s.nextDue(0, 10)) != "b@5,c@40")
+    rc |= fail("reschedule: " + ids(s.nextDue(0, 10)));
+  s.update("b", 5, "done");
+  s.update("e", 0, "open");
+  s.remove("c");
+  if (s.pending() != 0 || s.tracked() != 2)
+    rc |= fail("closing tasks must untrack them");
+
+  // Random writes, drains and peeks against the model.
+  std::mt19937 rng(42);
+  Model model;
+  DueScheduler r;
+  for (int step = 0; step < 20000; ++step) {
+    const std::string id = "t" + std::to_string(rng() % 300);
+    const int what = (int)(rng() % 10);
+    const long long now = step;
+    if (what < 6) {
+      const long long due = (rng() % 8 == 0) ? 0 : now + (long long)(rng() % 500);
+      const char *status = (rng() % 6 == 0) ? "done" : "open";
+      r.update(id, due, status);
+      if (!DueScheduler::tracks(due, status)) {
+        model.tasks.erase(id);
+      } else {
+        auto it = model.tasks.find(id);
+        if (it == model.tasks.end() || it->second.first != due)
+          model.tasks[id] = {due, false};
+      }
+    } else if (what < 7) {
+      r.remove(id);
+      model.tasks.erase(id);
+    } else if (what < 9) {
+      std::vector<DueTask> want;
+      for (const DueTask &t : model.pendingSorted())
+        if (t.due_at > now && want.size() < 5)
+          want.push_back(t);
+      if (ids(r.nextDue(now, 5)) != ids(want))
+        return fail("random nextDue at step " + std::to_string(step));
+    } else {
+      std::vector<DueTask> want;
+      for (const DueTask &t : model.pendingSorted())
+        if (t.due_at <= now) {
+          want.push_back(t);
+          model.tasks[t.id].second = true;
+        }
+      if (ids(r.drainDue(now)) != ids(want))
+        return fail("random drainDue at step " + std::to_string(step));
+    }
+    if (r.tracked() != model.tasks.size() ||
+        r.pending() != model.pendingSorted().size())
+      return fail("random sizes at step " + std::to_string(step));
+  }
+  return rc;
+}
+
+static int checkStore() {
+  int rc = 0;
+  const std::string path = freshDbPath("due_scheduler");
+  {
+    EventStore store;
+    if (auto err = store.open(path); !err.empty())
+      return fail("open: " + err);
+    store.upsertTask("t1", "Dishes", "ann", 100, 1, "open", "family", 1,
+                     R"({"title":"Dishes","due_at":100})");
+    store.upsertTask("t2", "Trash", "bo", 50, 1, "done", "family", 2,
+                     R"({"title":"Trash","due_at":50,"status":"done"})");
+    store.upsertTask("t3", "Lawn", "bo", 0, 1, "open", "family", 3,
+                     R"({"title":"Lawn"})");
+    if (!store.nextDue(0, 10).empty())
+      return fail("disabled scheduler must return nothing");
+
+    if (auto err = store.enableDueScheduler(); !err.empty())
+      return fail("enableDueScheduler: " + err);
+    if (ids(store.nextDue(0, 10)) != "t1@100")
+      rc |= fail("load: " + ids(store.nextDue(0, 10)));
+
+    // Committed writes update it; a rolled-back batch does not.
+    store.upsertTask("t3", "Lawn", "bo", 70, 1, "open", "family", 4,
+                     R"({"title":"Lawn","due_at":70})");
+    store.deleteTask("t1", 5, "{}");
+    std::vector<TaskUpsert> bad(2);
+    bad[0].row.id = "t4";
+    bad[0].row.title = "Ghost";
+    bad[0].row.due_at = 10;
+    bad[0].row.status = "open";
+    bad[0].payload_json = "{}"; // bad[1] has no id, so the batch fails
+    SeqRange range;
+    if (store.upsertTasks(bad, range) >= 0)
+      rc |= fail("malformed batch should fail");
+    if (ids(store.nextDue(0, 10)) != "t3@70")
+      rc |= fail("writes not applied: " + ids(store.nextDue(0, 10)));
+    if (ids(store.drainDue(80)) != "t3@70" || !store.drainDue(80).empty())
+      rc |= fail("drainDue through the store");
+
+    // Replay reloads from the rebuilt table.
+    ReplayOptions opts;
+    ReplayReport report;
+    std::string err;
+    if (!store.replay(opts, report, err))
+      return fail("replay: " + err);
+    if (ids(store.nextDue(0, 10)) != "t3@70")
+      rc |= fail("replay reload: " + ids(store.nextDue(0, 10)));
+  }
+
+  // A fresh process starts from the table.
+  EventStore store;
+  if (auto err = store.open(path); !err.empty())
+    return fail("reopen: " + err);
+  store.enableDueScheduler();
+  if (ids(store.nextDue(0, 10)) != "t3@70")
+    rc |= fail("reload on reopen: " + ids(store.nextDue(0, 10)));
+  return rc;
+}
+
+int main() {
+  int rc = checkHeap();
+  rc |= checkStore();
+  if (rc == 0)
+    std::cout << "OK: due scheduler tests passed\n";
+  return rc;
+}
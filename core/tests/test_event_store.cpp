@@ -1,24 +1,51 @@
 #include "core/EventStore.h"
+#include "TestUtil.h"
+#include <sqlite3.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <chrono>
+#include <climits>
 #include <filesystem>
 #include <iostream>
 #include <string>
 #include <vector>
 
+using together::CompactionProgress;
 using together::DeltaEvent;
+using together::PayloadFormat;
 using together::EventStore;
+using together::OpenOptions;
+using together::IngestReport;
+using together::ReadBudget;
+using together::ReadCursor;
+using together::RemoteEvent;
+using together::ReplayOptions;
+using together::ReplayReport;
+using together::SeqRange;
+using together::TaskRowView;
+using together::DeltaEventView;
+using together::TaskUpsert;
 using together::TaskRow; // changed: TaskRow is now at namespace scope
 
-static int fail(const std::string &msg) {
-  std::cerr << "TEST FAIL: " << msg << std::endl;
-  return 1;
-}
-
 static int scenarioA(EventStore &store);
 static int scenarioB(EventStore &store);
 static int scenarioC(EventStore &store);
 static int scenarioD(EventStore &store);
 static int scenarioE(EventStore &store);
+static int scenarioF(EventStore &store);
+static int scenarioG(EventStore &store);
+static int scenarioH(EventStore &store);
+static int scenarioI(EventStore &store);
+static int scenarioJ(EventStore &store);
+static int scenarioK(EventStore &store);
+static int scenarioL(EventStore &store);
+static int scenarioM(EventStore &store);
+static int scenarioN(EventStore &store);
+static int scenarioO(EventStore &store);
+static int scenarioP(EventStore &store);
+static int scenarioQ(EventStore &store);
+static int scenarioR(EventStore &store);
 
 int main(int argc, char **argv) {
   std::string which;
@@ -26,10 +53,20 @@ int main(int argc, char **argv) {
     which = argv[2]; 
   }
 
-  std::filesystem::create_directories("tmp");
+  // ctest runs each scenario, and all of them together, as separate
+  // processes that may overlap (ctest -j): each gets its own directory.
+  scratchDir() = "tmp/" + std::to_string(getpid());
+  std::filesystem::create_directories(scratchDir());
+  // Removed after `store` closes, on every return path.
+  struct Scratch {
+    ~Scratch() {
+      std::error_code ec;
+      std::filesystem::remove_all(scratchDir(), ec);
+    }
+  } scratch;
 
   EventStore store;
-  if (auto err = store.open("tmp/test.db"); !err.empty()) {
+  if (auto err = store.open(freshDbPath("test")); !err.empty()) {
     return fail(std::string("open: ") + err);
   }
 
@@ -44,6 +81,32 @@ int main(int argc, char **argv) {
       return scenarioD(store);
     if (which == "E")
       return scenarioE(store);
+    if (which == "F")
+      return scenarioF(store);
+    if (which == "G")
+      return scenarioG(store);
+    if (which == "H")
+      return scenarioH(store);
+    if (which == "I")
+      return scenarioI(store);
+    if (which == "J")
+      return scenarioJ(store);
+    if (which == "K")
+      return scenarioK(store);
+    if (which == "L")
+      return scenarioL(store);
+    if (which == "M")
+      return scenarioM(store);
+    if (which == "N")
+      return scenarioN(store);
+    if (which == "O")
+      return scenarioO(store);
+    if (which == "P")
+      return scenarioP(store);
+    if (which == "Q")
+      return scenarioQ(store);
+    if (which == "R")
+      return scenarioR(store);
     return fail("unknown case " + which);
   }
 
@@ -54,6 +117,19 @@ int main(int argc, char **argv) {
   rc |= scenarioC(store);
   rc |= scenarioD(store);
   rc |= scenarioE(store);
+  rc |= scenarioF(store);
+  rc |= scenarioG(store);
+  rc |= scenarioH(store);
+  rc |= scenarioI(store);
+  rc |= scenarioJ(store);
+  rc |= scenarioK(store);
+  rc |= scenarioL(store);
+  rc |= scenarioM(store);
+  rc |= scenarioN(store);
+  rc |= scenarioO(store);
+  rc |= scenarioP(store);
+  rc |= scenarioQ(store);
+  rc |= scenarioR(store);
   if (rc == 0) {
     std::cout << "OK: all scenarios passed\n";
   }
@@ -260,3 +336,1302 @@ static int scenarioE(EventStore &store) {
   return 0;
 }
 
+static int scenarioF(EventStore &) {
+  // --- Scenario F: appendBatch / upsertTasks write all-or-nothing
+  {
+    EventStore store;
+    if (auto err = store.open(freshDbPath("scenario_f")); !err.empty())
+      return fail("Scenario F: open: " + err);
+
+    std::vector<DeltaEvent> batch(100);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i].entity_type = "task";
+      batch[i].entity_id = "t" + std::to_string(i);
+      batch[i].op = "upsert";
+      batch[i].payload = R"({})";
+      batch[i].ts = (long long)i;
+    }
+
+    SeqRange range;
+    long long last = store.appendBatch(batch, range);
+    if (last < 1)
+      return fail("Scenario F: appendBatch returned " + std::to_string(last));
+    if (range.last != last || range.last - range.first + 1 != 100)
+      return fail("Scenario F: seq range is not contiguous");
+
+    // A malformed row (empty entity_id) rolls back the whole batch.
+    batch[50].entity_id.clear();
+    if (store.appendBatch(batch, range) >= 0)
+      return fail("Scenario F: bad batch should fail");
+    if (range.first != 0 || range.last != 0)
+      return fail("Scenario F: failed batch should report an empty range");
+
+    std::string err;
+    auto events = store.since(0, err);
+    if (!err.empty() || events.size() != 100)
+      return fail("Scenario F: failed batch left rows behind");
+
+    std::vector<TaskUpsert> tasks(3);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      tasks[i].row.id = "bulk" + std::to_string(i);
+      tasks[i].row.title = "Bulk task";
+      tasks[i].row.status = "open";
+      tasks[i].row.visibility_tag = "family";
+      tasks[i].row.points = (int)i;
+      tasks[i].row.updated_at = 1000 + (long long)i;
+      tasks[i].payload_json = R"({"bulk":true})";
+    }
+    last = store.upsertTasks(tasks, range);
+    if (last < 1 || range.last - range.first + 1 != 3)
+      return fail("Scenario F: upsertTasks range mismatch");
+
+    TaskRow row;
+    if (!store.getTaskId("bulk2", row, err) || row.points != 2)
+      return fail("Scenario F: bulk row not readable: " + err);
+
+    tasks[1].row.id.clear();
+    tasks[0].row.title = "Renamed";
+    if (store.upsertTasks(tasks, range) >= 0)
+      return fail("Scenario F: bad upsertTasks should fail");
+    if (!store.getTaskId("bulk0", row, err) || row.title != "Bulk task")
+      return fail("Scenario F: failed upsertTasks was not rolled back");
+  }
+  return 0;
+}
+static int scenarioG(EventStore &) {
+  // --- Scenario G: scanSince pages through the log within a budget
+  {
+    EventStore store;
+    if (auto err = store.open(freshDbPath("scenario_g")); !err.empty())
+      return fail("Scenario G: open: " + err);
+
+    std::vector<DeltaEvent> batch(250);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i].entity_type = "task";
+      batch[i].entity_id = "t" + std::to_string(i);
+      batch[i].op = "upsert";
+      batch[i].payload = std::string(10, 'x'); // fixed-size rows
+      batch[i].ts = (long long)i;
+    }
+    SeqRange range;
+    if (store.appendBatch(batch, range) < 1)
+      return fail("Scenario G: seed failed");
+
+    // Row budget: 100 + 100 + 50, every seq exactly once, in order.
+    ReadBudget budget;
+    budget.max_rows = 100;
+    long long cursor_seq = 0, expect = range.first;
+    int pages = 0;
+    std::string err;
+    for (;;) {
+      ReadCursor cursor;
+      bool ok = store.scanSince(
+          cursor_seq, budget,
+          [&](const DeltaEvent &e) { return e.seq == expect++; }, cursor, err);
+      if (!ok)
+        return fail("Scenario G: scanSince error: " + err);
+      ++pages;
+      if (cursor.rows > budget.max_rows)
+        return fail("Scenario G: page exceeded max_rows");
+      cursor_seq = cursor.next_seq;
+      if (cursor.done)
+        break;
+      if (pages > 3)
+        return fail("Scenario G: paging did not terminate");
+    }
+    if (pages != 3 || expect != range.last + 1)
+      return fail("Scenario G: row-budget paging mismatch");
+
+    // Byte budget: each row is 4 + len(id) + 6 + 10 bytes; fits two rows.
+    budget = ReadBudget{};
+    budget.max_bytes = 2 * (4 + 2 + 6 + 10) + 1; // ids t0..t9 are 2 bytes
+    ReadCursor cursor;
+    if (!store.scanSince(0, budget, [](const DeltaEvent &) { return true; },
+                         cursor, err))
+      return fail("Scenario G: byte-budget scan error: " + err);
+    if (cursor.rows != 2 || cursor.done || cursor.bytes > budget.max_bytes)
+      return fail("Scenario G: byte budget not enforced");
+
+    // A single row larger than the budget is still delivered.
+    budget.max_bytes = 1;
+    if (!store.scanSince(0, budget, [](const DeltaEvent &) { return true; },
+                         cursor, err) ||
+        cursor.rows != 1)
+      return fail("Scenario G: oversized row must still make progress");
+
+    // Visitor can stop early; resuming continues after the last row seen.
+    int seen = 0;
+    store.scanSince(
+        0, ReadBudget{}, [&](const DeltaEvent &) { return ++seen < 5; },
+        cursor, err);
+    if (seen != 5 || cursor.done || cursor.next_seq != range.first + 4)
+      return fail("Scenario G: early stop cursor mismatch");
+  }
+  return 0;
+}
+static int scenarioH(EventStore &store) {
+  // --- Scenario H: view-based reads agree with the owning APIs
+  {
+    const long long now_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    if (store.upsertTask("t_view", "Feed cat", "kid2", 42, 1, "open",
+                         "kids", now_ms, R"({"title":"Feed cat"})") < 1)
+      return fail("Scenario H: upsertTask failed");
+
+    std::string err;
+    TaskRow owned;
+    if (!store.getTaskId("t_view", owned, err))
+      return fail("Scenario H: getTaskId failed: " + err);
+
+    TaskRow from_view;
+    if (!store.viewTask(
+            "t_view", [&](const TaskRowView &v) { from_view = v.toOwned(); },
+            err))
+      return fail("Scenario H: viewTask failed: " + err);
+    if (from_view.title != owned.title || from_view.due_at != owned.due_at ||
+        from_view.visibility_tag != "kids" ||
+        from_view.updated_at != owned.updated_at)
+      return fail("Scenario H: viewTask row differs from getTaskId");
+
+    if (store.viewTask("no_such_task", [](const TaskRowView &) {}, err) ||
+        err != "not found")
+      return fail("Scenario H: viewTask should report not found");
+
+    auto listed = store.listTasks("", 50, 0, err);
+    size_t i = 0;
+    bool same = true;
+    store.forEachTask("", 50, 0,
+                      [&](const TaskRowView &v) {
+                        if (i >= listed.size() || v.id != listed[i].id ||
+                            v.status != listed[i].status)
+                          same = false;
+                        ++i;
+                        return true;
+                      },
+                      err);
+    if (!err.empty() || !same || i != listed.size())
+      return fail("Scenario H: forEachTask differs from listTasks");
+
+    // Visitor can stop early.
+    int seen = 0;
+    store.forEachTask("", 50, 0,
+                      [&](const TaskRowView &) { return ++seen < 2; }, err);
+    if (listed.size() >= 2 && seen != 2)
+      return fail("Scenario H: forEachTask ignored early stop");
+
+    auto events = store.since(0, err);
+    ReadCursor cursor;
+    size_t j = 0;
+    store.scanSinceView(0, ReadBudget{},
+                        [&](const DeltaEventView &v) {
+                          if (j >= events.size() || v.seq != events[j].seq ||
+                              v.payload != events[j].payload)
+                            same = false;
+                          ++j;
+                          return true;
+                        },
+                        cursor, err);
+    if (!same || j != events.size())
+      return fail("Scenario H: scanSinceView differs from since");
+  }
+  return 0;
+}
+static int scenarioI(EventStore &) {
+  // --- Scenario I: keyset pages match the OFFSET pages
+  {
+    EventStore store;
+    if (auto err = store.open(freshDbPath("scenario_i")); !err.empty())
+      return fail("Scenario I: open: " + err);
+
+    // 57 tasks; timestamps repeat so the id tie-break matters.
+    std::vector<TaskUpsert> tasks(57);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      tasks[i].row.id = "k" + std::to_string(i);
+      tasks[i].row.title = "Task " + std::to_string(i);
+      tasks[i].row.status = (i % 3 == 0) ? "done" : "open";
+      tasks[i].row.visibility_tag = "family";
+      tasks[i].row.updated_at = 1000 + (long long)(i / 4);
+      tasks[i].payload_json = R"({})";
+    }
+    SeqRange range;
+    if (store.upsertTasks(tasks, range) < 1)
+      return fail("Scenario I: seed failed");
+
+    for (const std::string status : {"", "open", "done"}) {
+      const int limit = 10;
+      std::string err, token, next;
+      std::vector<std::string> keyset_ids, offset_ids;
+
+      for (int page = 0;; ++page) {
+        auto rows = store.listTasksPage(status, limit, token, next, err);
+        if (!err.empty())
+          return fail("Scenario I: listTasksPage error: " + err);
+        if ((int)rows.size() > limit)
+          return fail("Scenario I: page larger than limit");
+        for (auto &r : rows)
+          keyset_ids.push_back(r.id);
+        if (next.empty())
+          break;
+        token = next;
+        if (page > 10)
+          return fail("Scenario I: keyset paging did not terminate");
+      }
+
+      for (int offset = 0;; offset += limit) {
+        auto rows = store.listTasks(status, limit, offset, err);
+        if (!err.empty())
+          return fail("Scenario I: listTasks error: " + err);
+        for (auto &r : rows)
+          offset_ids.push_back(r.id);
+        if ((int)rows.size() < limit)
+          break;
+      }
+
+      if (keyset_ids != offset_ids)
+        return fail("Scenario I: keyset and OFFSET pages differ for '" +
+                    status + "'");
+    }
+
+    std::string err, next;
+    store.listTasksPage("", 10, "garbage", next, err);
+    if (err != "invalid page token")
+      return fail("Scenario I: bad token should be rejected");
+
+    // The look-ahead row must not overflow the largest limit.
+    auto all = store.listTasksPage("", INT_MAX, "", next, err);
+    if (!err.empty() || all.size() != tasks.size() || !next.empty())
+      return fail("Scenario I: INT_MAX limit should return every task");
+  }
+  return 0;
+}
+static int scenarioJ(EventStore &) {
+  // --- Scenario J: write-through task cache
+  {
+    EventStore store;
+    if (auto err = store.open(freshDbPath("scenario_j")); !err.empty())
+      return fail("Scenario J: open: " + err);
+    store.setTaskCacheBudget(64 * 1024);
+
+    if (store.upsertTask("c1", "Water plants", "kid1", 0, 1, "open", "family",
+                         100, R"({})") < 1)
+      return fail("Scenario J: upsertTask failed");
+
+    // Write-through: the committed row is served from the cache.
+    TaskRow row;
+    std::string err;
+    if (!store.getTaskId("c1", row, err) || row.title != "Water plants")
+      return fail("Scenario J: getTaskId failed: " + err);
+    auto st = store.taskCacheStats();
+    if (st.hits != 1 || st.misses != 0 || st.entries != 1)
+      return fail("Scenario J: expected a cache hit after upsert");
+
+    store.upsertTask("c1", "Water all plants", "kid1", 0, 1, "open", "family",
+                     200, R"({})");
+    if (!store.getTaskId("c1", row, err) || row.title != "Water all plants")
+      return fail("Scenario J: cache not updated by upsert");
+
+    // A visitor reading another cached task keeps its own row.
+    store.upsertTask("c0", "Empty bins", "kid2", 0, 1, "open", "family", 250,
+                     R"({})");
+    std::string outer, inner;
+    store.viewTask(
+        "c1",
+        [&](const TaskRowView &v) {
+          store.viewTask(
+              "c0", [&](const TaskRowView &w) { inner = std::string(w.title); },
+              err);
+          outer = std::string(v.title);
+        },
+        err);
+    if (outer != "Water all plants" || inner != "Empty bins")
+      return fail("Scenario J: nested viewTask clobbered the outer row");
+
+    store.deleteTask("c1", 300, R"({})");
+    if (!store.getTaskId("c1", row, err) || row.status != "deleted" ||
+        row.updated_at != 300)
+      return fail("Scenario J: cache not updated by delete");
+
+    // Rolled-back writes never reach the cache.
+    std::vector<TaskUpsert> tasks(2);
+    tasks[0].row = TaskRow{"c1", "Should not stick", "", 0, 0, "open",
+                           "family", 400};
+    tasks[1].row = TaskRow{"", "invalid id", "", 0, 0, "open", "family", 400};
+    SeqRange range;
+    if (store.upsertTasks(tasks, range) >= 0)
+      return fail("Scenario J: bad batch should fail");
+    if (!store.getTaskId("c1", row, err) || row.title != "Water all plants")
+      return fail("Scenario J: rolled-back write leaked into the cache");
+
+    // Misses populate the cache from SQLite.
+    store.setTaskCacheBudget(0);
+    store.upsertTask("c2", "Fold laundry", "", 0, 1, "open", "family", 500,
+                     R"({})");
+    store.setTaskCacheBudget(64 * 1024);
+    store.getTaskId("c2", row, err);
+    store.getTaskId("c2", row, err);
+    st = store.taskCacheStats();
+    if (st.misses != 1 || st.hits != 1 || row.title != "Fold laundry")
+      return fail("Scenario J: miss should fill the cache");
+
+    // The budget bounds the cache.
+    store.setTaskCacheBudget(1024);
+    for (int i = 0; i < 50; ++i)
+      store.upsertTask("e" + std::to_string(i), "Evict me", "", 0, 0, "open",
+                       "family", 600 + i, R"({})");
+    st = store.taskCacheStats();
+    if (st.bytes > st.budget_bytes || st.evictions == 0)
+      return fail("Scenario J: budget not enforced");
+    if (!store.getTaskId("e0", row, err) || row.title != "Evict me")
+      return fail("Scenario J: evicted row must still load from SQLite");
+  }
+  return 0;
+}
+static int scenarioK(EventStore &) {
+  // --- Scenario K: binary payload storage, JSON on read
+  {
+    EventStore store;
+    if (auto err = store.open(freshDbPath("scenario_k")); !err.empty())
+      return fail("Scenario K: open: " + err);
+
+    const std::string json =
+        R"({"title":"Sweep floor","assignees":"kid1","points":2})";
+    store.upsertTask("t1", "Sweep floor", "kid1", 0, 2, "open", "family", 1,
+                     json); // stored as JSON
+    store.setPayloadFormat(PayloadFormat::Binary);
+    store.upsertTask("t1", "Sweep floor", "kid1", 0, 2, "open", "family", 2,
+                     json); // stored binary
+    store.deleteTask("t1", 3, "not a json object"); // kept verbatim
+
+    std::string err;
+    auto events = store.since(0, err);
+    if (!err.empty() || events.size() != 3)
+      return fail("Scenario K: since failed: " + err);
+    if (events[0].payload != json || events[1].payload != json)
+      return fail("Scenario K: readers must see JSON for both formats");
+    if (events[2].payload != "not a json object")
+      return fail("Scenario K: non-JSON payload must be stored unchanged");
+
+    // The view exposes the stored bytes.
+    std::vector<size_t> sizes;
+    std::vector<bool> binary;
+    ReadCursor cursor;
+    store.scanSinceView(0, ReadBudget{},
+                        [&](const DeltaEventView &v) {
+                          sizes.push_back(v.payload.size());
+                          binary.push_back(
+                              together::payload::isBinary(v.payload));
+                          return true;
+                        },
+                        cursor, err);
+    if (binary != std::vector<bool>{false, true, false})
+      return fail("Scenario K: unexpected stored formats");
+    if (sizes[1] >= sizes[0])
+      return fail("Scenario K: binary payload should be smaller");
+  }
+  return 0;
+}
+static int scenarioL(EventStore &) {
+  // --- Scenario L: exportDelta / importDelta round trip
+  {
+    EventStore src, dst;
+    if (auto err = src.open(freshDbPath("scenario_l_src")); !err.empty())
+      return fail("Scenario L: open src: " + err);
+    if (auto err = dst.open(freshDbPath("scenario_l_dst")); !err.empty())
+      return fail("Scenario L: open dst: " + err);
+
+    for (int i = 0; i < 200; ++i)
+      src.upsertTask("t" + std::to_string(i % 20), "Chore", "kid1", 0, i % 5,
+                     "open", "family", 1700000000000LL + i * 1000,
+                     R"({"title":"Chore","points":)" + std::to_string(i % 5) +
+                         "}");
+    src.setPayloadFormat(PayloadFormat::Binary); // mixed payload formats
+    src.deleteTask("t3", 1700000300000LL, R"({"reason":"user_deleted"})");
+
+    std::string err, bundle;
+    if (!src.exportDelta(0, bundle, err))
+      return fail("Scenario L: exportDelta failed: " + err);
+
+    auto expected = src.since(0, err);
+    size_t raw_bytes = 0;
+    for (auto &e : expected)
+      raw_bytes += e.entity_type.size() + e.entity_id.size() + e.op.size() +
+                   e.payload.size() + 16;
+    if (bundle.size() >= raw_bytes)
+      return fail("Scenario L: bundle is not smaller than the raw rows");
+
+    SeqRange range;
+    long long last = dst.importDelta(bundle, range, err);
+    if (last < 1 || range.last - range.first + 1 != (long long)expected.size())
+      return fail("Scenario L: importDelta failed: " + err);
+
+    auto got = dst.since(0, err);
+    if (got.size() != expected.size())
+      return fail("Scenario L: imported event count mismatch");
+    for (size_t i = 0; i < got.size(); ++i) {
+      if (got[i].entity_type != expected[i].entity_type ||
+          got[i].entity_id != expected[i].entity_id ||
+          got[i].op != expected[i].op || got[i].ts != expected[i].ts ||
+          got[i].payload != expected[i].payload)
+        return fail("Scenario L: imported event differs at " +
+                    std::to_string(i));
+    }
+
+    // The task events reached the task table, as replay would apply them.
+    TaskRow row;
+    if (!dst.getTaskId("t1", row, err) || row.title != "Chore" ||
+        row.updated_at != 1700000000000LL + 181 * 1000)
+      return fail("Scenario L: imported task not in the task table");
+    if (!dst.getTaskId("t3", row, err) || row.status != "deleted")
+      return fail("Scenario L: imported delete not applied");
+    ReplayOptions verify;
+    verify.verify_only = true;
+    ReplayReport report;
+    if (!dst.replay(verify, report, err) || report.mismatches != 0)
+      return fail("Scenario L: imported store does not verify");
+
+    // Importing the same bundle again applies nothing.
+    if (dst.importDelta(bundle, range, err) != 0 ||
+        dst.since(0, err).size() != expected.size())
+      return fail("Scenario L: re-import duplicated events");
+
+    // Nothing newer than the last seq: an empty bundle.
+    std::string tail;
+    if (!src.exportDelta(expected.back().seq, tail, err))
+      return fail("Scenario L: empty export failed: " + err);
+    if (dst.importDelta(tail, range, err) != 0)
+      return fail("Scenario L: empty bundle should import nothing");
+
+    // Corrupt input is rejected and writes nothing.
+    std::string bad = bundle;
+    bad[bad.size() / 2] ^= 0x5a;
+    if (dst.importDelta(bad, range, err) >= 0 || err.empty())
+      return fail("Scenario L: corrupt bundle was accepted");
+    if (dst.importDelta("not a bundle", range, err) != -8)
+      return fail("Scenario L: garbage should be rejected");
+    if (dst.since(0, err).size() != expected.size())
+      return fail("Scenario L: failed import wrote rows");
+  }
+  return 0;
+}
+static int scenarioM(EventStore &) {
+  // --- Scenario M: incremental compaction below a snapshot checkpoint
+  {
+    const std::string path = freshDbPath("scenario_m");
+    EventStore store;
+    if (auto err = store.open(path); !err.empty())
+      return fail("Scenario M: open: " + err);
+
+    // 10 tasks x 10 versions, then one delete: 101 events.
+    for (int v = 0; v < 10; ++v)
+      for (int t = 0; t < 10; ++t)
+        store.upsertTask("t" + std::to_string(t), "v" + std::to_string(v), "",
+                         0, v, "open", "family", v * 100 + t,
+                         R"({"v":)" + std::to_string(v) + "}");
+    long long del_seq = store.deleteTask("t0", 5000, R"({})");
+
+    std::string err;
+    auto before = store.since(0, err);
+    const long long checkpoint = before[79].seq; // inside version 7
+    auto newestPerEntity = [](const std::vector<DeltaEvent> &evs) {
+      std::vector<std::string> last(10);
+      for (auto &e : evs)
+        last[std::stoi(e.entity_id.substr(1))] = e.op + e.payload;
+      return last;
+    };
+
+    if (!store.beginCompaction(checkpoint, err))
+      return fail("Scenario M: beginCompaction failed: " + err);
+    if (store.beginCompaction(checkpoint - 1, err))
+      return fail("Scenario M: checkpoint must not move backwards");
+    if (store.beginCompaction(del_seq + 1, err))
+      return fail("Scenario M: checkpoint beyond the log must be rejected");
+
+    CompactionProgress progress;
+    long long deleted = 0;
+    int steps = 0;
+    do {
+      if (!store.compactStep(7, progress, err))
+        return fail("Scenario M: compactStep failed: " + err);
+      deleted += progress.rows_deleted;
+      if (++steps > 100)
+        return fail("Scenario M: compaction did not finish");
+    } while (!progress.done);
+    if (steps < 10)
+      return fail("Scenario M: compaction should run in bounded chunks");
+
+    // At or below the checkpoint: exactly one (the newest) event per task.
+    auto after = store.since(0, err);
+    if (!err.empty())
+      return fail("Scenario M: since(0) after compaction: " + err);
+    size_t at_or_below = 0;
+    for (auto &e : after)
+      if (e.seq <= checkpoint)
+        ++at_or_below;
+    if (at_or_below != 10 || deleted != 70)
+      return fail("Scenario M: expected 10 snapshot rows, 70 dropped");
+    if (newestPerEntity(after) != newestPerEntity(before))
+      return fail("Scenario M: compaction changed the final state");
+
+    // Above the checkpoint nothing changed.
+    auto tail_before = std::vector<DeltaEvent>(before.begin() + 80, before.end());
+    auto tail_after = store.since(checkpoint, err);
+    if (!err.empty() || tail_after.size() != tail_before.size())
+      return fail("Scenario M: since(checkpoint) must return the live tail");
+
+    // Peers that synced part-way below the checkpoint need a snapshot.
+    if (!store.snapshotRequired(checkpoint - 1) || store.snapshotRequired(0))
+      return fail("Scenario M: snapshotRequired mismatch");
+    store.since(checkpoint - 1, err);
+    if (err != "snapshot required")
+      return fail("Scenario M: expected 'snapshot required' signal");
+
+    // Checkpoint and progress survive reopening.
+    EventStore reopened;
+    reopened.open(path);
+    if (reopened.checkpointSeq() != checkpoint)
+      return fail("Scenario M: checkpoint not persisted");
+    if (!reopened.compactStep(7, progress, err) || !progress.done ||
+        progress.rows_deleted != 0)
+      return fail("Scenario M: finished compaction should be a no-op");
+  }
+  {
+    // The survivor carries the state of the events compaction drops, so
+    // replay of the compacted log rebuilds the same rows.
+    EventStore store;
+    if (auto err = store.open(freshDbPath("scenario_m_fold")); !err.empty())
+      return fail("Scenario M: open: " + err);
+    int remote_n = 0;
+    auto remote = [&](const std::string &type, const std::string &id,
+                      const std::string &op, const std::string &payload,
+                      long long ts) {
+      RemoteEvent r;
+      r.event.entity_type = type;
+      r.event.entity_id = id;
+      r.event.op = op;
+      r.event.payload = payload;
+      r.event.ts = ts;
+      r.origin = "peer";
+      r.remote_id = "peer:" + std::to_string(++remote_n);
+      IngestReport report;
+      return store.ingestRemote({r}, report);
+    };
+    auto local = [&](const std::string &type, const std::string &id,
+                     const std::string &op, const std::string &payload,
+                     long long ts) {
+      DeltaEvent e;
+      e.entity_type = type;
+      e.entity_id = id;
+      e.op = op;
+      e.payload = payload;
+      e.ts = ts;
+      return store.append(e);
+    };
+    const long long march = 1709251200000; // 2024-03-01
+    const long long april = 1711929600000; // 2024-04-01
+
+    // Deleted after a partial update: the delete must carry the row.
+    store.upsertTask("a", "Feed fish", "kid1", 42, 3, "open", "kids", 10,
+                     "{}");
+    remote("task", "a", "upsert", R"({"points":5})", 20);
+    store.deleteTask("a", 30, "{}");
+    // Only partial remote upserts, then a delete and an update.
+    remote("task", "b", "upsert", R"({"title":"Remote"})", 10);
+    remote("task", "b", "upsert", R"({"status":"done"})", 20);
+    remote("task", "c", "upsert", R"({"title":"Gone"})", 10);
+    remote("task", "c", "delete", "{}", 20);
+    remote("task", "c", "upsert", R"({"points":1})", 30);
+    // Budget rows: a month taken from the first event's ts, a delete.
+    local("budget_tx", "x1", "upsert",
+          R"({"category":"food","amount_cents":500})", march);
+    local("budget_tx", "x1", "upsert", R"({"amount_cents":700})", april);
+    local("budget_tx", "x2", "upsert",
+          R"({"category":"fun","amount_cents":100})", march);
+    local("budget_tx", "x2", "delete", "{}", april);
+    local("budget_limit", "l1", "upsert",
+          R"({"category":"food","amount_cents":9000})", march);
+    const long long first_cp =
+        local("budget_limit", "l1", "upsert", R"({"rollover":false})", april);
+
+    std::string err;
+    ReplayOptions verify;
+    verify.verify_only = true;
+    ReplayReport report;
+    if (!store.replay(verify, report, err) || report.mismatches != 0)
+      return fail("Scenario M: store inconsistent before compaction");
+
+    auto compactTo = [&](long long checkpoint) {
+      CompactionProgress progress;
+      if (!store.beginCompaction(checkpoint, err))
+        return false;
+      do {
+        if (!store.compactStep(2, progress, err)) // chains span windows
+          return false;
+      } while (!progress.done);
+      return true;
+    };
+    if (!compactTo(first_cp))
+      return fail("Scenario M: compaction failed: " + err);
+    if (!store.replay(verify, report, err) || report.mismatches != 0)
+      return fail("Scenario M: compacted log replays to different rows");
+
+    // A higher checkpoint restarts the pass over earlier snapshots; this
+    // time they are written in the binary format.
+    store.setPayloadFormat(PayloadFormat::Binary);
+    remote("task", "b", "upsert", R"({"visibility_tag":"parents"})", 40);
+    local("budget_tx", "x1", "upsert", R"({"category":"rent"})", april + 1);
+    if (!compactTo(local("note", "n1", "upsert", "{}", 1)))
+      return fail("Scenario M: second compaction failed: " + err);
+    auto events = store.since(0, err);
+    if (events.size() != 7)
+      return fail("Scenario M: expected one event per entity");
+    if (!store.replay(verify, report, err) || report.mismatches != 0)
+      return fail("Scenario M: recompacted log replays to different rows");
+
+    ReplayOptions rebuild;
+    if (!store.replay(rebuild, report, err) || report.rows != 3)
+      return fail("Scenario M: rebuild failed: " + err);
+    TaskRow row;
+    if (!store.getTaskId("a", row, err) || row.status != "deleted" ||
+        row.title != "Feed fish" || row.points != 5 ||
+        row.visibility_tag != "kids" || row.updated_at != 30)
+      return fail("Scenario M: deleted task lost its row in compaction");
+
+    // A peer syncing from zero gets the same rows.
+    EventStore peer;
+    if (auto perr = peer.open(freshDbPath("scenario_m_peer")); !perr.empty())
+      return fail("Scenario M: open peer: " + perr);
+    std::vector<RemoteEvent> batch;
+    for (const DeltaEvent &e : events) {
+      RemoteEvent r;
+      r.event = e;
+      r.origin = "home";
+      r.remote_id = "home:" + std::to_string(e.seq);
+      batch.push_back(r);
+    }
+    IngestReport ingested;
+    if (peer.ingestRemote(batch, ingested) < 1)
+      return fail("Scenario M: peer ingest failed");
+    for (const char *id : {"a", "b", "c"}) {
+      TaskRow mine, theirs;
+      store.getTaskId(id, mine, err);
+      if (!peer.getTaskId(id, theirs, err) || theirs.title != mine.title ||
+          theirs.status != mine.status || theirs.points != mine.points ||
+          theirs.visibility_tag != mine.visibility_tag)
+        return fail(std::string("Scenario M: peer row differs: ") + id);
+    }
+  }
+  return 0;
+}
+
+static int scenarioN(EventStore &) {
+  // --- Scenario N: replay rebuilds the task table from event_log
+  {
+    EventStore store;
+    if (auto err = store.open(freshDbPath("scenario_n")); !err.empty())
+      return fail("Scenario N: open: " + err);
+    store.setTaskCacheBudget(1 << 20);
+
+    auto taskJson = [](const std::string &title, int points,
+                       const std::string &status) {
+      return R"({"title":")" + title + R"(","assignees":"ann,bo","due_at":7,)" +
+             R"("points":)" + std::to_string(points) + R"(,"status":")" +
+             status + R"(","visibility_tag":"family"})";
+    };
+    for (int t = 0; t < 50; ++t)
+      for (int v = 0; v < 3; ++v)
+        store.upsertTask("t" + std::to_string(t), "v" + std::to_string(v),
+                         "ann,bo", 7, v, "open", "family", t * 10 + v,
+                         taskJson("v" + std::to_string(v), v, "open"));
+    store.deleteTask("t3", 9000, R"({})");
+
+    DeltaEvent other;
+    other.entity_type = "note";
+    other.entity_id = "n1";
+    other.op = "upsert";
+    other.payload = R"({"text":"hi"})";
+    other.ts = 1;
+    store.append(other);
+
+    ReplayOptions opts;
+    opts.batch_events = 16; // many small transactions
+    opts.verify_only = true;
+    ReplayReport report;
+    std::string err;
+    if (!store.replay(opts, report, err))
+      return fail("Scenario N: verify failed: " + err);
+    if (report.events != 152 || report.applied != 151 ||
+        report.skipped != 1 || report.rows != 50)
+      return fail("Scenario N: unexpected replay counts");
+    if (report.mismatches != 0)
+      return fail("Scenario N: consistent store reported mismatches");
+
+    // Drift: an event that never reached the live table.
+    DeltaEvent drift;
+    drift.entity_type = "task";
+    drift.entity_id = "t7";
+    drift.op = "upsert";
+    drift.payload = R"({"points":99})"; // partial: other fields carry over
+    drift.ts = 9500;
+    store.append(drift);
+
+    TaskRow cached;
+    store.getTaskId("t7", cached, err); // warm the cache with the stale row
+
+    opts.max_reported_diffs = 5;
+    if (!store.replay(opts, report, err) || report.mismatches != 1 ||
+        report.diff_ids != std::vector<std::string>{"task:t7"})
+      return fail("Scenario N: verify should report the drifted row");
+
+    opts.verify_only = false;
+    if (!store.replay(opts, report, err) || report.rows != 50)
+      return fail("Scenario N: rebuild failed: " + err);
+    TaskRow row;
+    if (!store.getTaskId("t7", row, err) || row.points != 99 ||
+        row.title != "v2" || row.assignees_csv != "ann,bo" ||
+        row.updated_at != 9500)
+      return fail("Scenario N: rebuilt row (or cache) is stale");
+    if (!store.getTaskId("t3", row, err) || row.status != "deleted")
+      return fail("Scenario N: delete not replayed");
+
+    opts.verify_only = true;
+    if (!store.replay(opts, report, err) || report.mismatches != 0)
+      return fail("Scenario N: rebuild should leave no mismatches");
+  }
+  {
+    // Callers pass partial payloads; the events log them unchanged and
+    // still replay to the rows upsertTask wrote.
+    EventStore store;
+    if (auto err = store.open(freshDbPath("scenario_n_partial")); !err.empty())
+      return fail("Scenario N: open: " + err);
+    store.upsertTask("p1", "Feed fish", "kid1", 42, 3, "open", "kids", 10,
+                     "{}");
+    store.upsertTask("p1", "Feed fish", "kid1", 42, 3, "done", "kids", 20,
+                     R"({"status":"done","note":"kept"})");
+    store.upsertTask("p2", "Budget review", "dad", 0, 1, "open", "parents",
+                     30, "");
+    if (store.upsertTask("p3", "Nested", "", 0, 0, "open", "parents", 40,
+                         R"({"a":{"b":1}})") < 1)
+      return fail("Scenario N: nested payload should be accepted");
+
+    std::string err;
+    auto events = store.since(0, err);
+    if (events.size() != 4 || events[0].payload != "{}" ||
+        events[1].payload != R"({"status":"done","note":"kept"})" ||
+        !events[2].payload.empty() || events[3].payload != R"({"a":{"b":1}})")
+      return fail("Scenario N: payloads must be logged unchanged");
+
+    ReplayOptions opts;
+    opts.verify_only = true;
+    ReplayReport report;
+    if (!store.replay(opts, report, err) || report.mismatches != 0)
+      return fail("Scenario N: partial payloads replay differently");
+
+    opts.verify_only = false;
+    if (!store.replay(opts, report, err) || report.rows != 3)
+      return fail("Scenario N: rebuild failed: " + err);
+    TaskRow row;
+    if (!store.getTaskId("p1", row, err) || row.title != "Feed fish" ||
+        row.assignees_csv != "kid1" || row.due_at != 42 || row.points != 3 ||
+        row.status != "done" || row.visibility_tag != "kids")
+      return fail("Scenario N: rebuilt row lost fields of a partial upsert");
+    if (!store.getTaskId("p2", row, err) || row.visibility_tag != "parents")
+      return fail("Scenario N: rebuild widened a task's visibility");
+    if (!store.getTaskId("p3", row, err) || row.title != "Nested" ||
+        row.visibility_tag != "parents")
+      return fail("Scenario N: rebuild lost a nested-payload task");
+
+    // Compaction folds the recorded rows into the survivors.
+    const long long del_seq = store.deleteTask("p3", 50, "");
+    if (del_seq < 1 || !store.beginCompaction(del_seq, err))
+      return fail("Scenario N: beginCompaction failed: " + err);
+    CompactionProgress progress;
+    do {
+      if (!store.compactStep(100, progress, err))
+        return fail("Scenario N: compactStep failed: " + err);
+    } while (!progress.done);
+    if (store.since(0, err).size() != 3)
+      return fail("Scenario N: compaction should keep one event per task");
+    opts.verify_only = true;
+    if (!store.replay(opts, report, err) || report.mismatches != 0)
+      return fail("Scenario N: compacted log replays differently");
+  }
+  return 0;
+}
+
+static int scenarioO(EventStore &) {
+  // --- Scenario O: a v1 database (text entity_type / op) migrates to v2,
+  // resuming a migration that stopped after its first batch
+  const std::string path = freshDbPath("scenario_o");
+  const long long kEvents = 120000; // more than two migration batches
+  {
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    const char *v1 = R"SQL(
+      CREATE TABLE event_log(
+        seq INTEGER PRIMARY KEY AUTOINCREMENT,
+        entity_type TEXT NOT NULL,
+        entity_id   TEXT NOT NULL,
+        op          TEXT NOT NULL,
+        payload_blob BLOB NOT NULL,
+        ts          INTEGER NOT NULL
+      );
+      CREATE INDEX idx_event_log_seq ON event_log(seq);
+      CREATE INDEX idx_event_log_entity
+        ON event_log(entity_type, entity_id, seq);
+      BEGIN;
+      WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n
+                              WHERE i < 120000)
+      INSERT INTO event_log(entity_type, entity_id, op, payload_blob, ts)
+        SELECT CASE WHEN i % 10 = 0 THEN 'note' ELSE 'task' END,
+               't' || (i % 500),
+               CASE WHEN i % 7 = 0 THEN 'delete' ELSE 'upsert' END,
+               '{"i":' || i || '}', i
+        FROM n;
+      COMMIT;
+      -- Compaction removed events past the end of the log.
+      UPDATE sqlite_sequence SET seq = seq + 5 WHERE name = 'event_log';
+      -- A previous open copied one batch before it was interrupted.
+      CREATE TABLE event_dict(code INTEGER PRIMARY KEY,
+                              name TEXT NOT NULL UNIQUE);
+      INSERT INTO event_dict(code, name) VALUES
+        (1, 'task'), (2, 'event'), (3, 'budget_tx'),
+        (4, 'upsert'), (5, 'delete'), (6, 'note');
+      CREATE TABLE event_log_v2(
+        seq INTEGER PRIMARY KEY AUTOINCREMENT,
+        type_code INTEGER NOT NULL,
+        entity_id TEXT NOT NULL,
+        op_code INTEGER NOT NULL,
+        payload_blob BLOB NOT NULL,
+        ts INTEGER NOT NULL
+      );
+      INSERT INTO event_log_v2
+        SELECT l.seq, t.code, l.entity_id, o.code, l.payload_blob, l.ts
+        FROM event_log l JOIN event_dict t ON t.name = l.entity_type
+                         JOIN event_dict o ON o.name = l.op
+        WHERE l.seq <= 50000;
+    )SQL";
+    char *errmsg = nullptr;
+    if (sqlite3_exec(db, v1, nullptr, nullptr, &errmsg) != SQLITE_OK) {
+      std::string err = errmsg ? errmsg : "";
+      sqlite3_free(errmsg);
+      sqlite3_close(db);
+      return fail("Scenario O: building v1 database: " + err);
+    }
+    sqlite3_close(db);
+  }
+
+  {
+    EventStore store;
+    if (auto err = store.open(path); !err.empty())
+      return fail("Scenario O: open (migrate): " + err);
+
+    std::string err;
+    auto all = store.since(0, err);
+    if (!err.empty() || (long long)all.size() != kEvents)
+      return fail("Scenario O: migrated log has wrong size: " + err);
+    for (long long i : {1LL, 7LL, 10LL, 50000LL, 50001LL, 120000LL}) {
+      const DeltaEvent &e = all[(std::size_t)(i - 1)];
+      if (e.seq != i || e.ts != i ||
+          e.entity_type != (i % 10 == 0 ? "note" : "task") ||
+          e.op != (i % 7 == 0 ? "delete" : "upsert") ||
+          e.entity_id != "t" + std::to_string(i % 500) ||
+          e.payload != R"({"i":)" + std::to_string(i) + "}")
+        return fail("Scenario O: event " + std::to_string(i) + " changed");
+    }
+
+    // New events keep counting from the v1 high-water mark, and new names
+    // get codes.
+    DeltaEvent ev;
+    ev.entity_type = "chore_list";
+    ev.entity_id = "c1";
+    ev.op = "archive";
+    ev.payload = "{}";
+    ev.ts = 1;
+    if (store.append(ev) != kEvents + 6)
+      return fail("Scenario O: seq reused after migration");
+    auto tail = store.since(kEvents, err);
+    if (tail.size() != 1 || tail[0].entity_type != "chore_list" ||
+        tail[0].op != "archive")
+      return fail("Scenario O: new names not round-tripped");
+
+    // An interned name rolled back with its transaction is forgotten.
+    ev.entity_type = "task";
+    ev.op = "";
+    DeltaEvent batch[2] = {ev, ev};
+    batch[0].entity_type = "ghost";
+    batch[0].op = "upsert";
+    SeqRange range;
+    if (store.appendBatch(batch, 2, range) >= 0)
+      return fail("Scenario O: malformed batch should fail");
+  }
+
+  sqlite3 *db = nullptr;
+  sqlite3_open(path.c_str(), &db);
+  auto queryInt = [db](const char *sql) {
+    sqlite3_stmt *st = nullptr;
+    long long v = -1;
+    if (sqlite3_prepare_v2(db, sql, -1, &st, nullptr) == SQLITE_OK &&
+        sqlite3_step(st) == SQLITE_ROW)
+      v = sqlite3_column_int64(st, 0);
+    sqlite3_finalize(st);
+    return v;
+  };
+  const long long version = queryInt("PRAGMA user_version");
+  const long long leftovers = queryInt(
+      "SELECT COUNT(*) FROM sqlite_master WHERE name = 'event_log_v2' "
+      "OR sql LIKE '%entity_type%'");
+  const long long ghosts =
+      queryInt("SELECT COUNT(*) FROM event_dict WHERE name = 'ghost'");
+  sqlite3_close(db);
+  if (version < 2)
+    return fail("Scenario O: user_version not migrated");
+  if (leftovers != 0)
+    return fail("Scenario O: v1 schema objects left behind");
+  if (ghosts != 0)
+    return fail("Scenario O: rolled-back name persisted");
+
+  // Reopening a v2 database does nothing.
+  EventStore again;
+  std::string err;
+  if (auto oerr = again.open(path); !oerr.empty() ||
+                                   again.since(kEvents, err).size() != 1)
+    return fail("Scenario O: reopen after migration");
+  return 0;
+}
+
+static int scenarioP(EventStore &) {
+  // --- Scenario P: listTasksForMember follows assignees_csv through
+  // upserts, deletes, replay and the v3 -> v4 backfill
+  const std::string path = freshDbPath("scenario_p");
+  auto ids = [](const std::vector<TaskRow> &rows) {
+    std::string out;
+    for (const TaskRow &r : rows)
+      out += (out.empty() ? "" : ",") + r.id;
+    return out;
+  };
+  {
+    EventStore store;
+    if (auto err = store.open(path); !err.empty())
+      return fail("Scenario P: open: " + err);
+    // Payloads carry the row so replay can rebuild it.
+    auto upsert = [&store](const std::string &id, const std::string &title,
+                           const std::string &csv, const std::string &status,
+                           long long ts) {
+      store.upsertTask(id, title, csv, 0, 1, status, "family", ts,
+                       R"({"title":")" + title + R"(","assignees":")" + csv +
+                           R"(","status":")" + status + R"("})");
+    };
+    upsert("t1", "Dishes", "ann,bo", "open", 10);
+    upsert("t2", "Trash", "bo", "done", 20);
+    upsert("t3", "Laundry", "ann,,ann", "open", 30);
+    upsert("t4", "Lawn", "", "open", 40);
+
+    std::string next, err;
+    auto ann = store.listTasksForMember("ann", "", 10, "", next, err);
+    if (!err.empty() || ids(ann) != "t3,t1" || !next.empty())
+      return fail("Scenario P: ann's tasks: " + ids(ann) + " " + err);
+    if (ann[0].title != "Laundry" || ann[0].assignees_csv != "ann,,ann")
+      return fail("Scenario P: member rows must carry the task columns");
+    auto bo_done = store.listTasksForMember("bo", "done", 10, "", next, err);
+    if (ids(bo_done) != "t2")
+      return fail("Scenario P: status filter: " + ids(bo_done));
+    if (!store.listTasksForMember("an", "", 10, "", next, err).empty())
+      return fail("Scenario P: member ids must match exactly");
+    store.listTasksForMember("", "", 10, "", next, err);
+    if (err.empty())
+      return fail("Scenario P: empty member_id must be rejected");
+
+    // Keyset paging, one row at a time.
+    std::string pages, token;
+    do {
+      auto page = store.listTasksForMember("bo", "", 1, token, next, err);
+      if (!err.empty() || page.size() != 1)
+        return fail("Scenario P: paging: " + err);
+      pages += page[0].id;
+      token = next;
+    } while (!token.empty());
+    if (pages != "t2t1")
+      return fail("Scenario P: pages out of order: " + pages);
+
+    // Reassigning moves the task; deleting keeps it with status deleted.
+    upsert("t1", "Dishes", "cy", "open", 50);
+    store.deleteTask("t2", 60, "{}");
+    if (ids(store.listTasksForMember("bo", "", 10, "", next, err)) != "t2" ||
+        ids(store.listTasksForMember("bo", "deleted", 10, "", next, err)) !=
+            "t2" ||
+        ids(store.listTasksForMember("cy", "", 10, "", next, err)) != "t1")
+      return fail("Scenario P: reassign/delete not reflected");
+
+    // Replay rebuilds the index along with the task table.
+    ReplayOptions opts;
+    ReplayReport report;
+    if (!store.replay(opts, report, err))
+      return fail("Scenario P: replay: " + err);
+    if (ids(store.listTasksForMember("ann", "", 10, "", next, err)) != "t3" ||
+        ids(store.listTasksForMember("bo", "deleted", 10, "", next, err)) !=
+            "t2")
+      return fail("Scenario P: index not rebuilt by replay");
+  }
+
+  // A v3 database (no task_assignee) is backfilled on open.
+  {
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_exec(db,
+                 "DROP TABLE task_assignee;"
+                 "INSERT INTO task(id, title, assignees_csv, status, "
+                 "                 updated_at) "
+                 "VALUES ('t5', 'Mop', 'dee,ann', 'open', 70);"
+                 "PRAGMA user_version = 3;",
+                 nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+  }
+  EventStore store;
+  if (auto err = store.open(path); !err.empty())
+    return fail("Scenario P: open v3: " + err);
+  std::string next, err;
+  if (ids(store.listTasksForMember("ann", "", 10, "", next, err)) != "t5,t3" ||
+      ids(store.listTasksForMember("dee", "open", 10, "", next, err)) != "t5")
+    return fail("Scenario P: v3 database not backfilled");
+  return 0;
+}
+
+static int scenarioQ(EventStore &) {
+  // --- Scenario Q: entityHistory and range page through their index in
+  // the documented order; a v6 database loses idx_event_log_seq
+  const std::string path = freshDbPath("scenario_q");
+  {
+    EventStore store;
+    if (auto err = store.open(path); !err.empty())
+      return fail("Scenario Q: open: " + err);
+    // ts out of seq order, with ties, so (ts, seq) order is its own thing.
+    std::vector<DeltaEvent> batch(3000);
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      batch[i].entity_type = i % 2 ? "note" : "task";
+      batch[i].entity_id = "t" + std::to_string(i % 50);
+      batch[i].op = "upsert";
+      batch[i].payload = R"({"i":)" + std::to_string(i) + "}";
+      batch[i].ts = (long long)(i * 7919 % 1000);
+    }
+    SeqRange range;
+    if (store.appendBatch(batch, range) < 1)
+      return fail("Scenario Q: append");
+    std::string err;
+    const std::vector<DeltaEvent> all = store.since(0, err);
+
+    ReadBudget budget;
+    budget.max_rows = 7;
+    std::vector<long long> got, want;
+    for (const DeltaEvent &e : all)
+      if (e.entity_type == "task" && e.entity_id == "t8")
+        want.push_back(e.seq);
+    ReadCursor cursor;
+    int pages = 0;
+    do {
+      if (!store.entityHistory(
+              "task", "t8", cursor.next_seq, budget,
+              [&](const DeltaEvent &e) {
+                got.push_back(e.seq);
+                return true;
+              },
+              cursor, err))
+        return fail("Scenario Q: entityHistory: " + err);
+      ++pages;
+    } while (!cursor.done);
+    if (got != want || pages != (int)(want.size() + 6) / 7)
+      return fail("Scenario Q: entityHistory returned " +
+                  std::to_string(got.size()) + " of " +
+                  std::to_string(want.size()) + " events");
+    if (!store.entityHistory("chore", "t8", 0, ReadBudget{},
+                             [](const DeltaEvent &) { return true; }, cursor,
+                             err) ||
+        cursor.rows != 0 || !cursor.done)
+      return fail("Scenario Q: an unknown type must have no history");
+
+    // [100, 200): the cursor doubles as the resume point.
+    got.clear();
+    want.clear();
+    std::vector<const DeltaEvent *> in_range;
+    for (const DeltaEvent &e : all)
+      if (e.ts >= 100 && e.ts < 200)
+        in_range.push_back(&e);
+    std::stable_sort(in_range.begin(), in_range.end(),
+                     [](const DeltaEvent *a, const DeltaEvent *b) {
+                       return a->ts < b->ts;
+                     });
+    for (const DeltaEvent *e : in_range)
+      want.push_back(e->seq);
+    cursor = ReadCursor{};
+    budget.max_rows = 4; // splits runs of equal ts
+    do {
+      if (!store.range(100, 200, cursor, budget,
+                       [&](const DeltaEvent &e) {
+                         got.push_back(e.seq);
+                         return true;
+                       },
+                       cursor, err))
+        return fail("Scenario Q: range: " + err);
+    } while (!cursor.done);
+    if (got != want)
+      return fail("Scenario Q: range returned " + std::to_string(got.size()) +
+                  " of " + std::to_string(want.size()) + " events");
+    if (!store.range(200, 200, ReadCursor{}, budget,
+                     [](const DeltaEvent &) { return true; }, cursor, err) ||
+        cursor.rows != 0 || !cursor.done)
+      return fail("Scenario Q: an empty range must be done");
+  }
+
+  // A v6 database: idx_event_log_seq is dropped, idx_event_log_ts added.
+  auto indexes = [&path] {
+    std::string out;
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_stmt *st = nullptr;
+    sqlite3_prepare_v2(db,
+                       "SELECT name FROM sqlite_master WHERE type = 'index' "
+                       "AND tbl_name = 'event_log' ORDER BY name",
+                       -1, &st, nullptr);
+    while (sqlite3_step(st) == SQLITE_ROW)
+      out += std::string((const char *)sqlite3_column_text(st, 0)) + " ";
+    sqlite3_finalize(st);
+    sqlite3_close(db);
+    return out;
+  };
+  {
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_exec(db,
+                 "DROP INDEX idx_event_log_ts;"
+                 "CREATE INDEX idx_event_log_seq ON event_log(seq);"
+                 "PRAGMA user_version = 6;",
+                 nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+  }
+  {
+    EventStore store;
+    if (auto err = store.open(path); !err.empty())
+      return fail("Scenario Q: open v6: " + err);
+  }
+  if (indexes() !=
+      "idx_event_log_entity idx_event_log_ts idx_event_log_vis ")
+    return fail("Scenario Q: v6 indexes not migrated: " + indexes());
+  return 0;
+}
+
+// One integer PRAGMA of the file at `path`, read outside the store.
+static long long pragmaOf(const std::string &path, const char *pragma) {
+  long long out = -1;
+  sqlite3 *db = nullptr;
+  sqlite3_open(path.c_str(), &db);
+  sqlite3_stmt *st = nullptr;
+  if (sqlite3_prepare_v2(db, (std::string("PRAGMA ") + pragma).c_str(), -1,
+                         &st, nullptr) == SQLITE_OK &&
+      sqlite3_step(st) == SQLITE_ROW)
+    out = sqlite3_column_int64(st, 0);
+  sqlite3_finalize(st);
+  sqlite3_close(db);
+  return out;
+}
+
+static int scenarioR(EventStore &) {
+  // --- Scenario R: tuning profiles; reopening a current database runs no
+  // DDL, an older one still migrates
+  const std::string path = freshDbPath("scenario_r");
+  {
+    EventStore store;
+    if (auto err = store.open(path, OpenOptions::server()); !err.empty())
+      return fail("Scenario R: open (server): " + err);
+    if (auto err = store.setReaderPool(2); !err.empty())
+      return fail("Scenario R: reader pool: " + err);
+    if (store.upsertTask("t1", "Tune", "", 0, 2, "open", "family", 10,
+                         R"({"title":"Tune","points":2})") < 1)
+      return fail("Scenario R: upsert");
+    TaskRow row;
+    std::string err;
+    if (!store.getTaskId("t1", row, err) || row.title != "Tune")
+      return fail("Scenario R: read through the pool: " + err);
+  }
+  if (pragmaOf(path, "page_size") != 8192)
+    return fail("Scenario R: a new file must take the profile's page size");
+  if (pragmaOf(path, "user_version") < 1)
+    return fail("Scenario R: schema version not written");
+
+  // An index dropped behind the store's back stays dropped: the fast path
+  // does not rerun the schema script.
+  const long long version = pragmaOf(path, "user_version");
+  {
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_exec(db, "DROP INDEX idx_event_log_vis;", nullptr, nullptr,
+                 nullptr);
+    sqlite3_close(db);
+  }
+  for (const OpenOptions &profile :
+       {OpenOptions(), OpenOptions::phone(), OpenOptions::desktop()}) {
+    EventStore store;
+    if (auto err = store.open(path, profile); !err.empty())
+      return fail("Scenario R: reopen: " + err);
+    TaskRow row;
+    std::string err;
+    if (!store.getTaskId("t1", row, err) || store.since(0, err).size() != 1)
+      return fail("Scenario R: reopened store lost its data: " + err);
+  }
+  if (pragmaOf(path, "page_size") != 8192)
+    return fail("Scenario R: a reopen must keep the file's page size");
+  auto hasVisIndex = [&path] {
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_stmt *st = nullptr;
+    sqlite3_prepare_v2(db,
+                       "SELECT 1 FROM sqlite_master WHERE type = 'index' AND "
+                       "name = 'idx_event_log_vis'",
+                       -1, &st, nullptr);
+    const bool found = sqlite3_step(st) == SQLITE_ROW;
+    sqlite3_finalize(st);
+    sqlite3_close(db);
+    return found;
+  };
+  if (hasVisIndex())
+    return fail("Scenario R: reopening a current database ran the DDL");
+
+  // One version back: the schema script runs again and restores it.
+  {
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    const std::string sql =
+        "PRAGMA user_version = " + std::to_string(version - 1) + ";";
+    sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+  }
+  {
+    EventStore store;
+    if (auto err = store.open(path, OpenOptions::phone()); !err.empty())
+      return fail("Scenario R: open older version: " + err);
+  }
+  if (!hasVisIndex() || pragmaOf(path, "user_version") != version)
+    return fail("Scenario R: an older database must be migrated");
+
+  // A newer build's database is refused and left as it was.
+  {
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    const std::string sql =
+        "PRAGMA user_version = " + std::to_string(version + 1) + ";";
+    sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+  }
+  {
+    EventStore store;
+    const std::string err = store.open(path);
+    if (err != "database schema v" + std::to_string(version + 1) +
+                   " is newer than supported v" + std::to_string(version))
+      return fail("Scenario R: a newer schema must be refused: " + err);
+    if (store.upsertTask("t2", "No", "", 0, 1, "open", "family", 1, "{}") >= 0)
+      return fail("Scenario R: a refused store must not write");
+  }
+  if (pragmaOf(path, "user_version") != version + 1)
+    return fail("Scenario R: a refused database must not be touched");
+  return 0;
+}
@@ -0,0 +1,295 @@
+#include "core/HouseholdRouter.h"
+#include "TestUtil.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using together::DeltaEvent;
+using together::EventStore;
+using together::HouseholdRouter;
+using together::RouterOptions;
+
+// An empty shard directory.
+static std::string freshDir(const std::string &name) {
+  const std::string dir = scratchDir() + "/" + name;
+  std::filesystem::remove_all(dir);
+  return dir;
+}
+
+static DeltaEvent note(const std::string &id) {
+  DeltaEvent ev;
+  ev.entity_type = "note";
+  ev.entity_id = id;
+  ev.op = "upsert";
+  ev.payload = "{}";
+  ev.ts = 1;
+  return ev;
+}
+
+static std::size_t eventCount(EventStore &store) {
+  std::string err;
+  return store.since(0, err).size();
+}
+
+static RouterOptions options(const std::string &dir, std::size_t max_open,
+                             std::size_t threads) {
+  RouterOptions o;
+  o.directory = dir;
+  o.max_open = max_open;
+  o.idle_timeout = std::chrono::milliseconds(0);
+  o.fan_out_threads = threads;
+  return o;
+}
+
+// Each household is its own file; at the bound the least recently used
+// unleased shard closes, and reopening it finds its data.
+static int checkRouting() {
+  int rc = 0;
+  const std::string dir = freshDir("router");
+  HouseholdRouter router(options(dir, 2, 0));
+  std::string err;
+  for (const char *h : {"h1", "h2", "h1", "h3"}) {
+    auto lease = router.acquire(h, err);
+    if (!lease || lease.household() != h || lease->append(note(h)) < 1)
+      return fail(std::string("acquire ") + h + ": " + err);
+  }
+  // h1, h2, h3 opened; h2 was least recently used when h3 needed a slot.
+  if (router.opens() != 3 || router.openShards() != 2)
+    rc |= fail("h3 must evict h2: " + std::to_string(router.opens()) +
+               " opens");
+  {
+    auto lease = router.acquire("h2", err); // evicts h1
+    if (!lease || eventCount(*lease) != 1 || router.opens() != 4)
+      rc |= fail("h2 reopened with its one event");
+  }
+  {
+    auto lease = router.acquire("h3", err);
+    if (!lease || eventCount(*lease) != 1 || router.opens() != 4)
+      rc |= fail("h3 stays open");
+  }
+  {
+    auto lease = router.acquire("h1", err);
+    if (!lease || eventCount(*lease) != 2 || router.opens() != 5)
+      rc |= fail("h1 reopened with only its own events");
+  }
+  if (router.households(err) != std::vector<std::string>{"h1", "h2", "h3"})
+    rc |= fail("households: " + err);
+  for (const char *bad : {"", "../h1", "h 1"})
+    if (router.acquire(bad, err) || err.empty())
+      rc |= fail(std::string("household id must be rejected: ") + bad);
+  if (router.closeIdle() != 2 || router.openShards() != 0)
+    rc |= fail("closeIdle with no timeout closes every unleased shard");
+
+  // A configure failure fails the open and keeps no shard.
+  RouterOptions o = options(dir, 2, 0);
+  o.configure = [](EventStore &) { return std::string("rejected"); };
+  HouseholdRouter rejecting(o);
+  if (rejecting.acquire("h1", err) || err != "rejected" ||
+      rejecting.openShards() != 0)
+    rc |= fail("configure error must fail the open: " + err);
+  return rc;
+}
+
+// At the bound with every shard leased, a new household waits for a
+// release; a thread that holds a lease opens past the bound instead.
+static int checkBound() {
+  int rc = 0;
+  HouseholdRouter router(options(freshDir("router_bound"), 1, 0));
+  std::string err;
+  auto held = router.acquire("a", err);
+
+  // This thread holds `held`: no wait, and the extra shard closes on
+  // release.
+  {
+    auto nested = router.acquire("b", err);
+    if (!nested || router.openShards() != 2 || router.waits() != 0)
+      rc |= fail("nested acquire must open past the bound");
+  }
+  if (router.openShards() != 1)
+    rc |= fail("the shard past the bound must close on release");
+
+  std::atomic<bool> got{false};
+  std::thread other([&] {
+    std::string e;
+    auto lease = router.acquire("c", e);
+    got = (bool)lease;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  if (got)
+    rc |= fail("acquire must wait while every shard is leased");
+  held = HouseholdRouter::Lease();
+  other.join();
+  if (!got || router.waits() != 1 || router.openShards() != 1)
+    rc |= fail("the waiter must take the released slot");
+
+  // A lease released on another thread no longer lets this one skip the
+  // bound: with "c" held elsewhere, acquiring "d" here waits.
+  held = router.acquire("a", err);
+  std::thread([moved = std::move(held)]() mutable {
+    moved = HouseholdRouter::Lease();
+  }).join();
+  std::atomic<bool> release_c{false};
+  std::atomic<bool> holding_c{false};
+  std::thread holder([&] {
+    std::string e;
+    auto lease = router.acquire("c", e);
+    holding_c = true;
+    while (!release_c)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  });
+  while (!holding_c)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  const unsigned long long waits = router.waits();
+  std::thread releaser([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    release_c = true;
+  });
+  {
+    auto lease = router.acquire("d", err);
+    if (!lease || router.waits() != waits + 1)
+      rc |= fail("a thread without leases must wait at the bound");
+  }
+  holder.join();
+  releaser.join();
+  return rc;
+}
+
+// Households evicted and reopened by several threads at once, one slot
+// between them: a reopen never overlaps the evicted shard's close, so no
+// write sees the file locked.
+static int checkChurn() {
+  HouseholdRouter router(options(freshDir("router_churn"), 1, 0));
+  std::atomic<int> failed{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 100; ++i) {
+        std::string err;
+        auto lease = router.acquire("h" + std::to_string((t + i) % 3), err);
+        if (!lease || lease->append(note("x")) < 1)
+          ++failed;
+      }
+    });
+  }
+  for (std::thread &t : threads)
+    t.join();
+  if (failed != 0)
+    return fail(std::to_string(failed.load()) + " churned writes failed");
+  return 0;
+}
+
+// The background sweep closes shards idle past the timeout.
+static int checkIdle() {
+  RouterOptions o = options(freshDir("router_idle"), 4, 0);
+  o.idle_timeout = std::chrono::milliseconds(20);
+  HouseholdRouter router(o);
+  std::string err;
+  router.acquire("a", err);
+  auto held = router.acquire("b", err);
+  for (int i = 0; i < 200 && router.openShards() != 1; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  if (router.openShards() != 1)
+    return fail("idle shard not closed by the sweep");
+  return 0;
+}
+
+// fanOut visits every household once, on several threads, with more
+// households than open slots; visitors may fan out again.
+static int checkFanOut() {
+  int rc = 0;
+  const std::string dir = freshDir("router_fan_out");
+  RouterOptions o = options(dir, 2, 3);
+  std::atomic<unsigned long long> configured{0};
+  o.configure = [&configured](EventStore &store) {
+    store.setTaskCacheBudget(1 << 16);
+    ++configured;
+    return std::string();
+  };
+  HouseholdRouter router(o);
+
+  std::vector<std::string> households;
+  for (int i = 0; i < 8; ++i)
+    households.push_back("h" + std::to_string(i));
+  std::mutex mu;
+  std::map<std::string, int> visits;
+  std::map<std::thread::id, int> threads;
+  std::string err = router.fanOut(households, [&](const std::string &h,
+                                                  EventStore &store) {
+    for (int i = 0; i < 50; ++i)
+      store.append(note(h));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    // Nested: every visitor also writes to one shared household.
+    router.fanOut({"shared"}, [](const std::string &, EventStore &shared) {
+      shared.append(note("from a visitor"));
+    });
+    std::lock_guard<std::mutex> lock(mu);
+    ++visits[h];
+    ++threads[std::this_thread::get_id()];
+  });
+  if (!err.empty())
+    rc |= fail("fanOut: " + err);
+  if (visits.size() != households.size() || threads.size() < 2)
+    rc |= fail("fanOut must visit each household on several threads");
+  for (const auto &v : visits)
+    if (v.second != 1)
+      rc |= fail(v.first + " visited " + std::to_string(v.second) + " times");
+
+  // A read-only fan-out: every shard holds its own events only.
+  std::map<std::string, std::size_t> counts;
+  households.push_back("shared");
+  router.fanOut(households, [&](const std::string &h, EventStore &store) {
+    const std::size_t n = eventCount(store);
+    std::lock_guard<std::mutex> lock(mu);
+    counts[h] = n;
+  });
+  for (const auto &c : counts)
+    if (c.second != (c.first == "shared" ? 8u : 50u))
+      rc |= fail(c.first + " holds " + std::to_string(c.second) + " events");
+
+  // Failed opens are reported, and the other households still run.
+  int ran = 0;
+  err = router.fanOut({"h0", "no/such", "h1"},
+                      [&](const std::string &, EventStore &) {
+                        std::lock_guard<std::mutex> lock(mu);
+                        ++ran;
+                      });
+  if (err.rfind("no/such: ", 0) != 0 || ran != 2)
+    rc |= fail("fanOut error: " + err);
+  // Several failures: the one earliest in the list is reported, whichever
+  // thread finishes first.
+  for (int i = 0; i < 20; ++i) {
+    err = router.fanOut({"h0", "bad/1", "h1", "bad/2", "bad/3"},
+                        [](const std::string &, EventStore &) {
+                          std::this_thread::sleep_for(
+                              std::chrono::milliseconds(1));
+                        });
+    if (err.rfind("bad/1: ", 0) != 0) {
+      rc |= fail("fanOut must report the first failure in order: " + err);
+      break;
+    }
+  }
+  if (configured != router.opens())
+    rc |= fail("configure must run on every open");
+  if (router.openShards() > 2)
+    rc |= fail("shards past the bound must close after the fan-out");
+  return rc;
+}
+
+int main() {
+  std::filesystem::create_directories("tmp");
+  int rc = checkRouting();
+  rc |= checkBound();
+  rc |= checkIdle();
+  rc |= checkFanOut();
+  rc |= checkChurn();
+  if (rc == 0)
+    std::cout << "OK: household router tests passed\n";
+  return rc;
+}
@@ -0,0 +1,225 @@
+#include "core/EventStore.h"
+#include "TestUtil.h"
+#include <sqlite3.h>
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using together::ChangeNotice;
+using together::DeltaEvent;
+using together::EventStore;
+using together::IngestReport;
+using together::RemoteEvent;
+using together::ReplayOptions;
+using together::ReplayReport;
+using together::TaskRow;
+
+// task.origin of `id`, read outside the store; "?" if there is no row.
+static std::string originOf(const std::string &path, const std::string &id) {
+  sqlite3 *db = nullptr;
+  std::string out = "?";
+  if (sqlite3_open(path.c_str(), &db) == SQLITE_OK) {
+    sqlite3_stmt *st = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT origin FROM task WHERE id = ?1", -1,
+                           &st, nullptr) == SQLITE_OK) {
+      sqlite3_bind_text(st, 1, id.c_str(), -1, SQLITE_TRANSIENT);
+      if (sqlite3_step(st) == SQLITE_ROW)
+        out = (const char *)sqlite3_column_text(st, 0);
+    }
+    sqlite3_finalize(st);
+  }
+  sqlite3_close(db);
+  return out;
+}
+
+static RemoteEvent remote(const std::string &origin, long long n,
+                          const std::string &type, const std::string &id,
+                          const std::string &op, long long ts,
+                          const std::string &payload) {
+  RemoteEvent r;
+  r.origin = origin;
+  r.remote_id = origin + ":" + std::to_string(n);
+  r.event.entity_type = type;
+  r.event.entity_id = id;
+  r.event.op = op;
+  r.event.payload = payload;
+  r.event.ts = ts;
+  return r;
+}
+
+static std::string describe(const IngestReport &r) {
+  return std::to_string(r.received) + "/" + std::to_string(r.duplicates) +
+         "/" + std::to_string(r.superseded) + "/" + std::to_string(r.applied);
+}
+
+static int verify(EventStore &store, const std::string &label) {
+  ReplayOptions options;
+  options.verify_only = true;
+  ReplayReport report;
+  std::string err;
+  if (!store.replay(options, report, err))
+    return fail(label + ": replay verify: " + err);
+  if (report.mismatches != 0)
+    return fail(label + ": " + std::to_string(report.mismatches) +
+                " mismatches, first " + report.diff_ids[0]);
+  return 0;
+}
+
+// LWW against local and remote writes, folding, deletes, dedup within and
+// across batches, and the task cache and change feed after a commit.
+static int checkMerge() {
+  int rc = 0;
+  const std::string path = freshDbPath("ingest");
+  EventStore store;
+  if (auto err = store.open(path); !err.empty())
+    return fail("open: " + err);
+  store.setTaskCacheBudget(1 << 20);
+  std::vector<ChangeNotice> notices;
+  store.subscribe({}, [&](const ChangeNotice &n) { notices.push_back(n); });
+
+  if (store.upsertTask("t1", "Local", "", 0, 1, "open", "family", 100,
+                       R"({"title":"Local","points":1})") < 1)
+    return fail("local upsert");
+  TaskRow row;
+  std::string err;
+  store.getTaskId("t1", row, err); // cached
+
+  const std::vector<RemoteEvent> batch{
+      // Older than the local write, then tied on ts and won on origin.
+      remote("a", 1, "task", "t1", "upsert", 90, R"({"title":"Old"})"),
+      remote("b", 1, "task", "t1", "upsert", 100, R"({"title":"B"})"),
+      // Partial: keeps B's title.
+      remote("a", 2, "task", "t1", "upsert", 150, R"({"points":3})"),
+      // Out of order in the batch: created, then deleted.
+      remote("b", 2, "task", "t2", "delete", 20, "{}"),
+      remote("a", 3, "task", "t2", "upsert", 10,
+             R"({"title":"New","visibility_tag":"adults"})"),
+      // A task that never existed: logged, no row.
+      remote("a", 4, "task", "t3", "delete", 5, "{}"),
+      remote("a", 5, "note", "n1", "upsert", 1, R"({"n":1})"),
+      remote("a", 5, "note", "n1", "upsert", 1, R"({"n":1})"),
+  };
+  IngestReport report;
+  const long long last = store.ingestRemote(batch, report);
+  if (describe(report) != "8/1/1/6" || last != report.range.last ||
+      report.range.first != 2 || report.range.last != 7)
+    rc |= fail("first batch: " + describe(report) + " seqs " +
+               std::to_string(report.range.first) + "-" +
+               std::to_string(report.range.last));
+  if (notices.size() != 2 || notices[1].first_seq != 2 ||
+      notices[1].events != 6)
+    rc |= fail("one notice per ingest, got " + std::to_string(notices.size()));
+
+  if (!store.getTaskId("t1", row, err) || row.title != "B" ||
+      row.points != 3 || row.updated_at != 150 || row.status != "open")
+    rc |= fail("t1 after merge: " + row.title + " " +
+               std::to_string(row.points) + " " +
+               std::to_string(row.updated_at));
+  if (!store.getTaskId("t2", row, err) || row.title != "New" ||
+      row.status != "deleted" || row.visibility_tag != "adults" ||
+      row.updated_at != 20)
+    rc |= fail("t2 must be created and deleted: " + row.status);
+  if (store.getTaskId("t3", row, err))
+    rc |= fail("a delete must not create t3");
+  if (originOf(path, "t1") != "a" || originOf(path, "t2") != "b")
+    rc |= fail("origin of the last writer");
+
+  // The log holds the events in the order they were applied: per entity,
+  // by (ts, origin).
+  std::vector<std::string> order;
+  for (const DeltaEvent &e : store.since(1, err))
+    order.push_back(e.entity_id + "@" + std::to_string(e.ts));
+  if (order != std::vector<std::string>{"n1@1", "t1@100", "t1@150", "t2@10",
+                                        "t2@20", "t3@5"})
+    rc |= fail("applied order");
+
+  // Redelivery is a no-op, including for the superseded event.
+  if (store.ingestRemote(batch, report) != 0 ||
+      describe(report) != "8/8/0/0" || notices.size() != 2)
+    rc |= fail("redelivery: " + describe(report));
+
+  // Ties on ts go to the greater origin; a local write takes the row back.
+  store.ingestRemote({remote("0", 1, "task", "t1", "upsert", 150,
+                             R"({"title":"Lost"})"),
+                      remote("z", 1, "task", "t1", "upsert", 150,
+                             R"({"title":"Z"})")},
+                     report);
+  if (describe(report) != "2/0/1/1" || !store.getTaskId("t1", row, err) ||
+      row.title != "Z" || originOf(path, "t1") != "z")
+    rc |= fail("tie on ts: " + describe(report) + " " + row.title);
+  store.upsertTask("t1", "Mine", "", 0, 3, "open", "family", 200,
+                   R"({"title":"Mine","points":3})");
+  if (originOf(path, "t1") != "")
+    rc |= fail("a local write must clear origin");
+  store.ingestRemote({remote("z", 2, "task", "t1", "upsert", 199,
+                             R"({"title":"Late"})")},
+                     report);
+  if (report.superseded != 1 || !store.getTaskId("t1", row, err) ||
+      row.title != "Mine")
+    rc |= fail("a remote event older than a local write must lose");
+
+  // A malformed event fails the batch before anything is written.
+  const long long before = store.since(0, err).back().seq;
+  if (store.ingestRemote({remote("a", 9, "note", "n9", "upsert", 9, "{}"),
+                          remote("a", 0, "note", "", "upsert", 9, "{}")},
+                         report) != -4 ||
+      store.since(0, err).back().seq != before)
+    rc |= fail("an event without entity_id must fail the batch");
+
+  rc |= verify(store, "merged");
+
+  // Rebuilding the task table keeps each row's origin.
+  store.ingestRemote({remote("q", 1, "task", "t1", "upsert", 500, "{}")},
+                     report);
+  ReplayReport replayed;
+  if (!store.replay(ReplayOptions{}, replayed, err))
+    return fail("replay: " + err);
+  if (originOf(path, "t1") != "q" || originOf(path, "t2") != "b")
+    rc |= fail("replay must restore origin, got " + originOf(path, "t1"));
+  rc |= verify(store, "rebuilt");
+  return rc;
+}
+
+// A v5 database gains task.origin (local: "") and remote_event on open.
+static int checkMigration() {
+  int rc = 0;
+  const std::string path = freshDbPath("ingest_migrate");
+  {
+    EventStore store;
+    if (auto err = store.open(path); !err.empty())
+      return fail("open: " + err);
+    store.upsertTask("t1", "Old", "", 0, 1, "open", "family", 100,
+                     R"({"title":"Old","points":1})");
+  }
+  std::string err;
+  if (!execRaw(path,
+               "DROP TABLE remote_event;"
+               "ALTER TABLE task DROP COLUMN origin;"
+               "PRAGMA user_version = 5;",
+               err))
+    return fail("downgrading to v5: " + err);
+
+  EventStore store;
+  if (auto open_err = store.open(path); !open_err.empty())
+    return fail("open (migrate): " + open_err);
+  if (originOf(path, "t1") != "")
+    rc |= fail("migrated rows must be local");
+  IngestReport report;
+  if (store.ingestRemote({remote("a", 1, "task", "t1", "upsert", 101,
+                                 R"({"title":"New"})")},
+                         report) < 1 ||
+      originOf(path, "t1") != "a")
+    rc |= fail("ingest after migrating");
+  rc |= verify(store, "migrated");
+  return rc;
+}
+
+int main() {
+  int rc = checkMerge();
+  rc |= checkMigration();
+  if (rc == 0)
+    std::cout << "OK: ingest tests passed\n";
+  return rc;
+}
@@ -0,0 +1,124 @@
+#include "core/EventStore.h"
+#include "core/Metrics.h"
+#include "TestUtil.h"
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using together::EventStore;
+using together::LatencyHistogram;
+using together::OpLatencyStats;
+using together::SeqRange;
+using together::StoreStats;
+using together::TaskRow;
+
+static const OpLatencyStats *findOp(const StoreStats &s, const std::string &op) {
+  for (const OpLatencyStats &o : s.ops)
+    if (op == o.op)
+      return &o;
+  return nullptr;
+}
+
+int main() {
+  int rc = 0;
+
+  // Buckets are contiguous and monotonic, exact below 16 ns.
+  for (std::uint64_t v : {0ull, 1ull, 15ull})
+    if (LatencyHistogram::bucketOf(v) != v)
+      rc |= fail("small values must be exact");
+  std::size_t prev = 0;
+  for (std::uint64_t v = 16; v < (1ull << 40); v = v * 5 / 4 + 1) {
+    std::size_t b = LatencyHistogram::bucketOf(v);
+    if (b < prev || LatencyHistogram::bucketLow(b) > v ||
+        (b + 1 < LatencyHistogram::kBuckets &&
+         LatencyHistogram::bucketLow(b + 1) <= v))
+      rc |= fail("bucket bounds at " + std::to_string(v));
+    prev = b;
+  }
+  if (LatencyHistogram::bucketOf(~0ull) != LatencyHistogram::kBuckets - 1)
+    rc |= fail("largest value must land in the last bucket");
+
+  // Percentiles of 1..10000 us are within the bucket resolution.
+  {
+    LatencyHistogram h;
+    for (std::uint64_t us = 1; us <= 10000; ++us)
+      h.record(us * 1000);
+    if (h.count() != 10000 || h.maxNanos() != 10000000)
+      rc |= fail("count / max");
+    for (double q : {0.5, 0.99, 0.999}) {
+      double expect = q * 10000 * 1000;
+      double got = (double)h.percentileNanos(q);
+      if (std::fabs(got - expect) > expect * 0.125)
+        rc |= fail("percentile " + std::to_string(q) + " off: " +
+                   std::to_string(got));
+    }
+    h.reset();
+    if (h.count() != 0 || h.percentileNanos(0.5) != 0)
+      rc |= fail("reset");
+  }
+
+  // Concurrent records are all counted.
+  {
+    LatencyHistogram h;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+      threads.emplace_back([&h, t] {
+        for (int i = 0; i < 50000; ++i)
+          h.record((std::uint64_t)(i * (t + 1)));
+      });
+    for (auto &t : threads)
+      t.join();
+    if (h.count() != 200000 || h.maxNanos() != 49999ull * 4)
+      rc |= fail("concurrent records lost");
+  }
+
+  // EventStore counters, when the library is built with metrics.
+  {
+    EventStore store;
+    store.open(":memory:");
+    StoreStats s = store.stats();
+    if (!s.enabled) {
+      std::cout << "OK: metrics tests passed (store metrics compiled out)\n";
+      return rc;
+    }
+
+    for (int i = 0; i < 10; ++i)
+      store.upsertTask("t" + std::to_string(i), "Title", "", 0, 1, "open",
+                       "family", i, R"({"title":"Title"})");
+    store.deleteTask("t0", 100, "{}");
+    if (store.upsertTask("", "x", "", 0, 0, "open", "family", 1, "{}") >= 0)
+      rc |= fail("empty id should fail");
+    std::string err;
+    store.since(0, err);
+    store.listTasks("", 4, 0, err);
+    TaskRow row;
+    store.getTaskId("t1", row, err);
+
+    s = store.stats();
+    const OpLatencyStats *up = findOp(s, "upsertTask");
+    const OpLatencyStats *commit = findOp(s, "commit");
+    if (!up || up->count != 11 || !commit || commit->count != 11 ||
+        findOp(s, "deleteTask")->count != 1 ||
+        findOp(s, "getTask")->count != 1)
+      rc |= fail("operation counts");
+    if (up->p50_us <= 0 || up->p999_us < up->p50_us || up->max_us < up->p99_us)
+      rc |= fail("latency percentiles not ordered");
+    if (s.events_scanned != 11 || s.task_rows_scanned != 4)
+      rc |= fail("rows scanned");
+    if (s.payload_bytes_written != 10 * 17 + 2 || s.rollbacks != 1)
+      rc |= fail("bytes written / rollbacks");
+
+    store.resetStats();
+    s = store.stats();
+    if (findOp(s, "upsertTask")->count != 0 || s.payload_bytes_written != 0)
+      rc |= fail("resetStats");
+  }
+
+  if (rc == 0)
+    std::cout << "OK: metrics tests passed\n";
+  return rc;
+}
@@ -0,0 +1,84 @@
+#include "core/PayloadCodec.h"
+#include "TestUtil.h"
+
+#include <iostream>
+#include <string>
+
+using together::PayloadField;
+using together::PayloadFields;
+namespace payload = together::payload;
+
+// JSON -> binary -> JSON must give back the compact form of the input.
+static int roundTrip(const std::string &entity_type, const std::string &json,
+                     const std::string &expect) {
+  std::string bin;
+  if (!payload::jsonToBinary(entity_type, json, bin))
+    return fail("jsonToBinary rejected " + json);
+  if (!payload::isBinary(bin))
+    return fail("missing format marker for " + json);
+  std::string back = payload::toJson(bin);
+  if (back != expect)
+    return fail("round trip: got " + back + " want " + expect);
+  return 0;
+}
+
+int main() {
+  int rc = 0;
+
+  // Payloads used by the EventStore scenarios.
+  rc |= roundTrip("task", R"({"title":"Do dishes","points":3})",
+                  R"({"title":"Do dishes","points":3})");
+  rc |= roundTrip("task",
+                  R"({"title":"Sweep floor","assignees":"kid1","points":2})",
+                  R"({"title":"Sweep floor","assignees":"kid1","points":2})");
+  rc |= roundTrip("task", R"({"reason":"user_deleted"})",
+                  R"({"reason":"user_deleted"})");
+  rc |= roundTrip("task", "{}", "{}");
+
+  // Whitespace, escapes, unknown names, every value kind.
+  rc |= roundTrip(
+      "budget_tx",
+      " { \"amount_cents\" : -1250, \"note\":\"caf\\u00e9 \\\"x\\\"\\n\","
+      " \"ratio\": 0.25, \"is_sensitive\": true, \"memo\": null } ",
+      R"({"amount_cents":-1250,"note":"café \"x\"\n","ratio":0.25,)"
+      R"("is_sensitive":true,"memo":null})");
+  rc |= roundTrip("event", R"({"big":9223372036854775807,"small":-1})",
+                  R"({"big":9223372036854775807,"small":-1})");
+  rc |= roundTrip("other", R"({"x":1e300,"emoji":"\ud83d\ude00"})",
+                  R"({"x":1e+300,"emoji":"😀"})");
+
+  // Dictionary tags make known fields smaller than their JSON.
+  std::string json = R"({"title":"Sweep floor","assignees":"kid1","points":2})";
+  std::string bin;
+  payload::jsonToBinary("task", json, bin);
+  if (bin.size() * 2 > json.size())
+    rc |= fail("binary task payload should be under half the JSON size");
+
+  // decode() accepts both formats.
+  PayloadFields a, b;
+  if (!payload::decode(json, a) || !payload::decode(bin, b) ||
+      a.size() != 3 || b.size() != 3 || b[2].kind != PayloadField::Kind::Int ||
+      b[2].i != 2 || b[0].s != "Sweep floor")
+    rc |= fail("decode of JSON vs binary differs");
+
+  // Non-flat or malformed JSON is rejected, so callers keep it as JSON.
+  for (const char *bad : {R"({"a":{"b":1}})", R"({"a":[1]})", R"([1,2])",
+                          R"({"a":1,})", R"({"a":1} x)", "", "not json"}) {
+    PayloadFields f;
+    if (payload::parseJson(bad, f))
+      rc |= fail(std::string("should reject ") + bad);
+  }
+  if (payload::toJson(std::string_view("{\"a\":1}")) != "{\"a\":1}")
+    rc |= fail("JSON input must pass through toJson unchanged");
+
+  // Truncated binary fails to decode instead of reading out of bounds.
+  PayloadFields f;
+  for (std::size_t n = 3; n < bin.size(); ++n)
+    if (payload::decodeBinary(std::string_view(bin.data(), n), f) &&
+        f.size() == 3)
+      rc |= fail("truncated binary decoded as complete");
+
+  if (rc == 0)
+    std::cout << "OK: payload codec\n";
+  return rc;
+}
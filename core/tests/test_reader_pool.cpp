@@ -0,0 +1,273 @@
+#include "core/EventStore.h"
+#include "TestUtil.h"
+#include <sqlite3.h>
+
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using together::DeltaEvent;
+using together::EventStore;
+using together::ReadBudget;
+using together::ReadCursor;
+using together::SeqRange;
+using together::TaskRow;
+using together::TaskRowView;
+using together::TaskUpsert;
+
+// Every batch rewrites all kTasks rows to one version, so a reader that
+// ever sees two versions in one listing saw a torn transaction.
+static constexpr int kTasks = 50;
+
+static std::vector<TaskUpsert> versionBatch(int version) {
+  std::vector<TaskUpsert> batch(kTasks);
+  for (int t = 0; t < kTasks; ++t) {
+    TaskRow &r = batch[t].row;
+    r.id = "t" + std::to_string(t);
+    r.title = "v" + std::to_string(version);
+    r.points = version;
+    r.status = "open";
+    r.visibility_tag = "family";
+    r.updated_at = version;
+    batch[t].payload_json = R"({"v":)" + std::to_string(version) + "}";
+  }
+  return batch;
+}
+
+// Visitors that re-enter the read calling them: the nested read must not
+// reset the outer one's cursor, which still sees every row.
+static int checkReentry(EventStore &store, const std::string &label) {
+  std::string err;
+  int outer = 0, inner = 0;
+  store.forEachTask(
+      "", kTasks, 0,
+      [&](const TaskRowView &) {
+        ++outer;
+        std::string e;
+        store.forEachTask(
+            "", 3, 0,
+            [&](const TaskRowView &) {
+              ++inner;
+              return true;
+            },
+            e);
+        return true;
+      },
+      err);
+  if (outer != kTasks || inner != 3 * kTasks)
+    return fail(label + ": forEachTask re-entered: " + std::to_string(outer) +
+                " outer rows");
+
+  ReadCursor cursor;
+  long long prev = 0;
+  outer = inner = 0;
+  bool ordered = true;
+  store.scanSince(
+      0, ReadBudget{},
+      [&](const DeltaEvent &e) {
+        ordered &= e.seq > prev;
+        prev = e.seq;
+        ++outer;
+        ReadBudget three;
+        three.max_rows = 3;
+        ReadCursor c;
+        std::string e2;
+        store.scanSince(
+            0, three,
+            [&](const DeltaEvent &) {
+              ++inner;
+              return true;
+            },
+            c, e2);
+        return true;
+      },
+      cursor, err);
+  if (outer != kTasks || inner != 3 * kTasks || !ordered)
+    return fail(label + ": scanSince re-entered: " + std::to_string(outer) +
+                " outer rows");
+  return 0;
+}
+
+int main() {
+  int rc = 0;
+
+  {
+    EventStore mem;
+    mem.open(":memory:");
+    if (mem.setReaderPool(2).empty())
+      rc |= fail("reader pool on :memory: should be rejected");
+  }
+
+  const std::string path = freshDbPath("reader_pool");
+  EventStore store;
+  if (auto err = store.open(path); !err.empty())
+    return fail("open: " + err);
+  SeqRange range;
+  store.upsertTasks(versionBatch(0), range);
+  rc |= checkReentry(store, "writer connection");
+
+  // A single reader still serves nested reads from the same thread.
+  if (auto err = store.setReaderPool(1); !err.empty())
+    return fail("setReaderPool(1): " + err);
+  {
+    std::string err, inner_err;
+    int nested = 0;
+    store.forEachTask(
+        "", 5, 0,
+        [&](const TaskRowView &v) {
+          TaskRow row;
+          nested += store.getTaskId(std::string(v.id), row, inner_err);
+          return true;
+        },
+        err);
+    if (nested != 5)
+      rc |= fail("nested read on a one-reader pool");
+  }
+  rc |= checkReentry(store, "one-reader pool");
+
+  // Every event read has its statements on the readers.
+  {
+    std::string err;
+    ReadCursor cursor;
+    int history = 0, in_range = 0;
+    if (!store.entityHistory(
+            "task", "t1", 0, ReadBudget{},
+            [&](const DeltaEvent &) {
+              ++history;
+              return true;
+            },
+            cursor, err) ||
+        history != 1)
+      rc |= fail("pooled entityHistory: " + err);
+    if (!store.range(
+            0, 1, ReadCursor{}, ReadBudget{},
+            [&](const DeltaEvent &) {
+              ++in_range;
+              return true;
+            },
+            cursor, err) ||
+        in_range != kTasks)
+      rc |= fail("pooled range: " + err);
+  }
+
+  // Readers are not blocked by an open write transaction from another
+  // connection, and do not see its uncommitted rows.
+  if (auto err = store.setReaderPool(4); !err.empty() ||
+                                         store.readerPoolSize() != 4)
+    return fail("setReaderPool(4): " + err);
+  {
+    sqlite3 *other = nullptr;
+    sqlite3_open(path.c_str(), &other);
+    sqlite3_exec(other,
+                 "BEGIN IMMEDIATE;"
+                 "INSERT INTO event_log(type_code, entity_id, op_code, "
+                 "payload_blob, ts) VALUES(1,'x',4,'{}',1);",
+                 nullptr, nullptr, nullptr);
+    std::atomic<int> ok{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+      threads.emplace_back([&] {
+        std::string err;
+        if (store.since(0, err).size() == kTasks && err.empty())
+          ++ok;
+      });
+    for (auto &t : threads)
+      t.join();
+    sqlite3_exec(other, "ROLLBACK", nullptr, nullptr, nullptr);
+    sqlite3_close(other);
+    if (ok != 4)
+      rc |= fail("reads during a foreign write transaction");
+  }
+
+  // Stress: one writer thread committing whole versions while readers
+  // list, get (through the task cache) and stream events.
+  store.setTaskCacheBudget(1 << 20);
+  constexpr int kVersions = 150;
+  std::atomic<bool> writing{true};
+  std::atomic<int> errors{0};
+  std::atomic<long long> reads{0};
+
+  std::thread writer([&] {
+    SeqRange r;
+    for (int v = 1; v <= kVersions; ++v)
+      if (store.upsertTasks(versionBatch(v), r) < 1)
+        ++errors;
+    writing = false;
+  });
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&, i] {
+      std::string err;
+      int last_version = 0;
+      long long last_events = 0;
+      do {
+        // Whole transactions only: one version across the listing.
+        auto rows = store.listTasks("", kTasks, 0, err);
+        if (rows.size() != kTasks) {
+          ++errors;
+          continue;
+        }
+        for (const TaskRow &r : rows)
+          if (r.points != rows.front().points)
+            ++errors;
+
+        // Monotonic reads, including through the cache.
+        TaskRow row;
+        if (!store.getTaskId("t" + std::to_string(i * 7 % kTasks), row, err) ||
+            row.points < last_version)
+          ++errors;
+        last_version = row.points;
+
+        // The log only grows, in whole batches, in seq order.
+        auto events = store.since(0, err);
+        long long prev = 0;
+        for (const DeltaEvent &e : events)
+          if (e.seq <= prev)
+            ++errors;
+          else
+            prev = e.seq;
+        if ((long long)events.size() < last_events ||
+            events.size() % kTasks != 0)
+          ++errors;
+        last_events = (long long)events.size();
+        ++reads;
+      } while (writing);
+    });
+  }
+
+  writer.join();
+  for (auto &t : readers)
+    t.join();
+  if (errors != 0)
+    rc |= fail("stress: " + std::to_string(errors.load()) +
+               " inconsistent reads");
+  if (reads == 0)
+    rc |= fail("stress: readers made no progress");
+
+  // After the writer is done every path agrees on the final version.
+  {
+    std::string err;
+    TaskRow row;
+    if (!store.getTaskId("t3", row, err) || row.points != kVersions)
+      rc |= fail("final cached row is stale");
+    if (store.since(0, err).size() != (size_t)kTasks * (kVersions + 1))
+      rc |= fail("final event count");
+  }
+
+  // Closing the pool routes reads back to the writer connection.
+  if (!store.setReaderPool(0).empty() || store.readerPoolSize() != 0)
+    rc |= fail("setReaderPool(0)");
+  {
+    std::string err;
+    if (store.listTasks("", 10, 0, err).size() != 10)
+      rc |= fail("reads after closing the pool");
+  }
+
+  if (rc == 0)
+    std::cout << "OK: reader pool tests passed\n";
+  return rc;
+}
@@ -0,0 +1,285 @@
+#include "core/EventStore.h"
+#include "core/Recurrence.h"
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using together::CompactionProgress;
+using together::DeltaEvent;
+using together::EventStore;
+using together::Frequency;
+using together::Occurrence;
+using together::PayloadFormat;
+using together::Recurrence;
+using together::RecurrenceOverride;
+using together::RecurrenceRule;
+
+constexpr long long kHour = 3600000;
+constexpr long long kDay = 24 * kHour;
+// 2024-01-01T00:00Z, a Monday. 2024 is a leap year.
+constexpr long long kJan1 = 1704067200000LL;
+
+static long long day(int n, long long hour = 9) {
+  return kJan1 + n * kDay + hour * kHour;
+}
+
+static std::vector<long long> starts(const Recurrence &r, long long from,
+                                     long long to) {
+  std::vector<long long> out;
+  Occurrence o;
+  for (auto it = r.occurrences(from, to); it.next(o);)
+    out.push_back(o.start);
+  return out;
+}
+
+static std::string days(const std::vector<long long> &ts) {
+  std::string out;
+  for (long long t : ts) {
+    long long d = (t - kJan1) / kDay;
+    out += (out.empty() ? "" : ",") + std::to_string(d);
+    if ((t - kJan1) % kDay != 9 * kHour)
+      out += "@" + std::to_string(((t - kJan1) % kDay) / kHour);
+  }
+  return out;
+}
+
+static bool compile(RecurrenceRule rule, Recurrence &out) {
+  std::string err;
+  if (!Recurrence::compile(std::move(rule), out, err)) {
+    std::cerr << "compile: " << err << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Windows anywhere in the series yield exactly the matching slice of the
+// full expansion, and isOccurrence agrees with it.
+static int checkWindows(const Recurrence &r, const std::string &label) {
+  const long long begin = r.rule().dtstart - 40 * kDay;
+  const long long end = r.rule().dtstart + 900 * kDay;
+  const std::vector<long long> all = starts(r, begin, end);
+  std::mt19937 rng(1);
+  for (int i = 0; i < 300; ++i) {
+    long long a = begin + (long long)(rng() % 940) * kDay +
+                  (long long)(rng() % 24) * kHour;
+    long long b = std::min(end, a + (long long)(rng() % 120) * kDay);
+    std::vector<long long> want;
+    for (long long t : all)
+      if (t >= a && t < b)
+        want.push_back(t);
+    if (starts(r, a, b) != want)
+      return fail(label + ": window " + std::to_string(i) + " got " +
+                  days(starts(r, a, b)) + " want " + days(want));
+  }
+  if (r.rule().overrides.empty())
+    for (long long t = begin; t < end; t += kHour) {
+      bool listed = false;
+      for (long long s : all)
+        listed = listed || s == t;
+      if (r.isOccurrence(t) != listed)
+        return fail(label + ": isOccurrence disagrees at " + days({t}));
+    }
+  return 0;
+}
+
+static int checkRules() {
+  int rc = 0;
+  Recurrence r;
+
+  // Every other day, five times.
+  RecurrenceRule daily;
+  daily.freq = Frequency::Daily;
+  daily.interval = 2;
+  daily.dtstart = day(3);
+  daily.count = 5;
+  if (!compile(daily, r) || days(starts(r, kJan1, day(400))) != "3,5,7,9,11")
+    rc |= fail("daily: " + days(starts(r, kJan1, day(400))));
+  rc |= checkWindows(r, "daily");
+
+  // Mon/Wed/Fri every second week from Wednesday 2024-01-03.
+  RecurrenceRule weekly;
+  weekly.freq = Frequency::Weekly;
+  weekly.interval = 2;
+  weekly.dtstart = day(2);
+  weekly.weekdays = 1 | 4 | 16;
+  weekly.count = 6;
+  if (!compile(weekly, r) ||
+      days(starts(r, kJan1, day(400))) != "2,4,14,16,18,28")
+    rc |= fail("weekly: " + days(starts(r, kJan1, day(400))));
+  rc |= checkWindows(r, "weekly");
+  weekly.count = 0;
+  weekly.until = day(28);
+  if (!compile(weekly, r) ||
+      days(starts(r, kJan1, day(400))) != "2,4,14,16,18,28")
+    rc |= fail("weekly until: " + days(starts(r, kJan1, day(400))));
+  rc |= checkWindows(r, "weekly until");
+
+  // The 31st, monthly: months without one are skipped.
+  RecurrenceRule monthly;
+  monthly.freq = Frequency::Monthly;
+  monthly.dtstart = day(30); // 2024-01-31
+  monthly.count = 4;
+  if (!compile(monthly, r) ||
+      days(starts(r, kJan1, day(400))) != "30,90,151,212")
+    rc |= fail("monthly 31st: " + days(starts(r, kJan1, day(400))));
+  rc |= checkWindows(r, "monthly 31st");
+  // Last day of every month.
+  monthly.month_day = -1;
+  if (!compile(monthly, r) ||
+      days(starts(r, kJan1, day(400))) != "30,59,90,120")
+    rc |= fail("monthly last: " + days(starts(r, kJan1, day(400))));
+  rc |= checkWindows(r, "monthly last");
+  // Unbounded, every third month on the 15th from dtstart's month.
+  monthly.month_day = 15;
+  monthly.interval = 3;
+  monthly.count = 0;
+  if (!compile(monthly, r) ||
+      days(starts(r, kJan1, day(366))) != "105,196,288")
+    rc |= fail("monthly interval: " + days(starts(r, kJan1, day(366))));
+  rc |= checkWindows(r, "monthly interval");
+
+  // Wall clock: Monday 20:00 at UTC-5 is Tuesday 01:00 UTC.
+  RecurrenceRule local;
+  local.freq = Frequency::Weekly;
+  local.dtstart = day(1, 1);
+  local.utc_offset_minutes = -300;
+  local.weekdays = 1; // Monday, local
+  if (!compile(local, r) || days(starts(r, kJan1, day(20))) != "1@1,8@1,15@1")
+    rc |= fail("utc offset: " + days(starts(r, kJan1, day(20))));
+  rc |= checkWindows(r, "utc offset");
+
+  RecurrenceRule bad = daily;
+  bad.interval = 0;
+  std::string err;
+  if (Recurrence::compile(bad, r, err))
+    rc |= fail("interval 0 must be rejected");
+  return rc;
+}
+
+static int checkOverrides() {
+  int rc = 0;
+  RecurrenceRule rule;
+  rule.freq = Frequency::Daily;
+  rule.dtstart = day(0);
+  rule.count = 10;
+  // Cancel day 2, move day 4 before day 3, move day 6 out of the series'
+  // span, move day 9 into the middle of the window.
+  rule.overrides = {{day(2), 0, true},
+                    {day(4), day(3, 8), false},
+                    {day(6), day(40), false},
+                    {day(9), day(5, 12), false}};
+  Recurrence r;
+  if (!compile(rule, r))
+    return fail("compile overrides");
+  if (days(starts(r, kJan1, day(100))) != "0,1,3@8,3,5,5@12,7,8,40")
+    rc |= fail("overrides: " + days(starts(r, kJan1, day(100))));
+  if (days(starts(r, day(5), day(6))) != "5,5@12")
+    rc |= fail("override window: " + days(starts(r, day(5), day(6))));
+  Occurrence o;
+  auto it = r.occurrences(day(3, 0), day(4, 0));
+  if (!it.next(o) || o.start != day(3, 8) || o.original != day(4))
+    rc |= fail("moved occurrence must report its original start");
+  rc |= checkWindows(r, "overrides");
+
+  // Text form round trip.
+  Recurrence back;
+  std::string err;
+  if (!Recurrence::parse(r.encode(), back, err) ||
+      back.encode() != r.encode() ||
+      starts(back, kJan1, day(100)) != starts(r, kJan1, day(100)))
+    rc |= fail("encode/parse round trip: " + r.encode() + " " + err);
+  if (Recurrence::parse("FREQ=YEARLY;DTSTART=0", back, err) ||
+      Recurrence::parse("FREQ=DAILY", back, err) ||
+      Recurrence::parse("FREQ=DAILY;DTSTART=0;EXDATE=5", back, err))
+    rc |= fail("bad rrules must be rejected");
+
+  if (r.setOverride({day(3, 10), 0, true}, err) ||
+      r.setOverride({day(10), 0, true}, err))
+    rc |= fail("overrides must name an occurrence within COUNT");
+  if (!r.setOverride({day(4), 0, true}, err) ||
+      days(starts(r, day(3), day(5))) != "3")
+    rc |= fail("replacing a move with a cancel");
+  return rc;
+}
+
+static int checkStore() {
+  int rc = 0;
+  const std::string path = freshDbPath("recurrence");
+  EventStore store;
+  if (auto err = store.open(path); !err.empty())
+    return fail("open: " + err);
+  store.setPayloadFormat(PayloadFormat::Binary);
+
+  RecurrenceRule rule;
+  rule.freq = Frequency::Weekly;
+  rule.dtstart = day(0, 18);
+  rule.weekdays = 1 | 8; // Mon, Thu
+  Recurrence series;
+  if (!compile(rule, series))
+    return fail("compile");
+  DeltaEvent ev;
+  ev.entity_type = "event";
+  ev.entity_id = "swim";
+  ev.op = "upsert";
+  ev.payload = R"({"title":"Swimming","rrule":")" + series.encode() + R"("})";
+  ev.ts = 1;
+  store.append(ev);
+
+  std::string err;
+  Recurrence loaded;
+  if (!store.getRecurrence("event", "swim", loaded, err) ||
+      loaded.encode() != series.encode())
+    rc |= fail("getRecurrence: " + err);
+
+  // Overrides append a new event carrying the whole series.
+  if (store.overrideOccurrence("event", "swim", {day(3, 18), 0, true}, 2) < 1 ||
+      store.overrideOccurrence("event", "swim",
+                               {day(7, 18), day(8, 17), false}, 3) < 1)
+    rc |= fail("overrideOccurrence");
+  if (store.overrideOccurrence("event", "swim", {day(4, 18), 0, true}, 4) != -4)
+    rc |= fail("override of a non-occurrence must return -4");
+  if (store.overrideOccurrence("event", "gym", {day(0, 18), 0, true}, 4) != -3)
+    rc |= fail("override of a missing series must return -3");
+  if (!store.getRecurrence("event", "swim", loaded, err) ||
+      days(starts(loaded, kJan1, day(14))) != "0@18,8@17,10@18")
+    rc |= fail("overrides not stored: " + days(starts(loaded, kJan1, day(14))));
+  auto log = store.since(0, err);
+  if (log.size() != 3 || log.back().payload.find("Swimming") == std::string::npos)
+    rc |= fail("override must keep the rest of the payload");
+
+  // Compaction keeps the latest event, and with it the whole series.
+  if (!store.beginCompaction(log.back().seq, err))
+    return fail("beginCompaction: " + err);
+  CompactionProgress progress;
+  do {
+    if (!store.compactStep(100, progress, err))
+      return fail("compactStep: " + err);
+  } while (!progress.done);
+  if (store.since(0, err).size() != 1 ||
+      !store.getRecurrence("event", "swim", loaded, err) ||
+      days(starts(loaded, kJan1, day(14))) != "0@18,8@17,10@18")
+    rc |= fail("series lost by compaction");
+
+  DeltaEvent del = ev;
+  del.op = "delete";
+  del.payload = "{}";
+  del.ts = 5;
+  store.append(del);
+  if (store.getRecurrence("event", "swim", loaded, err) || err != "not found")
+    rc |= fail("deleted series must not be found");
+  return rc;
+}
+
+int main() {
+  int rc = checkRules();
+  rc |= checkOverrides();
+  rc |= checkStore();
+  if (rc == 0)
+    std::cout << "OK: recurrence tests passed\n";
+  return rc;
+}
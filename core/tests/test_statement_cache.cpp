@@ -0,0 +1,101 @@
+#include "core/StatementCache.h"
+#include "TestUtil.h"
+#include <sqlite3.h>
+
+#include <iostream>
+#include <string>
+
+using together::ScopedStmt;
+using together::StatementCache;
+
+int main() {
+  sqlite3 *db = nullptr;
+  if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+    return fail("open :memory:");
+
+  int rc = 0;
+  {
+    StatementCache cache(2);
+    cache.attach(db);
+
+    // Fixed slots are reused, and ScopedStmt leaves them reset for reuse.
+    if (cache.prepareFixed(0, "SELECT ?1 + 1") != SQLITE_OK)
+      rc |= fail("prepareFixed");
+    for (int i = 0; i < 3; ++i) {
+      ScopedStmt st(cache.fixed(0));
+      sqlite3_bind_int(st.get(), 1, i);
+      if (sqlite3_step(st.get()) != SQLITE_ROW ||
+          sqlite3_column_int(st.get(), 0) != i + 1)
+        rc |= fail("fixed statement reuse");
+    }
+    if (cache.fixed(5) != nullptr)
+      rc |= fail("unprepared slot should be null");
+
+    // Ad-hoc statements are keyed by SQL text.
+    sqlite3_stmt *a = cache.adhoc("SELECT 1").get();
+    if (!a || cache.adhoc("SELECT 1").get() != a)
+      rc |= fail("adhoc hit should return the cached statement");
+    if (cache.adhocHits() != 1 || cache.adhocMisses() != 1)
+      rc |= fail("adhoc hit/miss counters");
+
+    // LRU: touching "SELECT 1" makes "SELECT 2" the eviction victim.
+    cache.adhoc("SELECT 2");
+    cache.adhoc("SELECT 1");
+    cache.adhoc("SELECT 3");
+    if (cache.adhocSize() != 2 || cache.adhocEvictions() != 1)
+      rc |= fail("adhoc capacity not enforced");
+    unsigned long long misses = cache.adhocMisses();
+    cache.adhoc("SELECT 1");
+    if (cache.adhocMisses() != misses)
+      rc |= fail("most recently used entry was evicted");
+    cache.adhoc("SELECT 2");
+    if (cache.adhocMisses() != misses + 1)
+      rc |= fail("least recently used entry was not evicted");
+
+    if (cache.adhoc("NOT VALID SQL"))
+      rc |= fail("invalid SQL should return an empty statement");
+
+    // A held statement is pinned, stepped or not: fetching more than the
+    // capacity of other statements leaves it usable.
+    {
+      ScopedStmt held = cache.adhoc("SELECT ?1 * 2");
+      ScopedStmt also = cache.adhoc("SELECT 4");
+      for (int i = 5; i < 9; ++i)
+        cache.adhoc("SELECT " + std::to_string(i));
+      if (cache.adhocSize() != 3)
+        rc |= fail("pinned entries must stay cached over capacity");
+      sqlite3_bind_int(held.get(), 1, 21);
+      if (sqlite3_step(held.get()) != SQLITE_ROW ||
+          sqlite3_column_int(held.get(), 0) != 42)
+        rc |= fail("a pinned statement must not be finalized");
+    }
+    cache.adhoc("SELECT 9");
+    if (cache.adhocSize() != 2)
+      rc |= fail("unpinned entries must be evicted again");
+
+    // Re-entry: the same SQL while it is held and mid-step gets a private
+    // statement, and the outer one keeps its row.
+    {
+      ScopedStmt outer = cache.adhoc("SELECT ?1");
+      sqlite3_bind_int(outer.get(), 1, 7);
+      sqlite3_step(outer.get());
+      {
+        ScopedStmt inner = cache.adhoc("SELECT ?1");
+        sqlite3_bind_int(inner.get(), 1, 8);
+        if (!inner || inner.get() == outer.get() ||
+            sqlite3_step(inner.get()) != SQLITE_ROW ||
+            sqlite3_column_int(inner.get(), 0) != 8)
+          rc |= fail("re-entry must get a private statement");
+      }
+      if (sqlite3_column_int(outer.get(), 0) != 7)
+        rc |= fail("re-entry must not reset the outer statement");
+    }
+  } // cache finalizes before close
+
+  if (sqlite3_close(db) != SQLITE_OK)
+    rc |= fail("statements leaked past StatementCache destruction");
+
+  if (rc == 0)
+    std::cout << "OK: statement cache\n";
+  return rc;
+}
@@ -0,0 +1,238 @@
+#include "core/EventStore.h"
+#include "core/Visibility.h"
+#include "TestUtil.h"
+#include <sqlite3.h>
+
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using together::DeltaEvent;
+using together::EventStore;
+using together::Role;
+using together::TaskRow;
+namespace visibility = together::visibility;
+
+static const Role kRoles[] = {Role::Owner, Role::Adult, Role::Teen,
+                              Role::Child, Role::Guest};
+static const char *const kTags[] = {"family",     "adults_only", "kids",
+                                    "owner_only", "custom_list", "bogus"};
+
+// The documented matrix for a task the member is not listed on, in kTags
+// order (custom_list listed members are checked separately).
+static const bool kTaskMatrix[5][6] = {
+    {true, true, true, true, true, true},       // Owner
+    {true, true, true, false, false, false},    // Adult
+    {true, false, true, false, false, false},   // Teen
+    {true, false, true, false, false, false},   // Child
+    {false, false, false, false, false, false}, // Guest
+};
+
+static std::string taskId(const std::string &tag, bool listed) {
+  return tag + (listed ? ":listed" : ":other");
+}
+
+// Tasks for every tag, once with "ann" assigned and once without, then a
+// few events of each entity type per tag. Records the tag and type of each
+// event by seq.
+static bool seed(EventStore &store, std::map<long long, std::string> &tag_of,
+                 std::map<long long, std::string> &type_of) {
+  long long ts = 1;
+  for (const char *tag : kTags)
+    for (bool listed : {false, true}) {
+      long long seq = store.upsertTask(
+          taskId(tag, listed), "t", listed ? "bo,ann" : "cy", 0, 1,
+          listed ? "done" : "open", tag, ts++, R"({"title":"t"})");
+      if (seq < 1)
+        return false;
+      tag_of[seq] = tag;
+      type_of[seq] = "task";
+    }
+  for (const char *type : {"event", "budget_tx"})
+    for (const char *tag : kTags) {
+      DeltaEvent ev;
+      ev.entity_type = type;
+      ev.entity_id = std::string(type) + ":" + tag;
+      ev.op = "upsert";
+      ev.payload = std::string(R"({"visibility_tag":")") + tag + R"("})";
+      ev.ts = ts++;
+      long long seq = store.append(ev);
+      if (seq < 1)
+        return false;
+      tag_of[seq] = tag;
+      type_of[seq] = type;
+    }
+  // No tag in the payload: family for other types, the task's own tag for
+  // a task (here adults_only).
+  DeltaEvent plain;
+  plain.entity_type = "event";
+  plain.entity_id = "event:untagged";
+  plain.op = "upsert";
+  plain.payload = R"({"title":"dinner"})";
+  plain.ts = ts++;
+  long long seq = store.append(plain);
+  tag_of[seq] = "family";
+  type_of[seq] = "event";
+  seq = store.deleteTask(taskId("adults_only", false), ts++, "{}");
+  tag_of[seq] = "adults_only";
+  type_of[seq] = "task";
+  return seq > 0;
+}
+
+static int checkRoles(EventStore &store, const std::string &label,
+                      const std::map<long long, std::string> &tag_of,
+                      const std::map<long long, std::string> &type_of) {
+  int rc = 0;
+  for (Role role : kRoles) {
+    const std::string who = label + " " + visibility::roleName(role);
+    std::string err;
+
+    std::set<std::string> got;
+    for (const TaskRow &r : store.listTasks(role, "ann", "", 100, 0, err))
+      got.insert(r.id);
+    if (!err.empty())
+      rc |= fail(who + ": listTasks: " + err);
+    std::set<std::string> done;
+    for (const TaskRow &r : store.listTasks(role, "ann", "done", 100, 0, err))
+      done.insert(r.id);
+    for (const char *tag : kTags)
+      for (bool listed : {false, true}) {
+        const std::string id = taskId(tag, listed);
+        const bool expect = visibility::canSeeTask(role, tag, listed);
+        if (got.count(id) != (expect ? 1u : 0u))
+          rc |= fail(who + " task " + id);
+        if (done.count(id) != (expect && listed ? 1u : 0u))
+          rc |= fail(who + " done task " + id);
+      }
+
+    std::set<long long> seen;
+    for (const DeltaEvent &e : store.since(role, 0, err))
+      seen.insert(e.seq);
+    if (!err.empty())
+      rc |= fail(who + ": since: " + err);
+    for (const auto &entry : tag_of) {
+      const bool expect = visibility::canSeeEvent(
+          role, type_of.at(entry.first), entry.second);
+      if (seen.count(entry.first) != (expect ? 1u : 0u))
+        rc |= fail(who + " event " + std::to_string(entry.first) + " (" +
+                   type_of.at(entry.first) + "/" + entry.second + ")");
+    }
+  }
+  return rc;
+}
+
+int main() {
+  int rc = 0;
+
+  // The matrix itself.
+  for (int r = 0; r < 5; ++r)
+    for (int t = 0; t < 6; ++t) {
+      if (visibility::canSeeTask(kRoles[r], kTags[t], false) !=
+          kTaskMatrix[r][t])
+        rc |= fail(std::string("matrix ") + visibility::roleName(kRoles[r]) +
+                   "/" + kTags[t]);
+      const bool listed_custom =
+          std::string(kTags[t]) == "custom_list" && kRoles[r] != Role::Guest;
+      if (visibility::canSeeTask(kRoles[r], kTags[t], true) !=
+          (kTaskMatrix[r][t] || listed_custom))
+        rc |= fail(std::string("listed matrix ") +
+                   visibility::roleName(kRoles[r]) + "/" + kTags[t]);
+      if (visibility::canSeeEvent(kRoles[r], "event", kTags[t]) !=
+          (kTaskMatrix[r][t] &&
+           (kRoles[r] == Role::Owner || std::string(kTags[t]) != "custom_list")))
+        rc |= fail(std::string("event matrix ") +
+                   visibility::roleName(kRoles[r]) + "/" + kTags[t]);
+    }
+  if (visibility::tagBit("") != together::kVisOwnerOnly)
+    rc |= fail("empty tag must fail closed");
+
+  const std::string path = freshDbPath("visibility");
+  std::map<long long, std::string> tag_of, type_of;
+  {
+    EventStore store;
+    if (auto err = store.open(path); !err.empty())
+      return fail("open: " + err);
+    if (!seed(store, tag_of, type_of))
+      return fail("seed");
+    rc |= checkRoles(store, "writer", tag_of, type_of);
+
+    // Same answers from pooled readers.
+    if (auto err = store.setReaderPool(2); !err.empty())
+      return fail("setReaderPool: " + err);
+    rc |= checkRoles(store, "pool", tag_of, type_of);
+
+    // Retagging moves a task out of a role's view.
+    std::string err;
+    store.upsertTask(taskId("kids", false), "t", "cy", 0, 1, "open",
+                     "adults_only", 1000, "{}");
+    for (const TaskRow &r : store.listTasks(Role::Child, "", "", 100, 0, err))
+      if (r.id == taskId("kids", false))
+        rc |= fail("retagged task still visible to child");
+  }
+
+  // Upgrade: a v2 database (no vis_mask columns) is classified on open.
+  const std::string old_path = freshDbPath("visibility_v2");
+  {
+    sqlite3 *db = nullptr;
+    sqlite3_open(old_path.c_str(), &db);
+    const char *v2 = R"SQL(
+      CREATE TABLE event_dict(code INTEGER PRIMARY KEY,
+                              name TEXT NOT NULL UNIQUE);
+      INSERT INTO event_dict(code, name) VALUES
+        (1, 'task'), (2, 'event'), (3, 'budget_tx'),
+        (4, 'upsert'), (5, 'delete');
+      CREATE TABLE event_log(
+        seq INTEGER PRIMARY KEY AUTOINCREMENT,
+        type_code INTEGER NOT NULL,
+        entity_id TEXT NOT NULL,
+        op_code INTEGER NOT NULL,
+        payload_blob BLOB NOT NULL,
+        ts INTEGER NOT NULL
+      );
+      CREATE TABLE task (
+        id TEXT PRIMARY KEY,
+        title TEXT NOT NULL,
+        assignees_csv TEXT DEFAULT '',
+        due_at INTEGER DEFAULT 0,
+        points INTEGER DEFAULT 0,
+        status TEXT DEFAULT 'open',
+        visibility_tag TEXT DEFAULT 'family',
+        updated_at INTEGER NOT NULL
+      );
+      INSERT INTO task(id, title, visibility_tag, updated_at) VALUES
+        ('a', 'a', 'family', 1), ('b', 'b', 'adults_only', 2);
+      INSERT INTO event_log(type_code, entity_id, op_code, payload_blob, ts)
+      VALUES (1, 'a', 4, '{}', 1),
+             (1, 'b', 4, '{}', 2),
+             (2, 'e', 4, '{"visibility_tag":"owner_only"}', 3),
+             (2, 'f', 4, '{}', 4);
+      PRAGMA user_version = 2;
+    )SQL";
+    if (sqlite3_exec(db, v2, nullptr, nullptr, nullptr) != SQLITE_OK) {
+      sqlite3_close(db);
+      return fail("building v2 database");
+    }
+    sqlite3_close(db);
+
+    EventStore store;
+    if (auto err = store.open(old_path); !err.empty())
+      return fail("open v2: " + err);
+    std::string err;
+    auto tasks = store.listTasks(Role::Child, "", "", 10, 0, err);
+    auto events = store.since(Role::Child, 0, err);
+    if (tasks.size() != 1 || tasks[0].id != "a")
+      rc |= fail("upgraded tasks not classified");
+    if (events.size() != 2 || events[0].entity_id != "a" ||
+        events[1].entity_id != "f")
+      rc |= fail("upgraded events not classified");
+    if (store.since(Role::Owner, 0, err).size() != 4)
+      rc |= fail("owner must still see every upgraded event");
+  }
+
+  if (rc == 0)
+    std::cout << "OK: visibility tests passed\n";
+  return rc;
+}
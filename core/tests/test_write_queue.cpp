@@ -0,0 +1,129 @@
+#include "core/EventStore.h"
+#include "TestUtil.h"
+
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using together::DeltaEvent;
+using together::EventStore;
+using together::TaskRow;
+using together::TaskUpsert;
+using together::WriteQueueOptions;
+
+static TaskUpsert task(const std::string &id, int version) {
+  TaskUpsert t;
+  t.row.id = id;
+  t.row.title = "v" + std::to_string(version);
+  t.row.points = version;
+  t.row.status = "open";
+  t.row.visibility_tag = "family";
+  t.row.updated_at = version;
+  t.payload_json = R"({"points":)" + std::to_string(version) + "}";
+  return t;
+}
+
+int main() {
+  int rc = 0;
+  const std::string path = freshDbPath("write_queue");
+  using Clock = std::chrono::steady_clock;
+
+  {
+    EventStore store;
+    if (auto err = store.open(path); !err.empty())
+      return fail("open: " + err);
+
+    // Concurrent producers: every write lands, and each producer's writes
+    // to its own task commit in the order they were queued.
+    constexpr int kThreads = 4, kWrites = 200;
+    std::vector<std::vector<std::future<long long>>> futures(kThreads);
+    std::vector<std::thread> producers;
+    for (int t = 0; t < kThreads; ++t)
+      producers.emplace_back([&, t] {
+        for (int v = 1; v <= kWrites; ++v)
+          futures[t].push_back(
+              store.upsertTaskAsync(task("p" + std::to_string(t), v)));
+      });
+    for (auto &p : producers)
+      p.join();
+    for (int t = 0; t < kThreads; ++t) {
+      long long prev = 0;
+      for (auto &f : futures[t]) {
+        long long seq = f.get();
+        if (seq <= prev)
+          rc |= fail("per-producer order or result");
+        prev = seq;
+      }
+      TaskRow row;
+      std::string err;
+      if (!store.getTaskId("p" + std::to_string(t), row, err) ||
+          row.points != kWrites)
+        rc |= fail("final row is not the last queued write");
+    }
+
+    // A full batch commits without waiting out the window, and flush()
+    // cuts the window short.
+    WriteQueueOptions opts;
+    opts.max_batch = 32;
+    opts.max_delay_micros = 5'000'000;
+    store.setWriteQueueOptions(opts);
+    auto t0 = Clock::now();
+    std::vector<std::future<long long>> full;
+    for (int i = 0; i < 32; ++i)
+      full.push_back(store.upsertTaskAsync(task("b" + std::to_string(i), 1)));
+    for (auto &f : full)
+      if (f.get() < 1)
+        rc |= fail("batch write failed");
+    auto single = store.deleteTaskAsync("b0", 10, R"({})");
+    store.flush();
+    if (single.wait_for(std::chrono::seconds(0)) != std::future_status::ready ||
+        single.get() < 1)
+      rc |= fail("flush must wait for earlier writes");
+    if (Clock::now() - t0 > std::chrono::seconds(4))
+      rc |= fail("batch size / flush did not close the window");
+
+    // One bad write in a group fails alone.
+    opts.max_delay_micros = 20'000;
+    store.setWriteQueueOptions(opts);
+    DeltaEvent ev;
+    ev.entity_type = "note";
+    ev.entity_id = "n1";
+    ev.op = "upsert";
+    ev.payload = "{}";
+    ev.ts = 1;
+    auto good1 = store.appendAsync(ev);
+    auto bad = store.upsertTaskAsync(task("", 1)); // empty id is rejected
+    auto good2 = store.deleteTaskAsync("b1", 11, R"({})");
+    if (good1.get() < 1 || bad.get() >= 0 || good2.get() < 1)
+      rc |= fail("a failing write must not fail its group");
+
+    // Queued writes are visible to other connections once their future is
+    // ready.
+    EventStore other;
+    other.open(path);
+    TaskRow row;
+    std::string err;
+    if (!other.getTaskId("b1", row, err) || row.status != "deleted")
+      rc |= fail("completed write not durable");
+
+    // The destructor drains the queue.
+    for (int i = 0; i < 10; ++i)
+      store.upsertTaskAsync(task("drain" + std::to_string(i), 1));
+  }
+  {
+    EventStore reopened;
+    reopened.open(path);
+    TaskRow row;
+    std::string err;
+    if (!reopened.getTaskId("drain9", row, err))
+      rc |= fail("writes queued at destruction were lost");
+  }
+
+  if (rc == 0)
+    std::cout << "OK: write queue tests passed\n";
+  return rc;
+}